@@ -0,0 +1,178 @@
+#include "myfs.h"
+#include <pthread.h>
+
+/*
+ * Per-thread scratch arena.
+ *
+ * The FUSE handlers run on several threads and need path copies and
+ * directory pages only while they serve one request. Each thread gets a
+ * chain of chunks that it bump allocates from. A request saves the arena
+ * position on entry and restores it on exit, which frees everything it
+ * allocated in O(1). The chunks stay with the thread, so after the first
+ * few requests the metadata path does not call malloc at all.
+ */
+
+//big enough for a few directory pages (sizeof(dir_data_fcb) is about 8.7 KiB)
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+
+struct arena_chunk
+{
+	struct arena_chunk* next;
+	size_t size;
+	unsigned char data[];
+};
+
+struct arena
+{
+	//first chunk, then the chunks after the current one are kept for reuse
+	struct arena_chunk* head;
+	struct arena_chunk* current;
+	size_t used;
+};
+
+static pthread_key_t arena_key;
+static pthread_once_t arena_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Frees the arena of a thread that exits (FUSE retires idle worker threads).
+ */
+static void arena_free(void* ptr)
+{
+	struct arena* arena = ptr;
+	struct arena_chunk* chunk = arena->head;
+	while (chunk != NULL)
+	{
+		struct arena_chunk* next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	free(arena);
+}
+
+static void arena_key_init(void)
+{
+	pthread_key_create(&arena_key, arena_free);
+}
+
+static struct arena_chunk* arena_new_chunk(size_t size)
+{
+	if (size < ARENA_CHUNK_SIZE)
+	{
+		size = ARENA_CHUNK_SIZE;
+	}
+	struct arena_chunk* chunk = malloc(sizeof(struct arena_chunk) + size);
+	if (chunk == NULL)
+	{
+		return NULL;
+	}
+	chunk->next = NULL;
+	chunk->size = size;
+	return chunk;
+}
+
+/**
+ * Returns the arena of the calling thread, creating it on first use.
+ */
+static struct arena* arena_get(void)
+{
+	pthread_once(&arena_once, arena_key_init);
+	struct arena* arena = pthread_getspecific(arena_key);
+	if (arena == NULL)
+	{
+		arena = calloc(1, sizeof(struct arena));
+		if (arena == NULL)
+		{
+			return NULL;
+		}
+		arena->head = arena->current = arena_new_chunk(0);
+		if (arena->head == NULL)
+		{
+			free(arena);
+			return NULL;
+		}
+		pthread_setspecific(arena_key, arena);
+	}
+	return arena;
+}
+
+/**
+ * Allocates 'size' bytes from the arena of the calling thread.
+ * The memory lives until the arena is restored to a mark taken before the call.
+ *
+ * Returns NULL if out of memory.
+ */
+void* arena_alloc(size_t size)
+{
+	struct arena* arena = arena_get();
+	if (arena == NULL)
+	{
+		return NULL;
+	}
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+	if (arena->used + size > arena->current->size)
+	{
+		//move on to the next kept chunk, or put a new one after the current chunk
+		struct arena_chunk* next = arena->current->next;
+		if (next == NULL || next->size < size)
+		{
+			struct arena_chunk* chunk = arena_new_chunk(size);
+			if (chunk == NULL)
+			{
+				return NULL;
+			}
+			chunk->next = next;
+			arena->current->next = chunk;
+			next = chunk;
+		}
+		arena->current = next;
+		arena->used = 0;
+	}
+
+	void* ptr = &arena->current->data[arena->used];
+	arena->used += size;
+	return ptr;
+}
+
+/**
+ * Copies 'str' into the arena of the calling thread.
+ */
+char* arena_strdup(const char* str)
+{
+	size_t len = strlen(str) + 1;
+	char* copy = arena_alloc(len);
+	if (copy != NULL)
+	{
+		memcpy(copy, str, len);
+	}
+	return copy;
+}
+
+/**
+ * Returns the current position of the arena of the calling thread.
+ */
+arena_mark arena_save(void)
+{
+	arena_mark mark = {NULL, 0};
+	struct arena* arena = arena_get();
+	if (arena != NULL)
+	{
+		mark.chunk = arena->current;
+		mark.used = arena->used;
+	}
+	return mark;
+}
+
+/**
+ * Frees everything allocated since 'mark' was taken.
+ */
+void arena_restore(arena_mark mark)
+{
+	struct arena* arena = pthread_getspecific(arena_key);
+	if (arena != NULL && mark.chunk != NULL)
+	{
+		arena->current = mark.chunk;
+		arena->used = mark.used;
+	}
+}
@@ -0,0 +1,30 @@
+#include "myfs.h"
+
+/*
+ * Shrinks an unmounted database by copying its live records into a fresh file.
+ * Usage: ./compact [database]
+ */
+int main(int argc, char** argv)
+{
+	const char* path = (argc > 1) ? argv[1] : DATABASE_NAME;
+	struct stat before, after;
+	struct gc_stats stats;
+
+	if (stat(path, &before) != 0)
+	{
+		perror(path);
+		return EXIT_FAILURE;
+	}
+
+	int rc = gc_compact(path, &stats);
+	if (rc != UNQLITE_OK)
+	{
+		printf("compact: failed with error %d, '%s' left untouched\n", rc, path);
+		return EXIT_FAILURE;
+	}
+
+	stat(path, &after);
+	printf("compact: %lu records (%lu inodes) kept, %lld -> %lld bytes\n",
+		stats.records, stats.inodes, (long long)before.st_size, (long long)after.st_size);
+	return 0;
+}
@@ -5,6 +5,11 @@ unqlite *pDb;
 unqlite_int64 root_object_size_value = sizeof(struct rootS);
 
 unqlite *pDb;
+pthread_mutex_t db_lock = PTHREAD_MUTEX_INITIALIZER;
+const char *store_path = DATABASE_NAME;
+const char *snapshot_path;
+unsigned long long mem_used;
+unsigned long long mem_limit;
 struct rootS root_object;
 int root_is_empty;
 
@@ -27,7 +32,9 @@ FILE *init_log_file(){
 void write_log(const char *format, ...){
     va_list ap;
     va_start(ap, format);
-    vfprintf(NEWFS_PRIVATE_DATA->logfile, format, ap);
+    //the global rather than NEWFS_PRIVATE_DATA, so that threads started by the file system can log too
+    vfprintf(logfile, format, ap);
+    va_end(ap);
 }
 
 void error_handler(int rc){
@@ -61,10 +68,33 @@ void init_store(){
 
 	uuid_clear(zero_uuid);
 
+	// Use the io_uring VFS when it was compiled in, so that a commit is submitted as one batch.
+	const unqlite_vfs *pVfs = unqlite_lib_uring_vfs();
+	if(pVfs != NULL){
+		unqlite_lib_config(UNQLITE_LIB_CONFIG_VFS, pVfs);
+	}
+
 	// Open the database.
-	rc = unqlite_open(&pDb,DATABASE_NAME,UNQLITE_OPEN_CREATE);
+	rc = open_store(&pDb,store_path,UNQLITE_OPEN_CREATE);
 	if( rc != UNQLITE_OK ){ error_handler(rc); }
 
+	// An in-memory store keeps its records in the ordered skiplist engine rather than the hash table of "mem".
+	if(strcmp(store_path,MEMORY_STORE) == 0){
+		rc = unqlite_config(pDb,UNQLITE_CONFIG_KV_ENGINE,"skiplist");
+		if( rc != UNQLITE_OK ){ error_handler(rc); }
+	}
+
+	// An in-memory store starts from its snapshot, if there is one.
+	if(snapshot_path != NULL && access(snapshot_path,F_OK) == 0){
+		unqlite *pSnap;
+		rc = open_store(&pSnap,snapshot_path,UNQLITE_OPEN_READONLY);
+		if( rc != UNQLITE_OK ){ error_handler(rc); }
+		rc = copy_store(pSnap,pDb,&mem_used);
+		unqlite_close(pSnap);
+		if( rc != UNQLITE_OK ){ error_handler(rc); }
+		printf("init_store: loaded %llu bytes from snapshot %s\n",mem_used,snapshot_path);
+	}
+
 	// Does root already exist?
 	rc = read_root();
 	if(rc==UNQLITE_NOTFOUND){
@@ -94,9 +124,96 @@ void init_store(){
     }
 }
 
-//Read the root object from the store.
+//Open a database for the file system.
+//Keys are 16 byte uuids, so new databases use the word at a time hash and the fixed key cell format.
+//An existing database keeps the hash and cell format it was created with. Both must be configured
+//before the first access to the database.
+int open_store(unqlite **ppDb, const char *path, unsigned int mode){
+	int rc = unqlite_open(ppDb,path,mode);
+	if( rc != UNQLITE_OK ){ return rc; }
+	unqlite_kv_config(*ppDb,UNQLITE_KV_CONFIG_HASH_FUNC,unqlite_util_fast_hash);
+	unqlite_kv_config(*ppDb,UNQLITE_KV_CONFIG_FIXED_KEY_SIZE,(unsigned int)KEY_SIZE);
+	return UNQLITE_OK;
+}
+
+//Copy every record of 'src' into 'dst'. The key and data bytes copied are added to '*bytes'.
+int copy_store(unqlite *src, unqlite *dst, unsigned long long *bytes){
+	unqlite_kv_cursor *pCur;
+	unsigned char key[KEY_SIZE * 4];
+	void *data = NULL;
+	unqlite_int64 cap = 0;
+	int rc = unqlite_kv_cursor_init(src,&pCur);
+	if( rc != UNQLITE_OK ){ return rc; }
+	for(unqlite_kv_cursor_first_entry(pCur); unqlite_kv_cursor_valid_entry(pCur); unqlite_kv_cursor_next_entry(pCur)){
+		int nKey = sizeof(key);
+		unqlite_int64 nData;
+		rc = unqlite_kv_cursor_key(pCur,key,&nKey);
+		if( rc == UNQLITE_OK ){ rc = unqlite_kv_cursor_data(pCur,NULL,&nData); }
+		if( rc == UNQLITE_OK && nData > cap ){
+			void *grown = realloc(data,nData);
+			if( grown == NULL ){
+				rc = UNQLITE_NOMEM;
+			}else{
+				data = grown;
+				cap = nData;
+			}
+		}
+		if( rc == UNQLITE_OK ){ rc = unqlite_kv_cursor_data(pCur,data,&nData); }
+		if( rc == UNQLITE_OK ){ rc = unqlite_kv_store(dst,key,nKey,data,nData); }
+		if( rc != UNQLITE_OK ){ break; }
+		*bytes += nKey + nData;
+	}
+	free(data);
+	unqlite_kv_cursor_release(src,pCur);
+	return rc;
+}
+
+//Write the whole store to a new database at 'path'. The old snapshot is only replaced once the new one is complete.
+int save_snapshot(const char *path){
+	char tmp_path[PATH_MAX];
+	unqlite *pSnap;
+	unsigned long long bytes = 0;
+	snprintf(tmp_path,sizeof(tmp_path),"%s.tmp",path);
+	remove(tmp_path);
+	int rc = open_store(&pSnap,tmp_path,UNQLITE_OPEN_CREATE|UNQLITE_OPEN_OMIT_JOURNALING);
+	if( rc != UNQLITE_OK ){ return rc; }
+	pthread_mutex_lock(&db_lock);
+	rc = copy_store(pDb,pSnap,&bytes);
+	pthread_mutex_unlock(&db_lock);
+	if( rc == UNQLITE_OK ){ rc = unqlite_commit(pSnap); }
+	unqlite_close(pSnap);
+	if( rc == UNQLITE_OK && rename(tmp_path,path) != 0 ){ rc = UNQLITE_IOERR; }
+	if( rc != UNQLITE_OK ){ remove(tmp_path); }
+	write_log("[SYST] snapshot: %llu bytes to %s rc=%d\n",bytes,path,rc);
+	return rc;
+}
+
+//Fetch the root object of 'db' into 'out'. Falls back to the legacy root key, in which case '*legacy' is set.
+int fetch_root(unqlite *db, struct rootS *out, int *legacy){
+	unqlite_int64 nBytes = sizeof(struct rootS);
+	//a root object from before the usage counters only holds the id
+	memset(out,0,sizeof(struct rootS));
+	*legacy = 0;
+	int rc = unqlite_kv_fetch(db,ROOT_OBJECT_KEY,ROOT_OBJECT_KEY_SIZE,out,&nBytes);
+	if(rc==UNQLITE_NOTFOUND){
+		nBytes = sizeof(struct rootS);
+		rc = unqlite_kv_fetch(db,LEGACY_ROOT_OBJECT_KEY,LEGACY_ROOT_OBJECT_KEY_SIZE,out,&nBytes);
+		*legacy = (rc==UNQLITE_OK);
+	}
+	return rc;
+}
+
+//Read the root object from the store. A root object under the legacy key is moved to the current key.
 int read_root(){
-	return unqlite_kv_fetch(pDb,ROOT_OBJECT_KEY,ROOT_OBJECT_KEY_SIZE,&root_object,ROOT_OBJECT_SIZE_P);
+	int legacy;
+	int rc = fetch_root(pDb,&root_object,&legacy);
+	if(rc==UNQLITE_OK && legacy){
+		rc = write_root();
+		if(rc==UNQLITE_OK){
+			rc = unqlite_kv_delete(pDb,LEGACY_ROOT_OBJECT_KEY,LEGACY_ROOT_OBJECT_KEY_SIZE);
+		}
+	}
+	return rc;
 }
 
 //Write the root object to the store.
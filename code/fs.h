@@ -7,11 +7,17 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <time.h>
+#include <pthread.h>
+#include <limits.h>
 #include <fuse.h>
 
 extern unqlite_int64 root_object_size_value;
-#define ROOT_OBJECT_KEY "root"
-#define ROOT_OBJECT_KEY_SIZE 4
+//the root object key is as long as a uuid key, so that the store can use fixed length keys
+#define ROOT_OBJECT_KEY "myfs:root-object"
+#define ROOT_OBJECT_KEY_SIZE 16
+//key of the root object in stores created before fixed length keys
+#define LEGACY_ROOT_OBJECT_KEY "root"
+#define LEGACY_ROOT_OBJECT_KEY_SIZE 4
 #define ROOT_OBJECT_SIZE_P (unqlite_int64 *)&root_object_size_value
 #define ROOT_OBJECT_SIZE root_object_size_value
 #define ROOT_OBJECT_ID root_object.id
@@ -20,20 +26,41 @@ extern unqlite_int64 root_object_size_value;
 #define KEY_SIZE 16
 
 #define DATABASE_NAME "myfs.db"
+//store path of a mount that lives in RAM only (-o mem)
+#define MEMORY_STORE ":mem:"
 
 typedef struct rootS{
 	uuid_t id;
+	//usage for statfs: kept in memory while mounted and written back on unmount
+	unsigned long long inodes;
+	unsigned long long blocks;
+	unsigned long long free_pages;
+	//1 if the usage above is valid, cleared while mounted so that it is recounted after a crash
+	unsigned int usage_valid;
 }*root;
 
 extern unqlite *pDb;
+//serialises every access to pDb (FUSE runs the handlers on several threads)
+extern pthread_mutex_t db_lock;
+//where init_store() opens the store, DATABASE_NAME unless the mount lives in RAM
+extern const char *store_path;
+//snapshot loaded into and saved from an in-memory store, NULL for none
+extern const char *snapshot_path;
+//bytes of records in an in-memory store and the limit on them (-o mem_size), 0 for no limit
+extern unsigned long long mem_used;
+extern unsigned long long mem_limit;
 extern struct rootS root_object;
 extern int root_is_empty;
 
 extern void error_handler(int);
 extern int read_root();
 extern int write_root();
+int fetch_root(unqlite *db, struct rootS *out, int *legacy);
 void print_id(uuid_t *);
 void init_store();
+int open_store(unqlite **ppDb, const char *path, unsigned int mode);
+int copy_store(unqlite *src, unqlite *dst, unsigned long long *bytes);
+int save_snapshot(const char *path);
 int update_root();
 
 extern FILE* init_log_file();
@@ -43,6 +70,18 @@ extern uuid_t zero_uuid;
 
 struct myfs_state {
     FILE *logfile;
+
+    //mount options (-o vacuum,vacuum_rate=KiB/s)
+    int vacuum;
+    unsigned vacuum_rate;
+    //in-memory mount (-o mem,mem_size=64M,snapshot=path)
+    int mem;
+    char *mem_size;
+    char *snapshot;
+    //access time updates on read (-o noatime,relatime,strictatime), and if they wait for
+    //the next change of the inode or its last release (-o lazytime)
+    int atime;
+    int lazytime;
 };
 #define NEWFS_PRIVATE_DATA ((struct myfs_state *) fuse_get_context()->private_data)
 
@@ -0,0 +1,553 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "myfs.h"
+
+/*
+ * End to end benchmarks of a mounted file system.
+ * Usage: ./fsbench [-o results.json] [-s scale] [-t threads] [-f file size] [-x mount options] path/to/myfs
+ *
+ * Mounts a fresh store into a temporary directory, then runs
+ * - metadata storms: create, stat and unlink of full directories
+ * - wide directories: readdir and lookups of the last entry of a full directory
+ * - deep paths: mkdir, stat and rmdir of nested directories as deep as MY_MAX_PATH allows
+ * - sequential and random reads and writes at several request sizes
+ * - a mixed load of threads that create, write, read, stat and unlink at the same time
+ * and prints one JSON object with a result per workload, so runs can be compared over time.
+ * Operations that fail are counted as errors and left out of the latencies.
+ */
+
+#define BENCH_TEMPLATE "/tmp/myfs-bench.XXXXXX"
+#define MOUNT_TIMEOUT 10
+
+struct result
+{
+	const char* name;
+	double* lat;
+	size_t n;
+	size_t cap;
+	unsigned long errors;
+	double start;
+	double end;
+	struct result* next;
+};
+
+static struct result* results;
+static struct result** results_tail = &results;
+static pthread_mutex_t results_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static char mnt[PATH_MAX];
+static int scale = 10;
+static int threads = 4;
+static int file_size = MY_DATA_SIZE_PER_BLOCK;
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct result* result_new(const char* name)
+{
+	struct result* r = calloc(1, sizeof(struct result));
+	r->name = name;
+	r->start = now();
+	pthread_mutex_lock(&results_lock);
+	*results_tail = r;
+	results_tail = &r->next;
+	pthread_mutex_unlock(&results_lock);
+	return r;
+}
+
+/**
+ * Records one operation that started at 'start' and returned 'rc' (negative on failure).
+ */
+static void sample(struct result* r, double start, int rc)
+{
+	double t = now();
+	if (r->n == 0 && r->errors == 0)
+	{
+		r->start = start;
+	}
+	r->end = t;
+	if (rc < 0)
+	{
+		r->errors++;
+		return;
+	}
+	if (r->n == r->cap)
+	{
+		r->cap = r->cap ? r->cap * 2 : 256;
+		r->lat = realloc(r->lat, r->cap * sizeof(double));
+	}
+	r->lat[r->n++] = t - start;
+}
+
+//times one system call, which returns -1 on failure
+#define TIME(r, call) do { double t0 = now(); int rc_ = (call); sample((r), t0, rc_); } while (0)
+
+static void path_of(char* buf, const char* format, ...)
+{
+	char rel[MY_MAX_PATH * 2];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(rel, sizeof(rel), format, args);
+	va_end(args);
+	if (snprintf(buf, PATH_MAX, "%s%s", mnt, rel) >= PATH_MAX)
+	{
+		fprintf(stderr, "bench: path under %s too long\n", mnt);
+		exit(1);
+	}
+}
+
+static int create_file(const char* path)
+{
+	int fd = open(path, O_CREAT | O_WRONLY, 0644);
+	return (fd < 0) ? -1 : close(fd);
+}
+
+static int stat_path(const char* path)
+{
+	struct stat st;
+	return stat(path, &st);
+}
+
+static int list_dir(const char* path)
+{
+	DIR* dir = opendir(path);
+	if (dir == NULL)
+	{
+		return -1;
+	}
+	int n = 0;
+	while (readdir(dir) != NULL)
+	{
+		n++;
+	}
+	closedir(dir);
+	return n;
+}
+
+/**
+ * Creates, stats and unlinks a full directory of files, 'scale' times.
+ */
+static void bench_metadata()
+{
+	struct result* create = result_new("create");
+	struct result* lookup = result_new("stat");
+	struct result* unlink_r = result_new("unlink");
+	char path[PATH_MAX];
+
+	path_of(path, "/meta");
+	mkdir(path, 0755);
+	for (int round = 0; round < scale; round++)
+	{
+		for (int i = 0; i < MY_MAX_DIR_FILES; i++)
+		{
+			path_of(path, "/meta/f%d", i);
+			TIME(create, create_file(path));
+		}
+		for (int i = 0; i < MY_MAX_DIR_FILES; i++)
+		{
+			path_of(path, "/meta/f%d", i);
+			TIME(lookup, stat_path(path));
+		}
+		for (int i = 0; i < MY_MAX_DIR_FILES; i++)
+		{
+			path_of(path, "/meta/f%d", i);
+			TIME(unlink_r, unlink(path));
+		}
+	}
+	path_of(path, "/meta");
+	rmdir(path);
+}
+
+/**
+ * Lists a full directory and looks up its last entry.
+ */
+static void bench_wide()
+{
+	struct result* list = result_new("wide_readdir");
+	struct result* last = result_new("wide_stat_last");
+	char path[PATH_MAX];
+
+	path_of(path, "/wide");
+	mkdir(path, 0755);
+	for (int i = 0; i < MY_MAX_DIR_FILES; i++)
+	{
+		path_of(path, "/wide/f%d", i);
+		create_file(path);
+	}
+
+	path_of(path, "/wide");
+	for (int i = 0; i < scale * 20; i++)
+	{
+		TIME(list, list_dir(path));
+	}
+	path_of(path, "/wide/f%d", MY_MAX_DIR_FILES - 1);
+	for (int i = 0; i < scale * 20; i++)
+	{
+		TIME(last, stat_path(path));
+	}
+
+	for (int i = 0; i < MY_MAX_DIR_FILES; i++)
+	{
+		path_of(path, "/wide/f%d", i);
+		unlink(path);
+	}
+	path_of(path, "/wide");
+	rmdir(path);
+}
+
+/**
+ * Builds the deepest chain of one letter directories that fits in MY_MAX_PATH,
+ * stats its bottom and removes it again.
+ */
+static void bench_deep()
+{
+	struct result* mk = result_new("deep_mkdir");
+	struct result* lookup = result_new("deep_stat");
+	struct result* rm = result_new("deep_rmdir");
+	char rel[MY_MAX_PATH] = "";
+	char path[PATH_MAX];
+	int depth = 0;
+
+	for (int round = 0; round < scale; round++)
+	{
+		depth = 0;
+		rel[0] = 0;
+		while (strlen(rel) + 3 < MY_MAX_PATH)
+		{
+			strcat(rel, "/d");
+			path_of(path, "%s", rel);
+			TIME(mk, mkdir(path, 0755));
+			depth++;
+		}
+		for (int i = 0; i < 20; i++)
+		{
+			TIME(lookup, stat_path(path));
+		}
+		while (depth-- > 0)
+		{
+			path_of(path, "%s", rel);
+			TIME(rm, rmdir(path));
+			rel[strlen(rel) - 2] = 0;
+		}
+	}
+}
+
+/**
+ * Writes and reads a file of 'file_size' bytes with requests of 'size' bytes,
+ * in order and at random offsets.
+ */
+static void bench_io(int size)
+{
+	char* name[4];
+	asprintf(&name[0], "seq_write_%d", size);
+	asprintf(&name[1], "seq_read_%d", size);
+	asprintf(&name[2], "rand_write_%d", size);
+	asprintf(&name[3], "rand_read_%d", size);
+	struct result* seq_w = result_new(name[0]);
+	struct result* seq_r = result_new(name[1]);
+	struct result* rand_w = result_new(name[2]);
+	struct result* rand_r = result_new(name[3]);
+
+	char path[PATH_MAX];
+	char* buf = malloc(size);
+	int chunks = file_size / size;
+	memset(buf, 'x', size);
+	srand(size);
+
+	path_of(path, "/io%d", size);
+	for (int round = 0; round < scale; round++)
+	{
+		int fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0644);
+		if (fd < 0)
+		{
+			seq_w->errors++;
+			continue;
+		}
+		for (int i = 0; i < chunks; i++)
+		{
+			TIME(seq_w, pwrite(fd, buf, size, (off_t)i * size));
+		}
+		for (int i = 0; i < chunks; i++)
+		{
+			TIME(seq_r, pread(fd, buf, size, (off_t)i * size));
+		}
+		for (int i = 0; i < chunks; i++)
+		{
+			TIME(rand_w, pwrite(fd, buf, size, (off_t)(rand() % chunks) * size));
+		}
+		for (int i = 0; i < chunks; i++)
+		{
+			TIME(rand_r, pread(fd, buf, size, (off_t)(rand() % chunks) * size));
+		}
+		close(fd);
+	}
+	unlink(path);
+	free(buf);
+}
+
+struct mixed_arg
+{
+	int id;
+	struct result r;
+};
+
+/**
+ * One thread of the mixed load, working in its own directory.
+ */
+static void* mixed_main(void* ptr)
+{
+	struct mixed_arg* arg = ptr;
+	char dir[PATH_MAX], path[PATH_MAX];
+	char buf[MY_DATA_SIZE_PER_BLOCK];
+	memset(buf, 'm', sizeof(buf));
+
+	path_of(dir, "/mixed%d", arg->id);
+	mkdir(dir, 0755);
+	for (int i = 0; i < scale * 50; i++)
+	{
+		path_of(path, "/mixed%d/f%d", arg->id, i % MY_MAX_DIR_FILES);
+		double t0 = now();
+		int rc = -1;
+		int fd = open(path, O_CREAT | O_RDWR, 0644);
+		if (fd >= 0)
+		{
+			rc = (pwrite(fd, buf, sizeof(buf), 0) < 0 || pread(fd, buf, sizeof(buf), 0) < 0) ? -1 : 0;
+			close(fd);
+		}
+		if (rc == 0)
+		{
+			rc = stat_path(path);
+		}
+		if (rc == 0 && (i / MY_MAX_DIR_FILES) % 2 == 1)
+		{
+			rc = unlink(path);
+		}
+		sample(&arg->r, t0, rc);
+	}
+	for (int i = 0; i < MY_MAX_DIR_FILES; i++)
+	{
+		path_of(path, "/mixed%d/f%d", arg->id, i);
+		unlink(path);
+	}
+	rmdir(dir);
+	return NULL;
+}
+
+/**
+ * Runs 'threads' threads at once. Each iteration opens (creating) a file,
+ * writes and reads it, stats it and, every other pass over the directory, unlinks it.
+ */
+static void bench_mixed()
+{
+	pthread_t* tids = malloc(threads * sizeof(pthread_t));
+	struct mixed_arg* args = calloc(threads, sizeof(struct mixed_arg));
+	struct result* all = result_new("mixed");
+
+	for (int t = 0; t < threads; t++)
+	{
+		args[t].id = t;
+		pthread_create(&tids[t], NULL, mixed_main, &args[t]);
+	}
+	//merge the per thread samples, so the threads never share a result
+	for (int t = 0; t < threads; t++)
+	{
+		struct result* r = &args[t].r;
+		pthread_join(tids[t], NULL);
+		all->lat = realloc(all->lat, (all->n + r->n) * sizeof(double));
+		memcpy(all->lat + all->n, r->lat, r->n * sizeof(double));
+		all->n += r->n;
+		all->errors += r->errors;
+		free(r->lat);
+	}
+	all->end = now();
+	free(args);
+	free(tids);
+}
+
+static int cmp_double(const void* a, const void* b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static double percentile(struct result* r, double p)
+{
+	if (r->n == 0)
+	{
+		return 0;
+	}
+	size_t i = (size_t)(p * (r->n - 1) + 0.5);
+	return r->lat[i] * 1e6;
+}
+
+static void print_json(FILE* out, const char* myfs, const char* options, int alive)
+{
+	time_t t = time(NULL);
+	char stamp[32];
+	strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&t));
+
+	fprintf(out, "{\n  \"timestamp\": \"%s\",\n  \"myfs\": \"%s\",\n  \"options\": \"%s\",\n", stamp, myfs, options ? options : "");
+	fprintf(out, "  \"scale\": %d,\n  \"threads\": %d,\n  \"file_size\": %d,\n", scale, threads, file_size);
+	fprintf(out, "  \"mounted_at_end\": %s,\n  \"results\": [", alive ? "true" : "false");
+	for (struct result* r = results; r != NULL; r = r->next)
+	{
+		double secs = (r->end > r->start) ? r->end - r->start : 0;
+		qsort(r->lat, r->n, sizeof(double), cmp_double);
+		fprintf(out, "%s\n    {\"name\": \"%s\", \"ops\": %zu, \"errors\": %lu, \"seconds\": %.6f, \"ops_per_sec\": %.1f, ",
+			(r == results) ? "" : ",", r->name, r->n, r->errors, secs, secs > 0 ? r->n / secs : 0);
+		fprintf(out, "\"lat_us\": {\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f}}",
+			percentile(r, 0.5), percentile(r, 0.9), percentile(r, 0.99), percentile(r, 1.0));
+	}
+	fprintf(out, "\n  ]\n}\n");
+}
+
+static int run(char* const argv[])
+{
+	int status;
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		execvp(argv[0], argv);
+		_exit(127);
+	}
+	if (pid < 0 || waitpid(pid, &status, 0) < 0)
+	{
+		return -1;
+	}
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static int mounted()
+{
+	char path[PATH_MAX];
+	path_of(path, "%s", STATS_FILE);
+	return stat_path(path) == 0;
+}
+
+static int remove_entry(const char* path, const struct stat* st, int flag, struct FTW* ftw)
+{
+	return remove(path);
+}
+
+int main(int argc, char** argv)
+{
+	const char* out_path = NULL;
+	const char* options = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "o:s:t:f:x:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'o': out_path = optarg; break;
+			case 's': scale = atoi(optarg); break;
+			case 't': threads = atoi(optarg); break;
+			case 'f': file_size = atoi(optarg); break;
+			case 'x': options = optarg; break;
+			default:
+				fprintf(stderr, "usage: %s [-o out.json] [-s scale] [-t threads] [-f file size] [-x mount options] path/to/myfs\n", argv[0]);
+				return 2;
+		}
+	}
+	if (optind != argc - 1 || scale < 1 || threads < 1 || file_size < 1)
+	{
+		fprintf(stderr, "usage: %s [-o out.json] [-s scale] [-t threads] [-f file size] [-x mount options] path/to/myfs\n", argv[0]);
+		return 2;
+	}
+
+	//open the report before moving into the temp tree, which is removed at the end
+	FILE* out = stdout;
+	if (out_path != NULL && (out = fopen(out_path, "w")) == NULL)
+	{
+		perror(out_path);
+		return 1;
+	}
+
+	char myfs[PATH_MAX], base[] = BENCH_TEMPLATE, store[PATH_MAX];
+	if (realpath(argv[optind], myfs) == NULL || mkdtemp(base) == NULL)
+	{
+		perror("bench");
+		return 1;
+	}
+	snprintf(mnt, sizeof(mnt), "%s/mnt", base);
+	snprintf(store, sizeof(store), "%s/store", base);
+	mkdir(mnt, 0755);
+	mkdir(store, 0755);
+
+	//myfs keeps its store and log in the working directory
+	if (chdir(store) != 0)
+	{
+		perror("bench");
+		return 1;
+	}
+	char* mount_argv[] = {myfs, mnt, options ? "-o" : NULL, (char*)options, NULL};
+	if (run(mount_argv) != 0)
+	{
+		fprintf(stderr, "bench: could not mount %s on %s\n", myfs, mnt);
+		return 1;
+	}
+	for (int i = 0; i < MOUNT_TIMEOUT * 10 && !mounted(); i++)
+	{
+		usleep(100000);
+	}
+	if (!mounted())
+	{
+		fprintf(stderr, "bench: %s did not come up on %s\n", myfs, mnt);
+		return 1;
+	}
+
+	//a crashed myfs fails every later call, so stop at the first workload that takes it down
+	bench_metadata();
+	if (mounted())
+	{
+		bench_wide();
+	}
+	if (mounted())
+	{
+		bench_deep();
+	}
+	int sizes[] = {1, MY_MAX_DATA_SIZE, MY_DATA_SIZE_PER_BLOCK / 2, MY_DATA_SIZE_PER_BLOCK};
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]) && mounted(); i++)
+	{
+		if (sizes[i] <= file_size)
+		{
+			bench_io(sizes[i]);
+		}
+	}
+	if (mounted())
+	{
+		bench_mixed();
+	}
+
+	int alive = mounted();
+	char* umount_argv[] = {"fusermount", "-u", mnt, NULL};
+	run(umount_argv);
+
+	print_json(out, myfs, options, alive);
+	if (out != stdout)
+	{
+		fclose(out);
+	}
+
+	chdir("/");
+	nftw(base, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+	return alive ? 0 : 1;
+}
@@ -0,0 +1,669 @@
+#include "myfs.h"
+#include <pthread.h>
+#include <stddef.h>
+
+/*
+ * Garbage collection of the store.
+ *
+ * Deleted records only go back to the free list of the storage engine,
+ * the database file itself never shrinks. Compacting copies every record
+ * reachable from the root object into a fresh database and puts it in
+ * place of the old one. Records left behind by older versions of the
+ * file system (which never reclaimed unlinked files) are dropped as well.
+ *
+ * Records are copied one inode at a time: the inode, the records of its
+ * large extended attribute values, then its data fcb, direct blocks and
+ * data blocks. The storage engine places records by key hash, so this
+ * order is what keeps an inode's records close together (cell order
+ * within pages and overflow page allocation).
+ */
+
+/*
+ * Stack of inode ids still to be copied.
+ */
+struct gc_stack
+{
+	uuid_t* ids;
+	size_t used;
+	size_t allocated;
+};
+
+static int gc_push(struct gc_stack* stack, uuid_t id)
+{
+	if (stack->used == stack->allocated)
+	{
+		size_t allocated = (stack->allocated == 0) ? 64 : stack->allocated * 2;
+		uuid_t* ids = realloc(stack->ids, allocated * sizeof(uuid_t));
+		if (ids == NULL)
+		{
+			return UNQLITE_NOMEM;
+		}
+		stack->ids = ids;
+		stack->allocated = allocated;
+	}
+	uuid_copy(stack->ids[stack->used++], id);
+	return UNQLITE_OK;
+}
+
+static int gc_find(struct gc_stack* stack, uuid_t id)
+{
+	for (size_t i = 0; i < stack->used; i++)
+	{
+		if (uuid_compare(stack->ids[i], id) == 0)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void gc_stack_release(struct gc_stack* stack)
+{
+	free(stack->ids);
+	memset(stack, 0, sizeof(struct gc_stack));
+}
+
+/**
+ * Copies the record with key 'id' of the given 'size' from 'src' to 'dst',
+ * or only counts it if 'dst' is NULL.
+ * If 'data' is not NULL the record is also returned in it.
+ *
+ * Returns UNQLITE_OK on success.
+ */
+static int gc_copy_record(unqlite* src, unqlite* dst, uuid_t id, void* data, size_t size, struct gc_stats* stats)
+{
+	//large enough for a directory page, and for an inode with a link target and extended attributes
+	union
+	{
+		dir_data_fcb dir;
+		uint8_t inode[sizeof(my_inode) + MY_MAX_LINK_TARGET + MY_MAX_XATTR_TABLE];
+	} buf;
+	unqlite_int64 nBytes = sizeof(buf);
+
+	int rc = unqlite_kv_fetch(src, id, KEY_SIZE, &buf, &nBytes);
+	if (rc != UNQLITE_OK)
+	{
+		return rc;
+	}
+	if (nBytes == MY_INODE_V1_SIZE && size == sizeof(my_inode))
+	{
+		//an inode from before link counts is copied in the current layout
+		my_inode* inode = (my_inode*)&buf;
+		memset(buf.inode + MY_INODE_V1_SIZE, 0, sizeof(my_inode) - MY_INODE_V1_SIZE);
+		inode->nlink = S_ISDIR(inode->mode) ? 2 : 1;
+		inode->version = MY_INODE_VERSION;
+		nBytes = size;
+	}
+	else if (nBytes != size && !(nBytes >= MY_INODE_V2_SIZE && size == sizeof(my_inode)))
+	{
+		//only an inode has more after it, and one from before nanoseconds is shorter
+		return UNQLITE_CORRUPT;
+	}
+	if (data != NULL)
+	{
+		memcpy(data, &buf, size);
+	}
+	rc = (dst != NULL) ? unqlite_kv_store(dst, id, KEY_SIZE, &buf, nBytes) : UNQLITE_OK;
+	if (rc == UNQLITE_OK)
+	{
+		stats->records++;
+		stats->bytes += KEY_SIZE + nBytes;
+	}
+	return rc;
+}
+
+/**
+ * Copies a direct block and the data blocks it points at.
+ * Data blocks that files share since a clone are kept in 'linked' like the inodes of
+ * files with several links, if it is not NULL, and only counted once.
+ */
+static int gc_copy_direct_block(unqlite* src, unqlite* dst, uuid_t id, struct gc_stats* stats, struct gc_stack* linked)
+{
+	direct_block block;
+	int rc = gc_copy_record(src, dst, id, &block, sizeof(direct_block), stats);
+	if (rc != UNQLITE_OK)
+	{
+		return rc;
+	}
+
+	for (int i = 0; i < MY_MAX_DIRECT_BLOCKS; i++)
+	{
+		if (uuid_compare(zero_uuid, block.blocks[i]) == 0 ||
+			(linked != NULL && gc_find(linked, block.blocks[i])))
+		{
+			continue;
+		}
+
+		data_block data;
+		rc = gc_copy_record(src, dst, block.blocks[i], &data, sizeof(data_block), stats);
+		if (rc == UNQLITE_OK && linked != NULL && data.shares > 0)
+		{
+			rc = gc_push(linked, block.blocks[i]);
+		}
+		if (rc != UNQLITE_OK)
+		{
+			return rc;
+		}
+		stats->blocks++;
+	}
+	return UNQLITE_OK;
+}
+
+/**
+ * Copies the records that hold the large extended attribute values of 'inode'.
+ */
+static int gc_copy_xattrs(unqlite* src, unqlite* dst, my_inode* inode, struct gc_stats* stats)
+{
+	uint8_t table[MY_MAX_XATTR_TABLE];
+	unqlite_int64 len = sizeof(table);
+	size_t offset = MY_INODE_SIZE(inode) + (S_ISLNK(inode->mode) ? inode->size + 1 : 0);
+	if (unqlite_kv_fetch_range(src, inode->id, KEY_SIZE, offset, table, &len) != UNQLITE_OK)
+	{
+		return UNQLITE_OK;
+	}
+
+	xattr_entry entry;
+	for (unqlite_int64 pos = 0; pos + (unqlite_int64)sizeof(xattr_entry) <= len; pos += XATTR_ENTRY_SIZE(entry))
+	{
+		memcpy(&entry, table + pos, sizeof(xattr_entry));
+		if (pos + (unqlite_int64)XATTR_ENTRY_SIZE(entry) > len)
+		{
+			break;
+		}
+		if (entry.external)
+		{
+			int rc = gc_copy_record(src, dst, table + pos + sizeof(xattr_entry) + entry.name_len, NULL, entry.value_size, stats);
+			if (rc != UNQLITE_OK)
+			{
+				return rc;
+			}
+		}
+	}
+	return UNQLITE_OK;
+}
+
+/**
+ * Copies the inode with key 'id' and the records it owns.
+ * The inodes of a directory's entries are pushed on 'todo'.
+ * If 'linked' is not NULL the files with several links (and the shared data blocks)
+ * are kept in it and only handled once. Copies pass NULL, storing such a file twice is harmless.
+ *
+ * Returns UNQLITE_OK on success, UNQLITE_NOTFOUND if the inode is gone.
+ */
+static int gc_copy_inode(unqlite* src, unqlite* dst, uuid_t id, struct gc_stats* stats, struct gc_stack* todo, struct gc_stack* linked)
+{
+	if (linked != NULL && gc_find(linked, id))
+	{
+		return UNQLITE_OK;
+	}
+
+	my_inode inode;
+	int rc = gc_copy_record(src, dst, id, &inode, sizeof(my_inode), stats);
+	if (rc != UNQLITE_OK)
+	{
+		return rc;
+	}
+	stats->inodes++;
+
+	rc = gc_copy_xattrs(src, dst, &inode, stats);
+	if (rc != UNQLITE_OK)
+	{
+		return rc;
+	}
+
+	if (linked != NULL && !S_ISDIR(inode.mode) && inode.nlink > 1)
+	{
+		rc = gc_push(linked, id);
+		if (rc != UNQLITE_OK)
+		{
+			return rc;
+		}
+	}
+
+	if (uuid_compare(zero_uuid, inode.data_id) == 0)
+	{
+		return UNQLITE_OK;
+	}
+
+	if (S_ISDIR(inode.mode))
+	{
+		dir_data_fcb dir_data;
+		rc = gc_copy_record(src, dst, inode.data_id, &dir_data, sizeof(dir_data_fcb), stats);
+		if (rc != UNQLITE_OK)
+		{
+			return rc;
+		}
+
+		for (int i = 0; i < MY_MAX_DIR_FILES; i++)
+		{
+			if (strcmp(dir_data.entries[i].filename, "") != 0)
+			{
+				rc = gc_push(todo, dir_data.entries[i].inode_id);
+				if (rc != UNQLITE_OK)
+				{
+					return rc;
+				}
+			}
+		}
+	}
+	else
+	{
+		file_data_fcb data_fcb;
+		rc = gc_copy_record(src, dst, inode.data_id, &data_fcb, sizeof(file_data_fcb), stats);
+		if (rc != UNQLITE_OK)
+		{
+			return rc;
+		}
+
+		if (uuid_compare(zero_uuid, data_fcb.direct_data_id) != 0)
+		{
+			rc = gc_copy_direct_block(src, dst, data_fcb.direct_data_id, stats, linked);
+			if (rc != UNQLITE_OK)
+			{
+				return rc;
+			}
+		}
+		for (int i = 0; i < MY_MAX_DIRECT_BLOCKS; i++)
+		{
+			if (uuid_compare(zero_uuid, data_fcb.index_ids[i]) != 0)
+			{
+				rc = gc_copy_direct_block(src, dst, data_fcb.index_ids[i], stats, linked);
+				if (rc != UNQLITE_OK)
+				{
+					return rc;
+				}
+			}
+		}
+	}
+	return UNQLITE_OK;
+}
+
+/**
+ * Copies the root object from 'src' to 'dst', unless 'dst' is NULL, and pushes the root inode on 'todo'.
+ */
+static int gc_copy_root(unqlite* src, unqlite* dst, struct gc_stats* stats, struct gc_stack* todo)
+{
+	struct rootS root;
+	int legacy;
+
+	//a legacy root object is written under the current key, which the fixed key copy requires
+	int rc = fetch_root(src, &root, &legacy);
+	if (rc != UNQLITE_OK)
+	{
+		return rc;
+	}
+	//the copy starts with an empty free list, so the next mount recounts rather than trusting the old usage
+	root.free_pages = 0;
+	root.usage_valid = 0;
+	rc = (dst != NULL) ? unqlite_kv_store(dst, ROOT_OBJECT_KEY, ROOT_OBJECT_KEY_SIZE, &root, sizeof(struct rootS)) : UNQLITE_OK;
+	if (rc != UNQLITE_OK)
+	{
+		return rc;
+	}
+	stats->records++;
+	stats->bytes += ROOT_OBJECT_KEY_SIZE + sizeof(struct rootS);
+
+	if (uuid_compare(zero_uuid, root.id) == 0)
+	{
+		//empty file system
+		return UNQLITE_OK;
+	}
+	return gc_push(todo, root.id);
+}
+
+/**
+ * Copies the root object and every record reachable from it from 'src' to 'dst'.
+ *
+ * Returns UNQLITE_OK on success.
+ */
+int gc_copy_live(unqlite* src, unqlite* dst, struct gc_stats* stats)
+{
+	struct gc_stack todo;
+	memset(&todo, 0, sizeof(struct gc_stack));
+	memset(stats, 0, sizeof(struct gc_stats));
+
+	int rc = gc_copy_root(src, dst, stats, &todo);
+	while (rc == UNQLITE_OK && todo.used > 0)
+	{
+		todo.used--;
+		rc = gc_copy_inode(src, dst, todo.ids[todo.used], stats, &todo, NULL);
+	}
+
+	gc_stack_release(&todo);
+	return rc;
+}
+
+/**
+ * Counts the inodes and data blocks reachable from the root object of 'src',
+ * each file once however many links it has.
+ *
+ * Returns UNQLITE_OK on success.
+ */
+int gc_count_live(unqlite* src, struct gc_stats* stats)
+{
+	struct gc_stack todo, linked;
+	memset(&todo, 0, sizeof(struct gc_stack));
+	memset(&linked, 0, sizeof(struct gc_stack));
+	memset(stats, 0, sizeof(struct gc_stats));
+
+	int rc = gc_copy_root(src, NULL, stats, &todo);
+	while (rc == UNQLITE_OK && todo.used > 0)
+	{
+		todo.used--;
+		rc = gc_copy_inode(src, NULL, todo.ids[todo.used], stats, &todo, &linked);
+	}
+
+	gc_stack_release(&todo);
+	gc_stack_release(&linked);
+	return rc;
+}
+
+/**
+ * Compacts the database at 'path' while it is not mounted: the live records
+ * are copied into '<path>.compact' which is then renamed over 'path'.
+ * The old file is left untouched if anything goes wrong.
+ *
+ * Returns UNQLITE_OK on success.
+ */
+int gc_compact(const char* path, struct gc_stats* stats)
+{
+	char tmp_path[MY_MAX_PATH + 16];
+	unqlite *src, *dst;
+
+	uuid_clear(zero_uuid);
+	snprintf(tmp_path, sizeof(tmp_path), "%s.compact", path);
+	remove(tmp_path);
+
+	int rc = open_store(&src, path, UNQLITE_OPEN_READONLY);
+	if (rc != UNQLITE_OK)
+	{
+		return rc;
+	}
+	rc = open_store(&dst, tmp_path, UNQLITE_OPEN_CREATE);
+	if (rc != UNQLITE_OK)
+	{
+		unqlite_close(src);
+		return rc;
+	}
+
+	rc = gc_copy_live(src, dst, stats);
+	if (rc == UNQLITE_OK)
+	{
+		rc = unqlite_commit(dst);
+	}
+	unqlite_close(dst);
+	unqlite_close(src);
+
+	if (rc != UNQLITE_OK)
+	{
+		remove(tmp_path);
+		return rc;
+	}
+	if (rename(tmp_path, path) != 0)
+	{
+		return UNQLITE_IOERR;
+	}
+	return UNQLITE_OK;
+}
+
+
+/*
+ * Online vacuum.
+ *
+ * A background thread copies the live records into store_path".vacuum"
+ * one inode at a time while the file system stays mounted, sleeping between
+ * inodes so that no more than 'rate' KiB per second are copied. Each step
+ * holds db_lock, like every other access to the store.
+ *
+ * While the vacuum runs, store_to_db() and delete_from_db() mirror every
+ * change into the new database, so records that were already copied stay
+ * up to date and records created in the meantime are not missed. Once no
+ * inode is left to copy, the new database is committed and renamed over
+ * store_path, and pDb is reopened on it. store_path is absolute, as the
+ * vacuum runs after FUSE has changed to "/".
+ */
+#define VACUUM_SUFFIX ".vacuum"
+
+//store_path with VACUUM_SUFFIX, set when a vacuum starts
+static char vacuum_path[PATH_MAX];
+
+//new database while a vacuum is running, NULL otherwise
+static unqlite* vacuum_db;
+static pthread_t vacuum_thread;
+static int vacuum_joinable;
+static int vacuum_stop;
+static unsigned vacuum_rate;
+
+/**
+ * Mirrors a store into the database being built by the vacuum.
+ * Must be called with db_lock held.
+ */
+void gc_mirror_store(const void* key, int key_size, const void* data, size_t size)
+{
+	if (vacuum_db != NULL)
+	{
+		unqlite_kv_store(vacuum_db, key, key_size, data, size);
+	}
+}
+
+/**
+ * Mirrors a delete into the database being built by the vacuum.
+ * Must be called with db_lock held.
+ */
+void gc_mirror_delete(const void* key, int key_size)
+{
+	if (vacuum_db != NULL)
+	{
+		unqlite_kv_delete(vacuum_db, key, key_size);
+	}
+}
+
+/**
+ * Mirrors an in-place overwrite into the database being built by the vacuum.
+ * A record the vacuum has not copied yet is left alone, it is copied whole later.
+ * Must be called with db_lock held.
+ */
+void gc_mirror_overwrite(const void* key, int key_size, size_t offset, const void* data, size_t size)
+{
+	if (vacuum_db != NULL)
+	{
+		unqlite_kv_overwrite(vacuum_db, key, key_size, offset, data, size);
+	}
+}
+
+void (*gc_orphans)(void (*visit)(uuid_t id, void* arg), void* arg);
+
+struct gc_orphan_copy
+{
+	struct gc_stats* stats;
+	struct gc_stack* todo;
+	int rc;
+};
+
+/**
+ * Copies an open inode that no directory links to anymore.
+ * Must be called with db_lock held.
+ */
+static void gc_copy_orphan(uuid_t id, void* arg)
+{
+	struct gc_orphan_copy* copy = arg;
+	if (copy->rc == UNQLITE_OK)
+	{
+		copy->rc = gc_copy_inode(pDb, vacuum_db, id, copy->stats, copy->todo, NULL);
+		if (copy->rc == UNQLITE_NOTFOUND)
+		{
+			copy->rc = UNQLITE_OK;
+		}
+	}
+}
+
+static double gc_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Puts the new database in place of store_path.
+ * Must be called with db_lock held.
+ */
+static int gc_vacuum_swap()
+{
+	int rc = unqlite_commit(vacuum_db);
+	unqlite_close(vacuum_db);
+	vacuum_db = NULL;
+	if (rc != UNQLITE_OK)
+	{
+		remove(vacuum_path);
+		return rc;
+	}
+
+	//the old handle commits on close, but its file is about to be replaced anyway
+	unqlite_close(pDb);
+	if (rename(vacuum_path, store_path) != 0)
+	{
+		rc = UNQLITE_IOERR;
+	}
+
+	int open_rc = open_store(&pDb, store_path, UNQLITE_OPEN_CREATE);
+	if (open_rc != UNQLITE_OK)
+	{
+		error_handler(open_rc);
+	}
+	return rc;
+}
+
+static void* gc_vacuum_main(void* arg)
+{
+	struct gc_stack todo;
+	struct gc_stats stats;
+	(void) arg;
+
+	memset(&todo, 0, sizeof(struct gc_stack));
+	memset(&stats, 0, sizeof(struct gc_stats));
+	double start = gc_now();
+
+	pthread_mutex_lock(&db_lock);
+	int rc = gc_copy_root(pDb, vacuum_db, &stats, &todo);
+	pthread_mutex_unlock(&db_lock);
+
+	while (rc == UNQLITE_OK && todo.used > 0 && !vacuum_stop)
+	{
+		pthread_mutex_lock(&db_lock);
+		todo.used--;
+		rc = gc_copy_inode(pDb, vacuum_db, todo.ids[todo.used], &stats, &todo, NULL);
+		if (rc == UNQLITE_NOTFOUND)
+		{
+			//deleted since its parent was copied, the delete was mirrored
+			rc = UNQLITE_OK;
+		}
+		pthread_mutex_unlock(&db_lock);
+
+		//bandwidth cap: sleep until the copied bytes fit in the elapsed time
+		if (vacuum_rate > 0)
+		{
+			double ahead = stats.bytes / (vacuum_rate * 1024.0) - (gc_now() - start);
+			if (ahead > 0)
+			{
+				usleep((useconds_t)(ahead * 1e6));
+			}
+		}
+	}
+
+	pthread_mutex_lock(&db_lock);
+	if (rc == UNQLITE_OK && !vacuum_stop && gc_orphans != NULL)
+	{
+		//open files without a link are not reachable from the root, but must outlive the swap
+		struct gc_orphan_copy copy = {&stats, &todo, UNQLITE_OK};
+		gc_orphans(gc_copy_orphan, &copy);
+		rc = copy.rc;
+	}
+	if (rc == UNQLITE_OK && !vacuum_stop)
+	{
+		rc = gc_vacuum_swap();
+		write_log("[GC] vacuum: done rc=%d, %lu records (%lu inodes) in %.2fs\n",
+			rc, stats.records, stats.inodes, gc_now() - start);
+	}
+	else
+	{
+		write_log("[GC] vacuum: abandoned rc=%d\n", rc);
+		unqlite_close(vacuum_db);
+		vacuum_db = NULL;
+		remove(vacuum_path);
+	}
+	pthread_mutex_unlock(&db_lock);
+
+	gc_stack_release(&todo);
+	return NULL;
+}
+
+/**
+ * Starts an online vacuum in the background. 'rate' is the maximum copy
+ * bandwidth in KiB per second, 0 for no limit.
+ *
+ * Returns UNQLITE_OK if the vacuum was started.
+ */
+int gc_vacuum_start(unsigned rate)
+{
+	unqlite* db;
+
+	if (vacuum_db != NULL)
+	{
+		return UNQLITE_LOCKED;
+	}
+	//reap the previous run
+	gc_vacuum_wait(0);
+
+	if (snprintf(vacuum_path, sizeof(vacuum_path), "%s" VACUUM_SUFFIX, store_path) >= (int)sizeof(vacuum_path))
+	{
+		return UNQLITE_INVALID;
+	}
+	remove(vacuum_path);
+	//the new file is only renamed into place once committed, a journal buys nothing
+	int rc = open_store(&db, vacuum_path, UNQLITE_OPEN_CREATE | UNQLITE_OPEN_OMIT_JOURNALING);
+	if (rc != UNQLITE_OK)
+	{
+		return rc;
+	}
+
+	pthread_mutex_lock(&db_lock);
+	vacuum_db = db;
+	vacuum_stop = 0;
+	vacuum_rate = rate;
+	pthread_mutex_unlock(&db_lock);
+
+	if (pthread_create(&vacuum_thread, NULL, gc_vacuum_main, NULL) != 0)
+	{
+		pthread_mutex_lock(&db_lock);
+		vacuum_db = NULL;
+		pthread_mutex_unlock(&db_lock);
+		unqlite_close(db);
+		remove(vacuum_path);
+		return UNQLITE_ABORT;
+	}
+	vacuum_joinable = 1;
+	return UNQLITE_OK;
+}
+
+/**
+ * Waits for the running vacuum (if any) to finish.
+ * If 'abandon' is set the vacuum is stopped and the old database is kept.
+ */
+void gc_vacuum_wait(int abandon)
+{
+	if (!vacuum_joinable)
+	{
+		return;
+	}
+
+	if (abandon)
+	{
+		pthread_mutex_lock(&db_lock);
+		vacuum_stop = 1;
+		pthread_mutex_unlock(&db_lock);
+	}
+
+	pthread_join(vacuum_thread, NULL);
+	vacuum_joinable = 0;
+}
@@ -0,0 +1,166 @@
+#include <uuid/uuid.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "unqlite.h"
+
+/*
+ * Compares the legacy lhash hash (DJB) with unqlite_util_fast_hash().
+ * Usage: ./hashbench [number of keys]
+ *
+ * - distribution: uuid keys spread over 2^k buckets, as the linear hash picks them
+ * - throughput: hashes per second for several key sizes
+ * - store: inserting uuid keys into a fresh database with each hash
+ */
+
+#define BENCH_DB "/tmp/hashbench.db"
+
+typedef unsigned int (*hash_func)(const void*, unsigned int);
+
+//copy of the default lhash hash function, which is private to unqlite.c
+static unsigned int djb_hash(const void* src, unsigned int len)
+{
+	const unsigned char* z = src;
+	unsigned int h = 5381;
+	if (len > 2048)
+	{
+		len = 2048;
+	}
+	for (unsigned int i = 0; i < len; i++)
+	{
+		h = h * 33 + z[i];
+	}
+	return h;
+}
+
+static const struct
+{
+	const char* name;
+	hash_func hash;
+} hashes[] =
+{
+	{"djb", djb_hash},
+	{"fast", unqlite_util_fast_hash},
+};
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Prints the largest bucket and the chi-square of the bucket loads
+ * (about 1.0 for a uniform hash) for 2^bits buckets.
+ */
+static void distribution(hash_func hash, uuid_t* keys, int n, int bits)
+{
+	unsigned int buckets = 1u << bits;
+	unsigned int* load = calloc(buckets, sizeof(unsigned int));
+	unsigned int max = 0;
+	double expected = (double)n / buckets, chi = 0;
+
+	for (int i = 0; i < n; i++)
+	{
+		load[hash(keys[i], sizeof(uuid_t)) & (buckets - 1)]++;
+	}
+	for (unsigned int b = 0; b < buckets; b++)
+	{
+		double d = load[b] - expected;
+		chi += d * d / expected;
+		if (load[b] > max)
+		{
+			max = load[b];
+		}
+	}
+	printf("    2^%-2d buckets: max %5u (mean %7.1f) chi2/df %.3f\n", bits, max, expected, chi / (buckets - 1));
+	free(load);
+}
+
+static void throughput(hash_func hash, unsigned int len)
+{
+	unsigned char* buf = malloc(len + 64);
+	unsigned int sink = 0;
+	long iters = (64L << 20) / (len + 8);
+	memset(buf, 0xa5, len + 64);
+
+	double start = now();
+	for (long i = 0; i < iters; i++)
+	{
+		//vary the key so the work cannot be hoisted out of the loop
+		buf[i & 63] = (unsigned char)i;
+		sink += hash(&buf[i & 63], len);
+	}
+	double secs = now() - start;
+	printf("    %5u byte keys: %8.1f Mhash/s %9.1f MiB/s (%08x)\n",
+		len, iters / secs / 1e6, iters * (double)len / secs / (1 << 20), sink);
+	free(buf);
+}
+
+static void store(hash_func hash, uuid_t* keys, int n)
+{
+	unqlite* db;
+	char value[64];
+	unqlite_int64 size = 0;
+
+	memset(value, 0, sizeof(value));
+	remove(BENCH_DB);
+	if (unqlite_open(&db, BENCH_DB, UNQLITE_OPEN_CREATE | UNQLITE_OPEN_OMIT_JOURNALING) != UNQLITE_OK)
+	{
+		return;
+	}
+	unqlite_kv_config(db, UNQLITE_KV_CONFIG_HASH_FUNC, hash);
+
+	double start = now();
+	for (int i = 0; i < n; i++)
+	{
+		unqlite_kv_store(db, keys[i], sizeof(uuid_t), value, sizeof(value));
+	}
+	unqlite_commit(db);
+	double mid = now();
+	for (int i = 0; i < n; i++)
+	{
+		size = sizeof(value);
+		unqlite_kv_fetch(db, keys[i], sizeof(uuid_t), value, &size);
+	}
+	double end = now();
+	unqlite_close(db);
+
+	FILE* f = fopen(BENCH_DB, "r");
+	fseek(f, 0, SEEK_END);
+	printf("    store %.0f/s, fetch %.0f/s, %ld KiB\n", n / (mid - start), n / (end - mid), ftell(f) / 1024);
+	fclose(f);
+	remove(BENCH_DB);
+}
+
+int main(int argc, char** argv)
+{
+	int n = (argc > 1) ? atoi(argv[1]) : 100000;
+	uuid_t* keys = malloc(n * sizeof(uuid_t));
+
+	for (int i = 0; i < n; i++)
+	{
+		uuid_generate(keys[i]);
+	}
+
+	for (size_t h = 0; h < sizeof(hashes) / sizeof(hashes[0]); h++)
+	{
+		printf("%s\n", hashes[h].name);
+		printf("  distribution of %d uuid keys\n", n);
+		for (int bits = 8; bits <= 16; bits += 4)
+		{
+			distribution(hashes[h].hash, keys, n, bits);
+		}
+		printf("  throughput\n");
+		throughput(hashes[h].hash, 16);
+		throughput(hashes[h].hash, 64);
+		throughput(hashes[h].hash, 4096);
+		printf("  lhash engine\n");
+		store(hashes[h].hash, keys, n);
+	}
+
+	free(keys);
+	return 0;
+}
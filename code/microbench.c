@@ -0,0 +1,463 @@
+#define main myfs_main
+#include "myfs.c"
+#undef main
+
+/*
+ * Microbenchmarks of the file system code without FUSE or the kernel.
+ * Usage: ./microbench [-n iterations] [-b benchmark] [-s seed] [-d] [-l]
+ *
+ * Includes myfs.c and calls its helpers and the myfs_oper callbacks directly,
+ * with a fake fuse_context, so the numbers only hold the cost of myfs and the store.
+ * - get_inode: lookups in the root, at the bottom of the deepest path,
+ *   of the last entry of a full directory and of a missing name
+ * - update_parent: adding the last free entry of a directory
+ * - write_range, read_range: a whole file and a single data block
+ * - ops: getattr, getxattr (missing and present), access, read and write (by path
+ *   and through an open handle), create with unlink, rename, and copying a file
+ *   by read and write or by MYFS_IOC_CLONE_RANGE, through myfs_oper
+ *
+ * Every benchmark is a function of its own, so 'perf record -g ./microbench -b name'
+ * attributes samples to it. The store is built in RAM (or in MICROBENCH_DB with -d)
+ * from uuids drawn from a seeded generator, so every run with the same seed
+ * sees the same keys and the same store layout.
+ * The log goes to /dev/null, or to myfs.log with -l.
+ */
+
+#define MICROBENCH_DB "/tmp/microbench.db"
+#define NOINLINE __attribute__((noinline))
+
+//defined in fs.c, where write_log() writes
+extern FILE* logfile;
+
+static struct fuse_context context;
+static struct myfs_state state;
+static unsigned long long uuid_state;
+
+static long iterations = 100000;
+static const char* only;
+
+//the directories of the dataset
+#define WIDE_DIR "/wide"
+#define FULL_DIR "/full"
+#define DATA_FILE "/file"
+
+static char deep_path[MY_MAX_PATH];
+static char wide_last[MY_MAX_PATH];
+
+/**
+ * myfs only asks the context for the caller's ids and the private data.
+ */
+struct fuse_context* fuse_get_context(void)
+{
+	return &context;
+}
+
+/**
+ * Replaces libuuid's generator with splitmix64 over a seeded counter,
+ * which makes every key of a run, and so the layout of the store, repeatable.
+ */
+void uuid_generate(uuid_t out)
+{
+	for (int i = 0; i < 2; i++)
+	{
+		unsigned long long z = (uuid_state += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		z ^= z >> 31;
+		memcpy(out + i * 8, &z, 8);
+	}
+}
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int selected(const char* name)
+{
+	return only == NULL || strncmp(name, only, strlen(only)) == 0;
+}
+
+static void report(const char* name, long n, double secs)
+{
+	printf("  %-28s %10.1f ns/op %10.0f ops/s\n", name, secs * 1e9 / n, n / secs);
+}
+
+/**
+ * Builds the dataset:
+ * - the deepest chain of one letter directories that fits in MY_MAX_PATH
+ * - WIDE_DIR, a full directory of empty files
+ * - FULL_DIR, a directory with one free entry, for update_parent
+ * - DATA_FILE, a file of one block (MY_DATA_SIZE_PER_BLOCK bytes)
+ */
+static void build_dataset()
+{
+	struct fuse_operations* o = &myfs_oper;
+	struct fuse_file_info fi;
+	char path[MY_MAX_PATH];
+
+	memset(&fi, 0, sizeof(fi));
+	deep_path[0] = 0;
+	while (strlen(deep_path) + 3 < MY_MAX_PATH)
+	{
+		strcat(deep_path, "/d");
+		o->mkdir(deep_path, 0755);
+	}
+
+	o->mkdir(WIDE_DIR, 0755);
+	for (int i = 0; i < MY_MAX_DIR_FILES; i++)
+	{
+		snprintf(path, sizeof(path), WIDE_DIR "/f%02d", i);
+		o->create(path, 0644, &fi);
+		o->release(path, &fi);
+	}
+	snprintf(wide_last, sizeof(wide_last), WIDE_DIR "/f%02d", MY_MAX_DIR_FILES - 1);
+
+	o->mkdir(FULL_DIR, 0755);
+	for (int i = 0; i < MY_MAX_DIR_FILES - 1; i++)
+	{
+		snprintf(path, sizeof(path), FULL_DIR "/f%02d", i);
+		o->create(path, 0644, &fi);
+		o->release(path, &fi);
+	}
+
+	char data[MY_DATA_SIZE_PER_BLOCK + 1];
+	memset(data, 'a', MY_DATA_SIZE_PER_BLOCK);
+	data[MY_DATA_SIZE_PER_BLOCK] = 0;
+	o->create(DATA_FILE, 0644, &fi);
+	o->write(DATA_FILE, data, MY_DATA_SIZE_PER_BLOCK, 0, &fi);
+	o->release(DATA_FILE, &fi);
+}
+
+static NOINLINE void bench_get_inode(const char* name, const char* path)
+{
+	my_inode inode;
+	double start = now();
+	for (long i = 0; i < iterations; i++)
+	{
+		get_inode(path, &inode, 0);
+	}
+	report(name, iterations, now() - start);
+}
+
+/**
+ * Times update_parent() filling the last free entry of FULL_DIR.
+ * The directory is put back after every call, outside of the timing.
+ */
+static NOINLINE void bench_update_parent()
+{
+	my_inode parent, saved;
+	dir_data_fcb page;
+	uuid_t id;
+	double secs = 0;
+
+	get_inode(FULL_DIR, &saved, 0);
+	fetch_from_db(saved.data_id, &page, sizeof(dir_data_fcb));
+	uuid_generate(id);
+
+	for (long i = 0; i < iterations; i++)
+	{
+		parent = saved;
+		double start = now();
+		update_parent(&parent, id, FULL_DIR "/new");
+		secs += now() - start;
+		store_inode(&saved);
+		store_to_db(saved.data_id, &page, sizeof(dir_data_fcb));
+	}
+	report("update_parent", iterations, secs);
+}
+
+/**
+ * Times write_range() overwriting 'size' bytes at the start of DATA_FILE.
+ */
+static NOINLINE void bench_write_range(const char* name, int size)
+{
+	my_inode inode;
+	file_data_fcb data;
+	char buf[MY_DATA_SIZE_PER_BLOCK];
+
+	get_inode(DATA_FILE, &inode, 0);
+	fetch_from_db(inode.data_id, &data, sizeof(file_data_fcb));
+	memset(buf, 'b', size);
+
+	double start = now();
+	for (long i = 0; i < iterations; i++)
+	{
+		write_range(&data, buf, size, 0);
+	}
+	report(name, iterations, now() - start);
+}
+
+/**
+ * Times read_range() reading 'size' bytes from the start of DATA_FILE.
+ */
+static NOINLINE void bench_read_range(const char* name, int size)
+{
+	my_inode inode;
+	file_data_fcb data;
+	char buf[MY_DATA_SIZE_PER_BLOCK];
+
+	get_inode(DATA_FILE, &inode, 0);
+	fetch_from_db(inode.data_id, &data, sizeof(file_data_fcb));
+
+	double start = now();
+	for (long i = 0; i < iterations; i++)
+	{
+		read_range(&data, buf, size, 0);
+	}
+	report(name, iterations, now() - start);
+}
+
+static NOINLINE void bench_op_getattr()
+{
+	struct stat st;
+	double start = now();
+	for (long i = 0; i < iterations; i++)
+	{
+		myfs_oper.getattr(wide_last, &st);
+	}
+	report("op_getattr", iterations, now() - start);
+}
+
+/**
+ * Times getxattr() of an attribute DATA_FILE does not have, as the kernel asks
+ * before every write, and of one it has.
+ */
+static NOINLINE void bench_op_getxattr()
+{
+	char value[16];
+	myfs_oper.setxattr(DATA_FILE, "user.bench", "value", 5, 0);
+
+	double start = now();
+	for (long i = 0; i < iterations; i++)
+	{
+		myfs_oper.getxattr(DATA_FILE, "security.capability", value, sizeof(value));
+	}
+	report("op_getxattr_missing", iterations, now() - start);
+
+	start = now();
+	for (long i = 0; i < iterations; i++)
+	{
+		myfs_oper.getxattr(DATA_FILE, "user.bench", value, sizeof(value));
+	}
+	report("op_getxattr", iterations, now() - start);
+}
+
+/**
+ * Times access() at the bottom of the deepest path, which checks the search
+ * permission of every directory on the way, as a shell probing PATH does.
+ */
+static NOINLINE void bench_op_access()
+{
+	double start = now();
+	for (long i = 0; i < iterations; i++)
+	{
+		myfs_oper.access(deep_path, R_OK);
+	}
+	report("op_access", iterations, now() - start);
+}
+
+/**
+ * Times reads of DATA_FILE, through an open file handle if 'opened' is set
+ * and by path (as truncate() does) otherwise.
+ */
+static NOINLINE void bench_op_read(const char* name, int opened)
+{
+	struct fuse_file_info fi;
+	char buf[MY_DATA_SIZE_PER_BLOCK];
+	memset(&fi, 0, sizeof(fi));
+	if (opened)
+	{
+		myfs_oper.open(DATA_FILE, &fi);
+	}
+
+	double start = now();
+	for (long i = 0; i < iterations; i++)
+	{
+		myfs_oper.read(DATA_FILE, buf, sizeof(buf), 0, &fi);
+	}
+	report(name, iterations, now() - start);
+
+	if (opened)
+	{
+		myfs_oper.release(DATA_FILE, &fi);
+	}
+}
+
+static NOINLINE void bench_op_write(const char* name, int opened)
+{
+	struct fuse_file_info fi;
+	char buf[MY_DATA_SIZE_PER_BLOCK + 1];
+	memset(&fi, 0, sizeof(fi));
+	memset(buf, 'c', MY_DATA_SIZE_PER_BLOCK);
+	buf[MY_DATA_SIZE_PER_BLOCK] = 0;
+	if (opened)
+	{
+		myfs_oper.open(DATA_FILE, &fi);
+	}
+
+	double start = now();
+	for (long i = 0; i < iterations; i++)
+	{
+		myfs_oper.write(DATA_FILE, buf, MY_DATA_SIZE_PER_BLOCK, 0, &fi);
+	}
+	report(name, iterations, now() - start);
+
+	if (opened)
+	{
+		myfs_oper.release(DATA_FILE, &fi);
+	}
+}
+
+static NOINLINE void bench_op_create_unlink()
+{
+	struct fuse_file_info fi;
+	memset(&fi, 0, sizeof(fi));
+
+	double start = now();
+	for (long i = 0; i < iterations; i++)
+	{
+		myfs_oper.create("/tmp", 0644, &fi);
+		myfs_oper.release("/tmp", &fi);
+		myfs_oper.unlink("/tmp");
+	}
+	report("op_create_release_unlink", iterations, now() - start);
+}
+
+static NOINLINE void bench_op_rename()
+{
+	double start = now();
+	for (long i = 0; i < iterations; i++)
+	{
+		myfs_oper.rename(DATA_FILE, DATA_FILE "2");
+		myfs_oper.rename(DATA_FILE "2", DATA_FILE);
+	}
+	report("op_rename", iterations * 2, now() - start);
+}
+
+/**
+ * Times copying DATA_FILE over another file, with MYFS_IOC_CLONE_RANGE ('clone' set)
+ * and with read and write through the handlers otherwise.
+ */
+static NOINLINE void bench_op_copy(const char* name, int clone)
+{
+	struct fuse_file_info fi;
+	memset(&fi, 0, sizeof(fi));
+	//a clone needs a handle open for writing
+	fi.flags = O_RDWR;
+	myfs_oper.create(DATA_FILE "copy", 0644, &fi);
+
+	struct myfs_clone_range range;
+	char buf[MY_DATA_SIZE_PER_BLOCK];
+	double start = now();
+	for (long i = 0; i < iterations; i++)
+	{
+		if (clone)
+		{
+			memset(&range, 0, sizeof(range));
+			strcpy(range.src, DATA_FILE);
+			myfs_oper.ioctl(DATA_FILE "copy", MYFS_IOC_CLONE_RANGE, NULL, &fi, 0, &range);
+		}
+		else
+		{
+			myfs_oper.read(DATA_FILE, buf, sizeof(buf), 0, NULL);
+			myfs_oper.write(DATA_FILE "copy", buf, sizeof(buf), 0, &fi);
+		}
+	}
+	report(name, iterations, now() - start);
+
+	myfs_oper.release(DATA_FILE "copy", &fi);
+	myfs_oper.unlink(DATA_FILE "copy");
+}
+
+int main(int argc, char** argv)
+{
+	int on_disk = 0, log = 0, opt;
+
+	while ((opt = getopt(argc, argv, "n:b:s:dl")) != -1)
+	{
+		switch (opt)
+		{
+			case 'n': iterations = atol(optarg); break;
+			case 'b': only = optarg; break;
+			case 's': uuid_state = strtoull(optarg, NULL, 0); break;
+			case 'd': on_disk = 1; break;
+			case 'l': log = 1; break;
+			default:
+				fprintf(stderr, "usage: %s [-n iterations] [-b benchmark] [-s seed] [-d] [-l]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (iterations < 1)
+	{
+		fprintf(stderr, "%s: iterations must be positive\n", argv[0]);
+		return 2;
+	}
+
+	state.logfile = log ? init_log_file() : fopen("/dev/null", "w");
+	logfile = state.logfile;
+	state.vacuum_rate = 4096;
+	context.uid = getuid();
+	context.gid = getgid();
+	context.private_data = &state;
+
+	if (on_disk)
+	{
+		remove(MICROBENCH_DB);
+		store_path = MICROBENCH_DB;
+	}
+	else
+	{
+		store_path = MEMORY_STORE;
+	}
+	init_fs();
+	build_dataset();
+
+	char name[64];
+	printf("%ld iterations, %s store\n", iterations, on_disk ? "disk" : "memory");
+	if (selected("get_inode"))
+	{
+		bench_get_inode("get_inode_root", DATA_FILE);
+		snprintf(name, sizeof(name), "get_inode_deep_%d", (int)strlen(deep_path) / 2);
+		bench_get_inode(name, deep_path);
+		bench_get_inode("get_inode_wide_last", wide_last);
+		bench_get_inode("get_inode_missing", WIDE_DIR "/none");
+	}
+	if (selected("update_parent"))
+	{
+		bench_update_parent();
+	}
+	if (selected("write_range"))
+	{
+		bench_write_range("write_range_data", MY_MAX_DATA_SIZE);
+		bench_write_range("write_range_file", MY_DATA_SIZE_PER_BLOCK);
+	}
+	if (selected("read_range"))
+	{
+		bench_read_range("read_range_data", MY_MAX_DATA_SIZE);
+		bench_read_range("read_range_file", MY_DATA_SIZE_PER_BLOCK);
+	}
+	if (selected("op"))
+	{
+		bench_op_getattr();
+		bench_op_getxattr();
+		bench_op_access();
+		bench_op_read("op_read", 0);
+		bench_op_read("op_read_fh", 1);
+		bench_op_write("op_write", 0);
+		bench_op_write("op_write_fh", 1);
+		bench_op_create_unlink();
+		bench_op_rename();
+		bench_op_copy("op_copy", 0);
+		bench_op_copy("op_clone", 1);
+	}
+
+	shutdown_fs();
+	if (on_disk)
+	{
+		remove(MICROBENCH_DB);
+	}
+	return 0;
+}
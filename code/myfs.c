@@ -5,6 +5,10 @@
 #include <fcntl.h>
 #include <time.h>
 #include <libgen.h>
+#include <stddef.h>
+#include <sys/statvfs.h>
+#include <linux/falloc.h>
+#include <sys/xattr.h>
 
 #include "myfs.h"
 
@@ -39,6 +43,40 @@ char* get_file_name(const char* path)
 	return basename(path);
 }
 
+/**
+ * Returns the current time, to the nanosecond, for the times of an inode.
+ */
+static struct timespec time_now()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return now;
+}
+
+//sets the time 'field' (mtime, atime or ctime) of the inode 'inode' points at to the timespec 'ts'
+#define SET_TIME(inode, field, ts) ((inode)->field = (ts).tv_sec, (inode)->field##_nsec = (ts).tv_nsec)
+
+//compares the time 'fa' of the inode 'a' points at with the time 'fb' of 'b', like strcmp()
+#define CMP_TIME(a, fa, b, fb) (((a)->fa != (b)->fb) ? (((a)->fa < (b)->fb) ? -1 : 1) : \
+	((int64_t)(a)->fa##_nsec - (int64_t)(b)->fb##_nsec))
+
+/**
+ * Fills in what an inode read from the start of a record of 'nBytes' bytes lacks if the
+ * record is in an older layout, which stays in 'version'.
+ */
+static void inode_layout(my_inode* inode, unqlite_int64 nBytes)
+{
+	if (inode->version == MY_INODE_VERSION)
+	{
+		return;
+	}
+	if (nBytes == MY_INODE_V1_SIZE)
+	{
+		inode->nlink = S_ISDIR(inode->mode) ? 2 : 1;
+	}
+	inode->mtime_nsec = inode->atime_nsec = inode->ctime_nsec = 0;
+}
+
 
 /**
  * Fetches the given 'id' from the database into the given 'data' pointer
@@ -53,939 +91,4048 @@ int fetch_from_db(uuid_t id, void* data, size_t size)
 	int rc;
 	unqlite_int64 nBytes = size;  //Data length.
 
+	stats_count(STAT_KV_FETCH, 1);
+	pthread_mutex_lock(&db_lock);
 	rc = unqlite_kv_fetch(pDb, id, KEY_SIZE, NULL, &nBytes);
 	if (rc != UNQLITE_OK)
 	{
+		pthread_mutex_unlock(&db_lock);
 		return -ENOENT;
 	}
 	error_handle(rc);
 
+	//an inode is read from the start of its record, which may be in an older layout,
+	//and which holds a symbolic link's target and the extended attributes after the inode
+	int inode = (size == sizeof(my_inode));
+	unqlite_int64 stored = nBytes;
+
 	//error check we fetched the right thing
-	if(nBytes!=size)
+	if ((inode && nBytes < MY_INODE_V1_SIZE) || (!inode && nBytes != size))
 	{
 		write_log("[DB] fetch: Data object has unexpected size. Expected %d, got %d\n", size, nBytes);
 		exit(-1);
 	}
 
 	//Fetch the fcb that the root object points at. We will probably need it.
-	unqlite_kv_fetch(pDb, id, KEY_SIZE, data, &nBytes);
+	if (inode)
+	{
+		nBytes = FLOOR(stored, (unqlite_int64)size);
+		unqlite_kv_fetch_range(pDb, id, KEY_SIZE, 0, data, &nBytes);
+	}
+	else
+	{
+		unqlite_kv_fetch(pDb, id, KEY_SIZE, data, &nBytes);
+	}
+	pthread_mutex_unlock(&db_lock);
+
+	if (inode)
+	{
+		inode_layout(data, stored);
+		nBytes = size;
+	}
 
 	return nBytes;
 }
 
 /**
- * Function to store back to the database.
- * Stores with key 'id' and value 'data'.
- * 'size' is the size of 'data'.
+ * Fetches 'size' bytes starting at byte 'offset' of the item with key 'id' into 'data'.
+ * Only the part of the item that holds the range is read from the database.
  *
- * Returns 0 on success.
+ * Returns the number of bytes fetched, which is short if the item ends before the range.
+ * Otherwise returns -ENOENT if the item was not found in the database.
  */
-int store_to_db(uuid_t id, void* data, size_t size)
+int fetch_range_from_db(uuid_t id, size_t offset, void* data, size_t size)
 {
-	if (uuid_compare(id, root_object.id) == 0)
+	unqlite_int64 nBytes = size;
+
+	stats_count(STAT_KV_FETCH, 1);
+	pthread_mutex_lock(&db_lock);
+	int rc = unqlite_kv_fetch_range(pDb, id, KEY_SIZE, offset, data, &nBytes);
+	pthread_mutex_unlock(&db_lock);
+	if (rc != UNQLITE_OK)
 	{
-		the_root_fcb = *((my_inode*)data);
+		return -ENOENT;
 	}
-	int rc = unqlite_kv_store(pDb, id, KEY_SIZE, data, size);
-	error_handle(rc);
-	return rc;
-}
 
+	return nBytes;
+}
 
 /**
- * Gets the inode at the end of the given path and puts it in the pointer 'inode'
- * If the 'get_parent' flag is set to be greater than 0, gets the inode one before the end
- *
- * Example:
- * 	get_inode("/a/b/c", &inode, 0) gets the inode of "/a/b"
- * 	get_inode("/a/b/c", &inode, 1) gets the inode of "/a/b/c"
- *
- * Returns 0 on success and -ENOENT if an inode was not found at the given path.
+ * Returns the size of the record 'id' in bytes, counting its key, or 0 if there is none.
+ * The caller holds db_lock.
  */
-int get_inode(const char* path, my_inode* inode, int get_parent)
+static unsigned long long record_bytes(uuid_t id)
 {
-	write_log("[FUNC] get_inode: path='%s' get_parent='%d'\n", path, get_parent);
-	char* str = strdup(path);
-
-	//remove path after last '/' because we want the directory before it
-	if(get_parent)
+	unqlite_int64 nBytes;
+	if (unqlite_kv_fetch(pDb, id, KEY_SIZE, NULL, &nBytes) != UNQLITE_OK)
 	{
-		char* r = strrchr(str, '/');
-		*r = 0;
+		return 0;
 	}
+	return KEY_SIZE + nBytes;
+}
 
-	char* partial_path;
-
-	while((partial_path = strsep(&str, "/")) != NULL)
-	{
-		//root directory
-		if (strcmp(partial_path, "") == 0)
-		{
-			inode = memcpy(inode, &the_root_fcb, sizeof(my_inode));
-		}
-		else 
-		{
-			dir_data_fcb dir_fcb;
-			int rc = fetch_from_db(inode->data_id, &dir_fcb, sizeof(dir_data_fcb)); 
-			if (rc < 0)
-			{
-				write_log("[FUNC] get_inode: Not found in db\n");
-				return -ENOENT;
-			}
+/**
+ * Returns 1 if storing 'size' more bytes would take an in-memory store over its limit.
+ */
+int mem_would_exceed(size_t size)
+{
+	return mem_limit != 0 && mem_used + size > mem_limit;
+}
 
-			//loop through current inode
-			int found = 0;
-			for (int i = 0; i<MY_MAX_DIR_FILES; i++)
-			{
-				dir_entry entry = dir_fcb.entries[i];
-				if (strcmp(entry.filename, partial_path) == 0)
-				{
-					found = 1;
+static void open_cache(uuid_t id, void* data, size_t size);
 
-					//fetch next inode
-					fetch_from_db(entry.inode_id, inode, sizeof(my_inode));
+//usage counters of the root object, written back on unmount (see myfs_statfs())
+#define USAGE_ADD(counter, n) __atomic_fetch_add(&root_object.counter, (n), __ATOMIC_RELAXED)
 
-					break;
-				}
-			}
-			if(!found)
-			{
-				write_log("[FUNC] get_inode: Not found in fs\n");
-				return -ENOENT;
-			}
-		}
+/**
+ * Replaces the whole record 'id' with 'data', for callers that hold db_lock.
+ * Returns the unqlite result code.
+ */
+static int replace_locked(uuid_t id, void* data, size_t size)
+{
+	if (mem_limit != 0)
+	{
+		mem_used += KEY_SIZE + size - record_bytes(id);
 	}
-	return 0;
+	int rc = unqlite_kv_store(pDb, id, KEY_SIZE, data, size);
+	gc_mirror_store(id, KEY_SIZE, data, size);
+	return rc;
 }
 
 /**
- * Function to update the parent directory with a new inode
- * Returns 0 on success, an error code on error.
+ * Rewrites the inode record 'id' in the current layout if it is in an older one,
+ * keeping what follows the inode. The caller holds db_lock.
+ * Returns the unqlite result code, UNQLITE_NOTFOUND if there is no such record.
  */
-int update_parent(my_inode* parent_inode, uuid_t new_inode_id, const char* path)
+static int upgrade_locked(uuid_t id)
 {
-	dir_data_fcb parent_data;
-	fetch_from_db(parent_inode->data_id, &parent_data, sizeof(dir_data_fcb));
+	my_inode inode;
+	unqlite_int64 nBytes;
+	int rc = unqlite_kv_fetch(pDb, id, KEY_SIZE, NULL, &nBytes);
+	if (rc != UNQLITE_OK)
+	{
+		return rc;
+	}
+	if (nBytes < MY_INODE_V1_SIZE)
+	{
+		return UNQLITE_CORRUPT;
+	}
 
-	parent_inode->size = parent_inode->size + 1;
-	parent_inode->mtime = time(NULL);
+	unqlite_int64 head = FLOOR(nBytes, (unqlite_int64)sizeof(my_inode));
+	unqlite_kv_fetch_range(pDb, id, KEY_SIZE, 0, &inode, &head);
+	if (inode.version == MY_INODE_VERSION)
+	{
+		return UNQLITE_OK;
+	}
+	inode_layout(&inode, nBytes);
+	head = (nBytes == MY_INODE_V1_SIZE) ? MY_INODE_V1_SIZE : MY_INODE_V2_SIZE;
 
-	int found = 0;
+	unqlite_int64 tail = nBytes - head;
+	uint8_t* record = malloc(sizeof(my_inode) + tail);
+	if (record == NULL)
+	{
+		return UNQLITE_NOMEM;
+	}
+	inode.version = MY_INODE_VERSION;
+	memcpy(record, &inode, sizeof(my_inode));
+	if (tail > 0)
+	{
+		unqlite_kv_fetch_range(pDb, id, KEY_SIZE, head, record + sizeof(my_inode), &tail);
+	}
+	rc = replace_locked(id, record, sizeof(my_inode) + tail);
+	free(record);
+	return rc;
+}
 
-	//add new inode to parent
-	for (int i = 0; i<MY_MAX_DIR_FILES; i++)
+/**
+ * store_to_db() for callers that hold db_lock.
+ * Returns the unqlite result code.
+ */
+static int store_locked(uuid_t id, void* data, size_t size)
+{
+	//inodes are stored by store_inode_locked(), of the rest only a file data fcb is held open
+	if (size == sizeof(file_data_fcb))
 	{
-		dir_entry entry = parent_data.entries[i];
+		open_cache(id, data, size);
+	}
+	stats_count(STAT_KV_STORE, 1);
+	return replace_locked(id, data, size);
+}
 
-		//found empty entry
-		if(strcmp(entry.filename, "") == 0)
+/**
+ * store_inode() for callers that hold db_lock.
+ * An inode read from a record in an older layout has its record upgraded first,
+ * and its 'version' set in 'inode'.
+ * Returns the unqlite result code.
+ */
+static int store_inode_locked(my_inode* inode)
+{
+	if (inode->version != MY_INODE_VERSION)
+	{
+		int rc = upgrade_locked(inode->id);
+		if (rc != UNQLITE_OK && rc != UNQLITE_NOTFOUND)
 		{
-			found = 1;
-
-			uuid_copy(entry.inode_id, new_inode_id);
-			strcpy(entry.filename, get_file_name(path));
-
-			write_log("[FUNC] Updated parent with new inode (name='%s')\n", entry.filename);
-
-			parent_data.entries[i] = entry;
-			break;
+			return rc;
 		}
+		inode->version = MY_INODE_VERSION;
 	}
-
-	if (!found)
+	if (uuid_compare(inode->id, root_object.id) == 0)
 	{
-		write_log("[FUNC] Update parent directory no more space\n.");
-		return -ENOENT;
+		the_root_fcb = *inode;
 	}
+	open_cache(inode->id, inode, sizeof(my_inode));
+	stats_count(STAT_KV_STORE, 1);
 
-	store_to_db(parent_inode->id, parent_inode, sizeof(my_inode));
-	store_to_db(parent_inode->data_id, &parent_data, sizeof(dir_data_fcb));
+	//storing an inode rewrites it in place and keeps what follows it in its record,
+	//the target of a symbolic link and the extended attributes
+	int rc = unqlite_kv_overwrite(pDb, inode->id, KEY_SIZE, 0, inode, sizeof(my_inode));
+	if (rc != UNQLITE_NOTFOUND)
+	{
+		gc_mirror_overwrite(inode->id, KEY_SIZE, 0, inode, sizeof(my_inode));
+		return rc;
+	}
+	return replace_locked(inode->id, inode, sizeof(my_inode));
+}
 
-	return 0;
+/**
+ * delete_from_db() for callers that hold db_lock.
+ * Returns the unqlite result code.
+ */
+static int delete_locked(uuid_t id)
+{
+	stats_count(STAT_KV_DELETE, 1);
+	if (mem_limit != 0)
+	{
+		mem_used -= record_bytes(id);
+	}
+	int rc = unqlite_kv_delete(pDb, id, KEY_SIZE);
+	gc_mirror_delete(id, KEY_SIZE);
+	return rc;
 }
 
+/**
+ * Function to store back to the database.
+ * Stores with key 'id' and value 'data'.
+ * 'size' is the size of 'data'.
+ *
+ * Returns 0 on success.
+ */
+int store_to_db(uuid_t id, void* data, size_t size)
+{
+	pthread_mutex_lock(&db_lock);
+	int rc = store_locked(id, data, size);
+	pthread_mutex_unlock(&db_lock);
+	error_handle(rc);
+	return rc;
+}
 
-// Get file and directory attributes (meta-data).
-// Read 'man 2 stat' and 'man 2 chmod'.
-static int myfs_getattr(const char *path, struct stat *stbuf)
+/**
+ * Stores 'inode' under its id. Unlike store_to_db() this keeps what follows the
+ * inode in its record, and upgrades a record in an older layout.
+ *
+ * Returns 0 on success.
+ */
+int store_inode(my_inode* inode)
 {
-	write_log("\n[SYST] getattr: (path=\"%s\", statbuf=0x%08x)\n", path, stbuf);
+	pthread_mutex_lock(&db_lock);
+	int rc = store_inode_locked(inode);
+	pthread_mutex_unlock(&db_lock);
+	error_handle(rc);
+	return rc;
+}
 
-	memset(stbuf, 0, sizeof(struct stat));
 
-	my_inode inode;
-	int rc = get_inode(path, &inode, 0);
+/**
+ * Deletes the item with key 'id' from the database.
+ * Deleting an item that is not in the database is not an error.
+ *
+ * Returns 0 on success.
+ */
+int delete_from_db(uuid_t id)
+{
+	pthread_mutex_lock(&db_lock);
+	int rc = delete_locked(id);
+	pthread_mutex_unlock(&db_lock);
+	if (rc == UNQLITE_NOTFOUND)
+	{
+		return 0;
+	}
+	error_handle(rc);
+	return rc;
+}
 
-	if (rc < 0)
+/**
+ * Writes 'size' bytes of 'buf' at 'at' of the data block whose id is in 'slot'. A block
+ * other files share is copied first, to a new id that is put in 'slot'. The share count
+ * is read and changed under db_lock, so a concurrent clone or write cannot lose a share.
+ *
+ * Returns 1 if 'slot' changed, 0 if not, or -ENOENT if the block is missing.
+ */
+static int write_data_block(uuid_t slot, const void* buf, int at, int size)
+{
+	data_block block;
+	unqlite_int64 nBytes = sizeof(data_block);
+	int copied = 0;
+
+	pthread_mutex_lock(&db_lock);
+	stats_count(STAT_KV_FETCH, 1);
+	if (unqlite_kv_fetch(pDb, slot, KEY_SIZE, &block, &nBytes) != UNQLITE_OK)
 	{
+		pthread_mutex_unlock(&db_lock);
 		return -ENOENT;
 	}
-	else 
+	if (block.shares > 0)
 	{
-		stbuf->st_mode = inode.mode;
-		stbuf->st_nlink = 1; 
-		stbuf->st_mtime = inode.mtime;
-		stbuf->st_atime = inode.atime;
-		stbuf->st_ctime = inode.ctime;
-		stbuf->st_uid = inode.uid;
-		stbuf->st_gid = inode.gid;
-		stbuf->st_size = inode.size;
+		//the others keep the block as it is
+		block.shares--;
+		store_locked(block.id, &block, sizeof(data_block));
+
+		uuid_generate(block.id);
+		uuid_copy(slot, block.id);
+		block.shares = 0;
+		copied = 1;
+		USAGE_ADD(blocks, 1);
 	}
+	memcpy(block.data + at, buf, size);
+	block.size = MY_MAX_DATA_SIZE;
+	int rc = store_locked(block.id, &block, sizeof(data_block));
+	pthread_mutex_unlock(&db_lock);
+	error_handle(rc);
 
-	return 0;
+	return copied;
 }
 
 /**
- * Read a directory.
- * Read 'man 2 readdir'.
+ * Drops one file's use of the data block 'id', deleting it if no other file shares it.
  */
-static int myfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi)
+static void release_data_block(uuid_t id)
 {
-	(void) offset;
-	(void) fi;
-
-	write_log("\n[SYST] readdir: (path=\"%s\", buf=0x%08x, filler=0x%08x, offset=%lld, fi=0x%08x)\n", path, buf, filler, offset, fi);
-
-	filler(buf, ".", NULL, 0);
-	filler(buf, "..", NULL, 0);
+	data_block block;
+	unqlite_int64 nBytes = sizeof(data_block);
 
-	//get the inode
-	my_inode inode;
-	int rc = get_inode(path, &inode, 0);
-	if(rc < 0)
+	pthread_mutex_lock(&db_lock);
+	stats_count(STAT_KV_FETCH, 1);
+	if (unqlite_kv_fetch(pDb, id, KEY_SIZE, &block, &nBytes) == UNQLITE_OK && block.shares > 0)
 	{
-		write_log("[SYST] readdir: Returned without checking dir contents\n");
-		return 0;
+		block.shares--;
+		store_locked(id, &block, sizeof(data_block));
 	}
-	
-	//read directory data for that inode
-	dir_data_fcb dir_data;
-	fetch_from_db(inode.data_id, &dir_data, sizeof(dir_data_fcb));
-
-	//list the files in the directory
-	for (int i = 0; i<MY_MAX_DIR_FILES; i++)
+	else
 	{
-		char* filename = dir_data.entries[i].filename;
-
-		//there is a filename
-		if (strcmp(filename, "") != 0)
-		{
-			filler(buf, filename, NULL, 0);
-		}
+		delete_locked(id);
+		USAGE_ADD(blocks, -1);
 	}
-
-	write_log("[SYST] readdir: End read. \n");
-	return 0;
+	pthread_mutex_unlock(&db_lock);
 }
 
 /**
- * Assume 'id' given points to a data_block in the db
- * 'data_offset' is an int between 0 and MY_MAX_DATA_SIZE - 1
- * 'size' is the amount of bytes to read, between 1 and MY_MAX_DATA_SIZE
+ * Counts one more file using the data block 'id'.
+ * Returns 0 on success, or -ENOENT if the block is missing.
  */
-int read_data_block(uuid_t id, char** buf, int data_offset, int size)
+static int share_data_block(uuid_t id)
 {
 	data_block block;
-	fetch_from_db(id, &block, sizeof(data_block));
-	write_log("[SYST] read: Read to buffer: '%s'\n", block.data);
+	unqlite_int64 nBytes = sizeof(data_block);
 
-	memcpy(*buf, &(block.data[data_offset]), size);
-	*buf += size;
-
-	return size;
+	pthread_mutex_lock(&db_lock);
+	stats_count(STAT_KV_FETCH, 1);
+	int rc = unqlite_kv_fetch(pDb, id, KEY_SIZE, &block, &nBytes);
+	if (rc == UNQLITE_OK)
+	{
+		block.shares++;
+		rc = store_locked(id, &block, sizeof(data_block));
+	}
+	pthread_mutex_unlock(&db_lock);
+	return (rc == UNQLITE_OK) ? 0 : -ENOENT;
 }
 
-/** 
- * 'id' is the uuid_t of a direct block
- * 'block_offset' is which block to start from from 0 to MY_MAX_DIRECT_BLOCKS
- * 'data_offset' is which byte of the block to start from from 0 to MY_MAX_DATA_SIZE - 1
+/**
+ * Deletes a direct block and the data blocks it points at that no other file shares.
  */
-int read_direct_block(uuid_t id, char** buf, int block_offset, int data_offset, int size)
+void free_direct_block(uuid_t id)
 {
 	direct_block block;
-	fetch_from_db(id, &block, sizeof(direct_block));
-
-	int read = size;
-	int i = block_offset;
+	if (fetch_from_db(id, &block, sizeof(direct_block)) < 0)
+	{
+		return;
+	}
 
-	//read with offset
-	read -= read_data_block(block.blocks[i], buf, data_offset, FLOOR(read, MY_MAX_DATA_SIZE));
-	i++;
+	for (int i = 0; i < MY_MAX_DIRECT_BLOCKS; i++)
+	{
+		if (uuid_compare(zero_uuid, block.blocks[i]) != 0)
+		{
+			release_data_block(block.blocks[i]);
+		}
+	}
+	delete_from_db(id);
+}
 
-	//subsequent reads have no offset
-	while (read > 0 && i < MY_MAX_DIRECT_BLOCKS)
+/**
+ * Deletes a file data fcb and every block reachable from it.
+ */
+void free_file_data(uuid_t data_id)
+{
+	file_data_fcb data_fcb;
+	if (fetch_from_db(data_id, &data_fcb, sizeof(file_data_fcb)) < 0)
 	{
-		read -= read_data_block(block.blocks[i], buf, 0, FLOOR(read, MY_MAX_DATA_SIZE));
-		i++;
+		return;
 	}
 
-	if (read > 0)
+	if (uuid_compare(zero_uuid, data_fcb.direct_data_id) != 0)
 	{
-		//read only part of size
-		return size - read;
+		free_direct_block(data_fcb.direct_data_id);
 	}
-	else 
+	for (int i = 0; i < MY_MAX_DIRECT_BLOCKS; i++)
 	{
-		//read all of size
-		return size;
+		if (uuid_compare(zero_uuid, data_fcb.index_ids[i]) != 0)
+		{
+			free_direct_block(data_fcb.index_ids[i]);
+		}
 	}
-
+	delete_from_db(data_id);
 }
 
 /**
- * Reads the entire data of the file.
- * 'first_block_to_read' can be any uuid_t for a block to read from 'data_fcb'
+ * Returns where the extended attribute table of 'inode' starts in its record.
  */
-int read_block(uuid_t first_block_to_read, char** read_buf, file_data_fcb data_fcb, int size, int offset, int indrect_offset)
+static size_t xattr_offset(my_inode* inode)
 {
-	int read = size;
-
-	//start from direct blocks
-	int block_index = offset / MY_MAX_DATA_SIZE;
-	int data_index = offset % MY_MAX_DATA_SIZE;
-
-	//read first block
-	read -= read_direct_block(first_block_to_read, read_buf, block_index, data_index, size);
+	return MY_INODE_SIZE(inode) + (S_ISLNK(inode->mode) ? inode->size + 1 : 0);
+}
 
-	// read next indirect blocks
-	int i = indrect_offset;
-	while (read > 0 && i < MY_MAX_DIRECT_BLOCKS)
+/**
+ * Returns the entry in 'table' of 'len' bytes after 'pos' in 'entry' and its name in 'name'.
+ * Returns 0 at the end of the table.
+ */
+static int next_xattr(uint8_t* table, int len, int pos, xattr_entry* entry, char** name)
+{
+	if (pos + (int)sizeof(xattr_entry) > len)
 	{
-		read -= read_direct_block(data_fcb.index_ids[i], read_buf, 0, 0, read);
-		i++;
+		return 0;
 	}
+	memcpy(entry, table + pos, sizeof(xattr_entry));
+	if (pos + (int)XATTR_ENTRY_SIZE(*entry) > len)
+	{
+		return 0;
+	}
+	*name = (char*)table + pos + sizeof(xattr_entry);
+	return 1;
+}
 
-	return read;
-}
-
-// Read a file.
-// Read 'man 2 read'.
-static int myfs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+/**
+ * Deletes the records that hold the large extended attribute values of 'inode'.
+ */
+void free_xattrs(my_inode* inode)
 {
-	size_t len;
-	(void) fi;
-
-	write_log("\n[SYST] read: (path=\"%s\", buf=0x%08x, size=%d, offset=%lld, fi=0x%08x)\n", path, buf, size, offset, fi);
+	uint8_t table[MY_MAX_XATTR_TABLE];
+	int len = fetch_range_from_db(inode->id, xattr_offset(inode), table, MY_MAX_XATTR_TABLE);
 
-	my_inode inode;
-	int rc = get_inode(path, &inode, 0);
-	if (rc < 0)
+	xattr_entry entry;
+	char* name;
+	for (int pos = 0; next_xattr(table, len, pos, &entry, &name); pos += XATTR_ENTRY_SIZE(entry))
 	{
-		return -ENOENT;
+		if (entry.external)
+		{
+			delete_from_db((uint8_t*)name + entry.name_len);
+		}
 	}
-	else 
-	{
-		inode.atime = time(NULL);
-		store_to_db(inode.id, &inode, sizeof(my_inode));
-
-		len = inode.size;
-		int read = len;
-
-		char** read_buf = &buf;
+}
 
-		file_data_fcb data_fcb;
-		fetch_from_db(inode.data_id, &data_fcb, sizeof(file_data_fcb));
+/**
+ * Deletes an inode and all the records it owns from the database.
+ * For a directory this is its dir_data_fcb (the directory must be empty),
+ * for a file its data fcb, direct blocks and data blocks.
+ */
+void free_inode(my_inode* inode)
+{
+	write_log("[FUNC] free_inode: id='%s'\n", get_uuid(inode->id));
 
-		//go straight to indirect blocks
-		if (offset < len)
+	if (uuid_compare(zero_uuid, inode->data_id) != 0)
+	{
+		if (S_ISDIR(inode->mode))
 		{
-			if (offset > MY_DATA_SIZE_PER_BLOCK)
-			{
-				//get which indirect block to start from
-				int index_offset = (offset / MY_DATA_SIZE_PER_BLOCK);
-
-				//change offset to start at the current indirect block
-				offset = offset - (index_offset * MY_DATA_SIZE_PER_BLOCK);
-
-				//start reading from indirect blocks
-				read_block(data_fcb.index_ids[index_offset], read_buf, data_fcb, len, offset, index_offset);
-			}
-			else 
-			{
-				//start reading from direct blocks
-				read_block(data_fcb.direct_data_id, read_buf, data_fcb, len, offset % MY_MAX_DATA_SIZE, 0);
-			}
+			delete_from_db(inode->data_id);
 		}
-		else 
+		else
 		{
-			size = 0;
+			free_file_data(inode->data_id);
 		}
-
-		return size;
 	}
+	free_xattrs(inode);
+	delete_from_db(inode->id);
+	USAGE_ADD(inodes, -1);
 }
 
-
-// Create a file.
-// Read 'man 2 creat'.
-static int myfs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+/*
+ * Open files.
+ * open() and create() count the inode in this table and keep the entry in fi->fh.
+ * One entry serves every handle of an inode, so the access mode of a handle is the
+ * OPEN_WRITE bit of its fi->fh (entries come from calloc() and leave the low bit clear).
+ * The entry holds copies of the inode and its file data fcb, which store_inode_locked()
+ * and store_locked() keep up to date, so operations on an open file do not walk its path.
+ * An inode that loses its last link while it is open is only reclaimed on its last release.
+ * open_lock is never held while taking db_lock, the vacuum takes them the other way round.
+ */
+struct open_inode
 {
-    write_log("\n[SYST] create: (path=\"%s\", mode=0%03o, fi=0x%08x)\n", path, mode, fi);
-
-    int pathlen = strlen(path);
-    if (pathlen >= MY_MAX_PATH)
-    {
-    	write_log("[SYST] create: - ENAMETOOLONG\n");
-    	return -ENAMETOOLONG;
-    }
-
-    my_inode parent_fcb;
-    int rc = get_inode(path, &parent_fcb, 1);
-    if (rc < 0)
-    {
-    	parent_fcb = the_root_fcb;
-    }
-
-    //create new inode
-    my_inode new_inode;
-    memset(&new_inode, 0, sizeof(my_inode));
+	uuid_t id;
+	int count;
 
-    uuid_generate(new_inode.id);
+	//no link is left, the last release reclaims the inode
+	int orphan;
 
-    struct fuse_context* context = fuse_get_context();
+	//copies guarded by open_lock, 'data' is only valid if 'have_data' is set
+	my_inode inode;
+	file_data_fcb data;
+	int have_data;
 
-    time_t now = time(NULL);
-    new_inode.mtime = now;
-    new_inode.atime = now;
-    new_inode.ctime = now;
+	//a read set the access time of 'inode' without storing it (-o lazytime),
+	//it goes with the next store of the inode or the last release
+	int lazy_atime;
 
-    new_inode.uid = context->uid;
-    new_inode.gid = context->gid;
-    new_inode.mode = mode | S_IFREG;
-    new_inode.size = 0;
+	struct open_inode* next;
+};
 
-    //store new inode
-    store_to_db(new_inode.id, &new_inode, sizeof(my_inode));
+static struct open_inode* open_inodes;
+static pthread_mutex_t open_lock = PTHREAD_MUTEX_INITIALIZER;
 
-    //store to parent
-    rc = update_parent(&parent_fcb, new_inode.id, path);
-    if (rc < 0)
-    {
-    	return rc;
-    }
+//set in fi->fh if the handle was opened for writing
+#define OPEN_WRITE ((uintptr_t)1)
 
-	return 0;
+//the table entry of the handle 'fi', or NULL
+static struct open_inode* open_entry(struct fuse_file_info* fi)
+{
+	return (fi != NULL) ? (struct open_inode*)(uintptr_t)(fi->fh & ~OPEN_WRITE) : NULL;
 }
 
-// Set update the times (actime, modtime) for a file. This FS only supports modtime.
-// Read 'man 2 utime'.
-static int myfs_utime(const char *path, struct utimbuf *ubuf)
+//the caller holds open_lock
+static struct open_inode* find_open(uuid_t id)
 {
-    write_log("\n[SYST] utime: (path=\"%s\", ubuf=0x%08x)\n", path, ubuf);
+	struct open_inode* entry = open_inodes;
+	while (entry != NULL && uuid_compare(entry->id, id) != 0)
+	{
+		entry = entry->next;
+	}
+	return entry;
+}
 
-    my_inode inode;
-    int rc = get_inode(path, &inode, 0);
-    if (rc < 0)
-    {
-    	return -ENOENT;
-    }
+/**
+ * Counts one more open of 'inode'.
+ * Returns its table entry, or NULL if out of memory.
+ */
+static struct open_inode* open_ref(my_inode* inode)
+{
+	pthread_mutex_lock(&open_lock);
+	struct open_inode* entry = find_open(inode->id);
+	if (entry == NULL && (entry = calloc(1, sizeof(struct open_inode))) != NULL)
+	{
+		uuid_copy(entry->id, inode->id);
+		entry->inode = *inode;
+		entry->next = open_inodes;
+		open_inodes = entry;
+	}
+	if (entry != NULL)
+	{
+		entry->count++;
+	}
+	pthread_mutex_unlock(&open_lock);
+	return entry;
+}
 
-    else 
-    {
-    	inode.mtime = ubuf->modtime;
+/**
+ * Keeps 'entry' in fi->fh, marked OPEN_WRITE if fi->flags open it for writing.
+ */
+static void open_handle(struct fuse_file_info* fi, struct open_inode* entry)
+{
+	fi->fh = (uintptr_t)entry;
+	if (entry != NULL && (fi->flags & O_ACCMODE) != O_RDONLY)
+	{
+		fi->fh |= OPEN_WRITE;
+	}
+}
 
-    	//write back to store
-    	rc = store_to_db(inode.id, &inode, sizeof(my_inode));
-    	if (rc != UNQLITE_OK)
-    	{
-    		write_log("[SYST] utime: - EIO\n");
-    		return -EIO;
-    	}
+/**
+ * Counts one release of 'entry', reclaiming the inode if it was the last open of an orphan.
+ */
+static void open_unref(struct open_inode* entry)
+{
+	int reclaim = 0;
+	uuid_t id;
 
-    }
+	int lazy = 0;
+	my_inode accessed;
 
-    return 0;
+	pthread_mutex_lock(&open_lock);
+	if (--entry->count == 0)
+	{
+		struct open_inode** link = &open_inodes;
+		while (*link != entry)
+		{
+			link = &(*link)->next;
+		}
+		*link = entry->next;
+		reclaim = entry->orphan;
+		lazy = entry->lazy_atime;
+		accessed = entry->inode;
+		uuid_copy(id, entry->id);
+		free(entry);
+	}
+	pthread_mutex_unlock(&open_lock);
 
+	my_inode inode;
+	if (reclaim && fetch_from_db(id, &inode, sizeof(my_inode)) > 0)
+	{
+		write_log("[FUNC] release: reclaiming unlinked inode '%s'\n", get_uuid(id));
+		free_inode(&inode);
+	}
+	else if (lazy && fetch_from_db(id, &inode, sizeof(my_inode)) > 0 && CMP_TIME(&inode, atime, &accessed, atime) < 0)
+	{
+		inode.atime = accessed.atime;
+		inode.atime_nsec = accessed.atime_nsec;
+		store_inode(&inode);
+	}
 }
 
-
-// Assume buf_ptr passed here is <= MY_MAX_DATA_SIZE * MY_MAX_DIRECT_BLOCKS
-int write_to_direct_block(char** buf_ptr, direct_block* block_buf, size_t* size, int block_index, int data_index)
+/**
+ * Marks the inode 'id' to be reclaimed on its last release if 'mark' is set.
+ * Returns 1 if it is open, 0 if it is not, in which case nothing is marked.
+ */
+static int open_orphan(uuid_t id, int mark)
 {
-	int written = 0;
-
-	for (int i = block_index; i<MY_MAX_DIRECT_BLOCKS; i++)
+	pthread_mutex_lock(&open_lock);
+	struct open_inode* entry = find_open(id);
+	if (entry != NULL && mark)
 	{
-		int size_left = *size;
-		int write_index = MY_MAX_DATA_SIZE - data_index;
-		data_block block;
+		entry->orphan = 1;
+	}
+	pthread_mutex_unlock(&open_lock);
+	return entry != NULL;
+}
 
-		if (uuid_compare(zero_uuid, block_buf->blocks[i]) == 0)
-		{
-			uuid_generate(block.id);
-			uuid_copy(block_buf->blocks[i], block.id);
+/**
+ * Sets the access time of the open inode 'entry' to 'now' in the table only (-o lazytime).
+ */
+static void open_touch(struct open_inode* entry, struct timespec now)
+{
+	pthread_mutex_lock(&open_lock);
+	SET_TIME(&entry->inode, atime, now);
+	entry->lazy_atime = 1;
+	pthread_mutex_unlock(&open_lock);
+}
 
-			memset(&(block.data), 0, MY_MAX_DATA_SIZE);
-		}
-		else
+/**
+ * Gives 'inode' the access time kept back by lazytime if it is open with one.
+ * If 'drop' is set the kept time is forgotten instead, for utimens() to replace it.
+ */
+static void open_atime(my_inode* inode, int drop)
+{
+	pthread_mutex_lock(&open_lock);
+	struct open_inode* entry = find_open(inode->id);
+	if (entry != NULL && entry->lazy_atime)
+	{
+		if (drop)
 		{
-			fetch_from_db(block_buf->blocks[i], &block, sizeof(data_block));
+			entry->lazy_atime = 0;
 		}
-
-		//do checking
-		int write = size_left;
-		if (write > write_index)
+		else if (CMP_TIME(inode, atime, &entry->inode, atime) < 0)
 		{
-			write = write_index;
+			inode->atime = entry->inode.atime;
+			inode->atime_nsec = entry->inode.atime_nsec;
 		}
-		snprintf(&(block.data[data_index]), write + 1, *buf_ptr);
+	}
+	pthread_mutex_unlock(&open_lock);
+}
 
-		//still have leftover to write
-		if (write == write_index)
+/**
+ * Calls 'visit' for every open inode without links, for the vacuum (gc_orphans).
+ */
+static void open_orphans(void (*visit)(uuid_t id, void* arg), void* arg)
+{
+	pthread_mutex_lock(&open_lock);
+	for (struct open_inode* entry = open_inodes; entry != NULL; entry = entry->next)
+	{
+		if (entry->orphan)
 		{
-			written += write_index;
-			size_left -= write_index;
-
-			block.size = MY_MAX_DATA_SIZE;
-
-			//move data pointer along to next bytes
-			*buf_ptr += write_index;
+			visit(entry->id, arg);
 		}
-		else if (write > size_left)
-		{	
-			written += size_left;
-			size_left = -1;
+	}
+	pthread_mutex_unlock(&open_lock);
+}
 
-			block.size += size_left;
-		}
-		else 
-		{	
-			//no leftover to write		
-			written += write;
-			size_left -= write;
+/**
+ * Refreshes the copies held by the table when an inode or a file data fcb is stored.
+ * Called by store_locked() and store_inode_locked() with db_lock held.
+ */
+static void open_cache(uuid_t id, void* data, size_t size)
+{
+	if (size != sizeof(my_inode) && size != sizeof(file_data_fcb))
+	{
+		return;
+	}
 
-			block.size = write + data_index;
+	pthread_mutex_lock(&open_lock);
+	for (struct open_inode* entry = open_inodes; entry != NULL; entry = entry->next)
+	{
+		if (size == sizeof(my_inode) && uuid_compare(entry->id, id) == 0)
+		{
+			my_inode* inode = data;
+			if (uuid_compare(entry->inode.data_id, inode->data_id) != 0)
+			{
+				entry->have_data = 0;
+			}
+			//a later access time kept back by lazytime is stored along
+			if (entry->lazy_atime && CMP_TIME(inode, atime, &entry->inode, atime) < 0)
+			{
+				inode->atime = entry->inode.atime;
+				inode->atime_nsec = entry->inode.atime_nsec;
+			}
+			entry->lazy_atime = 0;
+			entry->inode = *inode;
 		}
-
-		write_log("[SYST] write: Wrote %s with size %d with offset %d\n", block.data, written, data_index);
-		store_to_db(block_buf->blocks[i], &block, sizeof(data_block));
-
-		if (size_left < 0)
+		else if (size == sizeof(file_data_fcb) && uuid_compare(entry->inode.data_id, id) == 0)
 		{
-			*buf_ptr += write;
-			return written;
+			entry->data = *((file_data_fcb*)data);
+			entry->have_data = 1;
 		}
-
-		*size = size_left;
-		data_index = 0;
 	}
-
-	return written;
+	pthread_mutex_unlock(&open_lock);
 }
 
-int write_block(uuid_t* first_block, char** buf, file_data_fcb* data_fcb, size_t size, off_t offset, int indirect_offset)
+/**
+ * Drops one link to 'inode', whose directory entry is already gone.
+ * The inode and its records are reclaimed when no link is left,
+ * or on the last release if the inode is still open.
+ */
+static void drop_link(my_inode* inode)
 {
-	int block_index = offset / MY_MAX_DATA_SIZE;
-	int data_index = offset % MY_MAX_DATA_SIZE;
-
-	//first block
-	direct_block block;
-	memset(&block, 0, sizeof(direct_block));
-	if (uuid_compare(zero_uuid, *first_block) == 0)
+	if (!S_ISDIR(inode->mode) && inode->nlink > 1)
 	{
-		uuid_generate(block.id);
-		uuid_copy(*first_block, block.id);
+		inode->nlink--;
+		SET_TIME(inode, ctime, time_now());
+		store_inode(inode);
+		return;
 	}
-	else
+
+	inode->nlink = 0;
+	if (!S_ISDIR(inode->mode) && open_orphan(inode->id, 0))
 	{
-		fetch_from_db(*first_block, &block, sizeof(direct_block));
+		//stored before it is marked, so that a release in between reclaims the latest version
+		store_inode(inode);
+		if (open_orphan(inode->id, 1))
+		{
+			write_log("[FUNC] drop_link: inode '%s' is open, reclaimed on release\n", get_uuid(inode->id));
+			return;
+		}
 	}
+	free_inode(inode);
+}
 
-	int written = write_to_direct_block(buf, &block, &size, block_index, data_index);
-	store_to_db(block.id, &block, sizeof(direct_block));
+/**
+ * Joins the 'target' of a symbolic link found in the directory 'dir' with the
+ * 'rest' of the path being looked up, resolving "." and ".." by name.
+ * Returns the path to walk from the root, allocated in the arena, or NULL if out of memory.
+ */
+static char* follow_link(const char* dir, const char* target, const char* rest)
+{
+	size_t size = strlen(dir) + strlen(target) + strlen(rest) + 3;
+	char* joined = arena_alloc(size);
+	char* path = arena_alloc(size);
+	if (joined == NULL || path == NULL)
+	{
+		return NULL;
+	}
+	snprintf(joined, size, "%s/%s/%s", (target[0] == '/') ? "" : dir, target, rest);
 
-	//next indirect blocks
-	int i = indirect_offset;
-	while(strlen(*buf) > 0 && i < MY_MAX_DIRECT_BLOCKS && size > 0)
+	size_t len = 0;
+	char* part;
+	path[0] = 0;
+	while ((part = strsep(&joined, "/")) != NULL)
 	{
-		direct_block next_block;
-		memset(&next_block, 0, sizeof(direct_block));
-		if (uuid_compare(zero_uuid, data_fcb->index_ids[i]) == 0)
+		if (strcmp(part, "") == 0 || strcmp(part, ".") == 0)
 		{
-			uuid_generate(next_block.id);
-			uuid_copy(data_fcb->index_ids[i], next_block.id);
+			continue;
 		}
-		else
+		if (strcmp(part, "..") == 0)
 		{
-			fetch_from_db(data_fcb->index_ids[i], &next_block, sizeof(direct_block));
+			//the root is its own parent
+			char* slash = strrchr(path, '/');
+			len = (slash != NULL) ? slash - path : 0;
+			path[len] = 0;
+			continue;
 		}
-
-		written += write_to_direct_block(buf, &next_block, &size, 0, 0);
-		store_to_db(next_block.id, &next_block, sizeof(direct_block));
-
-		i++;
+		len += sprintf(path + len, "/%s", part);
 	}
-
-	return written;
+	return path;
 }
 
-// Write to a file.
-// Read 'man 2 write'
-static int myfs_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+/**
+ * Gets the inode at the end of the given path and puts it in the pointer 'inode'
+ * If the 'get_parent' flag is set to be greater than 0, gets the inode one before the end
+ *
+ * Example:
+ * 	get_inode("/a/b/c", &inode, 0) gets the inode of "/a/b"
+ * 	get_inode("/a/b/c", &inode, 1) gets the inode of "/a/b/c"
+ *
+ * Symbolic links before the last name are followed, up to MY_MAX_LINK_DEPTH of them.
+ * The last name itself is never followed, so its own inode is returned.
+ *
+ * Returns 0 on success and -ENOENT if an inode was not found at the given path,
+ * -ENOTDIR if a name before the last is not a directory, -ELOOP for too many links.
+ */
+static int lookup_inode(const char* path, my_inode* inode, int get_parent)
 {
-    write_log("\n[SYST] write: (path=\"%s\", buf=0x%08x, size=%d, offset=%lld, fi=0x%08x)\n", path, buf, size, offset, fi);
-
-    my_inode inode;
-    int rc = get_inode(path, &inode, 0);
-    if (rc < 0)
-    {
-    	return -ENOENT;
-    }
-    else if (size > MY_MAX_FILE_SIZE)
-    {
-    	return -EFBIG;
-    }
-
-   	char** buf_ptr = &buf;
-	int written = 0;
-
-	file_data_fcb data;
-	memset(&data, 0, sizeof(file_data_fcb));
-	
-	//check if there is already a data block
-	if (uuid_compare(zero_uuid, inode.data_id) == 0)
-	{
-		//if not generate an id
-		uuid_generate(data.id);
-	}
-	else 
+	//the path copy and the directory page are scratch, get_inode() frees them
+	char* str = arena_strdup(path);
+	dir_data_fcb* dir_fcb = arena_alloc(sizeof(dir_data_fcb));
+	char* target = arena_alloc(MY_MAX_LINK_TARGET);
+	if (str == NULL || dir_fcb == NULL || target == NULL)
 	{
-		//if there is, fetch it from the db
-		fetch_from_db(inode.data_id, &data, sizeof(file_data_fcb));
+		return -ENOMEM;
 	}
 
-
-	if (offset > MY_DATA_SIZE_PER_BLOCK)
+	//remove path after last '/' because we want the directory before it
+	if(get_parent)
 	{
-		//start from indirect blocks
-		int index_offset = (offset / MY_DATA_SIZE_PER_BLOCK);
-		offset = offset - (index_offset * MY_DATA_SIZE_PER_BLOCK);
-
-		written += write_block(&(data.index_ids[index_offset - 1]), buf_ptr, &data, size, offset, index_offset);
+		char* r = strrchr(str, '/');
+		*r = 0;
 	}
-	else 
+
+	int links = 0;
+	for (;;)
 	{
-		written += write_block(&(data.direct_data_id), buf_ptr, &data, size, offset, 0);
-		//start from direct blocks
-	}
+		//the directories walked so far, which a relative link target starts from
+		char* walked = arena_alloc(strlen(str) + 1);
+		size_t walked_len = 0;
+		if (walked == NULL)
+		{
+			return -ENOMEM;
+		}
+		walked[0] = 0;
 
-	uuid_copy(inode.data_id, data.id);
+		//root directory
+		memcpy(inode, &the_root_fcb, sizeof(my_inode));
 
-	//store file data fcb
-	store_to_db(data.id, &data, sizeof(file_data_fcb));
+		char* partial_path;
+		int followed = 0;
+		while(!followed && (partial_path = strsep(&str, "/")) != NULL)
+		{
+			if (strcmp(partial_path, "") == 0)
+			{
+				continue;
+			}
+			if (!S_ISDIR(inode->mode))
+			{
+				write_log("[FUNC] get_inode: Not a directory\n");
+				return -ENOTDIR;
+			}
 
-    if (offset == 0) 
-    {
-    	inode.size = written;
-    }
-    else 
-    {
-    	inode.size = inode.size + written;
-    }
+			int rc = fetch_from_db(inode->data_id, dir_fcb, sizeof(dir_data_fcb)); 
+			if (rc < 0)
+			{
+				write_log("[FUNC] get_inode: Not found in db\n");
+				return -ENOENT;
+			}
 
-	time_t now = time(NULL);
-    inode.mtime = now;
-    inode.atime = now;
+			//loop through current inode
+			int found = 0;
+			for (int i = 0; i<MY_MAX_DIR_FILES; i++)
+			{
+				dir_entry* entry = &dir_fcb->entries[i];
+				if (strcmp(entry->filename, partial_path) == 0)
+				{
+					found = 1;
 
-    //store file inode
-    store_to_db(inode.id, &inode, sizeof(my_inode));
+					//fetch next inode
+					fetch_from_db(entry->inode_id, inode, sizeof(my_inode));
 
-	write_log("[SYST] write: end write, wrote %d bytes\n", written);
+					break;
+				}
+			}
+			if(!found)
+			{
+				write_log("[FUNC] get_inode: Not found in fs\n");
+				return -ENOENT;
+			}
+
+			//a symbolic link with more of the path after it: walk again from its target
+			if (S_ISLNK(inode->mode) && str != NULL)
+			{
+				if (++links > MY_MAX_LINK_DEPTH)
+				{
+					write_log("[FUNC] get_inode: Too many symbolic links\n");
+					return -ELOOP;
+				}
+				int len = fetch_range_from_db(inode->id, MY_INODE_SIZE(inode), target, MY_MAX_LINK_TARGET - 1);
+				if (len <= 0)
+				{
+					return -ENOENT;
+				}
+				target[len] = 0;
+
+				str = follow_link(walked, target, str);
+				if (str == NULL)
+				{
+					return -ENOMEM;
+				}
+				followed = 1;
+			}
+			else
+			{
+				walked_len += sprintf(walked + walked_len, "/%s", partial_path);
+			}
+		}
+		if (!followed)
+		{
+			return 0;
+		}
+	}
+}
+
+int get_inode(const char* path, my_inode* inode, int get_parent)
+{
+	write_log("[FUNC] get_inode: path='%s' get_parent='%d'\n", path, get_parent);
+
+	arena_mark mark = arena_save();
+	int rc = lookup_inode(path, inode, get_parent);
+	arena_restore(mark);
+	return rc;
+}
+
+/**
+ * Function to update the parent directory with a new inode
+ * Returns 0 on success, an error code on error.
+ */
+int update_parent(my_inode* parent_inode, uuid_t new_inode_id, const char* path)
+{
+	arena_mark mark = arena_save();
+	dir_data_fcb* parent_data = arena_alloc(sizeof(dir_data_fcb));
+	if (parent_data == NULL)
+	{
+		return -ENOMEM;
+	}
+	fetch_from_db(parent_inode->data_id, parent_data, sizeof(dir_data_fcb));
+
+	parent_inode->size = parent_inode->size + 1;
+	SET_TIME(parent_inode, mtime, time_now());
+
+	int found = 0;
+
+	//add new inode to parent
+	for (int i = 0; i<MY_MAX_DIR_FILES; i++)
+	{
+		dir_entry* entry = &parent_data->entries[i];
+
+		//found empty entry
+		if(strcmp(entry->filename, "") == 0)
+		{
+			found = 1;
+
+			uuid_copy(entry->inode_id, new_inode_id);
+			strcpy(entry->filename, get_file_name(path));
+
+			write_log("[FUNC] Updated parent with new inode (name='%s')\n", entry->filename);
+			break;
+		}
+	}
+
+	if (found)
+	{
+		store_inode(parent_inode);
+		store_to_db(parent_inode->data_id, parent_data, sizeof(dir_data_fcb));
+	}
+	else
+	{
+		write_log("[FUNC] Update parent directory no more space\n.");
+	}
+
+	arena_restore(mark);
+	return found ? 0 : -ENOENT;
+}
+
+
+/**
+ * Returns 1 if 'path' is STATS_DIR or lies under it.
+ * These paths are served by the metrics code, never by the store.
+ */
+static int in_stats_dir(const char* path)
+{
+	size_t len = strlen(STATS_DIR);
+	return strncmp(path, STATS_DIR, len) == 0 && (path[len] == '\0' || path[len] == '/');
+}
+
+/**
+ * getattr for STATS_DIR and STATS_FILE.
+ */
+static int stats_getattr(const char* path, struct stat* stbuf)
+{
+	stbuf->st_uid = the_root_fcb.uid;
+	stbuf->st_gid = the_root_fcb.gid;
+	stbuf->st_mtime = stbuf->st_atime = stbuf->st_ctime = time(NULL);
+
+	if (strcmp(path, STATS_DIR) == 0)
+	{
+		stbuf->st_mode = S_IFDIR | 0555;
+		stbuf->st_nlink = 2;
+		return 0;
+	}
+	if (strcmp(path, STATS_FILE) == 0)
+	{
+		//the size is only a hint, the file is opened with direct_io
+		size_t len = 0;
+		free(stats_render(&len));
+		stbuf->st_mode = S_IFREG | 0444;
+		stbuf->st_nlink = 1;
+		stbuf->st_size = len;
+		return 0;
+	}
+	return -ENOENT;
+}
+
+//metrics text taken when STATS_FILE is opened, kept in fi->fh until it is released
+struct stats_snapshot
+{
+	char* text;
+	size_t len;
+};
+
+/**
+ * Reads 'size' bytes at 'offset' of the snapshot the open file handle holds.
+ * Every read of one open file sees the same text.
+ */
+static int stats_read(char* buf, size_t size, off_t offset, struct fuse_file_info* fi)
+{
+	struct stats_snapshot* snap = (struct stats_snapshot*)(uintptr_t)fi->fh;
+	if (snap == NULL)
+	{
+		return -EBADF;
+	}
+
+	if (offset >= snap->len)
+	{
+		size = 0;
+	}
+	else if (offset + size > snap->len)
+	{
+		size = snap->len - offset;
+	}
+	memcpy(buf, snap->text + offset, size);
+	return size;
+}
+
+/**
+ * Gets the inode of a file, and its file data fcb if 'data' is not NULL.
+ * An open file is served from its table entry in fi->fh, without a path walk, and its
+ * fcb is fetched once. Without a handle (truncate() writes by path) the path is walked.
+ * The fcb of a file without data is zeroed.
+ *
+ * Returns 0 on success, or the error of the path walk.
+ */
+static int file_inode(const char* path, struct fuse_file_info* fi, my_inode* inode, file_data_fcb* data)
+{
+	struct open_inode* entry = open_entry(fi);
+	int have_data = 0;
+
+	if (entry != NULL)
+	{
+		pthread_mutex_lock(&open_lock);
+		*inode = entry->inode;
+		if (data != NULL && entry->have_data)
+		{
+			*data = entry->data;
+			have_data = 1;
+		}
+		pthread_mutex_unlock(&open_lock);
+	}
+	else
+	{
+		int rc = get_inode(path, inode, 0);
+		if (rc < 0)
+		{
+			return rc;
+		}
+	}
+
+	if (data == NULL || have_data)
+	{
+		return 0;
+	}
+	if (uuid_compare(zero_uuid, inode->data_id) == 0)
+	{
+		memset(data, 0, sizeof(file_data_fcb));
+		return 0;
+	}
+
+	fetch_from_db(inode->data_id, data, sizeof(file_data_fcb));
+	if (entry != NULL)
+	{
+		//unless a newer fcb was stored in the meantime
+		pthread_mutex_lock(&open_lock);
+		if (!entry->have_data && uuid_compare(entry->inode.data_id, inode->data_id) == 0)
+		{
+			entry->data = *data;
+			entry->have_data = 1;
+		}
+		pthread_mutex_unlock(&open_lock);
+	}
+	return 0;
+}
+
+/**
+ * Fills 'stbuf' with the attributes of 'inode'.
+ */
+static void inode_stat(my_inode* inode, struct stat* stbuf)
+{
+	stbuf->st_mode = inode->mode;
+	stbuf->st_nlink = inode->nlink;
+	stbuf->st_mtim.tv_sec = inode->mtime;
+	stbuf->st_mtim.tv_nsec = inode->mtime_nsec;
+	stbuf->st_atim.tv_sec = inode->atime;
+	stbuf->st_atim.tv_nsec = inode->atime_nsec;
+	stbuf->st_ctim.tv_sec = inode->ctime;
+	stbuf->st_ctim.tv_nsec = inode->ctime_nsec;
+	stbuf->st_uid = inode->uid;
+	stbuf->st_gid = inode->gid;
+	stbuf->st_size = inode->size;
+}
+
+// Get file and directory attributes (meta-data).
+// Read 'man 2 stat' and 'man 2 chmod'.
+static int myfs_getattr(const char *path, struct stat *stbuf)
+{
+	write_log("\n[SYST] getattr: (path=\"%s\", statbuf=0x%08x)\n", path, stbuf);
+
+	memset(stbuf, 0, sizeof(struct stat));
+
+	if (in_stats_dir(path))
+	{
+		return stats_getattr(path, stbuf);
+	}
+
+	my_inode inode;
+	int rc = get_inode(path, &inode, 0);
+
+	if (rc < 0)
+	{
+		//-ENOTDIR and -ELOOP from the walk are passed on as they are
+		return rc;
+	}
+	else 
+	{
+		open_atime(&inode, 0);
+		inode_stat(&inode, stbuf);
+	}
+
+	return 0;
+}
+
+// Get the attributes of an open file.
+// Read 'man 2 fstat'.
+static int myfs_fgetattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi)
+{
+	write_log("\n[SYST] fgetattr: (path=\"%s\", statbuf=0x%08x, fi=0x%08x)\n", path, stbuf, fi);
+
+	memset(stbuf, 0, sizeof(struct stat));
+
+	//the handle of STATS_FILE holds a snapshot, not a table entry
+	if (path != NULL && in_stats_dir(path))
+	{
+		return stats_getattr(path, stbuf);
+	}
+
+	my_inode inode;
+	int rc = file_inode(path, fi, &inode, NULL);
+	if (rc < 0)
+	{
+		return rc;
+	}
+	inode_stat(&inode, stbuf);
+	return 0;
+}
+
+/**
+ * Read a directory.
+ * Read 'man 2 readdir'.
+ */
+static int myfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi)
+{
+	(void) offset;
+	(void) fi;
+
+	write_log("\n[SYST] readdir: (path=\"%s\", buf=0x%08x, filler=0x%08x, offset=%lld, fi=0x%08x)\n", path, buf, filler, offset, fi);
+
+	filler(buf, ".", NULL, 0);
+	filler(buf, "..", NULL, 0);
+
+	if (strcmp(path, STATS_DIR) == 0)
+	{
+		filler(buf, get_file_name(STATS_FILE), NULL, 0);
+		return 0;
+	}
+
+	//get the inode
+	my_inode inode;
+	int rc = get_inode(path, &inode, 0);
+	if(rc < 0)
+	{
+		write_log("[SYST] readdir: Returned without checking dir contents\n");
+		return 0;
+	}
+	
+	//read directory data for that inode
+	arena_mark mark = arena_save();
+	dir_data_fcb* dir_data = arena_alloc(sizeof(dir_data_fcb));
+	if (dir_data == NULL)
+	{
+		return -ENOMEM;
+	}
+	fetch_from_db(inode.data_id, dir_data, sizeof(dir_data_fcb));
+
+	//list the files in the directory
+	for (int i = 0; i<MY_MAX_DIR_FILES; i++)
+	{
+		char* filename = dir_data->entries[i].filename;
+
+		//there is a filename
+		if (strcmp(filename, "") != 0)
+		{
+			filler(buf, filename, NULL, 0);
+		}
+	}
+	arena_restore(mark);
+
+	write_log("[SYST] readdir: End read. \n");
+	return 0;
+}
+
+/*
+ * File data.
+ * Byte 'pos' of a file is in data block pos / MY_MAX_DATA_SIZE. The data blocks are
+ * grouped by MY_MAX_DIRECT_BLOCKS under direct blocks, the first at direct_data_id and
+ * the rest at index_ids[]. A zero id at either level is a hole: it reads as zeros and
+ * takes no record, so sparse files and preallocation beyond the end cost only what is written.
+ */
+
+//data blocks in the largest file
+#define MY_MAX_FILE_BLOCKS (MY_MAX_FILE_SIZE / MY_MAX_DATA_SIZE)
+
+//the direct block of a file that a walk over its data blocks is in
+struct block_cursor
+{
+	file_data_fcb* data_fcb;
+
+	//which direct block is loaded, -1 for none
+	int index;
+	int dirty;
+	direct_block block;
+};
+
+/**
+ * Returns where the id of the direct block 'index' of a file is kept.
+ */
+static uuid_t* direct_block_id(file_data_fcb* data_fcb, int index)
+{
+	return (index == 0) ? &data_fcb->direct_data_id : &data_fcb->index_ids[index - 1];
+}
+
+/**
+ * Stores the loaded direct block if it changed, or deletes it if it no longer points at
+ * any data block. Either can change its id in the data fcb, which the caller stores.
+ */
+static void cursor_flush(struct block_cursor* cur)
+{
+	if (cur->index < 0 || !cur->dirty)
+	{
+		return;
+	}
+
+	int empty = 1;
+	for (int i = 0; i < MY_MAX_DIRECT_BLOCKS && empty; i++)
+	{
+		empty = uuid_compare(zero_uuid, cur->block.blocks[i]) == 0;
+	}
+
+	uuid_t* id = direct_block_id(cur->data_fcb, cur->index);
+	if (empty)
+	{
+		if (uuid_compare(zero_uuid, *id) != 0)
+		{
+			delete_from_db(*id);
+			uuid_clear(*id);
+		}
+	}
+	else
+	{
+		if (uuid_compare(zero_uuid, *id) == 0)
+		{
+			uuid_generate(cur->block.id);
+			uuid_copy(*id, cur->block.id);
+		}
+		store_to_db(cur->block.id, &cur->block, sizeof(direct_block));
+	}
+	cur->dirty = 0;
+}
+
+/**
+ * Returns the slot of data block 'n' of the file, loading its direct block first.
+ * A missing direct block loads as one with every slot a hole; it is only created
+ * when the cursor is flushed with a slot filled in.
+ */
+static uuid_t* cursor_slot(struct block_cursor* cur, int n)
+{
+	int index = n / MY_MAX_DIRECT_BLOCKS;
+	if (index != cur->index)
+	{
+		cursor_flush(cur);
+
+		uuid_t* id = direct_block_id(cur->data_fcb, index);
+		if (uuid_compare(zero_uuid, *id) == 0 ||
+			fetch_from_db(*id, &cur->block, sizeof(direct_block)) < 0)
+		{
+			memset(&cur->block, 0, sizeof(direct_block));
+			uuid_clear(*id);
+		}
+		cur->index = index;
+	}
+	return &cur->block.blocks[n % MY_MAX_DIRECT_BLOCKS];
+}
+
+/**
+ * Reads 'size' bytes at 'offset' of a file into 'buf', zeros for the holes.
+ * The caller keeps the range within MY_MAX_FILE_SIZE.
+ */
+void read_range(file_data_fcb* data_fcb, char* buf, size_t size, off_t offset)
+{
+	struct block_cursor cur = {data_fcb, -1, 0};
+	size_t done = 0;
+
+	while (done < size)
+	{
+		off_t pos = offset + done;
+		int at = pos % MY_MAX_DATA_SIZE;
+		size_t chunk = FLOOR((size_t)(MY_MAX_DATA_SIZE - at), size - done);
+
+		uuid_t* id = cursor_slot(&cur, pos / MY_MAX_DATA_SIZE);
+		int got = 0;
+		if (uuid_compare(zero_uuid, *id) != 0)
+		{
+			//only the requested bytes of the block are read
+			got = fetch_range_from_db(*id, offsetof(data_block, data) + at, buf + done, chunk);
+			got = (got < 0) ? 0 : got;
+		}
+		memset(buf + done + got, 0, chunk - got);
+		done += chunk;
+	}
+}
+
+/**
+ * Writes 'size' bytes of 'buf' at 'offset' of a file, creating the blocks it lands in.
+ * New direct blocks change 'data_fcb', which the caller stores.
+ * The caller keeps the range within MY_MAX_FILE_SIZE.
+ */
+void write_range(file_data_fcb* data_fcb, const char* buf, size_t size, off_t offset)
+{
+	struct block_cursor cur = {data_fcb, -1, 0};
+	size_t done = 0;
+
+	while (done < size)
+	{
+		off_t pos = offset + done;
+		int at = pos % MY_MAX_DATA_SIZE;
+		size_t chunk = FLOOR((size_t)(MY_MAX_DATA_SIZE - at), size - done);
+
+		uuid_t* id = cursor_slot(&cur, pos / MY_MAX_DATA_SIZE);
+		int rc = -ENOENT;
+		if (uuid_compare(zero_uuid, *id) != 0)
+		{
+			//a block shared since a clone is copied first
+			rc = write_data_block(*id, buf + done, at, chunk);
+		}
+		if (rc < 0)
+		{
+			data_block block;
+			memset(&block, 0, sizeof(data_block));
+			uuid_generate(block.id);
+			memcpy(block.data + at, buf + done, chunk);
+			block.size = MY_MAX_DATA_SIZE;
+			store_to_db(block.id, &block, sizeof(data_block));
+			uuid_copy(*id, block.id);
+			USAGE_ADD(blocks, 1);
+		}
+		if (rc != 0)
+		{
+			cur.dirty = 1;
+		}
+		done += chunk;
+	}
+	cursor_flush(&cur);
+}
+
+/**
+ * What fill_range() does with the data blocks of a range.
+ */
+enum fill_mode
+{
+	//create the missing blocks zeroed, keep the data of the others
+	FILL_ALLOCATE,
+	//create the missing blocks, zero the range in the others
+	FILL_ZERO,
+	//delete the blocks inside the range, zero the range in those at its edges
+	FILL_PUNCH,
+};
+
+/**
+ * Allocates, zeros or punches out [start, end) of a file, see enum fill_mode.
+ * Changes 'data_fcb' when direct blocks come or go, which the caller stores.
+ * Returns the number of data blocks created.
+ */
+int fill_range(file_data_fcb* data_fcb, off_t start, off_t end, enum fill_mode mode)
+{
+	struct block_cursor cur = {data_fcb, -1, 0};
+	int created = 0;
+
+	for (int n = start / MY_MAX_DATA_SIZE; n < MY_MAX_FILE_BLOCKS && (off_t)n * MY_MAX_DATA_SIZE < end; n++)
+	{
+		off_t first = (off_t)n * MY_MAX_DATA_SIZE;
+		int from = (start > first) ? start - first : 0;
+		int to = (end < first + MY_MAX_DATA_SIZE) ? end - first : MY_MAX_DATA_SIZE;
+
+		//a missing direct block has nothing to punch, so skip it whole
+		if (mode == FILL_PUNCH && n % MY_MAX_DIRECT_BLOCKS == 0 && from == 0 &&
+			uuid_compare(zero_uuid, *direct_block_id(data_fcb, n / MY_MAX_DIRECT_BLOCKS)) == 0)
+		{
+			n += MY_MAX_DIRECT_BLOCKS - 1;
+			continue;
+		}
+
+		uuid_t* id = cursor_slot(&cur, n);
+		int allocated = uuid_compare(zero_uuid, *id) != 0;
+		data_block block;
+
+		if (mode == FILL_PUNCH && allocated && from == 0 && to == MY_MAX_DATA_SIZE)
+		{
+			release_data_block(*id);
+			uuid_clear(*id);
+			cur.dirty = 1;
+		}
+		else if (mode != FILL_PUNCH && !allocated)
+		{
+			memset(&block, 0, sizeof(data_block));
+			uuid_generate(block.id);
+			block.size = MY_MAX_DATA_SIZE;
+			store_to_db(block.id, &block, sizeof(data_block));
+			uuid_copy(*id, block.id);
+			cur.dirty = 1;
+			created++;
+			USAGE_ADD(blocks, 1);
+		}
+		else if (mode != FILL_ALLOCATE && allocated)
+		{
+			//zero part of the block, or all of it to keep it allocated
+			uint8_t zeros[MY_MAX_DATA_SIZE] = {0};
+			if (write_data_block(*id, zeros, from, to - from) == 1)
+			{
+				cur.dirty = 1;
+			}
+		}
+	}
+	cursor_flush(&cur);
+
+	return created;
+}
+
+/**
+ * Copies 'length' bytes at 'src_offset' of the file 'src' to 'dst_offset' of the file 'dst'.
+ * If the offsets are the same distance into a block, the data blocks covered whole are
+ * shared (holes stay holes) and only the partial blocks at the ends are copied. 'src' may
+ * be 'dst', which is copied through a buffer. Changes 'dst', which the caller stores.
+ */
+void clone_range(file_data_fcb* dst, file_data_fcb* src, off_t src_offset, size_t length, off_t dst_offset)
+{
+	char buf[MY_MAX_FILE_SIZE];
+	if (src == dst || (src_offset - dst_offset) % MY_MAX_DATA_SIZE != 0)
+	{
+		read_range(src, buf, length, src_offset);
+		write_range(dst, buf, length, dst_offset);
+		return;
+	}
+
+	//the partial blocks at the ends
+	size_t head = FLOOR((size_t)((MY_MAX_DATA_SIZE - dst_offset % MY_MAX_DATA_SIZE) % MY_MAX_DATA_SIZE), length);
+	size_t tail = (length - head) % MY_MAX_DATA_SIZE;
+	read_range(src, buf, head, src_offset);
+	write_range(dst, buf, head, dst_offset);
+	read_range(src, buf, tail, src_offset + length - tail);
+	write_range(dst, buf, tail, dst_offset + length - tail);
+
+	struct block_cursor from = {src, -1, 0};
+	struct block_cursor to = {dst, -1, 0};
+	for (size_t done = head; done < length - tail; done += MY_MAX_DATA_SIZE)
+	{
+		uuid_t* src_id = cursor_slot(&from, (src_offset + done) / MY_MAX_DATA_SIZE);
+		uuid_t* dst_id = cursor_slot(&to, (dst_offset + done) / MY_MAX_DATA_SIZE);
+		if (uuid_compare(*src_id, *dst_id) == 0)
+		{
+			continue;
+		}
+
+		if (uuid_compare(zero_uuid, *dst_id) != 0)
+		{
+			release_data_block(*dst_id);
+		}
+		uuid_clear(*dst_id);
+		if (uuid_compare(zero_uuid, *src_id) != 0 && share_data_block(*src_id) == 0)
+		{
+			uuid_copy(*dst_id, *src_id);
+		}
+		to.dirty = 1;
+	}
+	cursor_flush(&to);
+}
+
+/**
+ * Finds the first offset at or after 'offset' of a file of 'size' bytes that is in data
+ * ('data' set) or in a hole, as lseek() does for SEEK_DATA and SEEK_HOLE. Only the direct
+ * blocks are read. The end of the file counts as a hole.
+ * Returns the offset, or -ENXIO if 'offset' is past the end or no data follows it.
+ */
+off_t seek_range(file_data_fcb* data_fcb, off_t size, off_t offset, int data)
+{
+	if (offset < 0 || offset >= size)
+	{
+		return -ENXIO;
+	}
+
+	struct block_cursor cur = {data_fcb, -1, 0};
+	off_t limit = FLOOR(size, MY_MAX_FILE_SIZE);
+	for (off_t pos = offset; pos < limit; pos = (pos / MY_MAX_DATA_SIZE + 1) * MY_MAX_DATA_SIZE)
+	{
+		uuid_t* id = cursor_slot(&cur, pos / MY_MAX_DATA_SIZE);
+		if ((uuid_compare(zero_uuid, *id) != 0) == data)
+		{
+			return pos;
+		}
+	}
+
+	return data ? -ENXIO : size;
+}
+
+//when a read updates the access time, from the mount options
+enum atime_mode
+{
+	//once after each change of the file, and at least once a day
+	ATIME_RELATIME,
+	ATIME_NOATIME,
+	//on every read
+	ATIME_STRICT,
+};
+static enum atime_mode atime_mode = ATIME_RELATIME;
+
+//the access times set by reads of open files are kept in the table (see open_touch())
+static int lazytime;
+
+/**
+ * Returns 1 if a read at 'now' updates the access time of 'inode'.
+ */
+static int atime_due(my_inode* inode, struct timespec now)
+{
+	switch (atime_mode)
+	{
+		case ATIME_NOATIME:
+			return 0;
+		case ATIME_STRICT:
+			return 1;
+		default:
+			return CMP_TIME(inode, atime, inode, mtime) <= 0 || CMP_TIME(inode, atime, inode, ctime) <= 0 ||
+				now.tv_sec - inode->atime >= 24 * 60 * 60;
+	}
+}
+
+// Read a file.
+// Read 'man 2 read'.
+static int myfs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+	size_t len;
+
+	write_log("\n[SYST] read: (path=\"%s\", buf=0x%08x, size=%d, offset=%lld, fi=0x%08x)\n", path, buf, size, offset, fi);
+
+	if (strcmp(path, STATS_FILE) == 0)
+	{
+		return stats_read(buf, size, offset, fi);
+	}
+
+	my_inode inode;
+	file_data_fcb data_fcb;
+	int rc = file_inode(path, fi, &inode, &data_fcb);
+	if (rc < 0)
+	{
+		return -ENOENT;
+	}
+	else 
+	{
+		struct timespec now = time_now();
+		struct open_inode* entry = open_entry(fi);
+		if (atime_due(&inode, now))
+		{
+			if (lazytime && entry != NULL)
+			{
+				open_touch(entry, now);
+			}
+			else
+			{
+				SET_TIME(&inode, atime, now);
+				store_inode(&inode);
+			}
+		}
+
+		//nothing past the end, and a short read up to it
+		if (offset >= inode.size)
+		{
+			return 0;
+		}
+		len = FLOOR(size, (size_t)(inode.size - offset));
+
+		read_range(&data_fcb, buf, len, offset);
+
+		return len;
+	}
+}
+
+
+/*
+ * Permissions.
+ * access(), open(), truncate() and the source of a clone evaluate the mode, owner and group
+ * of the inode and the search permission of every directory above it against the caller's
+ * credentials, like the kernel does. Adding or removing a name needs write and search
+ * permission on its directory, and changing the mode, owner, times or attributes of an
+ * inode needs its owner. The owner, group and mode of every path checked are remembered, so the
+ * shell probing PATH or make testing its files costs no walk and no fetch. Any change
+ * that could make them wrong (chmod, chown, unlinking or renaming a name) bumps
+ * perm_generation, which forgets them all. The supplementary groups of a caller are
+ * read from /proc by FUSE, they are remembered per process for PERM_GROUPS_TTL.
+ */
+#define PERM_SLOTS 256
+#define PERM_GROUP_SLOTS 16
+#define PERM_MAX_GROUPS 32
+#define PERM_GROUPS_TTL 1000000000ULL
+
+struct perm_attr
+{
+	//generation the attributes were read in, 0 for an empty slot
+	unsigned long generation;
+	char path[MY_MAX_PATH];
+	mode_t mode;
+	uid_t uid;
+	gid_t gid;
+};
+
+struct perm_groups
+{
+	pid_t pid;
+	uid_t uid;
+	gid_t gid;
+	//stats_now() after which the groups are read again, 0 for an empty slot
+	unsigned long long expires;
+	int count;
+	gid_t groups[PERM_MAX_GROUPS];
+};
+
+//the caller of a check, its groups are only read if the group of an inode needs them
+struct perm_cred
+{
+	uid_t uid;
+	gid_t gid;
+	pid_t pid;
+	int count;
+	gid_t groups[PERM_MAX_GROUPS];
+};
+
+static struct perm_attr perm_attrs[PERM_SLOTS];
+static struct perm_groups perm_groups[PERM_GROUP_SLOTS];
+static unsigned long perm_generation = 1;
+static pthread_mutex_t perm_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Fills 'cred' with the caller of the current FUSE request. Its groups are read later.
+ */
+static void perm_caller(struct perm_cred* cred)
+{
+	struct fuse_context* context = fuse_get_context();
+	cred->uid = context->uid;
+	cred->gid = context->gid;
+	cred->pid = context->pid;
+	cred->count = -1;
+}
+
+/**
+ * Returns 1 if 'gid' is the group of 'cred' or one of its supplementary groups.
+ */
+static int perm_in_group(struct perm_cred* cred, gid_t gid)
+{
+	if (cred->gid == gid)
+	{
+		return 1;
+	}
+
+	if (cred->count < 0)
+	{
+		unsigned long long now = stats_now();
+		pthread_mutex_lock(&perm_lock);
+		struct perm_groups* slot = &perm_groups[cred->pid % PERM_GROUP_SLOTS];
+		if (slot->expires <= now || slot->pid != cred->pid || slot->uid != cred->uid || slot->gid != cred->gid)
+		{
+			//more groups than fit are left out, the check then fails closed
+			gid_t groups[PERM_MAX_GROUPS];
+			int count = fuse_getgroups(PERM_MAX_GROUPS, groups);
+			slot->count = (count < 0) ? 0 : FLOOR(count, PERM_MAX_GROUPS);
+			memcpy(slot->groups, groups, slot->count * sizeof(gid_t));
+			slot->pid = cred->pid;
+			slot->uid = cred->uid;
+			slot->gid = cred->gid;
+			slot->expires = now + PERM_GROUPS_TTL;
+		}
+		cred->count = slot->count;
+		memcpy(cred->groups, slot->groups, slot->count * sizeof(gid_t));
+		pthread_mutex_unlock(&perm_lock);
+	}
+
+	for (int i = 0; i < cred->count; i++)
+	{
+		if (cred->groups[i] == gid)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Returns 0 if 'cred' may access an inode of the given 'mode', 'uid' and 'gid' for
+ * 'mask' (R_OK, W_OK and X_OK), otherwise -EACCES.
+ */
+static int perm_check(struct perm_cred* cred, mode_t mode, uid_t uid, gid_t gid, int mask)
+{
+	//root reads and writes anything, and executes what anyone may execute
+	if (cred->uid == 0)
+	{
+		return (!(mask & X_OK) || S_ISDIR(mode) || (mode & (S_IXUSR | S_IXGRP | S_IXOTH))) ? 0 : -EACCES;
+	}
+
+	int bits;
+	if (cred->uid == uid)
+	{
+		bits = mode >> 6;
+	}
+	else if (perm_in_group(cred, gid))
+	{
+		bits = mode >> 3;
+	}
+	else
+	{
+		bits = mode;
+	}
+	return ((bits & mask) == mask) ? 0 : -EACCES;
+}
+
+//the caller holds perm_lock
+static struct perm_attr* perm_slot(const char* path, size_t len)
+{
+	unsigned long hash = 5381;
+	for (size_t i = 0; i < len; i++)
+	{
+		hash = hash * 33 + (unsigned char)path[i];
+	}
+	return &perm_attrs[hash % PERM_SLOTS];
+}
+
+/**
+ * Gets the mode, owner and group of the first 'len' characters of 'path', from the
+ * remembered ones or by walking the path.
+ * Returns 0 on success, or the error of the walk.
+ */
+static int perm_attr(const char* path, size_t len, struct perm_attr* attr)
+{
+	if (len >= MY_MAX_PATH)
+	{
+		return -ENAMETOOLONG;
+	}
+
+	pthread_mutex_lock(&perm_lock);
+	struct perm_attr* slot = perm_slot(path, len);
+	int found = slot->generation == perm_generation && strncmp(slot->path, path, len) == 0 && slot->path[len] == 0;
+	if (found)
+	{
+		*attr = *slot;
+	}
+	unsigned long generation = perm_generation;
+	pthread_mutex_unlock(&perm_lock);
+	if (found)
+	{
+		return 0;
+	}
+
+	memcpy(attr->path, path, len);
+	attr->path[len] = 0;
+	my_inode inode;
+	int rc = get_inode(attr->path, &inode, 0);
+	if (rc < 0)
+	{
+		return rc;
+	}
+	attr->mode = inode.mode;
+	attr->uid = inode.uid;
+	attr->gid = inode.gid;
+	attr->generation = generation;
+
+	//unless something changed during the walk
+	pthread_mutex_lock(&perm_lock);
+	if (generation == perm_generation)
+	{
+		*perm_slot(path, len) = *attr;
+	}
+	pthread_mutex_unlock(&perm_lock);
+	return 0;
+}
+
+/**
+ * Returns 0 if the caller 'cred' may search every directory above 'path', otherwise
+ * -EACCES, or the error of a walk. A symbolic link on the way is searched like a directory.
+ */
+static int perm_search(struct perm_cred* cred, const char* path)
+{
+	const char* slash = strrchr(path, '/');
+	if (slash == NULL || strcmp(path, "/") == 0)
+	{
+		return 0;
+	}
+
+	int rc = perm_check(cred, the_root_fcb.mode, the_root_fcb.uid, the_root_fcb.gid, X_OK);
+	for (const char* c = path + 1; rc == 0 && c <= slash; c++)
+	{
+		struct perm_attr attr;
+		if (*c == '/' && (rc = perm_attr(path, c - path, &attr)) == 0)
+		{
+			rc = perm_check(cred, attr.mode, attr.uid, attr.gid, X_OK);
+		}
+	}
+	return rc;
+}
+
+/**
+ * Forgets every remembered mode, owner and group.
+ */
+static void perm_forget()
+{
+	pthread_mutex_lock(&perm_lock);
+	perm_generation++;
+	pthread_mutex_unlock(&perm_lock);
+}
+
+/**
+ * Returns 0 if the caller 'cred' may add or remove the name 'path', which takes search
+ * permission on every directory above it and write permission on its own, otherwise
+ * -EACCES, or the error of a walk.
+ */
+static int perm_parent(struct perm_cred* cred, const char* path)
+{
+	int rc = perm_search(cred, path);
+	const char* slash = strrchr(path, '/');
+	if (rc < 0 || slash == NULL)
+	{
+		return rc;
+	}
+
+	struct perm_attr attr;
+	if (slash == path)
+	{
+		attr.mode = the_root_fcb.mode;
+		attr.uid = the_root_fcb.uid;
+		attr.gid = the_root_fcb.gid;
+	}
+	else if ((rc = perm_attr(path, slash - path, &attr)) < 0)
+	{
+		return rc;
+	}
+	return perm_check(cred, attr.mode, attr.uid, attr.gid, W_OK | X_OK);
+}
+
+/**
+ * Returns 0 if the caller 'cred' owns an inode of 'uid', or is root, otherwise -EPERM.
+ */
+static int perm_owner(struct perm_cred* cred, uid_t uid)
+{
+	return (cred->uid == 0 || cred->uid == uid) ? 0 : -EPERM;
+}
+
+// Check the caller's permissions on a file, 'mask' is F_OK or any of R_OK, W_OK and X_OK.
+// Read 'man 2 access'.
+static int myfs_access(const char *path, int mask)
+{
+	write_log("\n[SYST] access: (path=\"%s\", mask=%d)\n", path, mask);
+
+	struct perm_cred cred;
+	perm_caller(&cred);
+
+	//STATS_DIR is not in the store, it may always be searched
+	int rc = in_stats_dir(path) ? perm_check(&cred, the_root_fcb.mode, the_root_fcb.uid, the_root_fcb.gid, X_OK) :
+		perm_search(&cred, path);
+	if (rc < 0)
+	{
+		return rc;
+	}
+
+	struct perm_attr attr;
+	if (in_stats_dir(path))
+	{
+		struct stat stbuf;
+		rc = stats_getattr(path, &stbuf);
+		attr.mode = stbuf.st_mode;
+		attr.uid = stbuf.st_uid;
+		attr.gid = stbuf.st_gid;
+	}
+	else if (strcmp(path, "/") == 0)
+	{
+		attr.mode = the_root_fcb.mode;
+		attr.uid = the_root_fcb.uid;
+		attr.gid = the_root_fcb.gid;
+	}
+	else
+	{
+		rc = perm_attr(path, strlen(path), &attr);
+	}
+	if (rc < 0 || mask == F_OK)
+	{
+		return rc;
+	}
+
+	return perm_check(&cred, attr.mode, attr.uid, attr.gid, mask);
+}
+
+// Create a file.
+// Read 'man 2 creat'.
+static int myfs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    write_log("\n[SYST] create: (path=\"%s\", mode=0%03o, fi=0x%08x)\n", path, mode, fi);
+
+    int pathlen = strlen(path);
+    if (pathlen >= MY_MAX_PATH)
+    {
+    	write_log("[SYST] create: - ENAMETOOLONG\n");
+    	return -ENAMETOOLONG;
+    }
+    if (mem_would_exceed(KEY_SIZE + sizeof(my_inode)))
+    {
+    	write_log("[SYST] create: - ENOSPC\n");
+    	return -ENOSPC;
+    }
+
+    struct perm_cred cred;
+    perm_caller(&cred);
+    int rc = perm_parent(&cred, path);
+    if (rc < 0)
+    {
+    	write_log("[SYST] create: - %d\n", rc);
+    	return rc;
+    }
+
+    my_inode parent_fcb;
+    rc = get_inode(path, &parent_fcb, 1);
+    if (rc < 0)
+    {
+    	parent_fcb = the_root_fcb;
+    }
+
+    //create new inode
+    my_inode new_inode;
+    memset(&new_inode, 0, sizeof(my_inode));
+
+    uuid_generate(new_inode.id);
+
+    struct timespec now = time_now();
+    SET_TIME(&new_inode, mtime, now);
+    SET_TIME(&new_inode, atime, now);
+    SET_TIME(&new_inode, ctime, now);
+    new_inode.version = MY_INODE_VERSION;
+
+    new_inode.uid = cred.uid;
+    new_inode.gid = cred.gid;
+    new_inode.mode = mode | S_IFREG;
+    new_inode.size = 0;
+    new_inode.nlink = 1;
+
+    //store new inode
+    store_inode(&new_inode);
+
+    //store to parent, an inode no directory names is dropped again
+    rc = update_parent(&parent_fcb, new_inode.id, path);
+    if (rc < 0)
+    {
+    	delete_from_db(new_inode.id);
+    	return rc;
+    }
+    USAGE_ADD(inodes, 1);
+
+    //create also opens the file, FUSE releases it like any open file
+    open_handle(fi, open_ref(&new_inode));
+
+	return 0;
+}
+
+// Set the access and modification times of a file, to the nanosecond. Either may be
+// UTIME_NOW or UTIME_OMIT, and 'tv' may be NULL to set both to now.
+// Read 'man 2 utimensat'.
+static int myfs_utimens(const char *path, const struct timespec tv[2])
+{
+    write_log("\n[SYST] utimens: (path=\"%s\", tv=0x%08x)\n", path, tv);
+
+    struct timespec now = time_now();
+    struct timespec times[2] = {now, now};
+    int chosen = 0;
+    for (int i = 0; tv != NULL && i < 2; i++)
+    {
+    	if (tv[i].tv_nsec == UTIME_OMIT)
+    	{
+    		times[i].tv_nsec = UTIME_OMIT;
+    	}
+    	else if (tv[i].tv_nsec != UTIME_NOW)
+    	{
+    		if (tv[i].tv_nsec < 0 || tv[i].tv_nsec >= 1000000000)
+    		{
+    			return -EINVAL;
+    		}
+    		times[i] = tv[i];
+    		chosen = 1;
+    	}
+    }
+
+    struct perm_cred cred;
+    perm_caller(&cred);
+    int rc = perm_search(&cred, path);
+    if (rc < 0)
+    {
+    	return rc;
+    }
+
+    my_inode inode;
+    rc = get_inode(path, &inode, 0);
+    if (rc < 0)
+    {
+    	return rc;
+    }
+
+    //the owner sets any time, whoever may write the file only sets it to now
+    if (perm_owner(&cred, inode.uid) < 0)
+    {
+    	rc = chosen ? -EPERM : perm_check(&cred, inode.mode, inode.uid, inode.gid, W_OK);
+    	if (rc < 0)
+    	{
+    		write_log("[SYST] utimens: - %d\n", rc);
+    		return rc;
+    	}
+    }
+
+    if (times[0].tv_nsec != UTIME_OMIT)
+    {
+    	open_atime(&inode, 1);
+    	SET_TIME(&inode, atime, times[0]);
+    }
+    if (times[1].tv_nsec != UTIME_OMIT)
+    {
+    	SET_TIME(&inode, mtime, times[1]);
+    }
+    SET_TIME(&inode, ctime, now);
+
+    //write back to store
+    rc = store_inode(&inode);
+    if (rc != UNQLITE_OK)
+    {
+    	write_log("[SYST] utimens: - EIO\n");
+    	return -EIO;
+    }
+
+    return 0;
+}
+
+// Set the access and modification times of a file, to the second.
+// Read 'man 2 utime'.
+static int myfs_utime(const char *path, struct utimbuf *ubuf)
+{
+    write_log("\n[SYST] utime: (path=\"%s\", ubuf=0x%08x)\n", path, ubuf);
+
+    if (ubuf == NULL)
+    {
+    	return myfs_utimens(path, NULL);
+    }
+    struct timespec tv[2] = {{ubuf->actime, 0}, {ubuf->modtime, 0}};
+    return myfs_utimens(path, tv);
+}
+
+
+// Write to a file.
+// Read 'man 2 write'
+static int myfs_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+    write_log("\n[SYST] write: (path=\"%s\", buf=0x%08x, size=%d, offset=%lld, fi=0x%08x)\n", path, buf, size, offset, fi);
+
+    my_inode inode;
+    file_data_fcb data;
+    int rc = file_inode(path, fi, &inode, &data);
+    if (rc < 0)
+    {
+    	return -ENOENT;
+    }
+    else if (offset >= MY_MAX_FILE_SIZE)
+    {
+    	return -EFBIG;
+    }
+    else if (mem_would_exceed(size))
+    {
+    	return -ENOSPC;
+    }
+
+	//a short write up to the largest file size
+	int written = FLOOR(size, (size_t)(MY_MAX_FILE_SIZE - offset));
+
+	//check if there is already a data block, if not generate an id
+	if (uuid_compare(zero_uuid, inode.data_id) == 0)
+	{
+		uuid_generate(data.id);
+	}
+
+	//anything skipped between the old end and 'offset' stays a hole
+	write_range(&data, buf, written, offset);
+
+	uuid_copy(inode.data_id, data.id);
+
+	//store file data fcb
+	store_to_db(data.id, &data, sizeof(file_data_fcb));
+
+    if (offset + written > inode.size)
+    {
+    	inode.size = offset + written;
+    }
+
+	struct timespec now = time_now();
+    SET_TIME(&inode, mtime, now);
+    SET_TIME(&inode, ctime, now);
+
+    //store file inode
+    store_inode(&inode);
+
+	write_log("[SYST] write: end write, wrote %d bytes\n", written);
+
+    return written;
+
+}
+
+
+/**
+ * Sets the size of the file at 'path', or of the open file 'fi' if it is not NULL.
+ * Growing the file leaves a hole at its end, shrinking it frees the blocks past the new end.
+ */
+static int truncate_file(const char *path, off_t newsize, struct fuse_file_info *fi)
+{
+    if (newsize > MY_MAX_FILE_SIZE)
+    {
+    	write_log("[SYST] truncate: - EFBIG\n");
+    	return -EFBIG;
+    }
+
+    my_inode inode;
+    file_data_fcb data;
+    int rc = file_inode(path, fi, &inode, &data);
+    if (rc < 0)
+    {
+    	write_log("[SYST] truncate: -ENOENT\n");
+    	return -ENOENT;
+    }
+
+    //an open file was checked for writing when it was opened
+    if (fi == NULL)
+    {
+    	struct perm_cred cred;
+    	perm_caller(&cred);
+    	rc = perm_search(&cred, path);
+    	if (rc == 0)
+    	{
+    		rc = perm_check(&cred, inode.mode, inode.uid, inode.gid, W_OK);
+    	}
+    	if (rc < 0)
+    	{
+    		write_log("[SYST] truncate: - %d\n", rc);
+    		return rc;
+    	}
+    }
+
+    //blocks preallocated past the end go too, and the rest of the last block is
+    //zeroed for when the file grows again
+    if (newsize <= inode.size && newsize < MY_MAX_FILE_SIZE && uuid_compare(zero_uuid, inode.data_id) != 0)
+    {
+    	fill_range(&data, newsize, MY_MAX_FILE_SIZE, FILL_PUNCH);
+    	store_to_db(data.id, &data, sizeof(file_data_fcb));
+    }
+
+    inode.size = newsize;
+    struct timespec now = time_now();
+    SET_TIME(&inode, mtime, now);
+    SET_TIME(&inode, ctime, now);
+    rc = store_inode(&inode);
+    if (rc != UNQLITE_OK)
+    {
+    	write_log("[SYST] truncate: - EIO\n");
+    	return -EIO;
+    }
+
+    write_log("[SYST] truncate: End.\n");
+    return 0;
+}
+
+// Set the size of a file.
+// Read 'man 2 truncate'.
+int myfs_truncate(const char *path, off_t newsize)
+{
+    write_log("\n[SYST] truncate: (path=\"%s\", newsize=%lld)\n", path, newsize);
+
+    return truncate_file(path, newsize, NULL);
+}
+
+// Set the size of an open file.
+// Read 'man 2 ftruncate'.
+static int myfs_ftruncate(const char *path, off_t newsize, struct fuse_file_info *fi)
+{
+    write_log("\n[SYST] ftruncate: (path=\"%s\", newsize=%lld, fi=0x%08x)\n", path, newsize, fi);
+
+    return truncate_file(path, newsize, fi);
+}
+
+// Allocate, zero or punch out a range of an open file.
+// Read 'man 2 fallocate'.
+static int myfs_fallocate(const char *path, int mode, off_t offset, off_t len, struct fuse_file_info *fi)
+{
+    write_log("\n[SYST] fallocate: (path=\"%s\", mode=%d, offset=%lld, len=%lld, fi=0x%08x)\n", path, mode, offset, len, fi);
+
+    int punch = mode & FALLOC_FL_PUNCH_HOLE;
+    int zero = mode & FALLOC_FL_ZERO_RANGE;
+    if ((mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE | FALLOC_FL_ZERO_RANGE)) ||
+    	(punch && !(mode & FALLOC_FL_KEEP_SIZE)) || (punch && zero))
+    {
+    	write_log("[SYST] fallocate: - EOPNOTSUPP\n");
+    	return -EOPNOTSUPP;
+    }
+    if (offset < 0 || len <= 0)
+    {
+    	return -EINVAL;
+    }
+
+    off_t end = offset + len;
+    if (end > MY_MAX_FILE_SIZE || end < offset)
+    {
+    	//there is nothing to punch out past the largest file
+    	if (!punch)
+    	{
+    		write_log("[SYST] fallocate: - EFBIG\n");
+    		return -EFBIG;
+    	}
+    	end = MY_MAX_FILE_SIZE;
+    }
+    if (!punch && mem_would_exceed(len))
+    {
+    	return -ENOSPC;
+    }
+
+    my_inode inode;
+    file_data_fcb data;
+    int rc = file_inode(path, fi, &inode, &data);
+    if (rc < 0)
+    {
+    	return -ENOENT;
+    }
+
+    if (uuid_compare(zero_uuid, inode.data_id) == 0)
+    {
+    	if (punch)
+    	{
+    		return 0;
+    	}
+    	memset(&data, 0, sizeof(file_data_fcb));
+    	uuid_generate(data.id);
+    	uuid_copy(inode.data_id, data.id);
+    }
+
+    if (offset < end)
+    {
+    	int created = fill_range(&data, offset, end, punch ? FILL_PUNCH : zero ? FILL_ZERO : FILL_ALLOCATE);
+    	write_log("[SYST] fallocate: %d new data blocks\n", created);
+    	store_to_db(data.id, &data, sizeof(file_data_fcb));
+    }
+
+    if (!(mode & FALLOC_FL_KEEP_SIZE) && end > inode.size)
+    {
+    	inode.size = end;
+    }
+    if (punch || zero)
+    {
+    	struct timespec now = time_now();
+    	SET_TIME(&inode, mtime, now);
+    	SET_TIME(&inode, ctime, now);
+    }
+    rc = store_inode(&inode);
+    if (rc != UNQLITE_OK)
+    {
+    	write_log("[SYST] fallocate: - EIO\n");
+    	return -EIO;
+    }
+
+    return 0;
+}
+
+/**
+ * MYFS_IOC_CLONE_RANGE on the open file 'fi' at 'path', see struct myfs_clone_range.
+ */
+static int clone_file(const char *path, struct fuse_file_info *fi, struct myfs_clone_range* range)
+{
+    range->src[MY_MAX_PATH - 1] = 0;
+    write_log("[SYST] ioctl: clone '%s' at %lld length %lld to %lld\n", range->src, range->src_offset, range->length, range->dst_offset);
+
+    if (range->src_offset < 0 || range->dst_offset < 0 || range->length < 0)
+    {
+    	return -EINVAL;
+    }
+    //like write(), the clone needs a handle open for writing
+    if (fi == NULL || (fi->fh & OPEN_WRITE) == 0)
+    {
+    	return -EBADF;
+    }
+
+    my_inode src, dst;
+    file_data_fcb src_data, dst_data;
+    int rc = get_inode(range->src, &src, 0);
+    if (rc < 0)
+    {
+    	return rc;
+    }
+    //the source is read by path, so the caller needs to be able to open it for reading
+    struct perm_cred cred;
+    perm_caller(&cred);
+    rc = perm_search(&cred, range->src);
+    if (rc == 0)
+    {
+    	rc = perm_check(&cred, src.mode, src.uid, src.gid, R_OK);
+    }
+    if (rc < 0)
+    {
+    	write_log("[SYST] ioctl: - %d\n", rc);
+    	return rc;
+    }
+    if (!S_ISREG(src.mode))
+    {
+    	return S_ISDIR(src.mode) ? -EISDIR : -EINVAL;
+    }
+    if (file_inode(path, fi, &dst, &dst_data) < 0)
+    {
+    	return -ENOENT;
+    }
+
+    //a length of 0, or one past the end of the source, copies up to its end
+    off_t length = (range->src_offset < src.size) ? src.size - range->src_offset : 0;
+    if (range->length != 0 && range->length < length)
+    {
+    	length = range->length;
+    }
+    range->length = length;
+    if (length == 0)
+    {
+    	return 0;
+    }
+    if (range->dst_offset + length > MY_MAX_FILE_SIZE)
+    {
+    	return -EFBIG;
+    }
+
+    if (uuid_compare(zero_uuid, dst.data_id) == 0)
+    {
+    	memset(&dst_data, 0, sizeof(file_data_fcb));
+    	uuid_generate(dst_data.id);
+    	uuid_copy(dst.data_id, dst_data.id);
+    }
+    if (uuid_compare(src.id, dst.id) != 0)
+    {
+    	if (uuid_compare(zero_uuid, src.data_id) == 0)
+    	{
+    		memset(&src_data, 0, sizeof(file_data_fcb));
+    	}
+    	else if (fetch_from_db(src.data_id, &src_data, sizeof(file_data_fcb)) < 0)
+    	{
+    		return -EIO;
+    	}
+    	clone_range(&dst_data, &src_data, range->src_offset, length, range->dst_offset);
+    }
+    else
+    {
+    	clone_range(&dst_data, &dst_data, range->src_offset, length, range->dst_offset);
+    }
+    store_to_db(dst_data.id, &dst_data, sizeof(file_data_fcb));
+
+    if (range->dst_offset + length > dst.size)
+    {
+    	dst.size = range->dst_offset + length;
+    }
+    struct timespec now = time_now();
+    SET_TIME(&dst, mtime, now);
+    SET_TIME(&dst, ctime, now);
+    rc = store_inode(&dst);
+    if (rc != UNQLITE_OK)
+    {
+    	return -EIO;
+    }
+
+    return 0;
+}
+
+// Control an open file: the MYFS_IOC_SEEK_DATA and MYFS_IOC_SEEK_HOLE queries, and
+// MYFS_IOC_CLONE_RANGE.
+// Read 'man 2 ioctl' and 'man 2 lseek'.
+static int myfs_ioctl(const char *path, int cmd, void *arg, struct fuse_file_info *fi, unsigned int flags, void *data)
+{
+    (void) arg;
+    (void) flags;
+
+    write_log("\n[SYST] ioctl: (path=\"%s\", cmd=0x%08x, fi=0x%08x)\n", path, cmd, fi);
+
+    //'cmd' has the sign bit of the read and write direction set
+    unsigned int request = cmd;
+    if (in_stats_dir(path))
+    {
+    	return -ENOTTY;
+    }
+    if (request == MYFS_IOC_CLONE_RANGE)
+    {
+    	return clone_file(path, fi, data);
+    }
+    if (request != MYFS_IOC_SEEK_DATA && request != MYFS_IOC_SEEK_HOLE)
+    {
+    	return -ENOTTY;
+    }
+
+    my_inode inode;
+    file_data_fcb data_fcb;
+    int rc = file_inode(path, fi, &inode, &data_fcb);
+    if (rc < 0)
+    {
+    	return -ENOENT;
+    }
+    if (uuid_compare(zero_uuid, inode.data_id) == 0)
+    {
+    	memset(&data_fcb, 0, sizeof(file_data_fcb));
+    }
+
+    off_t* offset = data;
+    off_t found = seek_range(&data_fcb, inode.size, *offset, request == MYFS_IOC_SEEK_DATA);
+    if (found < 0)
+    {
+    	return found;
+    }
+    *offset = found;
+
+    return 0;
+}
+
+// Set permissions.
+// Read 'man 2 chmod'.
+int myfs_chmod(const char *path, mode_t mode)
+{
+    write_log("\n[SYST] chmod: (path=\"%s\", mode=0%03o)\n", path, mode);
+
+    struct perm_cred cred;
+    perm_caller(&cred);
+    int rc = perm_search(&cred, path);
+    if (rc < 0)
+    {
+    	return rc;
+    }
+
+    my_inode inode;
+    rc = get_inode(path, &inode, 0);
+    if (rc < 0)
+    {
+    	write_log("[SYST] chmod: - ENOENT\n");
+    	return -ENOENT;
+    }
+    if (perm_owner(&cred, inode.uid) < 0)
+    {
+    	write_log("[SYST] chmod: - EPERM\n");
+    	return -EPERM;
+    }
+
+    inode.mode = mode;
+    store_inode(&inode);
+    perm_forget();
+
+    write_log("[SYST] chmod: End.\n");
+    return 0;
+}
+
+// Set ownership.
+// Read 'man 2 chown'.
+int myfs_chown(const char *path, uid_t uid, gid_t gid)
+{
+    write_log("\n[SYST] chown: (path=\"%s\", uid=%d, gid=%d)\n", path, uid, gid);
+
+    struct perm_cred cred;
+    perm_caller(&cred);
+    int rc = perm_search(&cred, path);
+    if (rc < 0)
+    {
+    	return rc;
+    }
+
+    my_inode inode;
+    rc = get_inode(path, &inode, 0);
+    if (rc < 0)
+    {
+    	write_log("[SYST] chown: - ENOENT\n");
+    	return -ENOENT;
+    }
+
+    //-1 leaves the owner or group as it is. Only root gives a file away, the owner
+    //may hand it to one of its own groups.
+    if (uid == (uid_t)-1)
+    {
+    	uid = inode.uid;
+    }
+    if (gid == (gid_t)-1)
+    {
+    	gid = inode.gid;
+    }
+    if (cred.uid != 0 && (uid != inode.uid ||
+    	(gid != inode.gid && (perm_owner(&cred, inode.uid) < 0 || !perm_in_group(&cred, gid)))))
+    {
+    	write_log("[SYST] chown: - EPERM\n");
+    	return -EPERM;
+    }
+
+    inode.uid = uid;
+    inode.gid = gid;
+
+    store_inode(&inode);
+    perm_forget();
+
+    write_log("[SYST] chown: End.\n");
+    return 0;
+}
+
+/** 
+ * Create a directory.
+ * Read 'man 2 mkdir'.
+ */
+int myfs_mkdir(const char *path, mode_t mode)
+{
+	write_log("\n[SYST] mkdir: path='%s', name='%s'\n",path, get_file_name(path));
+
+	if (mem_would_exceed(2 * KEY_SIZE + sizeof(my_inode) + sizeof(dir_data_fcb)))
+	{
+		return -ENOSPC;
+	}
+
+	struct perm_cred cred;
+	perm_caller(&cred);
+	int rc = perm_parent(&cred, path);
+	if (rc < 0)
+	{
+		write_log("[SYST] mkdir: - %d\n", rc);
+		return rc;
+	}
+
+	//make directory fcb
+	my_inode new_inode;
+	memset(&new_inode, 0, sizeof(my_inode));
+
+	uuid_generate(new_inode.id);
+
+	new_inode.mode = mode | S_IFDIR;
+	new_inode.uid = cred.uid;
+	new_inode.gid = cred.gid;
+	struct timespec now = time_now();
+	SET_TIME(&new_inode, mtime, now);
+	SET_TIME(&new_inode, atime, now);
+	SET_TIME(&new_inode, ctime, now);
+	new_inode.nlink = 2;
+	new_inode.version = MY_INODE_VERSION;
+
+	//make directory data fcb
+	arena_mark mark = arena_save();
+	dir_data_fcb* dir_data = arena_alloc(sizeof(dir_data_fcb));
+	if (dir_data == NULL)
+	{
+		return -ENOMEM;
+	}
+	memset(dir_data, 0, sizeof(dir_data_fcb));
+
+	uuid_generate(dir_data->id);
+	uuid_copy(new_inode.data_id, dir_data->id);
+
+	//store directory fcb
+	rc = store_inode(&new_inode);
+
+	//store directory data
+	rc = store_to_db(dir_data->id, dir_data, sizeof(dir_data_fcb));
+	arena_restore(mark);
+
+	write_log("[SYST] mkdir: Made new directory '%s'\n", path);
+
+
+	//get parent fcb
+	my_inode parent_fcb;
+	rc = get_inode(path, &parent_fcb, 1);
+	if (rc < 0)
+	{
+		parent_fcb = the_root_fcb;
+	}
+
+	//update parent, the new directory's ".." links to it
+	parent_fcb.nlink++;
+	rc = update_parent(&parent_fcb, new_inode.id, path);
+	if (rc < 0)
+	{
+		//neither record is named anywhere
+		delete_from_db(new_inode.data_id);
+		delete_from_db(new_inode.id);
+		return rc;
+	}
+	USAGE_ADD(inodes, 1);
+
+	write_log("[SYST] mkdir: End.\n");
+    return 0;
+}
+
+/*
+ * Extended attributes.
+ * The table after an inode is read with one fetch, and changed by rewriting the record
+ * under db_lock. The kernel asks for security.capability before every write to a file,
+ * so misses are remembered by path and name: a later lookup does not walk the path or
+ * fetch anything. Any change that could make a remembered miss wrong (setting an
+ * attribute, unlinking or renaming a name) bumps xattr_generation, which forgets them all.
+ */
+#define XATTR_MISS_SLOTS 64
+#define XATTR_MISS_NAME 32
+
+struct xattr_miss
+{
+	//generation the miss was seen in, 0 for an empty slot
+	unsigned long generation;
+	char path[MY_MAX_PATH];
+	char name[XATTR_MISS_NAME];
+};
+
+static struct xattr_miss xattr_misses[XATTR_MISS_SLOTS];
+static unsigned long xattr_generation = 1;
+static pthread_mutex_t xattr_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//the caller holds xattr_lock
+static struct xattr_miss* miss_slot(const char* path, const char* name)
+{
+	unsigned long hash = 5381;
+	for (const char* c = path; *c != 0; c++)
+	{
+		hash = hash * 33 + (unsigned char)*c;
+	}
+	for (const char* c = name; *c != 0; c++)
+	{
+		hash = hash * 33 + (unsigned char)*c;
+	}
+	return &xattr_misses[hash % XATTR_MISS_SLOTS];
+}
+
+/**
+ * Returns 1 if 'name' is known to be missing from the file at 'path'. Otherwise returns 0,
+ * with the generation to pass to xattr_missing() after the lookup in 'generation'.
+ */
+static int xattr_known_missing(const char* path, const char* name, unsigned long* generation)
+{
+	*generation = 0;
+	if (strlen(path) >= MY_MAX_PATH || strlen(name) >= XATTR_MISS_NAME)
+	{
+		return 0;
+	}
+
+	pthread_mutex_lock(&xattr_lock);
+	struct xattr_miss* slot = miss_slot(path, name);
+	int missing = slot->generation == xattr_generation &&
+		strcmp(slot->path, path) == 0 && strcmp(slot->name, name) == 0;
+	*generation = xattr_generation;
+	pthread_mutex_unlock(&xattr_lock);
+	return missing;
+}
+
+/**
+ * Remembers that 'name' is missing from the file at 'path', unless something
+ * changed since xattr_known_missing() returned 'generation'.
+ */
+static void xattr_missing(const char* path, const char* name, unsigned long generation)
+{
+	if (generation == 0)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&xattr_lock);
+	if (generation == xattr_generation)
+	{
+		struct xattr_miss* slot = miss_slot(path, name);
+		slot->generation = generation;
+		strcpy(slot->path, path);
+		strcpy(slot->name, name);
+	}
+	pthread_mutex_unlock(&xattr_lock);
+}
+
+/**
+ * Forgets every remembered miss.
+ */
+static void xattr_forget()
+{
+	pthread_mutex_lock(&xattr_lock);
+	xattr_generation++;
+	pthread_mutex_unlock(&xattr_lock);
+}
+
+/**
+ * Returns the position of the entry called 'name' in 'table' of 'len' bytes,
+ * with the entry in 'entry', or -1 if there is none.
+ */
+static int find_xattr(uint8_t* table, int len, const char* name, xattr_entry* entry)
+{
+	size_t name_len = strlen(name);
+	char* at;
+	for (int pos = 0; next_xattr(table, len, pos, entry, &at); pos += XATTR_ENTRY_SIZE(*entry))
+	{
+		if (entry->name_len == name_len && memcmp(at, name, name_len) == 0)
+		{
+			return pos;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Sets the attribute 'name' of 'inode' to 'entry' followed by 'value' (the id of the
+ * record that holds it for an external value), or removes it if 'entry' is NULL.
+ * 'flags' are those of setxattr(). The id of a record that held the old value is
+ * returned in 'dropped' for the caller to delete, or a zero id.
+ *
+ * Returns 0 on success, or -EEXIST, -ENODATA or -ENOSPC.
+ */
+static int change_xattr(my_inode* inode, const char* name, xattr_entry* entry, const void* value, int flags, uuid_t dropped)
+{
+	uuid_clear(dropped);
+
+	arena_mark mark = arena_save();
+	//the table starts after a whole inode once the record is upgraded
+	size_t capacity = xattr_offset(inode) - MY_INODE_SIZE(inode) + sizeof(my_inode) + MY_MAX_XATTR_TABLE;
+	uint8_t* record = arena_alloc(capacity);
+	uint8_t* table = arena_alloc(MY_MAX_XATTR_TABLE);
+	if (record == NULL || table == NULL)
+	{
+		arena_restore(mark);
+		return -ENOMEM;
+	}
+
+	//the record is read again under the lock, so concurrent changes are not lost,
+	//in the current layout for the table to start after the whole inode
+	pthread_mutex_lock(&db_lock);
+	stats_count(STAT_KV_FETCH, 1);
+	unqlite_int64 nBytes = capacity;
+	int rc = upgrade_locked(inode->id);
+	if (rc == UNQLITE_OK)
+	{
+		rc = unqlite_kv_fetch_range(pDb, inode->id, KEY_SIZE, 0, record, &nBytes);
+	}
+	size_t offset = xattr_offset((my_inode*)record);
+	if (rc != UNQLITE_OK || nBytes < (unqlite_int64)offset)
+	{
+		pthread_mutex_unlock(&db_lock);
+		arena_restore(mark);
+		return -ENOENT;
+	}
+
+	//copy every entry but the one named
+	int len = 0;
+	int found = 0;
+	xattr_entry old;
+	char* at;
+	for (int pos = 0; next_xattr(record + offset, nBytes - offset, pos, &old, &at); pos += XATTR_ENTRY_SIZE(old))
+	{
+		if (old.name_len == strlen(name) && memcmp(at, name, old.name_len) == 0)
+		{
+			found = 1;
+			if (old.external)
+			{
+				uuid_copy(dropped, (uint8_t*)at + old.name_len);
+			}
+			continue;
+		}
+		memcpy(table + len, record + offset + pos, XATTR_ENTRY_SIZE(old));
+		len += XATTR_ENTRY_SIZE(old);
+	}
+
+	if (found && (flags & XATTR_CREATE))
+	{
+		rc = -EEXIST;
+	}
+	else if (!found && (entry == NULL || (flags & XATTR_REPLACE)))
+	{
+		rc = -ENODATA;
+	}
+	else if (entry != NULL && len + XATTR_ENTRY_SIZE(*entry) > MY_MAX_XATTR_TABLE)
+	{
+		rc = -ENOSPC;
+	}
+	if (rc < 0)
+	{
+		pthread_mutex_unlock(&db_lock);
+		uuid_clear(dropped);
+		arena_restore(mark);
+		return rc;
+	}
+
+	if (entry != NULL)
+	{
+		memcpy(table + len, entry, sizeof(xattr_entry));
+		memcpy(table + len + sizeof(xattr_entry), name, entry->name_len);
+		memcpy(table + len + sizeof(xattr_entry) + entry->name_len, value, entry->external ? KEY_SIZE : entry->value_size);
+		len += XATTR_ENTRY_SIZE(*entry);
+	}
+	memcpy(record + offset, table, len);
+
+	my_inode* stored = (my_inode*)record;
+	SET_TIME(stored, ctime, time_now());
+	*inode = *stored;
+
+	stats_count(STAT_KV_STORE, 1);
+	open_cache(inode->id, record, sizeof(my_inode));
+	rc = replace_locked(inode->id, record, offset + len);
+	pthread_mutex_unlock(&db_lock);
+	arena_restore(mark);
+
+	error_handle(rc);
+	return 0;
+}
+
+// Set an extended attribute.
+// Read 'man 2 setxattr'.
+static int myfs_setxattr(const char *path, const char *name, const char *value, size_t size, int flags)
+{
+	write_log("\n[SYST] setxattr: path='%s' name='%s' size=%d flags=%d\n", path, name, size, flags);
+
+	size_t name_len = strlen(name);
+	if (name_len == 0 || name_len > MY_MAX_XATTR_NAME)
+	{
+		return -ERANGE;
+	}
+	if (size > MY_MAX_XATTR_VALUE)
+	{
+		return -E2BIG;
+	}
+	//access control lists would be kept without being enforced
+	if (strncmp(name, "system.", 7) == 0)
+	{
+		return -EOPNOTSUPP;
+	}
+	if (mem_would_exceed(KEY_SIZE + name_len + size))
+	{
+		return -ENOSPC;
+	}
+
+	struct perm_cred cred;
+	perm_caller(&cred);
+	int rc = perm_search(&cred, path);
+	if (rc < 0)
+	{
+		return rc;
+	}
+
+	my_inode inode;
+	rc = get_inode(path, &inode, 0);
+	if (rc < 0)
+	{
+		return rc;
+	}
+	if (perm_owner(&cred, inode.uid) < 0)
+	{
+		return -EPERM;
+	}
+
+	xattr_entry entry;
+	entry.name_len = name_len;
+	entry.external = size > MY_MAX_XATTR_INLINE;
+	entry.value_size = size;
+
+	//a large value is stored before the table points at it
+	uuid_t value_id, dropped;
+	if (entry.external)
+	{
+		uuid_generate(value_id);
+		store_to_db(value_id, (void*)value, size);
+	}
+
+	rc = change_xattr(&inode, name, &entry, entry.external ? (const void*)value_id : value, flags, dropped);
+	if (rc < 0 && entry.external)
+	{
+		delete_from_db(value_id);
+	}
+	if (uuid_compare(zero_uuid, dropped) != 0)
+	{
+		delete_from_db(dropped);
+	}
+	xattr_forget();
+
+	return rc;
+}
+
+// Get an extended attribute.
+// Read 'man 2 getxattr'.
+static int myfs_getxattr(const char *path, const char *name, char *value, size_t size)
+{
+	write_log("\n[SYST] getxattr: path='%s' name='%s' size=%d\n", path, name, size);
+
+	if (in_stats_dir(path))
+	{
+		return -ENODATA;
+	}
+
+	unsigned long generation;
+	if (xattr_known_missing(path, name, &generation))
+	{
+		return -ENODATA;
+	}
+
+	my_inode inode;
+	int rc = get_inode(path, &inode, 0);
+	if (rc < 0)
+	{
+		return rc;
+	}
+
+	uint8_t table[MY_MAX_XATTR_TABLE];
+	int len = fetch_range_from_db(inode.id, xattr_offset(&inode), table, MY_MAX_XATTR_TABLE);
+	xattr_entry entry;
+	int pos = find_xattr(table, len, name, &entry);
+	if (pos < 0)
+	{
+		xattr_missing(path, name, generation);
+		return -ENODATA;
+	}
+
+	if (size == 0)
+	{
+		return entry.value_size;
+	}
+	if (size < entry.value_size)
+	{
+		return -ERANGE;
+	}
+
+	uint8_t* at = table + pos + sizeof(xattr_entry) + entry.name_len;
+	if (!entry.external)
+	{
+		memcpy(value, at, entry.value_size);
+	}
+	else if (fetch_range_from_db(at, 0, value, entry.value_size) != entry.value_size)
+	{
+		return -EIO;
+	}
+	return entry.value_size;
+}
+
+// List the names of the extended attributes of a file.
+// Read 'man 2 listxattr'.
+static int myfs_listxattr(const char *path, char *list, size_t size)
+{
+	write_log("\n[SYST] listxattr: path='%s' size=%d\n", path, size);
+
+	if (in_stats_dir(path))
+	{
+		return 0;
+	}
+
+	my_inode inode;
+	int rc = get_inode(path, &inode, 0);
+	if (rc < 0)
+	{
+		return rc;
+	}
+
+	uint8_t table[MY_MAX_XATTR_TABLE];
+	int len = fetch_range_from_db(inode.id, xattr_offset(&inode), table, MY_MAX_XATTR_TABLE);
+
+	//the names, each followed by a 0
+	size_t total = 0;
+	xattr_entry entry;
+	char* name;
+	for (int pos = 0; next_xattr(table, len, pos, &entry, &name); pos += XATTR_ENTRY_SIZE(entry))
+	{
+		if (size != 0)
+		{
+			if (total + entry.name_len + 1 > size)
+			{
+				return -ERANGE;
+			}
+			memcpy(list + total, name, entry.name_len);
+			list[total + entry.name_len] = 0;
+		}
+		total += entry.name_len + 1;
+	}
+	return total;
+}
+
+// Remove an extended attribute.
+// Read 'man 2 removexattr'.
+static int myfs_removexattr(const char *path, const char *name)
+{
+	write_log("\n[SYST] removexattr: path='%s' name='%s'\n", path, name);
+
+	struct perm_cred cred;
+	perm_caller(&cred);
+	int rc = perm_search(&cred, path);
+	if (rc < 0)
+	{
+		return rc;
+	}
+
+	my_inode inode;
+	rc = get_inode(path, &inode, 0);
+	if (rc < 0)
+	{
+		return rc;
+	}
+	if (perm_owner(&cred, inode.uid) < 0)
+	{
+		return -EPERM;
+	}
+
+	uuid_t dropped;
+	rc = change_xattr(&inode, name, NULL, NULL, 0, dropped);
+	if (uuid_compare(zero_uuid, dropped) != 0)
+	{
+		delete_from_db(dropped);
+	}
+	return rc;
+}
+
+// Delete a file.
+// Read 'man 2 unlink'.
+int myfs_unlink(const char *path)
+{
+	write_log("\n[SYST] unlink: path='%s'\n",path);
+
+	char* file_name = get_file_name(path);
+
+	struct perm_cred cred;
+	perm_caller(&cred);
+	int rc = perm_parent(&cred, path);
+	if (rc < 0)
+	{
+		write_log("[SYST] unlink: - %d\n", rc);
+		return rc;
+	}
+
+	my_inode parent;
+	rc = get_inode(path, &parent, 1);
+	if (rc < 0)
+	{
+		return -ENOENT;
+	}
+
+	arena_mark mark = arena_save();
+	dir_data_fcb* parent_data = arena_alloc(sizeof(dir_data_fcb));
+	if (parent_data == NULL)
+	{
+		return -ENOMEM;
+	}
+	fetch_from_db(parent.data_id, parent_data, sizeof(dir_data_fcb));
+
+	int found = 0;
+	int have_inode = 0;
+	my_inode inode;
+	for (int i = 0; i<MY_MAX_DIR_FILES; i++)
+	{
+		dir_entry* entry = &parent_data->entries[i];
+
+		if (strcmp(entry->filename, file_name) == 0)
+		{
+			found = 1;
+			have_inode = fetch_from_db(entry->inode_id, &inode, sizeof(my_inode)) > 0;
+
+			//memset to remove from parent's inode
+			memset(&entry->inode_id, 0, sizeof(uuid_t));
+			memset(&entry->filename, 0, MY_MAX_FILE_NAME);
+			break;
+		}
+	}
+
+	if (found)
+	{
+		//a removed directory's ".." no longer links to the parent
+		if (have_inode && S_ISDIR(inode.mode) && parent.nlink > 2)
+		{
+			parent.nlink--;
+		}
+		//the entry count, like move_entry keeps it
+		if (parent.size > 0)
+		{
+			parent.size = parent.size - 1;
+		}
+		SET_TIME(&parent, mtime, time_now());
+		store_inode(&parent);
+		store_to_db(parent.data_id, parent_data, sizeof(dir_data_fcb));
+	}
+	arena_restore(mark);
+
+	if (found)
+	{
+		if (have_inode)
+		{
+			drop_link(&inode);
+		}
+		xattr_forget();
+		perm_forget();
+		return 0;
+	}
+	else 
+	{
+		return -ENOENT;
+	}
+}
+
+
+/**
+ * Returns 1 if the directory 'dir' has no entries, 0 if it has some, or -ENOMEM.
+ */
+static int dir_is_empty(my_inode* dir)
+{
+	arena_mark mark = arena_save();
+	dir_data_fcb* dir_fcb = arena_alloc(sizeof(dir_data_fcb));
+	if (dir_fcb == NULL)
+	{
+		return -ENOMEM;
+	}
+	fetch_from_db(dir->data_id, dir_fcb, sizeof(dir_data_fcb));
+
+	int empty = 1;
+	for (int i = 0; i < MY_MAX_DIR_FILES; i++)
+	{
+		if (strcmp(dir_fcb->entries[i].filename, "") != 0)
+		{
+			empty = 0;
+			break;
+		}
+	}
+	arena_restore(mark);
+	return empty;
+}
+
+// Delete a directory.
+// Read 'man 2 rmdir'.
+int myfs_rmdir(const char *path)
+{
+    write_log("\n[SYST] rmdir: path='%s'\n",path);
+
+    my_inode inode;
+    int rc = get_inode(path, &inode, 0);
+
+    if (rc < 0)
+    {
+    	write_log("[SYST] rmdir: - ENOENT\n");
+    	return -ENOENT;
+    }
+    else 
+    {
+    	int empty = dir_is_empty(&inode);
+    	if (empty < 0)
+    	{
+    		return empty;
+    	}
+
+    	if (empty)
+    	{
+    		return myfs_unlink(path);
+    	}
+    	else 
+    	{
+    		write_log("[SYST] rmdir: -ENOTEMPTY\n");
+    		return -ENOTEMPTY;
+    	}
+    }
+
+
+    return 0;
+}
+
+//renames are serialised, so a concurrent rename cannot make the cycle check below stale
+static pthread_mutex_t rename_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Returns the entry called 'name' in 'dir_fcb', or NULL if there is none.
+ * An empty 'name' finds a free entry.
+ */
+static dir_entry* find_entry(dir_data_fcb* dir_fcb, const char* name)
+{
+	for (int i = 0; i < MY_MAX_DIR_FILES; i++)
+	{
+		if (strcmp(dir_fcb->entries[i].filename, name) == 0)
+		{
+			return &dir_fcb->entries[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Moves the entry of 'from' to 'to', replacing what 'to' names.
+ * Only the directory pages and inodes of the two parents and the moved inode are
+ * rewritten, whatever the size of the file or tree that moves.
+ * The caller holds rename_lock.
+ */
+static int move_entry(const char* from, const char* to)
+{
+	my_inode src_parent, dst_parent, inode, target;
+	if (get_inode(from, &src_parent, 1) < 0 || get_inode(to, &dst_parent, 1) < 0)
+	{
+		return -ENOENT;
+	}
+	if (!S_ISDIR(dst_parent.mode))
+	{
+		return -ENOTDIR;
+	}
+
+	arena_mark mark = arena_save();
+	dir_data_fcb* src_page = arena_alloc(sizeof(dir_data_fcb));
+	dir_data_fcb* dst_page = arena_alloc(sizeof(dir_data_fcb));
+	if (src_page == NULL || dst_page == NULL)
+	{
+		arena_restore(mark);
+		return -ENOMEM;
+	}
+
+	//within one directory both entries live in the same page
+	int same_dir = uuid_compare(src_parent.id, dst_parent.id) == 0;
+	my_inode* dst_dir = same_dir ? &src_parent : &dst_parent;
+	fetch_from_db(src_parent.data_id, src_page, sizeof(dir_data_fcb));
+	if (same_dir)
+	{
+		dst_page = src_page;
+	}
+	else
+	{
+		fetch_from_db(dst_parent.data_id, dst_page, sizeof(dir_data_fcb));
+	}
+
+	int rc = 0;
+	int replace = 0;
+	const char* to_name = get_file_name(to);
+	dir_entry* src = find_entry(src_page, get_file_name(from));
+	dir_entry* dst = find_entry(dst_page, to_name);
+	if (src == NULL || fetch_from_db(src->inode_id, &inode, sizeof(my_inode)) < 0)
+	{
+		rc = -ENOENT;
+	}
+	else if (dst != NULL)
+	{
+		//both names already point at the same inode
+		if (uuid_compare(dst->inode_id, src->inode_id) == 0)
+		{
+			arena_restore(mark);
+			return 0;
+		}
+		fetch_from_db(dst->inode_id, &target, sizeof(my_inode));
+		if (S_ISDIR(inode.mode) && !S_ISDIR(target.mode))
+		{
+			rc = -ENOTDIR;
+		}
+		else if (!S_ISDIR(inode.mode) && S_ISDIR(target.mode))
+		{
+			rc = -EISDIR;
+		}
+		else if (S_ISDIR(target.mode) && (rc = dir_is_empty(&target)) >= 0)
+		{
+			rc = rc ? 0 : -ENOTEMPTY;
+		}
+		replace = 1;
+	}
+	else if (same_dir)
+	{
+		//a rename within a directory keeps the entry and changes its name
+		dst = src;
+	}
+	else if ((dst = find_entry(dst_page, "")) == NULL)
+	{
+		rc = -ENOSPC;
+	}
+
+	if (rc < 0)
+	{
+		write_log("[SYST] rename: - %d\n", rc);
+		arena_restore(mark);
+		return rc;
+	}
+
+	uuid_copy(dst->inode_id, inode.id);
+	strcpy(dst->filename, to_name);
+	if (dst != src)
+	{
+		memset(src, 0, sizeof(dir_entry));
+	}
 
-    return size;
+	struct timespec now = time_now();
+	//the source entry goes away unless it was renamed in place, and the
+	//destination gains one unless an existing entry was reused
+	if (!same_dir && !replace)
+	{
+		dst_parent.size = dst_parent.size + 1;
+	}
+	if ((!same_dir || replace) && src_parent.size > 0)
+	{
+		src_parent.size = src_parent.size - 1;
+	}
+	//the ".." of a moved directory links to its new parent, a replaced directory's to none
+	if (S_ISDIR(inode.mode) && !same_dir)
+	{
+		src_parent.nlink--;
+		dst_parent.nlink++;
+	}
+	if (replace && S_ISDIR(target.mode))
+	{
+		dst_dir->nlink--;
+	}
+	SET_TIME(&src_parent, mtime, now);
+	SET_TIME(&src_parent, ctime, now);
+	SET_TIME(dst_dir, mtime, now);
+	SET_TIME(dst_dir, ctime, now);
+	SET_TIME(&inode, ctime, now);
+
+	//every record of the rename is written under one hold of db_lock, so the
+	//records land in the same unqlite transaction and no handler sees half of it
+	pthread_mutex_lock(&db_lock);
+	rc = store_locked(src_parent.data_id, src_page, sizeof(dir_data_fcb));
+	if (rc == UNQLITE_OK)
+	{
+		rc = store_inode_locked(&src_parent);
+	}
+	if (rc == UNQLITE_OK && !same_dir)
+	{
+		rc = store_locked(dst_parent.data_id, dst_page, sizeof(dir_data_fcb));
+	}
+	if (rc == UNQLITE_OK && !same_dir)
+	{
+		rc = store_inode_locked(&dst_parent);
+	}
+	if (rc == UNQLITE_OK)
+	{
+		rc = store_inode_locked(&inode);
+	}
+	pthread_mutex_unlock(&db_lock);
+	arena_restore(mark);
+	error_handle(rc);
 
+	//the replaced inode lost the link 'to' was
+	if (replace)
+	{
+		drop_link(&target);
+	}
+	return 0;
 }
 
+// Make a symbolic link.
+// Read 'man 2 symlink'.
+static int myfs_symlink(const char *target, const char *path)
+{
+	write_log("\n[SYST] symlink: target='%s' path='%s'\n", target, path);
 
-// Set the size of a file.
-// Read 'man 2 truncate'.
-int myfs_truncate(const char *path, off_t newsize)
+	size_t len = strlen(target);
+	if (strlen(path) >= MY_MAX_PATH || len >= MY_MAX_LINK_TARGET)
+	{
+		return -ENAMETOOLONG;
+	}
+	if (mem_would_exceed(KEY_SIZE + sizeof(my_inode) + len + 1))
+	{
+		return -ENOSPC;
+	}
+
+	struct perm_cred cred;
+	perm_caller(&cred);
+	int rc = perm_parent(&cred, path);
+	if (rc < 0)
+	{
+		return rc;
+	}
+
+	my_inode parent;
+	if (get_inode(path, &parent, 1) < 0)
+	{
+		return -ENOENT;
+	}
+
+	//the target follows the inode in its record, readlink reads it with the inode
+	arena_mark mark = arena_save();
+	my_inode* inode = arena_alloc(sizeof(my_inode) + len + 1);
+	if (inode == NULL)
+	{
+		return -ENOMEM;
+	}
+	memset(inode, 0, sizeof(my_inode));
+	memcpy(inode + 1, target, len + 1);
+
+	uuid_generate(inode->id);
+	inode->mode = S_IFLNK | 0777;
+	inode->uid = cred.uid;
+	inode->gid = cred.gid;
+	struct timespec now = time_now();
+	SET_TIME(inode, mtime, now);
+	SET_TIME(inode, atime, now);
+	SET_TIME(inode, ctime, now);
+	inode->version = MY_INODE_VERSION;
+	inode->size = len;
+	inode->nlink = 1;
+
+	store_to_db(inode->id, inode, sizeof(my_inode) + len + 1);
+	rc = update_parent(&parent, inode->id, path);
+	if (rc < 0)
+	{
+		delete_from_db(inode->id);
+	}
+	else
+	{
+		USAGE_ADD(inodes, 1);
+	}
+	arena_restore(mark);
+	return rc;
+}
+
+// Read the target of a symbolic link.
+// Read 'man 2 readlink'. Unlike readlink(2) the target is 0 terminated, and cut short to fit 'size'.
+static int myfs_readlink(const char *path, char *buf, size_t size)
 {
-    write_log("\n[SYST] truncate: (path=\"%s\", newsize=%lld)\n", path, newsize);
+	write_log("\n[SYST] readlink: path='%s'\n", path);
 
-    if (newsize >= MY_MAX_FILE_SIZE)
-    {
-    	write_log("[SYST] truncate: - EFBIG\n");
-    	return -EFBIG;
-    }
+	my_inode inode;
+	int rc = get_inode(path, &inode, 0);
+	if (rc < 0)
+	{
+		return rc;
+	}
+	if (!S_ISLNK(inode.mode))
+	{
+		return -EINVAL;
+	}
+	if (size == 0)
+	{
+		return 0;
+	}
 
-    my_inode inode;
-    int rc = get_inode(path, &inode, 0);
-    if (rc < 0)
-    {
-    	write_log("[SYST] truncate: -ENOENT\n");
-    	return -ENOENT;
-    }
+	int len = fetch_range_from_db(inode.id, MY_INODE_SIZE(&inode), buf, size - 1);
+	if (len < 0)
+	{
+		return -EIO;
+	}
+	buf[len] = 0;
+	return 0;
+}
 
-    if (newsize > inode.size)
-    {
-    	char buf[newsize - inode.size];
-    	memset(buf, 0, newsize - inode.size);
+// Make a hard link.
+// Read 'man 2 link'.
+static int myfs_link(const char *from, const char *to)
+{
+	write_log("\n[SYST] link: from='%s' to='%s'\n", from, to);
 
-    	myfs_write(path, buf, newsize - inode.size, inode.size, NULL);
-    } 
+	if (strlen(to) >= MY_MAX_PATH)
+	{
+		return -ENAMETOOLONG;
+	}
 
-    inode.size = newsize;
-    rc = store_to_db(inode.id, &inode, sizeof(my_inode));
-    if (rc != UNQLITE_OK)
-    {
-    	write_log("[SYST] truncate: - EIO\n");
-    	return -EIO;
-    }
+	struct perm_cred cred;
+	perm_caller(&cred);
+	int rc = perm_search(&cred, from);
+	if (rc == 0)
+	{
+		rc = perm_parent(&cred, to);
+	}
+	if (rc < 0)
+	{
+		return rc;
+	}
 
-    write_log("[SYST] truncate: End.\n");
-    return 0;
+	my_inode inode, parent;
+	if (get_inode(from, &inode, 0) < 0 || get_inode(to, &parent, 1) < 0)
+	{
+		return -ENOENT;
+	}
+	if (S_ISDIR(inode.mode))
+	{
+		return -EPERM;
+	}
+	if (!S_ISDIR(parent.mode))
+	{
+		return -ENOTDIR;
+	}
+
+	arena_mark mark = arena_save();
+	dir_data_fcb* parent_data = arena_alloc(sizeof(dir_data_fcb));
+	if (parent_data == NULL)
+	{
+		return -ENOMEM;
+	}
+	fetch_from_db(parent.data_id, parent_data, sizeof(dir_data_fcb));
+
+	const char* name = get_file_name(to);
+	dir_entry* entry = NULL;
+	if (find_entry(parent_data, name) != NULL)
+	{
+		rc = -EEXIST;
+	}
+	else if ((entry = find_entry(parent_data, "")) == NULL)
+	{
+		rc = -ENOSPC;
+	}
+	if (rc < 0)
+	{
+		arena_restore(mark);
+		return rc;
+	}
+
+	uuid_copy(entry->inode_id, inode.id);
+	strcpy(entry->filename, name);
+
+	struct timespec now = time_now();
+	inode.nlink++;
+	SET_TIME(&inode, ctime, now);
+	parent.size = parent.size + 1;
+	SET_TIME(&parent, mtime, now);
+	SET_TIME(&parent, ctime, now);
+
+	//the new entry and the count that covers it are written together, like a rename
+	pthread_mutex_lock(&db_lock);
+	rc = store_inode_locked(&inode);
+	if (rc == UNQLITE_OK)
+	{
+		rc = store_locked(parent.data_id, parent_data, sizeof(dir_data_fcb));
+	}
+	if (rc == UNQLITE_OK)
+	{
+		rc = store_inode_locked(&parent);
+	}
+	pthread_mutex_unlock(&db_lock);
+	arena_restore(mark);
+	error_handle(rc);
+	return 0;
 }
 
-// Set permissions.
-// Read 'man 2 chmod'.
-int myfs_chmod(const char *path, mode_t mode)
+// Rename a file or directory.
+// Read 'man 2 rename'.
+static int myfs_rename(const char *from, const char *to)
 {
-    write_log("\n[SYST] chmod: (path=\"%s\", mode=0%03o)\n", path, mode);
+	write_log("\n[SYST] rename: from='%s' to='%s'\n", from, to);
 
-    my_inode inode;
-    int rc = get_inode(path, &inode, 0);
-    if (rc < 0)
-    {
-    	write_log("[SYST] chmod: - ENOENT\n");
-    	return -ENOENT;
-    }
+	size_t len = strlen(from);
+	if (strcmp(from, to) == 0)
+	{
+		return 0;
+	}
+	if (strlen(to) >= MY_MAX_PATH)
+	{
+		return -ENAMETOOLONG;
+	}
+	if (strcmp(from, "/") == 0 || strcmp(to, "/") == 0)
+	{
+		return -EBUSY;
+	}
 
-    inode.mode = mode;
-    store_to_db(inode.id, &inode, sizeof(my_inode));
+	//a directory cannot move below itself. FUSE hands over paths without
+	//symbolic links in them, so a prefix of the path is a prefix of the tree.
+	if (strncmp(to, from, len) == 0 && to[len] == '/')
+	{
+		return -EINVAL;
+	}
 
-    write_log("[SYST] chmod: End.\n");
-    return 0;
+	//the name goes from one directory and comes to the other
+	struct perm_cred cred;
+	perm_caller(&cred);
+	int rc = perm_parent(&cred, from);
+	if (rc == 0)
+	{
+		rc = perm_parent(&cred, to);
+	}
+	if (rc < 0)
+	{
+		write_log("[SYST] rename: - %d\n", rc);
+		return rc;
+	}
+
+	pthread_mutex_lock(&rename_lock);
+	rc = move_entry(from, to);
+	pthread_mutex_unlock(&rename_lock);
+	xattr_forget();
+	perm_forget();
+	return rc;
 }
 
-// Set ownership.
-// Read 'man 2 chown'.
-int myfs_chown(const char *path, uid_t uid, gid_t gid)
+// Get file system statistics.
+// Read 'man 2 statfs'.
+// Blocks are pages of the store. The free space is the free pages of the store
+// plus what the disk under it has left, or what is left of mem_size in memory.
+// Nothing is scanned, the counts come from the root object and the store.
+static int myfs_statfs(const char *path, struct statvfs *stbuf)
 {
-    write_log("\n[SYST] chown: (path=\"%s\", uid=%d, gid=%d)\n", path, uid, gid);
+	write_log("\n[SYST] statfs: path='%s'\n", path);
 
-    my_inode inode;
-    int rc = get_inode(path, &inode, 0);
-    if (rc < 0)
+	unqlite_pager_stats pager;
+	unqlite_int64 free_pages = 0;
+	int page_size = 0;
+
+	pthread_mutex_lock(&db_lock);
+	int rc = unqlite_config(pDb, UNQLITE_CONFIG_PAGER_STATS, &pager);
+	if (unqlite_kv_config(pDb, UNQLITE_KV_CONFIG_GET_FREE_PAGES, &free_pages, &page_size) != UNQLITE_OK)
+	{
+		//the in-memory engine has no pages
+		free_pages = 0;
+		page_size = 4096;
+	}
+	pthread_mutex_unlock(&db_lock);
+	if (rc != UNQLITE_OK)
+	{
+		return -EIO;
+	}
+
+	unsigned long long inodes = __atomic_load_n(&root_object.inodes, __ATOMIC_RELAXED);
+	unsigned long long blocks = __atomic_load_n(&root_object.blocks, __ATOMIC_RELAXED);
+	unsigned long long used, avail;
+	if (strcmp(store_path, MEMORY_STORE) == 0)
+	{
+		//without a limit the records are not measured, the inodes and data blocks are close enough
+		used = (mem_limit != 0) ? mem_used :
+			inodes * (KEY_SIZE + sizeof(my_inode)) + blocks * (KEY_SIZE + sizeof(data_block));
+		avail = (mem_limit != 0) ? ((mem_limit > used) ? mem_limit - used : 0) :
+			(unsigned long long)sysconf(_SC_AVPHYS_PAGES) * sysconf(_SC_PAGESIZE);
+	}
+	else
+	{
+		struct statvfs disk;
+		used = (pager.nPage > free_pages) ? (pager.nPage - free_pages) * page_size : 0;
+		avail = free_pages * page_size;
+		//main made store_path absolute, FUSE has since left the directory it was given in
+		if (statvfs(store_path, &disk) != 0)
+		{
+			return -errno;
+		}
+		avail += (unsigned long long)disk.f_bavail * disk.f_frsize;
+	}
+
+	stbuf->f_bsize = page_size;
+	stbuf->f_frsize = page_size;
+	stbuf->f_blocks = (used + avail) / page_size;
+	stbuf->f_bfree = avail / page_size;
+	stbuf->f_bavail = stbuf->f_bfree;
+	//an inode is one record
+	stbuf->f_ffree = avail / (KEY_SIZE + sizeof(my_inode));
+	stbuf->f_favail = stbuf->f_ffree;
+	stbuf->f_files = inodes + stbuf->f_ffree;
+	//the name is stored 0 terminated
+	stbuf->f_namemax = MY_MAX_FILE_NAME - 1;
+	return 0;
+}
+
+// OPTIONAL - included as an example
+// Flush any cached data.
+int myfs_flush(const char *path, struct fuse_file_info *fi)
+{
+    int retstat = 0;
+
+    write_log("myfs_flush(path=\"%s\", fi=0x%08x)\n", path, fi);
+
+    return retstat;
+}
+
+// OPTIONAL - included as an example
+// Release the file. There will be one call to release for each call to open.
+int myfs_release(const char *path, struct fuse_file_info *fi)
+{
+    int retstat = 0;
+
+    write_log("myfs_release(path=\"%s\", fi=0x%08x)\n", path, fi);
+
+    //the path of an unlinked file may be NULL
+    if (path != NULL && strcmp(path, STATS_FILE) == 0 && fi->fh != 0)
     {
-    	write_log("[SYST] chown: - ENOENT\n");
-    	return -ENOENT;
+    	struct stats_snapshot* snap = (struct stats_snapshot*)(uintptr_t)fi->fh;
+    	free(snap->text);
+    	free(snap);
+    	fi->fh = 0;
+    }
+    else if (fi->fh != 0)
+    {
+    	open_unref(open_entry(fi));
+    	fi->fh = 0;
     }
 
-    inode.uid = uid;
-    inode.gid = gid;
+    return retstat;
+}
+
+// OPTIONAL - included as an example
+// Open a file. Open should check if the operation is permitted for the given flags (fi->flags).
+// Read 'man 2 open'.
+static int myfs_open(const char *path, struct fuse_file_info *fi)
+{
+	// if (strcmp(path, the_root_fcb.path) != 0)
+	write_log("[SYST] open: (path\"%s\", fi=0x%08x)\n", path, fi);
+
+	if (strcmp(path, STATS_FILE) == 0)
+	{
+		if ((fi->flags & O_ACCMODE) != O_RDONLY)
+		{
+			return -EACCES;
+		}
+		struct stats_snapshot* snap = malloc(sizeof(struct stats_snapshot));
+		if (snap == NULL || (snap->text = stats_render(&snap->len)) == NULL)
+		{
+			free(snap);
+			return -ENOMEM;
+		}
+		fi->fh = (uintptr_t)snap;
+		//the snapshot is longer or shorter than the size getattr reported, read it to the end
+		fi->direct_io = 1;
+		return 0;
+	}
+
+	my_inode inode;
+	int rc = get_inode(path, &inode, 0);
+	if (rc < 0)
+	{
+		return rc;
+	}
+
+	//return -EACCES if the access is not permitted.
+	int mask = ((fi->flags & O_ACCMODE) == O_RDONLY) ? R_OK :
+		((fi->flags & O_ACCMODE) == O_WRONLY) ? W_OK : R_OK | W_OK;
+	if (fi->flags & O_TRUNC)
+	{
+		mask |= W_OK;
+	}
+	struct perm_cred cred;
+	perm_caller(&cred);
+	rc = perm_search(&cred, path);
+	if (rc == 0)
+	{
+		rc = perm_check(&cred, inode.mode, inode.uid, inode.gid, mask);
+	}
+	if (rc < 0)
+	{
+		write_log("[SYST] open: - %d\n", rc);
+		return rc;
+	}
 
-    store_to_db(inode.id, &inode, sizeof(my_inode));
+	struct open_inode* entry = open_ref(&inode);
+	if (entry == NULL)
+	{
+		return -ENOMEM;
+	}
+	open_handle(fi, entry);
 
-    write_log("[SYST] chown: End.\n");
-    return 0;
+	return 0;
 }
 
-/** 
- * Create a directory.
- * Read 'man 2 mkdir'.
+/**
+ * Called once FUSE is running (after it has daemonised), which is the
+ * earliest point a background thread can be started.
  */
-int myfs_mkdir(const char *path, mode_t mode)
+static void* myfs_init(struct fuse_conn_info *conn)
 {
-	write_log("\n[SYST] mkdir: path='%s', name='%s'\n",path, get_file_name(path));
+	struct myfs_state *state = NEWFS_PRIVATE_DATA;
 
-	//make directory fcb
-	my_inode new_inode;
-	memset(&new_inode, 0, sizeof(my_inode));
+	//an in-memory store has no file to rebuild
+	if (state->vacuum && !state->mem)
+	{
+		int rc = gc_vacuum_start(state->vacuum_rate);
+		write_log("[SYST] init: vacuum started rc=%d rate=%uKiB/s\n", rc, state->vacuum_rate);
+	}
+	return state;
+}
 
-	uuid_generate(new_inode.id);
+static void myfs_destroy(void *private_data)
+{
+	//an unfinished vacuum is thrown away, the old database is still complete
+	gc_vacuum_wait(1);
+}
 
-	new_inode.mode = mode | S_IFDIR;
-	new_inode.uid = getuid();
-	new_inode.gid = getgid();
-	new_inode.mtime = time(NULL);
 
-	//make directory data fcb
-	dir_data_fcb dir_data;
-	memset(&dir_data, 0, sizeof(dir_data_fcb));
+/*
+ * FUSE calls the handlers through these wrappers, which time them.
+ * Handlers calling each other (truncate calls write) are counted once.
+ * The wrappers of handlers that change the store refuse the metrics paths.
+ */
+#define TIMED(op, call) \
+	unsigned long long start = stats_now(); \
+	int rc = call; \
+	stats_op(op, start, rc); \
+	return rc
 
-	uuid_generate(dir_data.id);
-	uuid_copy(new_inode.data_id, dir_data.id);
+#define TIMED_RW(op, call) TIMED(op, in_stats_dir(path) ? -EACCES : call)
 
-	//store directory fcb
-	int rc = unqlite_kv_store(pDb, new_inode.id, KEY_SIZE, &new_inode, sizeof(my_inode));
-	error_handle(rc);
+static int timed_getattr(const char *path, struct stat *stbuf)
+{
+	TIMED(OP_GETATTR, myfs_getattr(path, stbuf));
+}
 
-	//store directory data
-	rc = unqlite_kv_store(pDb, dir_data.id, KEY_SIZE, &dir_data, sizeof(dir_data_fcb));
-	error_handle(rc);
+static int timed_fgetattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi)
+{
+	TIMED(OP_FGETATTR, myfs_fgetattr(path, stbuf, fi));
+}
 
-	write_log("[SYST] mkdir: Made new directory '%s'\n", path);
+static int timed_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi)
+{
+	TIMED(OP_READDIR, myfs_readdir(path, buf, filler, offset, fi));
+}
 
+static int timed_open(const char *path, struct fuse_file_info *fi)
+{
+	TIMED(OP_OPEN, myfs_open(path, fi));
+}
 
-	//get parent fcb
-	my_inode parent_fcb;
-	rc = get_inode(path, &parent_fcb, 1);
-	if (rc < 0)
+static int timed_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+	unsigned long long start = stats_now();
+	int rc = myfs_read(path, buf, size, offset, fi);
+	stats_op(OP_READ, start, rc);
+	if (rc > 0 && !in_stats_dir(path))
 	{
-		parent_fcb = the_root_fcb;
+		stats_count(STAT_BYTES_READ, rc);
 	}
+	return rc;
+}
 
-	//update parent
-	rc = update_parent(&parent_fcb, new_inode.id, path);
-	if (rc < 0)
+static int timed_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+	unsigned long long start = stats_now();
+	int rc = in_stats_dir(path) ? -EACCES : myfs_write(path, buf, size, offset, fi);
+	stats_op(OP_WRITE, start, rc);
+	if (rc > 0)
 	{
-		return rc;
+		stats_count(STAT_BYTES_WRITTEN, rc);
 	}
-
-	write_log("[SYST] mkdir: End.\n");
-    return 0;
+	return rc;
 }
 
-// Delete a file.
-// Read 'man 2 unlink'.
-int myfs_unlink(const char *path)
+static int timed_create(const char *path, mode_t mode, struct fuse_file_info *fi)
 {
-	write_log("\n[SYST] unlink: path='%s'\n",path);
-
-	char* file_name = get_file_name(path);
+	TIMED_RW(OP_CREATE, myfs_create(path, mode, fi));
+}
 
-	my_inode parent;
-	int rc = get_inode(path, &parent, 1);
-	if (rc < 0)
-	{
-		return -ENOENT;
-	}
+static int timed_utime(const char *path, struct utimbuf *ubuf)
+{
+	TIMED_RW(OP_UTIME, myfs_utime(path, ubuf));
+}
 
-	dir_data_fcb parent_data;
-	fetch_from_db(parent.data_id, &parent_data, sizeof(dir_data_fcb));
+static int timed_utimens(const char *path, const struct timespec tv[2])
+{
+	TIMED_RW(OP_UTIMENS, myfs_utimens(path, tv));
+}
 
-	int found = 0;
-	for (int i = 0; i<MY_MAX_DIR_FILES; i++)
-	{
-		dir_entry* entry = &parent_data.entries[i];
+static int timed_access(const char *path, int mask)
+{
+	TIMED(OP_ACCESS, myfs_access(path, mask));
+}
 
-		if (strcmp(entry->filename, file_name) == 0)
-		{
-			found = 1;
+static int timed_truncate(const char *path, off_t newsize)
+{
+	TIMED_RW(OP_TRUNCATE, myfs_truncate(path, newsize));
+}
 
-			//memset to remove from parent's inode
-			memset(&entry->inode_id, 0, sizeof(uuid_t));
-			memset(&entry->filename, 0, MY_MAX_FILE_NAME);
-			break;
-		}
-	}
+static int timed_ftruncate(const char *path, off_t newsize, struct fuse_file_info *fi)
+{
+	TIMED(OP_FTRUNCATE, (path != NULL && in_stats_dir(path)) ? -EACCES : myfs_ftruncate(path, newsize, fi));
+}
 
-	if (found)
-	{
-		parent.mtime = time(NULL);
-		store_to_db(parent.id, &parent, sizeof(my_inode));
-		store_to_db(parent.data_id, &parent_data, sizeof(dir_data_fcb));
-		return 0;
-	}
-	else 
-	{
-		return -ENOENT;
-	}
+static int timed_fallocate(const char *path, int mode, off_t offset, off_t len, struct fuse_file_info *fi)
+{
+	TIMED(OP_FALLOCATE, (path != NULL && in_stats_dir(path)) ? -EACCES : myfs_fallocate(path, mode, offset, len, fi));
 }
 
+static int timed_ioctl(const char *path, int cmd, void *arg, struct fuse_file_info *fi, unsigned int flags, void *data)
+{
+	TIMED(OP_IOCTL, myfs_ioctl(path, cmd, arg, fi, flags, data));
+}
 
-// Delete a directory.
-// Read 'man 2 rmdir'.
-int myfs_rmdir(const char *path)
+static int timed_setxattr(const char *path, const char *name, const char *value, size_t size, int flags)
 {
-    write_log("\n[SYST] rmdir: path='%s'\n",path);
+	TIMED_RW(OP_SETXATTR, myfs_setxattr(path, name, value, size, flags));
+}
 
-    my_inode inode;
-    int rc = get_inode(path, &inode, 0);
+static int timed_getxattr(const char *path, const char *name, char *value, size_t size)
+{
+	TIMED(OP_GETXATTR, myfs_getxattr(path, name, value, size));
+}
 
-    if (rc < 0)
-    {
-    	write_log("[SYST] rmdir: - ENOENT\n");
-    	return -ENOENT;
-    }
-    else 
-    {
-    	//loop through directory contents
-    	dir_data_fcb dir_fcb;
-    	fetch_from_db(inode.data_id, &dir_fcb, sizeof(dir_data_fcb));
+static int timed_listxattr(const char *path, char *list, size_t size)
+{
+	TIMED(OP_LISTXATTR, myfs_listxattr(path, list, size));
+}
 
-    	int empty = 1;
-    	for (int i = 0; i < MY_MAX_DIR_FILES; i++)
-    	{
-    		dir_entry entry = dir_fcb.entries[i];
-    		if (strcmp(entry.filename, "") != 0)
-    		{
-    			empty = 0;
-    			break;	
-    		}
-    	}
+static int timed_removexattr(const char *path, const char *name)
+{
+	TIMED_RW(OP_REMOVEXATTR, myfs_removexattr(path, name));
+}
 
-    	if (empty)
-    	{
-    		return myfs_unlink(path);
-    	}
-    	else 
-    	{
-    		write_log("[SYST] rmdir: -ENOTEMPTY\n");
-    		return -ENOTEMPTY;
-    	}
-    }
+static int timed_mkdir(const char *path, mode_t mode)
+{
+	TIMED_RW(OP_MKDIR, myfs_mkdir(path, mode));
+}
 
+static int timed_flush(const char *path, struct fuse_file_info *fi)
+{
+	TIMED(OP_FLUSH, myfs_flush(path, fi));
+}
 
-    return 0;
+static int timed_release(const char *path, struct fuse_file_info *fi)
+{
+	TIMED(OP_RELEASE, myfs_release(path, fi));
 }
 
-// OPTIONAL - included as an example
-// Flush any cached data.
-int myfs_flush(const char *path, struct fuse_file_info *fi)
+static int timed_rmdir(const char *path)
 {
-    int retstat = 0;
+	TIMED_RW(OP_RMDIR, myfs_rmdir(path));
+}
 
-    write_log("myfs_flush(path=\"%s\", fi=0x%08x)\n", path, fi);
+static int timed_unlink(const char *path)
+{
+	TIMED_RW(OP_UNLINK, myfs_unlink(path));
+}
 
-    return retstat;
+static int timed_chown(const char *path, uid_t uid, gid_t gid)
+{
+	TIMED_RW(OP_CHOWN, myfs_chown(path, uid, gid));
 }
 
-// OPTIONAL - included as an example
-// Release the file. There will be one call to release for each call to open.
-int myfs_release(const char *path, struct fuse_file_info *fi)
+static int timed_chmod(const char *path, mode_t mode)
 {
-    int retstat = 0;
+	TIMED_RW(OP_CHMOD, myfs_chmod(path, mode));
+}
 
-    write_log("myfs_release(path=\"%s\", fi=0x%08x)\n", path, fi);
+static int timed_symlink(const char *target, const char *path)
+{
+	TIMED_RW(OP_SYMLINK, myfs_symlink(target, path));
+}
 
-    return retstat;
+static int timed_readlink(const char *path, char *buf, size_t size)
+{
+	TIMED(OP_READLINK, myfs_readlink(path, buf, size));
 }
 
-// OPTIONAL - included as an example
-// Open a file. Open should check if the operation is permitted for the given flags (fi->flags).
-// Read 'man 2 open'.
-static int myfs_open(const char *path, struct fuse_file_info *fi)
+static int timed_statfs(const char *path, struct statvfs *stbuf)
 {
-	// if (strcmp(path, the_root_fcb.path) != 0)
-	write_log("[SYST] open: (path\"%s\", fi=0x%08x)\n", path, fi);
+	TIMED(OP_STATFS, myfs_statfs(path, stbuf));
+}
 
-	//return -EACCES if the access is not permitted.
-	return 0;
+static int timed_link(const char *from, const char *to)
+{
+	TIMED(OP_LINK, (in_stats_dir(from) || in_stats_dir(to)) ? -EACCES : myfs_link(from, to));
 }
 
+static int timed_rename(const char *from, const char *to)
+{
+	TIMED(OP_RENAME, (in_stats_dir(from) || in_stats_dir(to)) ? -EACCES : myfs_rename(from, to));
+}
 
 static struct fuse_operations myfs_oper = 
 {
-	.getattr	= myfs_getattr,
-	.readdir	= myfs_readdir,
-	.open		= myfs_open,
-	.read		= myfs_read,
-	.create		= myfs_create,
-	.utime 		= myfs_utime,
-	.write		= myfs_write,
-	.truncate	= myfs_truncate,
-	.mkdir 		= myfs_mkdir,
-	.flush		= myfs_flush,
-	.release	= myfs_release,
-	.rmdir 		= myfs_rmdir,
-	.unlink 	= myfs_unlink,
-	.chown 		= myfs_chown,
-	.chmod 		= myfs_chmod,
+	.getattr	= timed_getattr,
+	.fgetattr	= timed_fgetattr,
+	.readdir	= timed_readdir,
+	.open		= timed_open,
+	.read		= timed_read,
+	.create		= timed_create,
+	.utime 		= timed_utime,
+	.utimens	= timed_utimens,
+	.access		= timed_access,
+	.write		= timed_write,
+	.truncate	= timed_truncate,
+	.ftruncate	= timed_ftruncate,
+	.mkdir 		= timed_mkdir,
+	.flush		= timed_flush,
+	.release	= timed_release,
+	.rmdir 		= timed_rmdir,
+	.unlink 	= timed_unlink,
+	.chown 		= timed_chown,
+	.chmod 		= timed_chmod,
+	.rename		= timed_rename,
+	.link		= timed_link,
+	.symlink	= timed_symlink,
+	.readlink	= timed_readlink,
+	.statfs		= timed_statfs,
+	.fallocate	= timed_fallocate,
+	.ioctl		= timed_ioctl,
+	.setxattr	= timed_setxattr,
+	.getxattr	= timed_getxattr,
+	.listxattr	= timed_listxattr,
+	.removexattr	= timed_removexattr,
+	.init		= myfs_init,
+	.destroy	= myfs_destroy,
+};
+
+//mount options understood by myfs, everything else is passed on to FUSE
+static struct fuse_opt myfs_opts[] =
+{
+	{"vacuum", offsetof(struct myfs_state, vacuum), 1},
+	{"vacuum_rate=%u", offsetof(struct myfs_state, vacuum_rate), 0},
+	{"mem", offsetof(struct myfs_state, mem), 1},
+	{"mem_size=%s", offsetof(struct myfs_state, mem_size), 0},
+	{"snapshot=%s", offsetof(struct myfs_state, snapshot), 0},
+	{"relatime", offsetof(struct myfs_state, atime), ATIME_RELATIME},
+	{"noatime", offsetof(struct myfs_state, atime), ATIME_NOATIME},
+	{"strictatime", offsetof(struct myfs_state, atime), ATIME_STRICT},
+	{"lazytime", offsetof(struct myfs_state, lazytime), 1},
+	FUSE_OPT_END
 };
 
 
+/**
+ * Takes the usage counters for statfs from the root object, or recounts the inodes and
+ * data blocks if the last mount did not write them back (after a crash, or in a store
+ * from before the counters). The root object says they are stale until the unmount.
+ */
+static void mount_usage()
+{
+	if (root_object.usage_valid)
+	{
+		unqlite_kv_config(pDb, UNQLITE_KV_CONFIG_FREE_PAGES, (unqlite_int64)root_object.free_pages);
+	}
+	else
+	{
+		//the free pages are counted by the store when statfs first asks for them
+		struct gc_stats stats;
+		if (gc_count_live(pDb, &stats) == UNQLITE_OK)
+		{
+			root_object.inodes = stats.inodes;
+			root_object.blocks = stats.blocks;
+		}
+		printf("init_fs: counted %llu inodes and %llu data blocks\n", root_object.inodes, root_object.blocks);
+	}
+
+	root_object.usage_valid = 0;
+	error_handle(write_root());
+}
+
+/**
+ * Writes the usage counters back to the root object.
+ */
+static void unmount_usage()
+{
+	unqlite_int64 free_pages;
+	int page_size;
+	if (unqlite_kv_config(pDb, UNQLITE_KV_CONFIG_GET_FREE_PAGES, &free_pages, &page_size) == UNQLITE_OK)
+	{
+		root_object.free_pages = free_pages;
+	}
+	root_object.usage_valid = 1;
+	write_root();
+}
+
 // Initialise the in-memory data structures from the store. If the root object (from the store) is empty then create a root fcb (directory)
 // and write it to the store. Note that this code is executed outide of fuse. If there is a failure then we have failed toi initlaise the
 // file system so exit with an error code.
@@ -995,23 +4142,25 @@ void init_fs()
 	printf("init_fs\n");
 	//Initialise the store.
 	init_store();
+	gc_orphans = open_orphans;
 	if(!root_is_empty)
 	{
 		printf("init_fs: root is not empty\n");
 
-		//error checking
-		unqlite_int64 nBytes;  //Data length.
-		rc = unqlite_kv_fetch(pDb, root_object.id, KEY_SIZE, NULL, &nBytes);
-		error_handle(rc);
-
-		if(nBytes!=sizeof(my_inode))
+		//Fetch the fcb that the root object points at. We will probably need it.
+		//Like any inode it may be in an older layout, or have extended attributes after it.
+		if (fetch_from_db(root_object.id, &the_root_fcb, sizeof(my_inode)) < 0)
 		{
-			printf("Data object has unexpected size. Doing nothing.\n");
+			printf("Root fcb not found. Doing nothing.\n");
 			exit(-1);
 		}
 
-		//Fetch the fcb that the root object points at. We will probably need it.
-		unqlite_kv_fetch(pDb, root_object.id, KEY_SIZE, &the_root_fcb, &nBytes);
+		//roots used to be made without search permission, which nothing checked before access()
+		if ((the_root_fcb.mode & ~S_IFMT) == (S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH))
+		{
+			the_root_fcb.mode |= S_IXUSR|S_IXGRP|S_IXOTH;
+			store_inode(&the_root_fcb);
+		}
 	}
 	else
 	{
@@ -1021,13 +4170,16 @@ void init_fs()
 
 		//See 'man 2 stat' and 'man 2 chmod'.
 
-		the_root_fcb.mode |= S_IFDIR|S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH;
-		time_t now = time(NULL);
-		the_root_fcb.mtime = now;
-		the_root_fcb.ctime = now;
+		the_root_fcb.mode |= S_IFDIR|S_IRWXU|S_IRGRP|S_IWGRP|S_IXGRP|S_IROTH|S_IXOTH;
+		struct timespec now = time_now();
+		SET_TIME(&the_root_fcb, mtime, now);
+		SET_TIME(&the_root_fcb, atime, now);
+		SET_TIME(&the_root_fcb, ctime, now);
+		the_root_fcb.version = MY_INODE_VERSION;
 		the_root_fcb.uid = getuid();
 		the_root_fcb.gid = getgid();
 		the_root_fcb.size = 0;
+		the_root_fcb.nlink = 2;
 
 
 		//create directory data of root
@@ -1051,17 +4203,80 @@ void init_fs()
 
 		printf("init_fs: writing updated root object\n");
 
-		//Store root object
+		//Store root object, with the usage of an empty file system
+		root_object.inodes = 1;
+		root_object.usage_valid = 1;
 		rc = write_root();
 	 	error_handle(rc);
 	}
+	mount_usage();
 }
 
 void shutdown_fs()
 {
+	unmount_usage();
+	if (snapshot_path != NULL)
+	{
+		save_snapshot(snapshot_path);
+	}
+
+	//allocator counters, for profiling
+	unqlite_mem_stats db_mem, lib_mem;
+	if (unqlite_config(pDb, UNQLITE_CONFIG_MEM_STATS, &db_mem, &lib_mem) == UNQLITE_OK)
+	{
+		write_log("[FUNC] shutdown_fs: db allocator heap=%lld/%lld pool=%lld/%lld\n",
+			db_mem.nHeapAlloc, db_mem.nHeapFree, db_mem.nPoolAlloc, db_mem.nPoolFree);
+		write_log("[FUNC] shutdown_fs: shared allocator heap=%lld/%lld pool=%lld/%lld cache hit=%lld fill=%lld flush=%lld lock=%lld wait=%lld\n",
+			lib_mem.nHeapAlloc, lib_mem.nHeapFree, lib_mem.nPoolAlloc, lib_mem.nPoolFree,
+			lib_mem.nCacheHit, lib_mem.nCacheFill, lib_mem.nCacheFlush, lib_mem.nLock, lib_mem.nLockWait);
+	}
 	unqlite_close(pDb);
 }
 
+/**
+ * Parses a size with an optional K, M or G suffix.
+ * Returns 0 for a malformed size.
+ */
+static unsigned long long parse_size(const char* text)
+{
+	char* end;
+	unsigned long long size = strtoull(text, &end, 10);
+	switch (*end)
+	{
+		case 'G': case 'g': size <<= 10; //fall through
+		case 'M': case 'm': size <<= 10; //fall through
+		case 'K': case 'k': size <<= 10; end++; break;
+		case '\0': break;
+		default: return 0;
+	}
+	return *end == '\0' ? size : 0;
+}
+
+/**
+ * Returns 'path' made absolute against the working directory, which FUSE leaves
+ * for "/" when it daemonises. Returns NULL if out of memory or the working
+ * directory cannot be found.
+ */
+static char* absolute_path(const char* path)
+{
+	if (path[0] == '/')
+	{
+		return strdup(path);
+	}
+	char cwd[PATH_MAX];
+	if (getcwd(cwd, sizeof(cwd)) == NULL)
+	{
+		return NULL;
+	}
+	size_t size = strlen(cwd) + strlen(path) + 2;
+	char* absolute = malloc(size);
+	if (absolute != NULL)
+	{
+		snprintf(absolute, size, "%s/%s", cwd, path);
+	}
+	return absolute;
+}
+
 int main(int argc, char *argv[])
 {
 	int fuserc;
@@ -1069,12 +4284,51 @@ int main(int argc, char *argv[])
 
 	//Setup the log file and store the FILE* in the private data object for the file system.
 	myfs_internal_state = malloc(sizeof(struct myfs_state));
+	memset(myfs_internal_state, 0, sizeof(struct myfs_state));
     myfs_internal_state->logfile = init_log_file();
+	myfs_internal_state->vacuum_rate = 4096;
+
+	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	if (fuse_opt_parse(&args, myfs_internal_state, myfs_opts, NULL) == -1)
+	{
+		return 1;
+	}
+
+	//A mount in RAM has no journal and nothing to sync. It may be saved to a snapshot when unmounted.
+	if (myfs_internal_state->mem)
+	{
+		store_path = MEMORY_STORE;
+		//the snapshot is saved from shutdown_fs, once FUSE has left this directory
+		if (myfs_internal_state->snapshot != NULL && (snapshot_path = absolute_path(myfs_internal_state->snapshot)) == NULL)
+		{
+			perror("myfs");
+			return 1;
+		}
+		if (myfs_internal_state->mem_size != NULL)
+		{
+			mem_limit = parse_size(myfs_internal_state->mem_size);
+			if (mem_limit == 0)
+			{
+				fprintf(stderr, "myfs: bad mem_size '%s'\n", myfs_internal_state->mem_size);
+				return 1;
+			}
+		}
+	}
+	else if ((store_path = absolute_path(store_path)) == NULL)
+	{
+		//the store, and the vacuum next to it, are opened again after FUSE has left this directory
+		perror("myfs");
+		return 1;
+	}
+
+	atime_mode = myfs_internal_state->atime;
+	lazytime = myfs_internal_state->lazytime;
 
 	//Initialise the file system. This is being done outside of fuse for ease of debugging.
 	init_fs();
 
-	fuserc = fuse_main(argc, argv, &myfs_oper, myfs_internal_state);
+	fuserc = fuse_main(args.argc, args.argv, &myfs_oper, myfs_internal_state);
+	fuse_opt_free_args(&args);
 
 	//Shutdown the file system.
 	shutdown_fs();
@@ -1,10 +1,16 @@
 #include "fs.h"
+#include <sys/ioctl.h>
 
 #define MY_MAX_PATH 100
 
 #define MY_MAX_DIR_FILES 32
 #define MY_MAX_FILE_NAME 255
 
+//a symbolic link's target is stored after its inode, in the same record
+#define MY_MAX_LINK_TARGET PATH_MAX
+//symbolic links followed by one lookup before it fails with ELOOP
+#define MY_MAX_LINK_DEPTH 40
+
 //Data sizes defined to be small for easier testing
 #define MY_MAX_DATA_SIZE 4
 #define MY_MAX_DIRECT_BLOCKS 8
@@ -15,6 +21,23 @@
 
 #define FLOOR(x,y) ((x > y) ? y : x)
 
+//lseek() SEEK_DATA and SEEK_HOLE on an open file, which FUSE 2 does not pass on,
+//as ioctl()s that take the offset to start at and return the one found
+#define MYFS_IOC_SEEK_DATA _IOWR('m', 1, off_t)
+#define MYFS_IOC_SEEK_HOLE _IOWR('m', 2, off_t)
+
+//copies 'length' bytes (0 for the rest of the file) at 'src_offset' of the file 'src', a path
+//in the file system, to 'dst_offset' of the open file. Whole blocks at the same position in a
+//block on both sides are shared, not copied. 'length' is set to the bytes copied.
+struct myfs_clone_range
+{
+	char src[MY_MAX_PATH];
+	off_t src_offset;
+	off_t length;
+	off_t dst_offset;
+};
+#define MYFS_IOC_CLONE_RANGE _IOWR('m', 3, struct myfs_clone_range)
+
 
 /* Inode struct */
 typedef struct my_inode
@@ -27,13 +50,34 @@ typedef struct my_inode
 	uid_t uid;
 	gid_t gid;
 	mode_t mode;
+
+	//MY_INODE_VERSION, or 0 (what was padding here) for an inode stored in an older layout
+	uint32_t version;
+
 	time_t mtime;	
 	time_t atime;
 	time_t ctime;
 	off_t size;
 
+	//directory entries naming the inode, 2 plus the subdirectories for a directory
+	nlink_t nlink;
+
+	//nanoseconds of the times
+	uint32_t mtime_nsec;
+	uint32_t atime_nsec;
+	uint32_t ctime_nsec;
+
 } my_inode;
 
+//size of the inodes stored before 'nlink' was added, which are read as having the usual link count
+#define MY_INODE_V1_SIZE offsetof(my_inode, nlink)
+//size of the inodes stored before the nanoseconds were added, which are read as whole seconds
+#define MY_INODE_V2_SIZE offsetof(my_inode, mtime_nsec)
+#define MY_INODE_VERSION 3
+
+//bytes 'inode' takes at the start of its record, before a link target and the extended attributes
+#define MY_INODE_SIZE(inode) ((inode)->version == MY_INODE_VERSION ? sizeof(my_inode) : MY_INODE_V2_SIZE)
+
 
 /*
  * File data structs 
@@ -41,10 +85,15 @@ typedef struct my_inode
 typedef struct data_block
 {
 	uuid_t id;
-	size_t size;
+
+	//bytes in use and other files sharing the block since a clone, which a write copies it away from.
+	//Stores from before clones had a size_t size here, whose high half (on x86) reads as no shares.
+	uint32_t size;
+	uint32_t shares;
+
 	uint8_t data[MY_MAX_DATA_SIZE];
 
-} data_block;
+} __attribute__((aligned(8))) data_block;
 
 typedef struct direct_block
 {
@@ -87,4 +136,106 @@ typedef struct dir_data_fcb
 	//array of dir_entries
 	dir_entry entries[MY_MAX_DIR_FILES];
 
-} dir_data_fcb;
\ No newline at end of file
+} dir_data_fcb;
+
+/*
+ * Extended attributes.
+ * An inode's attributes are a table after it in its record, after the target for a
+ * symbolic link. Each entry is an xattr_entry, the name, then the value, or for a value
+ * longer than MY_MAX_XATTR_INLINE the id of a record that holds it.
+ */
+#define MY_MAX_XATTR_NAME 255
+#define MY_MAX_XATTR_VALUE 4096
+#define MY_MAX_XATTR_INLINE 32
+#define MY_MAX_XATTR_TABLE 1024
+
+typedef struct xattr_entry
+{
+	uint8_t name_len;
+
+	//the value is in a record of its own, whose id follows the name
+	uint8_t external;
+
+	uint16_t value_size;
+
+} xattr_entry;
+
+//bytes taken in the table by an entry
+#define XATTR_ENTRY_SIZE(e) (sizeof(xattr_entry) + (e).name_len + ((e).external ? KEY_SIZE : (e).value_size))
+
+/*
+ * Garbage collection (gc.c)
+ */
+struct gc_stats
+{
+	//records copied to the new database
+	unsigned long records;
+
+	//inodes reachable from the root
+	unsigned long inodes;
+
+	//data blocks reachable from the root
+	unsigned long blocks;
+
+	//keys and values copied
+	unsigned long long bytes;
+};
+
+int gc_copy_live(unqlite* src, unqlite* dst, struct gc_stats* stats);
+int gc_count_live(unqlite* src, struct gc_stats* stats);
+int gc_compact(const char* path, struct gc_stats* stats);
+
+void gc_mirror_store(const void* key, int key_size, const void* data, size_t size);
+void gc_mirror_delete(const void* key, int key_size);
+void gc_mirror_overwrite(const void* key, int key_size, size_t offset, const void* data, size_t size);
+int gc_vacuum_start(unsigned rate);
+void gc_vacuum_wait(int abandon);
+
+//set by the file system: calls 'visit' for every inode that is open but no longer linked from a directory
+extern void (*gc_orphans)(void (*visit)(uuid_t id, void* arg), void* arg);
+
+/*
+ * Per-thread scratch arena for the FUSE handlers (arena.c)
+ */
+struct arena_chunk;
+typedef struct arena_mark
+{
+	struct arena_chunk* chunk;
+	size_t used;
+} arena_mark;
+
+void* arena_alloc(size_t size);
+char* arena_strdup(const char* str);
+arena_mark arena_save(void);
+void arena_restore(arena_mark mark);
+
+/*
+ * Metrics (stats.c), served read-only at STATS_FILE
+ */
+#define STATS_DIR "/.myfs"
+#define STATS_FILE "/.myfs/stats"
+
+//FUSE entry points that are timed
+enum stats_op
+{
+	OP_GETATTR, OP_READDIR, OP_OPEN, OP_READ, OP_CREATE, OP_UTIME, OP_WRITE, OP_TRUNCATE,
+	OP_MKDIR, OP_FLUSH, OP_RELEASE, OP_RMDIR, OP_UNLINK, OP_CHOWN, OP_CHMOD,
+	OP_RENAME, OP_LINK, OP_SYMLINK, OP_READLINK, OP_FGETATTR, OP_FTRUNCATE, OP_STATFS,
+	OP_FALLOCATE, OP_IOCTL, OP_SETXATTR, OP_GETXATTR, OP_LISTXATTR, OP_REMOVEXATTR, OP_UTIMENS,
+	OP_ACCESS,
+	OP_COUNT
+};
+
+enum stats_counter
+{
+	STAT_KV_FETCH, STAT_KV_STORE, STAT_KV_DELETE, STAT_BYTES_READ, STAT_BYTES_WRITTEN,
+	STAT_COUNT
+};
+
+//log2 latency buckets in ns, the last one also counts everything slower (2^31 ns is about 2 s)
+#define STATS_BUCKETS 32
+
+unsigned long long stats_now(void);
+void stats_op(enum stats_op op, unsigned long long start, int rc);
+void stats_count(enum stats_counter counter, unsigned long long n);
+char* stats_render(size_t* len);
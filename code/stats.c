@@ -0,0 +1,226 @@
+#include "myfs.h"
+#include <stdarg.h>
+
+/*
+ * Hot path metrics.
+ *
+ * The FUSE entry points and the store helpers bump relaxed atomic counters,
+ * which costs a few nanoseconds per call, so the metrics are always on.
+ * stats_render() formats them together with the unqlite pager and allocator
+ * counters in the Prometheus text format. The file system serves that text
+ * read-only at STATS_FILE.
+ */
+
+static const char* op_names[OP_COUNT] =
+{
+	"getattr", "readdir", "open", "read", "create", "utime", "write", "truncate",
+	"mkdir", "flush", "release", "rmdir", "unlink", "chown", "chmod",
+	"rename", "link", "symlink", "readlink", "fgetattr", "ftruncate", "statfs",
+	"fallocate", "ioctl", "setxattr", "getxattr", "listxattr", "removexattr", "utimens",
+	"access",
+};
+
+static const char* counter_names[STAT_COUNT] =
+{
+	"myfs_kv_fetch_total",
+	"myfs_kv_store_total",
+	"myfs_kv_delete_total",
+	"myfs_read_bytes_total",
+	"myfs_written_bytes_total",
+};
+
+struct op_stats
+{
+	unsigned long long calls;
+	unsigned long long errors;
+	unsigned long long ns;
+	//latency histogram, bucket i counts calls that took [2^i, 2^(i+1)) ns
+	unsigned long long buckets[STATS_BUCKETS];
+};
+
+static struct op_stats ops[OP_COUNT];
+static unsigned long long counters[STAT_COUNT];
+
+#define STAT_ADD(var, n) __atomic_fetch_add(&(var), (n), __ATOMIC_RELAXED)
+#define STAT_GET(var) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+
+/**
+ * Returns a monotonic time stamp in nanoseconds.
+ */
+unsigned long long stats_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Records one call of 'op' that started at 'start' (from stats_now()) and returned 'rc'.
+ */
+void stats_op(enum stats_op op, unsigned long long start, int rc)
+{
+	unsigned long long ns = stats_now() - start;
+	int bucket = (ns == 0) ? 0 : 63 - __builtin_clzll(ns);
+	if (bucket >= STATS_BUCKETS)
+	{
+		bucket = STATS_BUCKETS - 1;
+	}
+
+	STAT_ADD(ops[op].calls, 1);
+	STAT_ADD(ops[op].ns, ns);
+	STAT_ADD(ops[op].buckets[bucket], 1);
+	if (rc < 0)
+	{
+		STAT_ADD(ops[op].errors, 1);
+	}
+}
+
+/**
+ * Adds 'n' to 'counter'.
+ */
+void stats_count(enum stats_counter counter, unsigned long long n)
+{
+	STAT_ADD(counters[counter], n);
+}
+
+//appends printf style text to a growing buffer
+struct text
+{
+	char* data;
+	size_t len;
+	size_t size;
+};
+
+static void append(struct text* text, const char* format, ...)
+{
+	va_list args;
+	for (;;)
+	{
+		va_start(args, format);
+		int n = vsnprintf(text->data + text->len, text->size - text->len, format, args);
+		va_end(args);
+		if (n < 0)
+		{
+			return;
+		}
+		if (text->len + n < text->size)
+		{
+			text->len += n;
+			return;
+		}
+		size_t size = text->size * 2 + n;
+		char* data = realloc(text->data, size);
+		if (data == NULL)
+		{
+			return;
+		}
+		text->data = data;
+		text->size = size;
+	}
+}
+
+//appends one sample and the TYPE line that precedes it, 'type' is "counter" or "gauge"
+static void append_metric(struct text* text, const char* name, const char* type, unsigned long long value)
+{
+	append(text, "# TYPE %s %s\n%s %llu\n", name, type, name, value);
+}
+
+static void render_ops(struct text* text)
+{
+	append(text, "# TYPE myfs_op_latency_ns histogram\n");
+	for (int op = 0; op < OP_COUNT; op++)
+	{
+		struct op_stats* s = &ops[op];
+		if (STAT_GET(s->calls) == 0)
+		{
+			continue;
+		}
+
+		//cumulative buckets, only those that add calls are printed
+		unsigned long long total = 0;
+		for (int b = 0; b < STATS_BUCKETS; b++)
+		{
+			unsigned long long n = STAT_GET(s->buckets[b]);
+			if (n == 0)
+			{
+				continue;
+			}
+			total += n;
+			append(text, "myfs_op_latency_ns_bucket{op=\"%s\",le=\"%llu\"} %llu\n",
+				op_names[op], (2ULL << b) - 1, total);
+		}
+		append(text, "myfs_op_latency_ns_bucket{op=\"%s\",le=\"+Inf\"} %llu\n", op_names[op], total);
+		append(text, "myfs_op_latency_ns_sum{op=\"%s\"} %llu\n", op_names[op], STAT_GET(s->ns));
+		append(text, "myfs_op_latency_ns_count{op=\"%s\"} %llu\n", op_names[op], total);
+	}
+
+	//a family is printed in one piece, after the histogram rather than inside it
+	append(text, "# TYPE myfs_op_errors_total counter\n");
+	for (int op = 0; op < OP_COUNT; op++)
+	{
+		if (STAT_GET(ops[op].calls) != 0)
+		{
+			append(text, "myfs_op_errors_total{op=\"%s\"} %llu\n", op_names[op], STAT_GET(ops[op].errors));
+		}
+	}
+}
+
+static void render_store(struct text* text)
+{
+	unqlite_pager_stats pager;
+	unqlite_mem_stats mem;
+	int rc;
+
+	pthread_mutex_lock(&db_lock);
+	rc = unqlite_config(pDb, UNQLITE_CONFIG_PAGER_STATS, &pager);
+	if (rc == UNQLITE_OK)
+	{
+		rc = unqlite_config(pDb, UNQLITE_CONFIG_MEM_STATS, NULL, &mem);
+	}
+	pthread_mutex_unlock(&db_lock);
+	if (rc != UNQLITE_OK)
+	{
+		return;
+	}
+
+	append_metric(text, "myfs_pager_hits_total", "counter", pager.nHit);
+	append_metric(text, "myfs_pager_misses_total", "counter", pager.nMiss);
+	append_metric(text, "myfs_commits_total", "counter", pager.nCommit);
+	append_metric(text, "myfs_dirty_commits_total", "counter", pager.nDirtyCommit);
+	append_metric(text, "myfs_commit_us_sum", "counter", pager.nCommitUsec);
+	//the longest commit so far is a level, not a running count
+	append_metric(text, "myfs_commit_us_max", "gauge", pager.nMaxCommitUsec);
+	append_metric(text, "myfs_alloc_pool_total", "counter", mem.nPoolAlloc);
+	append_metric(text, "myfs_alloc_heap_total", "counter", mem.nHeapAlloc);
+	append_metric(text, "myfs_alloc_lock_waits_total", "counter", mem.nLockWait);
+	append_metric(text, "myfs_inodes", "gauge", __atomic_load_n(&root_object.inodes, __ATOMIC_RELAXED));
+	append_metric(text, "myfs_data_blocks", "gauge", __atomic_load_n(&root_object.blocks, __ATOMIC_RELAXED));
+	if (mem_limit != 0)
+	{
+		append_metric(text, "myfs_mem_used_bytes", "gauge", mem_used);
+		append_metric(text, "myfs_mem_limit_bytes", "gauge", mem_limit);
+	}
+}
+
+/**
+ * Formats every metric as text.
+ * Returns a buffer to free() and its length in 'len', or NULL if out of memory.
+ */
+char* stats_render(size_t* len)
+{
+	struct text text = {malloc(4096), 0, 4096};
+	if (text.data == NULL)
+	{
+		return NULL;
+	}
+
+	render_ops(&text);
+	for (int c = 0; c < STAT_COUNT; c++)
+	{
+		append_metric(&text, counter_names[c], "counter", STAT_GET(counters[c]));
+	}
+	render_store(&text);
+
+	*len = text.len;
+	return text.data;
+}
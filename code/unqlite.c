@@ -229,6 +229,15 @@ typedef struct unqlite unqlite;
  * UNQLITE_ENABLE_JX9_HASH_IO
  * If this directive is enabled, built-in hash functions such as md5(), sha1(), md5_file(), crc32(), etc.
  * are included in the build.
+ *
+ * UNQLITE_ENABLE_IO_URING
+ *  If this directive is enabled (Linux only), an io_uring backed VFS is included in the build.
+ *  Writes are queued in memory and submitted to the kernel as a single batch when the file
+ *  is synced, the fsync being ordered after the queued writes so that a whole commit costs
+ *  one submission round-trip per file. The VFS is obtained via unqlite_lib_uring_vfs() and
+ *  installed using unqlite_lib_config() with a configuration verb set to UNQLITE_LIB_CONFIG_VFS.
+ *  Files for which the kernel refuses to set up a ring silently fall back to the built-in
+ *  UNIX I/O methods.
  */
 /* Symisc public definitions */
 #if !defined(SYMISC_STANDARD_DEFS)
@@ -464,6 +473,47 @@ typedef sxi64 unqlite_int64;
 #define UNQLITE_CONFIG_KV_ENGINE           4  /* ONE ARGUMENT: const char *zKvName */
 #define UNQLITE_CONFIG_DISABLE_AUTO_COMMIT 5  /* NO ARGUMENTS */
 #define UNQLITE_CONFIG_GET_KV_NAME         6  /* ONE ARGUMENT: const char **pzPtr */
+#define UNQLITE_CONFIG_MEM_STATS           7  /* TWO ARGUMENTS: unqlite_mem_stats *pDbStats, unqlite_mem_stats *pLibStats */
+#define UNQLITE_CONFIG_PAGER_STATS         8  /* ONE ARGUMENT: unqlite_pager_stats *pStats */
+/*
+ * Page cache and transaction counters, filled by
+ * unqlite_config(pDb,UNQLITE_CONFIG_PAGER_STATS,&sStats).
+ * Counters are cumulative since the database was opened. Commit times are in
+ * microseconds and stay 0 on platforms without a suitable clock.
+ */
+typedef struct unqlite_pager_stats unqlite_pager_stats;
+struct unqlite_pager_stats
+{
+	unqlite_int64 nHit;           /* Page requests served from the page cache */
+	unqlite_int64 nMiss;          /* Page requests that had to load the page */
+	unqlite_int64 nCommit;        /* Write transactions committed */
+	unqlite_int64 nCommitUsec;    /* Total time of the nCommit commits, syncs and journal deletes included */
+	unqlite_int64 nMaxCommitUsec; /* Longest of the nCommit commits */
+	unqlite_int64 nDirtyCommit;   /* Hot dirty pages flushed early because the page cache filled up */
+	unqlite_int64 nPage;          /* Pages in the database file, a gauge rather than a counter */
+};
+/*
+ * Memory allocator counters.
+ *
+ * unqlite_config(pDb,UNQLITE_CONFIG_MEM_STATS,&sDb,&sLib) fills sDb with the counters of
+ * the allocator private to the database handle (pager pages, cursors, VM) and sLib with
+ * those of the allocator shared by all handles. Either pointer may be NULL.
+ * Counters are cumulative. Pool requests served by a per-thread cache are added to the
+ * totals the next time that cache refills from or flushes to the shared pool.
+ */
+typedef struct unqlite_mem_stats unqlite_mem_stats;
+struct unqlite_mem_stats
+{
+	unqlite_int64 nHeapAlloc;  /* Blocks taken from the underlying allocator (malloc() by default) */
+	unqlite_int64 nHeapFree;   /* Blocks given back to the underlying allocator */
+	unqlite_int64 nPoolAlloc;  /* Small chunks handed out by the pool allocator */
+	unqlite_int64 nPoolFree;   /* Small chunks returned to the pool allocator */
+	unqlite_int64 nCacheHit;   /* Pool requests served by a per-thread cache without locking */
+	unqlite_int64 nCacheFill;  /* Batches moved from the shared pool to a per-thread cache */
+	unqlite_int64 nCacheFlush; /* Batches moved from a per-thread cache back to the shared pool */
+	unqlite_int64 nLock;       /* Times the allocator mutex was taken */
+	unqlite_int64 nLockWait;   /* Times the allocator mutex was already held by another thread */
+};
 /*
  * UnQLite/Jx9 Virtual Machine Configuration Commands.
  *
@@ -509,6 +559,9 @@ typedef sxi64 unqlite_int64;
  */
 #define UNQLITE_KV_CONFIG_HASH_FUNC  1 /* ONE ARGUMENT: unsigned int (*xHash)(const void *,unsigned int) */
 #define UNQLITE_KV_CONFIG_CMP_FUNC   2 /* ONE ARGUMENT: int (*xCmp)(const void *,const void *,unsigned int) */
+#define UNQLITE_KV_CONFIG_FIXED_KEY_SIZE 3 /* ONE ARGUMENT: unsigned int nKeyLen (1..255, 0 for variable length keys) */
+#define UNQLITE_KV_CONFIG_FREE_PAGES     4 /* ONE ARGUMENT: unqlite_int64 nPage, length of the free page list recorded by the caller */
+#define UNQLITE_KV_CONFIG_GET_FREE_PAGES 5 /* TWO ARGUMENTS: unqlite_int64 *pnPage, int *pPageSize */
 /*
  * Global Library Configuration Commands.
  *
@@ -634,9 +687,14 @@ struct unqlite_file {
  * the file. The sector size is the minimum write that can be performed without
  * disturbing other bytes in the file.
  *
+ * The xWritev() method is only available when iVersion is 2 or greater and may be NULL.
+ * It writes nBuf buffers of iAmt bytes each to consecutive locations of the file starting
+ * at offset iOfst (i.e. a run of contiguous database pages) using as few system calls as
+ * possible. When it is not available, UnQLite falls back to one xWrite() call per buffer.
+ *
  */
 struct unqlite_io_methods {
-  int iVersion;                 /* Structure version number (currently 1) */
+  int iVersion;                 /* Structure version number (currently 2) */
   int (*xClose)(unqlite_file*);
   int (*xRead)(unqlite_file*, void*, unqlite_int64 iAmt, unqlite_int64 iOfst);
   int (*xWrite)(unqlite_file*, const void*, unqlite_int64 iAmt, unqlite_int64 iOfst);
@@ -647,6 +705,8 @@ struct unqlite_io_methods {
   int (*xUnlock)(unqlite_file*, int);
   int (*xCheckReservedLock)(unqlite_file*, int *pResOut);
   int (*xSectorSize)(unqlite_file*);
+  /* Methods above are valid for version 1 */
+  int (*xWritev)(unqlite_file*, const void **apBuf, int nBuf, unqlite_int64 iAmt, unqlite_int64 iOfst);
 };
 /*
  * CAPIREF: OS Interface Object
@@ -814,13 +874,19 @@ struct unqlite_kv_engine
  * object.
  * Registration of a Key/Value storage engine at run-time is done via [unqlite_lib_config()]
  * with a configuration verb set to UNQLITE_LIB_CONFIG_STORAGE_ENGINE.
+ *
+ * The xDataRange() and xOverwrite() methods are only available when iVersion is 2 or greater
+ * and may be NULL. xDataRange() consumes at most nLen bytes of the cursor's data starting at
+ * offset iOfft. xOverwrite() replaces nLen bytes of the cursor's data starting at offset iOfft
+ * in place; the range must lie within the data. When they are not available, UnQLite falls
+ * back to xData() and to rewriting the whole record.
  */
 struct unqlite_kv_methods
 {
   const char *zName; /* Storage engine name [i.e. Hash, B+tree, LSM, R-tree, Mem, etc.]*/
   int szKv;          /* 'unqlite_kv_engine' subclass size */
   int szCursor;      /* 'unqlite_kv_cursor' subclass size */
-  int iVersion;      /* Structure version, currently 1 */
+  int iVersion;      /* Structure version, currently 2 */
   /* Storage engine methods */
   int (*xInit)(unqlite_kv_engine *,int iPageSize);
   void (*xRelease)(unqlite_kv_engine *);
@@ -850,6 +916,10 @@ struct unqlite_kv_methods
   int (*xData)(unqlite_kv_cursor *,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData);
   void (*xReset)(unqlite_kv_cursor *);
   void (*xCursorRelease)(unqlite_kv_cursor *);
+  /* Methods above are in version 1 of the structure. Methods below are added in version 2 */
+  int (*xDataRange)(unqlite_kv_cursor *,unqlite_int64 iOfft,unqlite_int64 nLen,
+	  int (*xConsumer)(const void *,unsigned int,void *),void *pUserData);
+  int (*xOverwrite)(unqlite_kv_cursor *,unqlite_int64 iOfft,const void *pData,unqlite_int64 nLen);
 };
 /*
  * UnQLite journal file suffix.
@@ -886,6 +956,10 @@ UNQLITE_APIEXPORT int unqlite_kv_append_fmt(unqlite *pDb,const void *pKey,int nK
 UNQLITE_APIEXPORT int unqlite_kv_fetch(unqlite *pDb,const void *pKey,int nKeyLen,void *pBuf,unqlite_int64 /* in|out */*pBufLen);
 UNQLITE_APIEXPORT int unqlite_kv_fetch_callback(unqlite *pDb,const void *pKey,
 	                    int nKeyLen,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData);
+UNQLITE_APIEXPORT int unqlite_kv_fetch_range(unqlite *pDb,const void *pKey,int nKeyLen,
+	                    unqlite_int64 iOfft,void *pBuf,unqlite_int64 /* in|out */*pBufLen);
+UNQLITE_APIEXPORT int unqlite_kv_overwrite(unqlite *pDb,const void *pKey,int nKeyLen,
+	                    unqlite_int64 iOfft,const void *pData,unqlite_int64 nDataLen);
 UNQLITE_APIEXPORT int unqlite_kv_delete(unqlite *pDb,const void *pKey,int nKeyLen);
 UNQLITE_APIEXPORT int unqlite_kv_config(unqlite *pDb,int iOp,...);
 
@@ -925,6 +999,7 @@ UNQLITE_APIEXPORT int unqlite_util_load_mmaped_file(const char *zFile,void **ppM
 UNQLITE_APIEXPORT int unqlite_util_release_mmaped_file(void *pMap,unqlite_int64 iFileSize);
 UNQLITE_APIEXPORT int unqlite_util_random_string(unqlite *pDb,char *zBuf,unsigned int buf_size);
 UNQLITE_APIEXPORT unsigned int unqlite_util_random_num(unqlite *pDb);
+UNQLITE_APIEXPORT unsigned int unqlite_util_fast_hash(const void *pKey,unsigned int nLen);
 
 /* In-process extending interfaces */
 UNQLITE_APIEXPORT int unqlite_create_function(unqlite_vm *pVm,const char *zName,int (*xFunc)(unqlite_context *,int,unqlite_value **),void *pUserData);
@@ -1020,6 +1095,7 @@ UNQLITE_APIEXPORT const char * unqlite_lib_version(void);
 UNQLITE_APIEXPORT const char * unqlite_lib_signature(void);
 UNQLITE_APIEXPORT const char * unqlite_lib_ident(void);
 UNQLITE_APIEXPORT const char * unqlite_lib_copyright(void);
+UNQLITE_APIEXPORT const unqlite_vfs * unqlite_lib_uring_vfs(void);
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -1745,6 +1821,22 @@ union SyMemHeader
 	SyMemHeader *pNext; /* Next chunk of size 1 << (nBucket + SXMEM_POOL_INCR) in the list */
 	sxu32 nBucket;      /* Bucket index in aPool[] */
 };
+/*
+ * Allocation counters of a memory backend.
+ */
+typedef struct SyMemStats SyMemStats;
+struct SyMemStats
+{
+	sxu64 nHeapAlloc;  /* Blocks taken from the underlying allocator */
+	sxu64 nHeapFree;   /* Blocks given back to the underlying allocator */
+	sxu64 nPoolAlloc;  /* Pool chunks handed out */
+	sxu64 nPoolFree;   /* Pool chunks returned */
+	sxu64 nCacheHit;   /* Pool requests served by a per-thread cache without locking */
+	sxu64 nCacheFill;  /* Batches moved from the shared pool to a per-thread cache */
+	sxu64 nCacheFlush; /* Batches moved from a per-thread cache back to the shared pool */
+	sxu64 nLock;       /* Times the backend mutex was taken */
+	sxu64 nLockWait;   /* Times the backend mutex was already held (needs xTryEnter) */
+};
 struct SyMemBackend
 {
 	const SyMutexMethods *pMutexMethods; /* Mutex methods */
@@ -1756,6 +1848,8 @@ struct SyMemBackend
 	SyMutex *pMutex;               /* Per instance mutex */
 	sxu32 nMagic;                  /* Sanity check against misuse */
 	SyMemHeader *apPool[SXMEM_POOL_NBUCKETS+SXMEM_POOL_INCR]; /* Pool of memory chunks */
+	sxu32 nCacheId;                /* Per-thread pool cache tag, 0 if this backend is not cached */
+	SyMemStats sStats;             /* Allocation counters */
 };
 /* Mutex types */
 #define SXMUTEX_TYPE_FAST	1
@@ -3164,6 +3258,7 @@ JX9_PRIVATE sxi32 SyMemBackendRelease(SyMemBackend *pBackend);
 JX9_PRIVATE sxi32 SyMemBackendInitFromOthers(SyMemBackend *pBackend, const SyMemMethods *pMethods, ProcMemError xMemErr, void *pUserData);
 JX9_PRIVATE sxi32 SyMemBackendInit(SyMemBackend *pBackend, ProcMemError xMemErr, void *pUserData);
 JX9_PRIVATE sxi32 SyMemBackendInitFromParent(SyMemBackend *pBackend,const SyMemBackend *pParent);
+JX9_PRIVATE void SyMemBackendGetStats(SyMemBackend *pBackend, SyMemStats *pStats);
 #if 0
 /* Not used in the current release of the JX9 engine */
 JX9_PRIVATE void *SyMemBackendPoolRealloc(SyMemBackend *pBackend, void *pOld, sxu32 nByte);
@@ -3482,13 +3577,20 @@ UNQLITE_PRIVATE sxi32 FastJsonDecode(
 	);
 /* vfs.c [io_win.c, io_unix.c ] */
 UNQLITE_PRIVATE const unqlite_vfs * unqliteExportBuiltinVfs(void);
+#if defined(__UNIXES__)
+UNQLITE_PRIVATE const unqlite_vfs * unqliteExportUringVfs(void);
+#endif
 /* mem_kv.c */
 UNQLITE_PRIVATE const unqlite_kv_methods * unqliteExportMemKvStorage(void);
+/* skiplist_kv.c */
+UNQLITE_PRIVATE const unqlite_kv_methods * unqliteExportSkipListKvStorage(void);
 /* lhash_kv.c */
 UNQLITE_PRIVATE const unqlite_kv_methods * unqliteExportDiskKvStorage(void);
+UNQLITE_PRIVATE sxu32 unqliteFastHash(const void *pSrc,sxu32 nLen);
 /* os.c */
 UNQLITE_PRIVATE int unqliteOsRead(unqlite_file *id, void *pBuf, unqlite_int64 amt, unqlite_int64 offset);
 UNQLITE_PRIVATE int unqliteOsWrite(unqlite_file *id, const void *pBuf, unqlite_int64 amt, unqlite_int64 offset);
+UNQLITE_PRIVATE int unqliteOsWritev(unqlite_file *id, const void **apBuf, int nBuf, unqlite_int64 amt, unqlite_int64 offset);
 UNQLITE_PRIVATE int unqliteOsTruncate(unqlite_file *id, unqlite_int64 size);
 UNQLITE_PRIVATE int unqliteOsSync(unqlite_file *id, int flags);
 UNQLITE_PRIVATE int unqliteOsFileSize(unqlite_file *id, unqlite_int64 *pSize);
@@ -3523,9 +3625,11 @@ UNQLITE_PRIVATE int unqlitePagerOpen(
   unsigned int iFlags      /* flags controlling this file */
   );
 UNQLITE_PRIVATE int unqlitePagerRegisterKvEngine(Pager *pPager,unqlite_kv_methods *pMethods);
+UNQLITE_PRIVATE int unqlitePagerSwitchKvEngine(Pager *pPager,unqlite_kv_methods *pMethods);
 UNQLITE_PRIVATE unqlite_kv_engine * unqlitePagerGetKvEngine(unqlite *pDb);
 UNQLITE_PRIVATE int unqlitePagerBegin(Pager *pPager);
 UNQLITE_PRIVATE int unqlitePagerCommit(Pager *pPager);
+UNQLITE_PRIVATE void unqlitePagerGetStats(Pager *pPager,unqlite_pager_stats *pStats);
 UNQLITE_PRIVATE int unqlitePagerRollback(Pager *pPager,int bResetKvEngine);
 UNQLITE_PRIVATE void unqlitePagerRandomString(Pager *pPager,char *zBuf,sxu32 nLen);
 UNQLITE_PRIVATE sxu32 unqlitePagerRandomNum(Pager *pPager);
@@ -3829,10 +3933,12 @@ static sxi32 unqliteCoreInitialize(void)
 	if( sUnqlMPGlobal.nMagic == UNQLITE_LIB_MAGIC ){
 		return UNQLITE_OK; /* Already initialized */
 	}
-	/* Point to the built-in vfs */
-	pVfs = unqliteExportBuiltinVfs();
-	/* Install it */
-	unqlite_lib_config(UNQLITE_LIB_CONFIG_VFS, pVfs);
+	if( sUnqlMPGlobal.pVfs == 0 ){
+		/* No vfs was installed via UNQLITE_LIB_CONFIG_VFS, point to the built-in vfs */
+		pVfs = unqliteExportBuiltinVfs();
+		/* Install it */
+		unqlite_lib_config(UNQLITE_LIB_CONFIG_VFS, pVfs);
+	}
 #if defined(UNQLITE_ENABLE_THREADS)
 	if( sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_SINGLE ){
 		pMutexMethods = sUnqlMPGlobal.pMutexMethods;
@@ -3880,6 +3986,9 @@ static sxi32 unqliteCoreInitialize(void)
 		/* Install the built-in Key Value storage engines */
 		pMethods = unqliteExportMemKvStorage(); /* In-memory storage */
 		unqlite_lib_config(UNQLITE_LIB_CONFIG_STORAGE_ENGINE,pMethods);
+		/* Ordered in-memory storage */
+		pMethods = unqliteExportSkipListKvStorage();
+		unqlite_lib_config(UNQLITE_LIB_CONFIG_STORAGE_ENGINE,pMethods);
 		/* Default disk key/value storage engine */
 		pMethods = unqliteExportDiskKvStorage(); /* Disk storage */
 		unqlite_lib_config(UNQLITE_LIB_CONFIG_STORAGE_ENGINE,pMethods);
@@ -4066,6 +4175,20 @@ const char * unqlite_lib_copyright(void)
 {
 	return UNQLITE_COPYRIGHT;
 }
+/*
+ * [CAPIREF: unqlite_lib_uring_vfs()]
+ * Return the io_uring backed VFS if it was compiled in (UNQLITE_ENABLE_IO_URING)
+ * and the host supports it. NULL otherwise.
+ * Install the returned VFS using unqlite_lib_config(UNQLITE_LIB_CONFIG_VFS,...).
+ */
+const unqlite_vfs * unqlite_lib_uring_vfs(void)
+{
+#if defined(__UNIXES__)
+	return unqliteExportUringVfs();
+#else
+	return 0;
+#endif
+}
 /*
  * Remove harmfull and/or stale flags passed to the [unqlite_open()] interface.
  */
@@ -4239,6 +4362,23 @@ UNQLITE_PRIVATE int unqliteGenOutofMem(unqlite *pDb)
 	rc = unqliteGenError(pDb,"unQLite is running out of memory");
 	return rc;
 }
+/*
+ * Copy the allocation counters of a memory backend to the public structure.
+ */
+static void unqliteMemStats(SyMemBackend *pBackend,unqlite_mem_stats *pOut)
+{
+	SyMemStats sStats;
+	SyMemBackendGetStats(pBackend,&sStats);
+	pOut->nHeapAlloc  = (unqlite_int64)sStats.nHeapAlloc;
+	pOut->nHeapFree   = (unqlite_int64)sStats.nHeapFree;
+	pOut->nPoolAlloc  = (unqlite_int64)sStats.nPoolAlloc;
+	pOut->nPoolFree   = (unqlite_int64)sStats.nPoolFree;
+	pOut->nCacheHit   = (unqlite_int64)sStats.nCacheHit;
+	pOut->nCacheFill  = (unqlite_int64)sStats.nCacheFill;
+	pOut->nCacheFlush = (unqlite_int64)sStats.nCacheFlush;
+	pOut->nLock       = (unqlite_int64)sStats.nLock;
+	pOut->nLockWait   = (unqlite_int64)sStats.nLockWait;
+}
 /*
  * Configure a working UnQLite database handle.
  */
@@ -4282,6 +4422,23 @@ static int unqliteConfigure(unqlite *pDb,int nOp,va_list ap)
 		pDb->iFlags |= UNQLITE_FL_DISABLE_AUTO_COMMIT;
 		break;
 											}
+	case UNQLITE_CONFIG_KV_ENGINE: {
+		/* Switch the KV storage engine of an in-memory database */
+		const char *zName = va_arg(ap,const char *);
+		unqlite_kv_methods *pMethods;
+		if( zName == 0 ){
+			rc = UNQLITE_CORRUPT;
+			break;
+		}
+		pMethods = unqliteFindKVStore(zName,SyStrlen(zName));
+		if( pMethods == 0 ){
+			unqliteGenErrorFormat(pDb,"No such Key/Value storage engine '%s'",zName);
+			rc = UNQLITE_NOTIMPLEMENTED;
+			break;
+		}
+		rc = unqlitePagerSwitchKvEngine(pDb->sDB.pPager,pMethods);
+		break;
+								   }
 	case UNQLITE_CONFIG_GET_KV_NAME: {
 		/* Name of the underlying KV storage engine */
 		const char **pzPtr = va_arg(ap,const char **);
@@ -4293,6 +4450,26 @@ static int unqliteConfigure(unqlite *pDb,int nOp,va_list ap)
 		}
 		break;
 									 }
+	case UNQLITE_CONFIG_MEM_STATS: {
+		/* Allocation counters of the handle and of the shared allocator */
+		unqlite_mem_stats *pDbStats  = va_arg(ap,unqlite_mem_stats *);
+		unqlite_mem_stats *pLibStats = va_arg(ap,unqlite_mem_stats *);
+		if( pDbStats ){
+			unqliteMemStats(&pDb->sMem,pDbStats);
+		}
+		if( pLibStats ){
+			unqliteMemStats(&sUnqlMPGlobal.sAllocator,pLibStats);
+		}
+		break;
+								   }
+	case UNQLITE_CONFIG_PAGER_STATS: {
+		/* Page cache and commit counters */
+		unqlite_pager_stats *pStats = va_arg(ap,unqlite_pager_stats *);
+		if( pStats ){
+			unqlitePagerGetStats(pDb->sDB.pPager,pStats);
+		}
+		break;
+									 }
 	default:
 		/* Unknown configuration option */
 		rc = UNQLITE_UNKNOWN;
@@ -5724,6 +5901,180 @@ int unqlite_kv_fetch_callback(unqlite *pDb,const void *pKey,int nKeyLen,int (*xC
 #endif
 	return rc;
 }
+/*
+ * Range consumer used when the storage engine does not implement xDataRange().
+ */
+struct kv_range_data
+{
+	SyBlob *pBlob;       /* Output buffer */
+	unqlite_int64 iSkip; /* Bytes to skip before the range */
+	unqlite_int64 nLeft; /* Bytes left in the range */
+};
+static int unqliteRangeConsumer(const void *pOut,unsigned int nLen,void *pUserData)
+{
+	struct kv_range_data *pRange = (struct kv_range_data *)pUserData;
+	const char *zOut = (const char *)pOut;
+	if( pRange->iSkip >= (unqlite_int64)nLen ){
+		pRange->iSkip -= nLen;
+		return UNQLITE_OK;
+	}
+	zOut += pRange->iSkip;
+	nLen -= (unsigned int)pRange->iSkip;
+	pRange->iSkip = 0;
+	if( (unqlite_int64)nLen > pRange->nLeft ){
+		nLen = (unsigned int)pRange->nLeft;
+	}
+	pRange->nLeft -= nLen;
+	return SyBlobAppend(pRange->pBlob,zOut,nLen);
+}
+/*
+ * [CAPIREF: unqlite_kv_fetch_range()]
+ * Fetch at most *pBufLen bytes of a record's data starting at offset iOfft.
+ * On return *pBufLen holds the number of bytes copied, which is short when the
+ * range runs past the end of the data.
+ */
+int unqlite_kv_fetch_range(unqlite *pDb,const void *pKey,int nKeyLen,unqlite_int64 iOfft,void *pBuf,unqlite_int64 *pBufLen)
+{
+	unqlite_kv_methods *pMethods;
+	unqlite_kv_engine *pEngine;
+	unqlite_kv_cursor *pCur;
+	int rc;
+	if( UNQLITE_DB_MISUSE(pDb) ){
+		return UNQLITE_CORRUPT;
+	}
+	if( iOfft < 0 || pBuf == 0 || *pBufLen < 0 ){
+		return UNQLITE_INVALID;
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 SyMutexEnter(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 /* Point to the underlying storage engine */
+	 pEngine = unqlitePagerGetKvEngine(pDb);
+	 pMethods = pEngine->pIo->pMethods;
+	 pCur = pDb->sDB.pCursor;
+	 if( nKeyLen < 0 ){
+		 /* Assume a null terminated string and compute it's length */
+		 nKeyLen = SyStrlen((const char *)pKey);
+	 }
+	 if( !nKeyLen ){
+		  unqliteGenError(pDb,"Empty key");
+		  rc = UNQLITE_EMPTY;
+	 }else{
+		  /* Seek to the record position */
+		  rc = pMethods->xSeek(pCur,pKey,nKeyLen,UNQLITE_CURSOR_MATCH_EXACT);
+	 }
+	 if( rc == UNQLITE_OK ){
+		 SyBlob sBlob;
+		 /* Initialize the data consumer */
+		 SyBlobInitFromBuf(&sBlob,pBuf,(sxu32)*pBufLen);
+		 if( pMethods->iVersion > 1 && pMethods->xDataRange ){
+			 /* Consume only the requested range */
+			 rc = pMethods->xDataRange(pCur,iOfft,*pBufLen,unqliteDataConsumer,&sBlob);
+		 }else{
+			 struct kv_range_data sRange;
+			 sRange.pBlob = &sBlob;
+			 sRange.iSkip = iOfft;
+			 sRange.nLeft = *pBufLen;
+			 rc = pMethods->xData(pCur,unqliteRangeConsumer,&sRange);
+		 }
+		 /* Data length */
+		 *pBufLen = (unqlite_int64)SyBlobLength(&sBlob);
+		 /* Cleanup */
+		 SyBlobRelease(&sBlob);
+	 }
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 SyMutexLeave(sUnqlMPGlobal.pMutexMethods,pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_overwrite()]
+ * Overwrite nDataLen bytes of a record's data starting at offset iOfft.
+ * The part of the range that lies within the existing data is written in place,
+ * the remainder is appended to the record. iOfft may not be past the end of the data.
+ */
+int unqlite_kv_overwrite(unqlite *pDb,const void *pKey,int nKeyLen,unqlite_int64 iOfft,const void *pData,unqlite_int64 nDataLen)
+{
+	unqlite_kv_methods *pMethods;
+	unqlite_kv_engine *pEngine;
+	unqlite_kv_cursor *pCur;
+	unqlite_int64 nOld = 0;
+	unqlite_int64 nIn;
+	int rc;
+	if( UNQLITE_DB_MISUSE(pDb) ){
+		return UNQLITE_CORRUPT;
+	}
+	if( iOfft < 0 || nDataLen < 0 ){
+		return UNQLITE_INVALID;
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 SyMutexEnter(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 /* Point to the underlying storage engine */
+	 pEngine = unqlitePagerGetKvEngine(pDb);
+	 pMethods = pEngine->pIo->pMethods;
+	 pCur = pDb->sDB.pCursor;
+	 if( nKeyLen < 0 ){
+		 /* Assume a null terminated string and compute it's length */
+		 nKeyLen = SyStrlen((const char *)pKey);
+	 }
+	 if( !nKeyLen ){
+		  unqliteGenError(pDb,"Empty key");
+		  rc = UNQLITE_EMPTY;
+	 }else{
+		  /* Seek to the record position */
+		  rc = pMethods->xSeek(pCur,pKey,nKeyLen,UNQLITE_CURSOR_MATCH_EXACT);
+	 }
+	 if( rc == UNQLITE_OK ){
+		 rc = pMethods->xDataLength(pCur,&nOld);
+	 }
+	 if( rc == UNQLITE_OK && iOfft > nOld ){
+		 unqliteGenError(pDb,"Overwrite offset past the end of the record");
+		 rc = UNQLITE_INVALID;
+	 }
+	 if( rc == UNQLITE_OK ){
+		 /* Bytes that land within the existing data */
+		 nIn = nOld - iOfft;
+		 if( nIn > nDataLen ){
+			 nIn = nDataLen;
+		 }
+		 if( nIn > 0 ){
+			 if( pMethods->iVersion > 1 && pMethods->xOverwrite ){
+				 rc = pMethods->xOverwrite(pCur,iOfft,pData,nIn);
+			 }else{
+				 SyBlob sWorker; /* Working buffer */
+				 /* Rewrite the whole record */
+				 SyBlobInit(&sWorker,&pDb->sMem);
+				 rc = pMethods->xData(pCur,unqliteDataConsumer,&sWorker);
+				 if( rc == UNQLITE_OK ){
+					 SyMemcpy(pData,&((char *)SyBlobData(&sWorker))[iOfft],(sxu32)nIn);
+					 rc = pMethods->xReplace(pEngine,pKey,nKeyLen,SyBlobData(&sWorker),SyBlobLength(&sWorker));
+				 }
+				 SyBlobRelease(&sWorker);
+			 }
+		 }
+		 if( rc == UNQLITE_OK && nDataLen > nIn ){
+			 /* Extend the record */
+			 rc = pMethods->xAppend(pEngine,pKey,nKeyLen,&((const char *)pData)[nIn],nDataLen - nIn);
+		 }
+	 }
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 SyMutexLeave(sUnqlMPGlobal.pMutexMethods,pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	return rc;
+}
 /*
  * [CAPIREF: unqlite_kv_delete()]
  * Please refer to the official documentation for function purpose and expected parameters.
@@ -6325,6 +6676,16 @@ UNQLITE_APIEXPORT unsigned int unqlite_util_random_num(unqlite *pDb)
 #endif
 	 return iNum;
 }
+/*
+ * [CAPIREF: unqlite_util_fast_hash()]
+ * Word at a time hash function, with a fast path for 16 byte keys.
+ * Pass it to [unqlite_kv_config()] with UNQLITE_KV_CONFIG_HASH_FUNC before the first
+ * access to a new database. A database keeps the hash it was created with.
+ */
+UNQLITE_APIEXPORT unsigned int unqlite_util_fast_hash(const void *pKey,unsigned int nLen)
+{
+	return unqliteFastHash(pKey,nLen);
+}
 /*
  * ----------------------------------------------------------
  * File: bitvec.c
@@ -26816,6 +27177,10 @@ static void UnixMutexEnter(SyMutex *pMutex)
 {
 	pthread_mutex_lock(&pMutex->sMutex);
 }
+static sxi32 UnixMutexTryEnter(SyMutex *pMutex)
+{
+	return pthread_mutex_trylock(&pMutex->sMutex) == 0 ? SXRET_OK : SXERR_BUSY;
+}
 static void UnixMutexLeave(SyMutex *pMutex)
 {
 	pthread_mutex_unlock(&pMutex->sMutex);
@@ -26827,7 +27192,7 @@ static const SyMutexMethods sPthreadMutexMethods = {
 	UnixMutexNew,      /* xNew() */
 	UnixMutexRelease,  /* xRelease() */
 	UnixMutexEnter,    /* xEnter() */
-	0,                 /* xTryEnter() */
+	UnixMutexTryEnter, /* xTryEnter() */
 	UnixMutexLeave     /* xLeave() */
 };
 JX9_PRIVATE const SyMutexMethods * SyMutexExportMethods(void)
@@ -27115,6 +27480,30 @@ static const SyMemMethods sOSAllocMethods = {
 	0, 
 	0
 };
+/*
+ * Lock a backend shared between threads, counting the times the lock
+ * was already held when the mutex subsystem can tell.
+ */
+static void MemBackendEnter(SyMemBackend *pBackend)
+{
+	const SyMutexMethods *pMethods = pBackend->pMutexMethods;
+	if( pMethods == 0 || pBackend->pMutex == 0 ){
+		return;
+	}
+	if( pMethods->xTryEnter == 0 ){
+		pMethods->xEnter(pBackend->pMutex);
+	}else if( pMethods->xTryEnter(pBackend->pMutex) != SXRET_OK ){
+		pMethods->xEnter(pBackend->pMutex);
+		pBackend->sStats.nLockWait++;
+	}
+	pBackend->sStats.nLock++;
+}
+static void MemBackendLeave(SyMemBackend *pBackend)
+{
+	if( pBackend->pMutexMethods ){
+		SyMutexLeave(pBackend->pMutexMethods, pBackend->pMutex);
+	}
+}
 static void * MemBackendAlloc(SyMemBackend *pBackend, sxu32 nByte)
 {
 	SyMemBlock *pBlock;
@@ -27142,6 +27531,7 @@ static void * MemBackendAlloc(SyMemBackend *pBackend, sxu32 nByte)
 	pBlock->nGuard = SXMEM_BACKEND_MAGIC;
 #endif
 	pBackend->nBlock++;
+	pBackend->sStats.nHeapAlloc++;
 	return (void *)&pBlock[1];
 }
 JX9_PRIVATE void * SyMemBackendAlloc(SyMemBackend *pBackend, sxu32 nByte)
@@ -27152,13 +27542,9 @@ JX9_PRIVATE void * SyMemBackendAlloc(SyMemBackend *pBackend, sxu32 nByte)
 		return 0;
 	}
 #endif
-	if( pBackend->pMutexMethods ){
-		SyMutexEnter(pBackend->pMutexMethods, pBackend->pMutex);
-	}
+	MemBackendEnter(&(*pBackend));
 	pChunk = MemBackendAlloc(&(*pBackend), nByte);
-	if( pBackend->pMutexMethods ){
-		SyMutexLeave(pBackend->pMutexMethods, pBackend->pMutex);
-	}
+	MemBackendLeave(&(*pBackend));
 	return pChunk;
 }
 static void * MemBackendRealloc(SyMemBackend *pBackend, void * pOld, sxu32 nByte)
@@ -27212,13 +27598,9 @@ JX9_PRIVATE void * SyMemBackendRealloc(SyMemBackend *pBackend, void * pOld, sxu3
 		return 0;
 	}
 #endif
-	if( pBackend->pMutexMethods ){
-		SyMutexEnter(pBackend->pMutexMethods, pBackend->pMutex);
-	}
+	MemBackendEnter(&(*pBackend));
 	pChunk = MemBackendRealloc(&(*pBackend), pOld, nByte);
-	if( pBackend->pMutexMethods ){
-		SyMutexLeave(pBackend->pMutexMethods, pBackend->pMutex);
-	}
+	MemBackendLeave(&(*pBackend));
 	return pChunk;
 }
 static sxi32 MemBackendFree(SyMemBackend *pBackend, void * pChunk)
@@ -27239,6 +27621,7 @@ static sxi32 MemBackendFree(SyMemBackend *pBackend, void * pChunk)
 #endif
 		MACRO_LD_REMOVE(pBackend->pBlocks, pBlock);
 		pBackend->nBlock--;
+		pBackend->sStats.nHeapFree++;
 		pBackend->pMethods->xFree(pBlock);
 	}
 	return SXRET_OK;
@@ -27254,15 +27637,216 @@ JX9_PRIVATE sxi32 SyMemBackendFree(SyMemBackend *pBackend, void * pChunk)
 	if( pChunk == 0 ){
 		return SXRET_OK;
 	}
-	if( pBackend->pMutexMethods ){
-		SyMutexEnter(pBackend->pMutexMethods, pBackend->pMutex);
-	}
+	MemBackendEnter(&(*pBackend));
 	rc = MemBackendFree(&(*pBackend), pChunk);
-	if( pBackend->pMutexMethods ){
-		SyMutexLeave(pBackend->pMutexMethods, pBackend->pMutex);
-	}
+	MemBackendLeave(&(*pBackend));
 	return rc;
 }
+#if defined(JX9_ENABLE_THREADS) && !defined(JX9_DISABLE_MEM_THREAD_CACHE)
+#if defined(_MSC_VER)
+#define SXMEM_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__)
+#define SXMEM_THREAD_LOCAL __thread
+#endif
+#endif
+#ifdef SXMEM_THREAD_LOCAL
+/*
+ * Per-thread pool caches.
+ *
+ * Every pool allocation from a backend shared between threads takes the
+ * backend mutex. To avoid that, each thread keeps the free chunks of up to
+ * SXMEM_CACHE_SLOTS such backends in a private cache. Chunks move between a
+ * cache and the shared free lists SXMEM_CACHE_BATCH at a time, so the mutex
+ * is taken once per batch instead of once per chunk.
+ *
+ * A thread may still cache chunks of a backend that another thread releases.
+ * Cached backends are registered in aMemCacheLive[] under a static mutex and
+ * the entries of a backend that is no longer registered are dropped, never
+ * flushed. The dropped chunks were freed with the rest of the backend.
+ *
+ * A thread that exits hands its cached chunks and pending counters back to
+ * their live owners from a pthread key destructor, so the workers a server
+ * starts and stops under load do not strand chunks in dead caches.
+ */
+#define SXMEM_CACHE_SLOTS	4	/* Backends cached by each thread */
+#define SXMEM_CACHE_BATCH	16	/* Chunks moved per trip to the shared pool */
+#define SXMEM_CACHE_MAX		(2*SXMEM_CACHE_BATCH)	/* Free chunks kept per bucket */
+#define SXMEM_CACHE_NLIVE	64	/* Backends that can be cached at the same time */
+#define SXMEM_CACHE_MUTEX	SXMUTEX_TYPE_STATIC_3
+typedef struct SyMemCache SyMemCache;
+struct SyMemCache
+{
+	SyMemBackend *pBackend; /* Owner of the cached chunks */
+	sxu32 nCacheId;         /* Owner cache id, 0 if the entry is unused */
+	SyMemHeader *apPool[SXMEM_POOL_NBUCKETS]; /* Free chunks */
+	sxu32 anPool[SXMEM_POOL_NBUCKETS];        /* Length of each free list */
+	sxu32 nAlloc, nFree;    /* Chunks handed out and returned, not yet counted by the owner */
+	sxu32 nHit;             /* Requests served without locking, not yet counted by the owner */
+};
+static SXMEM_THREAD_LOCAL SyMemCache aMemCache[SXMEM_CACHE_SLOTS];
+static SXMEM_THREAD_LOCAL sxu32 iMemCacheVictim = 0;
+static sxu32 aMemCacheLive[SXMEM_CACHE_NLIVE]; /* Ids of the registered backends */
+static sxu32 nMemCacheGen = 0;
+static const SyMutexMethods *pMemCacheMutexMethods = 0; /* Methods of the registry mutex */
+/* The low byte of a cache id is its registry slot plus one, so 0 is never a valid id */
+#define SXMEM_CACHE_LIVE(ID) ((ID) != 0 && aMemCacheLive[((ID) & 0xFF) - 1] == (ID))
+/*
+ * Register a backend that is shared between threads. Backends beyond
+ * SXMEM_CACHE_NLIVE are not cached and always take the mutex.
+ */
+static void MemCacheRegister(SyMemBackend *pBackend)
+{
+	const SyMutexMethods *pMethods = pBackend->pMutexMethods;
+	SyMutex *pMutex;
+	sxu32 i;
+	pMutex = SyMutexNew(pMethods, SXMEM_CACHE_MUTEX);
+	SyMutexEnter(pMethods, pMutex);
+	pMemCacheMutexMethods = pMethods;
+	for( i = 0 ; i < SXMEM_CACHE_NLIVE ; ++i ){
+		if( aMemCacheLive[i] == 0 ){
+			nMemCacheGen = (nMemCacheGen + 1) & 0xFFFFFF;
+			pBackend->nCacheId = (nMemCacheGen << 8) | (i + 1);
+			aMemCacheLive[i] = pBackend->nCacheId;
+			break;
+		}
+	}
+	SyMutexLeave(pMethods, pMutex);
+}
+static void MemCacheUnregister(SyMemBackend *pBackend)
+{
+	const SyMutexMethods *pMethods = pBackend->pMutexMethods;
+	SyMutex *pMutex;
+	sxu32 i;
+	if( pBackend->nCacheId == 0 ){
+		return;
+	}
+	pMutex = SyMutexNew(pMethods, SXMEM_CACHE_MUTEX);
+	SyMutexEnter(pMethods, pMutex);
+	aMemCacheLive[(pBackend->nCacheId & 0xFF) - 1] = 0;
+	SyMutexLeave(pMethods, pMutex);
+	/* Forget the entry of the calling thread right away */
+	for( i = 0 ; i < SXMEM_CACHE_SLOTS ; ++i ){
+		if( aMemCache[i].nCacheId == pBackend->nCacheId ){
+			aMemCache[i].nCacheId = 0;
+		}
+	}
+	pBackend->nCacheId = 0;
+}
+/*
+ * Move up to nCount chunks of a bucket back to the shared free list.
+ * The owner mutex must be held.
+ */
+static void MemCacheReturn(SyMemCache *pCache, sxu32 nBucket, sxu32 nCount)
+{
+	SyMemBackend *pBackend = pCache->pBackend;
+	SyMemHeader *pHeader;
+	while( nCount > 0 && pCache->apPool[nBucket] ){
+		pHeader = pCache->apPool[nBucket];
+		pCache->apPool[nBucket] = pHeader->pNext;
+		pCache->anPool[nBucket]--;
+		pHeader->pNext = pBackend->apPool[nBucket];
+		pBackend->apPool[nBucket] = pHeader;
+		nCount--;
+	}
+}
+/*
+ * Add the pending counters of a cache to its owner. The owner mutex must be held.
+ */
+static void MemCacheSyncStats(SyMemCache *pCache)
+{
+	SyMemStats *pStats = &pCache->pBackend->sStats;
+	pStats->nPoolAlloc += pCache->nAlloc;
+	pStats->nPoolFree  += pCache->nFree;
+	pStats->nCacheHit  += pCache->nHit;
+	pCache->nAlloc = pCache->nFree = pCache->nHit = 0;
+}
+/*
+ * Hand every chunk and counter of a live cache entry back to its owner.
+ * The registry mutex must be held, so that the owner cannot be released.
+ */
+static void MemCacheFlush(SyMemCache *pCache)
+{
+	sxu32 i;
+	MemBackendEnter(pCache->pBackend);
+	for( i = 0 ; i < SXMEM_POOL_NBUCKETS ; ++i ){
+		MemCacheReturn(pCache, i, pCache->anPool[i]);
+	}
+	MemCacheSyncStats(pCache);
+	pCache->pBackend->sStats.nCacheFlush++;
+	MemBackendLeave(pCache->pBackend);
+}
+#if defined(__UNIXES__)
+static pthread_key_t sMemCacheKey;
+static pthread_once_t sMemCacheOnce = PTHREAD_ONCE_INIT;
+static int bMemCacheKey = 0;
+/*
+ * pthread key destructor: the exiting thread's aMemCache[] is handed back.
+ */
+static void MemCacheThreadExit(void *pArg)
+{
+	const SyMutexMethods *pMethods = pMemCacheMutexMethods;
+	SyMemCache *aCache = (SyMemCache *)pArg;
+	SyMutex *pMutex;
+	sxu32 i;
+	pMutex = SyMutexNew(pMethods, SXMEM_CACHE_MUTEX);
+	SyMutexEnter(pMethods, pMutex);
+	for( i = 0 ; i < SXMEM_CACHE_SLOTS ; ++i ){
+		if( SXMEM_CACHE_LIVE(aCache[i].nCacheId) ){
+			MemCacheFlush(&aCache[i]);
+		}
+		SyZero(&aCache[i], sizeof(SyMemCache));
+	}
+	SyMutexLeave(pMethods, pMutex);
+}
+static void MemCacheKeyInit(void)
+{
+	bMemCacheKey = pthread_key_create(&sMemCacheKey, MemCacheThreadExit) == 0;
+}
+#endif /* __UNIXES__ */
+/*
+ * Return the cache of the calling thread for the given backend, taking
+ * over an unused, stale or (round robin) live entry the first time.
+ */
+static SyMemCache * MemCacheFind(SyMemBackend *pBackend)
+{
+	const SyMutexMethods *pMethods = pBackend->pMutexMethods;
+	SyMemCache *pCache;
+	SyMutex *pMutex;
+	sxu32 i;
+	for( i = 0 ; i < SXMEM_CACHE_SLOTS ; ++i ){
+		pCache = &aMemCache[i];
+		if( pCache->pBackend == pBackend && pCache->nCacheId == pBackend->nCacheId ){
+			return pCache;
+		}
+	}
+#if defined(__UNIXES__)
+	/* Arm the destructor of the calling thread the first time it caches */
+	pthread_once(&sMemCacheOnce, MemCacheKeyInit);
+	if( bMemCacheKey && pthread_getspecific(sMemCacheKey) == 0 ){
+		pthread_setspecific(sMemCacheKey, aMemCache);
+	}
+#endif
+	pMutex = SyMutexNew(pMethods, SXMEM_CACHE_MUTEX);
+	SyMutexEnter(pMethods, pMutex);
+	pCache = 0;
+	for( i = 0 ; i < SXMEM_CACHE_SLOTS ; ++i ){
+		if( !SXMEM_CACHE_LIVE(aMemCache[i].nCacheId) ){
+			pCache = &aMemCache[i];
+			break;
+		}
+	}
+	if( pCache == 0 ){
+		/* Evict a live entry */
+		pCache = &aMemCache[iMemCacheVictim++ % SXMEM_CACHE_SLOTS];
+		MemCacheFlush(pCache);
+	}
+	SyZero(pCache, sizeof(SyMemCache));
+	pCache->pBackend = pBackend;
+	pCache->nCacheId = pBackend->nCacheId;
+	SyMutexLeave(pMethods, pMutex);
+	return pCache;
+}
+#endif /* SXMEM_THREAD_LOCAL */
 #if defined(JX9_ENABLE_THREADS)
 JX9_PRIVATE sxi32 SyMemBackendMakeThreadSafe(SyMemBackend *pBackend, const SyMutexMethods *pMethods)
 {
@@ -27279,6 +27863,9 @@ JX9_PRIVATE sxi32 SyMemBackendMakeThreadSafe(SyMemBackend *pBackend, const SyMut
 	/* Attach the mutex to the memory backend */
 	pBackend->pMutex = pMutex;
 	pBackend->pMutexMethods = pMethods;
+#ifdef SXMEM_THREAD_LOCAL
+	MemCacheRegister(&(*pBackend));
+#endif
 	return SXRET_OK;
 }
 JX9_PRIVATE sxi32 SyMemBackendDisbaleMutexing(SyMemBackend *pBackend)
@@ -27292,6 +27879,9 @@ JX9_PRIVATE sxi32 SyMemBackendDisbaleMutexing(SyMemBackend *pBackend)
 		/* There is no mutex subsystem at all */
 		return SXRET_OK;
 	}
+#ifdef SXMEM_THREAD_LOCAL
+	MemCacheUnregister(&(*pBackend));
+#endif
 	SyMutexRelease(pBackend->pMutexMethods, pBackend->pMutex);
 	pBackend->pMutexMethods = 0;
 	pBackend->pMutex = 0; 
@@ -27332,12 +27922,25 @@ static sxi32 MemPoolBucketAlloc(SyMemBackend *pBackend, sxu32 nBucket)
 	
 	return SXRET_OK;
 }
+/*
+ * Index of the smallest bucket that can hold nByte plus the chunk header.
+ */
+static sxu32 MemPoolBucketIndex(sxu32 nByte)
+{
+	sxu32 nBucketSize = SXMEM_POOL_MINALLOC;
+	sxu32 nBucket = 0;
+	while( nByte + sizeof(SyMemHeader) > nBucketSize  ){
+		nBucketSize <<= 1;
+		nBucket++;
+	}
+	return nBucket;
+}
 static void * MemBackendPoolAlloc(SyMemBackend *pBackend, sxu32 nByte)
 {
 	SyMemHeader *pBucket, *pNext;
-	sxu32 nBucketSize;
 	sxu32 nBucket;
 
+	pBackend->sStats.nPoolAlloc++;
 	if( nByte + sizeof(SyMemHeader) >= SXMEM_POOL_MAXALLOC ){
 		/* Allocate a big chunk directly */
 		pBucket = (SyMemHeader *)MemBackendAlloc(&(*pBackend), nByte+sizeof(SyMemHeader));
@@ -27349,12 +27952,7 @@ static void * MemBackendPoolAlloc(SyMemBackend *pBackend, sxu32 nByte)
 		return (void *)(pBucket+1);
 	}
 	/* Locate the appropriate bucket */
-	nBucket = 0;
-	nBucketSize = SXMEM_POOL_MINALLOC;
-	while( nByte + sizeof(SyMemHeader) > nBucketSize  ){
-		nBucketSize <<= 1;
-		nBucket++;
-	}
+	nBucket = MemPoolBucketIndex(nByte);
 	pBucket = pBackend->apPool[nBucket];
 	if( pBucket == 0 ){
 		sxi32 rc;
@@ -27371,6 +27969,70 @@ static void * MemBackendPoolAlloc(SyMemBackend *pBackend, sxu32 nByte)
 	pBucket->nBucket = (SXMEM_POOL_MAGIC << 16) | nBucket;
 	return (void *)&pBucket[1];
 }
+#ifdef SXMEM_THREAD_LOCAL
+/*
+ * Pool allocation through the cache of the calling thread.
+ */
+static void * MemCachePoolAlloc(SyMemBackend *pBackend, sxu32 nBucket)
+{
+	SyMemCache *pCache;
+	SyMemHeader *pHeader;
+	sxu32 n;
+	pCache = MemCacheFind(&(*pBackend));
+	if( pCache->apPool[nBucket] == 0 ){
+		/* Refill with a batch from the shared free list */
+		MemBackendEnter(&(*pBackend));
+		for( n = 0 ; n < SXMEM_CACHE_BATCH ; ++n ){
+			if( pBackend->apPool[nBucket] == 0 && MemPoolBucketAlloc(&(*pBackend), nBucket) != SXRET_OK ){
+				break;
+			}
+			pHeader = pBackend->apPool[nBucket];
+			pBackend->apPool[nBucket] = pHeader->pNext;
+			pHeader->pNext = pCache->apPool[nBucket];
+			pCache->apPool[nBucket] = pHeader;
+			pCache->anPool[nBucket]++;
+		}
+		pBackend->sStats.nCacheFill++;
+		MemCacheSyncStats(pCache);
+		MemBackendLeave(&(*pBackend));
+		if( pCache->apPool[nBucket] == 0 ){
+			return 0;
+		}
+	}else{
+		pCache->nHit++;
+	}
+	pHeader = pCache->apPool[nBucket];
+	pCache->apPool[nBucket] = pHeader->pNext;
+	pCache->anPool[nBucket]--;
+	pCache->nAlloc++;
+	/* Record bucket&magic number */
+	pHeader->nBucket = (SXMEM_POOL_MAGIC << 16) | nBucket;
+	return (void *)&pHeader[1];
+}
+/*
+ * Give a pool chunk back to the cache of the calling thread.
+ */
+static sxi32 MemCachePoolFree(SyMemBackend *pBackend, SyMemHeader *pHeader, sxu32 nBucket)
+{
+	SyMemCache *pCache;
+	pCache = MemCacheFind(&(*pBackend));
+	pHeader->pNext = pCache->apPool[nBucket];
+	pCache->apPool[nBucket] = pHeader;
+	pCache->anPool[nBucket]++;
+	pCache->nFree++;
+	if( pCache->anPool[nBucket] > SXMEM_CACHE_MAX ){
+		/* Flush a batch so the chunks can serve other threads */
+		MemBackendEnter(&(*pBackend));
+		MemCacheReturn(pCache, nBucket, SXMEM_CACHE_BATCH);
+		pBackend->sStats.nCacheFlush++;
+		MemCacheSyncStats(pCache);
+		MemBackendLeave(&(*pBackend));
+	}else{
+		pCache->nHit++;
+	}
+	return SXRET_OK;
+}
+#endif /* SXMEM_THREAD_LOCAL */
 JX9_PRIVATE void * SyMemBackendPoolAlloc(SyMemBackend *pBackend, sxu32 nByte)
 {
 	void *pChunk;
@@ -27379,13 +28041,14 @@ JX9_PRIVATE void * SyMemBackendPoolAlloc(SyMemBackend *pBackend, sxu32 nByte)
 		return 0;
 	}
 #endif
-	if( pBackend->pMutexMethods ){
-		SyMutexEnter(pBackend->pMutexMethods, pBackend->pMutex);
+#ifdef SXMEM_THREAD_LOCAL
+	if( pBackend->nCacheId && nByte + sizeof(SyMemHeader) < SXMEM_POOL_MAXALLOC ){
+		return MemCachePoolAlloc(&(*pBackend), MemPoolBucketIndex(nByte));
 	}
+#endif
+	MemBackendEnter(&(*pBackend));
 	pChunk = MemBackendPoolAlloc(&(*pBackend), nByte);
-	if( pBackend->pMutexMethods ){
-		SyMutexLeave(pBackend->pMutexMethods, pBackend->pMutex);
-	}
+	MemBackendLeave(&(*pBackend));
 	return pChunk;
 }
 static sxi32 MemBackendPoolFree(SyMemBackend *pBackend, void * pChunk)
@@ -27399,6 +28062,7 @@ static sxi32 MemBackendPoolFree(SyMemBackend *pBackend, void * pChunk)
 		return SXERR_CORRUPT;
 	}
 	nBucket = pHeader->nBucket & 0xFFFF;
+	pBackend->sStats.nPoolFree++;
 	if( nBucket == SXU16_HIGH ){
 		/* Free the big block */
 		MemBackendFree(&(*pBackend), pHeader);
@@ -27417,13 +28081,17 @@ JX9_PRIVATE sxi32 SyMemBackendPoolFree(SyMemBackend *pBackend, void * pChunk)
 		return SXERR_CORRUPT;
 	}
 #endif
-	if( pBackend->pMutexMethods ){
-		SyMutexEnter(pBackend->pMutexMethods, pBackend->pMutex);
+#ifdef SXMEM_THREAD_LOCAL
+	if( pBackend->nCacheId ){
+		SyMemHeader *pHeader = (SyMemHeader *)(((char *)pChunk) - sizeof(SyMemHeader));
+		if( (pHeader->nBucket >> 16) == SXMEM_POOL_MAGIC && (pHeader->nBucket & 0xFFFF) != SXU16_HIGH ){
+			return MemCachePoolFree(&(*pBackend), pHeader, pHeader->nBucket & 0x0f);
+		}
 	}
+#endif
+	MemBackendEnter(&(*pBackend));
 	rc = MemBackendPoolFree(&(*pBackend), pChunk);
-	if( pBackend->pMutexMethods ){
-		SyMutexLeave(pBackend->pMutexMethods, pBackend->pMutex);
-	}
+	MemBackendLeave(&(*pBackend));
 	return rc;
 }
 #if 0
@@ -27556,6 +28224,9 @@ JX9_PRIVATE sxi32 SyMemBackendInitFromParent(SyMemBackend *pBackend,const SyMemB
 		if( pBackend->pMutex ==  0){
 			return SXERR_OS;
 		}
+#ifdef SXMEM_THREAD_LOCAL
+		MemCacheRegister(&(*pBackend));
+#endif
 	}
 #if defined(UNTRUST)
 	pBackend->nMagic = SXMEM_BACKEND_MAGIC;
@@ -27618,6 +28289,10 @@ JX9_PRIVATE sxi32 SyMemBackendRelease(SyMemBackend *pBackend)
 	if( SXMEM_BACKEND_CORRUPT(pBackend) ){
 		return SXERR_INVALID;
 	}
+#endif
+#ifdef SXMEM_THREAD_LOCAL
+	/* Cached chunks of other threads are dropped once the backend is unregistered */
+	MemCacheUnregister(&(*pBackend));
 #endif
 	if( pBackend->pMutexMethods ){
 		SyMutexEnter(pBackend->pMutexMethods, pBackend->pMutex);
@@ -27629,6 +28304,19 @@ JX9_PRIVATE sxi32 SyMemBackendRelease(SyMemBackend *pBackend)
 	}
 	return rc;
 }
+/*
+ * Copy the allocation counters of a backend.
+ */
+JX9_PRIVATE void SyMemBackendGetStats(SyMemBackend *pBackend, SyMemStats *pStats)
+{
+	if( pBackend->pMutexMethods ){
+		SyMutexEnter(pBackend->pMutexMethods, pBackend->pMutex);
+	}
+	SyMemcpy((const void *)&pBackend->sStats, (void *)pStats, sizeof(SyMemStats));
+	if( pBackend->pMutexMethods ){
+		SyMutexLeave(pBackend->pMutexMethods, pBackend->pMutex);
+	}
+}
 JX9_PRIVATE void * SyMemBackendDup(SyMemBackend *pBackend, const void *pSrc, sxu32 nSize)
 {
 	void *pNew;
@@ -48679,10 +49367,24 @@ static sxi32 VmGetNextLine(SyString *pCursor, SyString *pCurrent)
  * Magic word to hash to identify a valid hash function.
  */
 #define L_HASH_WORD "chm@symisc"
+/*
+ * Magic number of a storage image where every key has the same length.
+ * The key length is stored in the low byte.
+ */
+#define L_HASH_MAGIC_FIXED 0xFA782E00
 /*
  * Cell size on disk. 
  */
 #define L_HASH_CELL_SZ (4/*Hash*/+4/*Key*/+8/*Data*/+2/* Offset of the next cell */+8/*Overflow*/)
+/*
+ * Cell size on disk when every key has the same length: the key length is not stored.
+ */
+#define L_HASH_CELL_SZ_FIXED (4/*Hash*/+8/*Data*/+2/* Offset of the next cell */+8/*Overflow*/)
+/*
+ * Cell size and offset of the data length field for the cells of a given page.
+ */
+#define L_HASH_CELL_HDR(pPage)  ((pPage)->pHash->nCellSz)
+#define L_HASH_CELL_DATA(pPage) ((pPage)->pHash->iCellData)
 /*
  * Primary page (not overflow pages) header size on disk.
  */
@@ -48796,11 +49498,19 @@ struct lhash_kv_engine
 	lhash_bmap_page sPageMap;     /* Primary bucket map */
 	int iPageSize;                /* Page size */
 	pgno nFreeList;               /* List of free pages */
+	sxi64 nFreePage;              /* Length of the free list, valid if bFreeKnown is set: In-memory only */
+	int bFreeKnown;               /* nFreePage was counted or given by the host application */
 	pgno split_bucket;            /* Current split bucket: MUST BE A POWER OF TWO */
 	pgno max_split_bucket;        /* Maximum split bucket: MUST BE A POWER OF TWO */
 	pgno nmax_split_nucket;       /* Next maximum split bucket (1 << nMsb): In-memory only */
 	sxu32 nMagic;                 /* Magic number to identify a valid linear hash disk database */
+	sxu32 nFixedKey;              /* Length of every key or 0 for variable length keys */
+	sxu16 nCellSz;                /* Cell header size on disk */
+	sxu16 iCellData;              /* Offset of the data length in a cell header */
 };
+/* Forward declaration */
+static sxu32 lhash_bin_hash(const void *pSrc,sxu32 nLen);
+static void lhSetFixedKey(lhash_kv_engine *pEngine,sxu32 nKey);
 /*
  * Given a logical bucket number, return the record associated with it.
  */
@@ -48934,6 +49644,71 @@ static int lhMapLoadPage(lhash_kv_engine *pEngine,lhash_bmap_page *pMap,const un
 	/* All done */
 	return UNQLITE_OK;
 }
+/*
+ * The bucket map is loaded on demand: only the records stored in page one
+ * are installed when the database is opened, the rest of the chain is read
+ * one page at a time as lookups miss. sPageMap.iNext is non-zero as long as
+ * some map pages have not been loaded yet.
+ *
+ * Load the next page of the bucket map chain.
+ */
+static int lhMapLoadNext(lhash_kv_engine *pEngine)
+{
+	lhash_bmap_page *pMap = &pEngine->sPageMap;
+	unqlite_page *pPage;
+	pgno iNext = pMap->iNext;
+	int rc;
+	/* Point to the target page */
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,iNext,&pPage);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	/* Fill in the structure */
+	pMap->iNum = iNext;
+	pMap->iPtr = 0;
+	/* Load the map in memory */
+	rc = lhMapLoadPage(pEngine,pMap,pPage->zData);
+	/* The records are copied, the page is no longer needed */
+	pEngine->pIo->xPageUnref(pPage);
+	return rc;
+}
+/*
+ * Load whatever is left of the bucket map. This must be done before the map
+ * is walked or extended.
+ */
+static int lhMapLoadAll(lhash_kv_engine *pEngine)
+{
+	int rc;
+	while( pEngine->sPageMap.iNext != 0 ){
+		rc = lhMapLoadNext(pEngine);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Given a logical bucket number, return the record associated with it,
+ * loading more of the bucket map if needed.
+ * *ppRec is set to NULL when no such bucket exists.
+ */
+static int lhMapLookup(lhash_kv_engine *pEngine,pgno iLogic,lhash_bmap_rec **ppRec)
+{
+	lhash_bmap_rec *pRec;
+	int rc;
+	for(;;){
+		pRec = lhMapFindBucket(pEngine,iLogic);
+		if( pRec || pEngine->sPageMap.iNext == 0 ){
+			break;
+		}
+		rc = lhMapLoadNext(pEngine);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	*ppRec = pRec;
+	return UNQLITE_OK;
+}
 /* 
  * Allocate a new cell instance.
  */
@@ -49103,7 +49878,16 @@ static lhcell * lhFindCell(
 			break;
 		}
 		if( pEntry->nHash == nHash && pEntry->nKey == nByte ){
-			if( SyBlobLength(&pEntry->sKey) < 1 ){
+			if( nByte == 16 && pPage->pHash->nFixedKey == 16 && pPage->pHash->xCmp == SyMemcmp ){
+				/* uuid keys: one 128 bit comparison */
+				sxu64 aKey[2],aCell[2];
+				SyMemcpy(pKey,aKey,16);
+				SyMemcpy(SyBlobData(&pEntry->sKey),aCell,16);
+				if( ((aKey[0] ^ aCell[0]) | (aKey[1] ^ aCell[1])) == 0 ){
+					/* Cell found */
+					return pEntry;
+				}
+			}else if( SyBlobLength(&pEntry->sKey) < 1 ){
 				/* Large key (> 256 KB) are not kept in-memory */
 				struct lhash_key_cmp sCmp;
 				int rc;
@@ -49143,9 +49927,14 @@ static int lhParseOneCell(lhpage *pPage,const unsigned char *zRaw,const unsigned
 	/* 4 byte hash number */
 	SyBigEndianUnpack32(zRaw,&iHash);
 	zRaw += 4;	
-	/* 4 byte key length  */
-	SyBigEndianUnpack32(zRaw,&nKey);
-	zRaw += 4;	
+	if( pPage->pHash->nFixedKey ){
+		/* Key length is not stored */
+		nKey = pPage->pHash->nFixedKey;
+	}else{
+		/* 4 byte key length  */
+		SyBigEndianUnpack32(zRaw,&nKey);
+		zRaw += 4;	
+	}
 	/* 8 byte data length */
 	SyBigEndianUnpack64(zRaw,&nData);
 	zRaw += 8;
@@ -49379,7 +50168,7 @@ static int lhConsumeCellkey(
 	zPayload = &zRaw[pCell->iStart];
 	if( pCell->iOvfl == 0 ){
 		/* Best scenario, consume the key directly without any overflow page */
-		zPayload += L_HASH_CELL_SZ;
+		zPayload += L_HASH_CELL_HDR(pPage);
 		rc = xConsumer((const void *)zPayload,pCell->nKey,pUserData);
 		if( rc != UNQLITE_OK ){
 			rc = UNQLITE_ABORT;
@@ -49461,7 +50250,7 @@ static int lhConsumeCellData(
 	zPayload = &zRaw[pCell->iStart];
 	if( pCell->iOvfl == 0 ){
 		/* Best scenario, consume the data directly without any overflow page */
-		zPayload += L_HASH_CELL_SZ + pCell->nKey;
+		zPayload += L_HASH_CELL_HDR(pPage) + pCell->nKey;
 		rc = xConsumer((const void *)zPayload,(sxu32)pCell->nData,pUserData);
 		if( rc != UNQLITE_OK ){
 			rc = UNQLITE_ABORT;
@@ -49524,6 +50313,103 @@ static int lhConsumeCellData(
 	}
 	return rc;
 }
+/*
+ * Given a cell, access nLen bytes of its data starting at offset iOfft. The range
+ * must lie within the data.
+ * If zWrite is not NULL, the range is overwritten in place with the content of zWrite.
+ * Otherwise the range is consumed by invoking the given callback for each extracted chunk.
+ * Overflow pages before the range are only visited for their link to the next page
+ * and the walk stops as soon as the end of the range is reached.
+ */
+static int lhCellDataRange(
+	lhcell *pCell,      /* Target cell */
+	sxu64 iOfft,        /* Offset of the range in the data */
+	sxu64 nLen,         /* Range length */
+	const unsigned char *zWrite, /* Overwrite content or NULL to read */
+	int (*xConsumer)(const void *,unsigned int,void *), /* Data consumer callback */
+	void *pUserData /* Last argument to xConsumer() */
+	)
+{
+	lhpage *pPage = pCell->pPage;
+	lhash_kv_engine *pEngine = pPage->pHash;
+	sxu64 iEnd = iOfft + nLen;
+	unsigned char *zPayload;
+	int rc;
+	if( nLen < 1 ){
+		return UNQLITE_OK;
+	}
+	if( pCell->iOvfl == 0 ){
+		/* Best scenario, the data is stored in the cell itself */
+		zPayload = &pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_HDR(pPage) + pCell->nKey + iOfft];
+		if( zWrite ){
+			rc = pEngine->pIo->xWrite(pPage->pRaw);
+			if( rc != UNQLITE_OK ){
+				return rc;
+			}
+			SyMemcpy((const void *)zWrite,(void *)zPayload,(sxu32)nLen);
+		}else{
+			rc = xConsumer((const void *)zPayload,(sxu32)nLen,pUserData);
+			if( rc != UNQLITE_OK ){
+				rc = UNQLITE_ABORT;
+			}
+		}
+	}else{
+		unqlite_page *pOvfl;
+		sxu64 iPos = 0; /* Offset of the current page content in the data */
+		int fix_offset = 0;
+		sxu64 iFrom,iTo;
+		sxu32 nByte;
+		pgno iOvfl;
+		/* Overflow page where data is stored */
+		iOvfl = pCell->iDataPage;
+		rc = UNQLITE_OK;
+		while( iOvfl != 0 && iPos < iEnd ){
+			/* Point to the overflow page */
+			rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,iOvfl,&pOvfl);
+			if( rc != UNQLITE_OK ){
+				return rc;
+			}
+			/* Point to the raw content */
+			zPayload = pOvfl->zData;
+			if( !fix_offset ){
+				/* Point to the data */
+				zPayload += pCell->iDataOfft;
+				nByte = pEngine->iPageSize - pCell->iDataOfft;
+				fix_offset = 1;
+			}else{
+				zPayload += 8;
+				/* Total usable bytes in an overflow page */
+				nByte = L_HASH_OVERFLOW_SIZE(pEngine->iPageSize);
+			}
+			if( iPos + nByte > iOfft ){
+				/* Part of the range lives in this page */
+				iFrom = iOfft > iPos ? iOfft - iPos : 0;
+				iTo = iEnd < iPos + nByte ? iEnd - iPos : nByte;
+				if( zWrite ){
+					rc = pEngine->pIo->xWrite(pOvfl);
+					if( rc == UNQLITE_OK ){
+						SyMemcpy((const void *)&zWrite[iPos + iFrom - iOfft],(void *)&zPayload[iFrom],(sxu32)(iTo - iFrom));
+					}
+				}else{
+					rc = xConsumer((const void *)&zPayload[iFrom],(unsigned int)(iTo - iFrom),pUserData);
+					if( rc != UNQLITE_OK ){
+						rc = UNQLITE_ABORT;
+					}
+				}
+				if( rc != UNQLITE_OK ){
+					pEngine->pIo->xPageUnref(pOvfl);
+					return rc;
+				}
+			}
+			iPos += nByte;
+			/* Next overflow page in the chain */
+			SyBigEndianUnpack64(pOvfl->zData,&iOvfl);
+			/* Unref the page */
+			pEngine->pIo->xPageUnref(pOvfl);
+		}
+	}
+	return rc;
+}
 /*
  * Read the linear hash header (Page one of the database).
  */
@@ -49537,7 +50423,12 @@ static int lhash_read_header(lhash_kv_engine *pEngine,unqlite_page *pHeader)
 	/* 4 byte magic number */
 	SyBigEndianUnpack32(zRaw,&pEngine->nMagic);
 	zRaw += 4;
-	if( pEngine->nMagic != L_HASH_MAGIC ){
+	if( pEngine->nMagic == L_HASH_MAGIC ){
+		lhSetFixedKey(pEngine,0);
+	}else if( (pEngine->nMagic & ~0xFFu) == L_HASH_MAGIC_FIXED && (pEngine->nMagic & 0xFF) > 0 ){
+		/* Compact cells: the stored key length wins over the configured one */
+		lhSetFixedKey(pEngine,pEngine->nMagic & 0xFF);
+	}else{
 		/* Corrupt implementation */
 		return UNQLITE_CORRUPT;
 	}
@@ -49546,9 +50437,18 @@ static int lhash_read_header(lhash_kv_engine *pEngine,unqlite_page *pHeader)
 	zRaw += 4;
 	/* Sanity check */
 	if( pEngine->xHash(L_HASH_WORD,sizeof(L_HASH_WORD)-1) != nHash ){
-		/* Different hash function */
-		pEngine->pIo->xErr(pEngine->pIo->pHandle,"Invalid hash function");
-		return UNQLITE_INVALID;
+		/* The stored value tells which hash function built the database:
+		 * an existing database keeps its builtin hash whatever was configured.
+		 */
+		if( lhash_bin_hash(L_HASH_WORD,sizeof(L_HASH_WORD)-1) == nHash ){
+			pEngine->xHash = lhash_bin_hash;
+		}else if( unqliteFastHash(L_HASH_WORD,sizeof(L_HASH_WORD)-1) == nHash ){
+			pEngine->xHash = unqliteFastHash;
+		}else{
+			/* Different hash function */
+			pEngine->pIo->xErr(pEngine->pIo->pHandle,"Invalid hash function");
+			return UNQLITE_INVALID;
+		}
 	}
 	/* List of free pages */
 	SyBigEndianUnpack64(zRaw,&pEngine->nFreeList);
@@ -49572,35 +50472,11 @@ static int lhash_read_header(lhash_kv_engine *pEngine,unqlite_page *pHeader)
 	SyBigEndianUnpack32(zRaw,&pMap->nRec);
 	zRaw += 4;
 	pMap->iPtr = (sxu16)(zRaw - pHeader->zData);
-	/* Load the map in memory */
+	/* Load the map records stored in page one. The rest of the
+	 * chain (if any) is loaded on demand by lhMapLookup().
+	 */
 	rc = lhMapLoadPage(pEngine,pMap,pHeader->zData);
-	if( rc != UNQLITE_OK ){
-		return rc;
-	}
-	/* Load the bucket map chain if any */
-	for(;;){
-		pgno iNext = pMap->iNext;
-		unqlite_page *pPage;
-		if( iNext == 0 ){
-			/* No more map pages */
-			break;
-		}
-		/* Point to the target page */
-		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,iNext,&pPage);
-		if( rc != UNQLITE_OK ){
-			return rc;
-		}
-		/* Fill in the structure */
-		pMap->iNum = iNext;
-		pMap->iPtr = 0;
-		/* Load the map in memory */
-		rc = lhMapLoadPage(pEngine,pMap,pPage->zData);
-		if( rc != UNQLITE_OK ){
-			return rc;
-		}
-	}
-	/* All done */
-	return UNQLITE_OK;
+	return rc;
 }
 /*
  * Perform a record lookup.
@@ -49623,6 +50499,10 @@ static int lhRecordLookup(
 	if( rc != UNQLITE_OK ){
 		return rc;
 	}
+	if( pEngine->nFixedKey && nByte != pEngine->nFixedKey ){
+		/* No key of this length can be stored */
+		return UNQLITE_NOTFOUND;
+	}
 	/* Compute the hash of the key first */
 	nHash = pEngine->xHash(pKey,nByte);
 	/* Extract the logical (i.e. not real) page number */
@@ -49632,7 +50512,10 @@ static int lhRecordLookup(
 		iBucket = nHash & (pEngine->max_split_bucket - 1);
 	}
 	/* Map the logical bucket number to real page number */
-	pRec = lhMapFindBucket(pEngine,iBucket);
+	rc = lhMapLookup(pEngine,iBucket,&pRec);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
 	if( pRec == 0 ){
 		/* No such entry */
 		return UNQLITE_NOTFOUND;
@@ -49668,6 +50551,7 @@ static int lhAcquirePage(lhash_kv_engine *pEngine,unqlite_page **ppOut)
 		if( rc == UNQLITE_OK ){
 			/* Point to the next free page */
 			SyBigEndianUnpack64(pPage->zData,&pEngine->nFreeList);
+			pEngine->nFreePage--;
 			/* Update the database header */
 			rc = pEngine->pIo->xWrite(pEngine->pHeader);
 			if( rc != UNQLITE_OK ){
@@ -49699,6 +50583,11 @@ static int lhMapWriteRecord(lhash_kv_engine *pEngine,pgno iLogic,pgno iReal)
 	lhash_bmap_page *pMap = &pEngine->sPageMap;
 	unqlite_page *pPage = 0;
 	int rc;
+	/* New records are appended to the last map page */
+	rc = lhMapLoadAll(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
 	if( pMap->iPtr > (pEngine->iPageSize - 16) /* 8 byte logical bucket number + 8 byte real bucket number */ ){
 		unqlite_page *pOld;
 		/* Point to the old page */
@@ -49775,6 +50664,30 @@ static int lhMapWriteRecord(lhash_kv_engine *pEngine,pgno iLogic,pgno iReal)
 	}
 	return rc;
 }
+/*
+ * Serialize a cell header. Return a pointer past the header.
+ */
+static unsigned char * lhCellPackHeader(lhash_kv_engine *pEngine,lhcell *pCell,unsigned char *zRaw)
+{
+	/* 4 byte hash number */
+	SyBigEndianPack32(zRaw,pCell->nHash);
+	zRaw += 4;
+	if( pEngine->nFixedKey == 0 ){
+		/* 4 byte key length */
+		SyBigEndianPack32(zRaw,pCell->nKey);
+		zRaw += 4;
+	}
+	/* 8 byte data length */
+	SyBigEndianPack64(zRaw,pCell->nData);
+	zRaw += 8;
+	/* 2 byte offset of the next cell */
+	SyBigEndianPack16(zRaw,pCell->iNext);
+	zRaw += 2;
+	/* 8 byte overflow page number */
+	SyBigEndianPack64(zRaw,pCell->iOvfl);
+	zRaw += 8;
+	return zRaw;
+}
 /*
  * Defragment a page.
  */
@@ -49785,8 +50698,10 @@ static int lhPageDefragment(lhpage *pPage)
 	lhcell *pCell;
 	/* Get a temporary page from the pager. This opertaion never fail */
 	zTmp = pEngine->pIo->xTmpPage(pEngine->pIo->pHandle);
-	/* Move the target cells to the begining */
-	pCell = pPage->pList;
+	/* Move the target cells to the begining. Cells are linked to the master
+	 * page, a slave page has an empty list of its own.
+	 */
+	pCell = pPage->pMaster->pList;
 	/* Write the slave page number */
 	SyBigEndianPack64(&zTmp[2/*Offset of the first cell */+2/*Offset of the first free block */],pPage->sHdr.iSlave);
 	zPtr = &zTmp[L_HASH_PAGE_HDR_SZ]; /* Offset to start writing from */
@@ -49801,28 +50716,14 @@ static int lhPageDefragment(lhpage *pPage)
 			/* Cell payload if locally stored */
 			zPayload = 0;
 			if( pCell->iOvfl == 0 ){
-				zPayload = &pCell->pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_SZ];
+				zPayload = &pCell->pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_HDR(pPage)];
 			}
 			/* Move the cell */
 			pCell->iNext = pPage->sHdr.iOfft;
 			pCell->iStart = (sxu16)(zPtr - zTmp); /* Offset where this cell start */
 			pPage->sHdr.iOfft = pCell->iStart;
 			/* Write the cell header */
-			/* 4 byte hash number */
-			SyBigEndianPack32(zPtr,pCell->nHash);
-			zPtr += 4;
-			/* 4 byte ley length */
-			SyBigEndianPack32(zPtr,pCell->nKey);
-			zPtr += 4;
-			/* 8 byte data length */
-			SyBigEndianPack64(zPtr,pCell->nData);
-			zPtr += 8;
-			/* 2 byte offset of the next cell */
-			SyBigEndianPack16(zPtr,pCell->iNext);
-			zPtr += 2;
-			/* 8 byte overflow page number */
-			SyBigEndianPack64(zPtr,pCell->iOvfl);
-			zPtr += 8;
+			zPtr = lhCellPackHeader(pEngine,pCell,zPtr);
 			if( zPayload ){
 				/* Local payload */
 				SyMemcpy((const void *)zPayload,zPtr,(sxu32)(pCell->nKey + pCell->nData));
@@ -49953,24 +50854,9 @@ static int lhAllocateSpace(lhpage *pPage,sxu64 nAmount,sxu16 *pOfft)
 static int lhCellWriteHeader(lhcell *pCell)
 {
 	lhpage *pPage = pCell->pPage;
-	unsigned char *zRaw = pPage->pRaw->zData;
-	/* Seek to the desired location */
-	zRaw += pCell->iStart;
-	/* 4 byte hash number */
-	SyBigEndianPack32(zRaw,pCell->nHash);
-	zRaw += 4;
-	/* 4 byte key length */
-	SyBigEndianPack32(zRaw,pCell->nKey);
-	zRaw += 4;
-	/* 8 byte data length */
-	SyBigEndianPack64(zRaw,pCell->nData);
-	zRaw += 8;
-	/* 2 byte offset of the next cell */
+	/* Link to the first cell of the page */
 	pCell->iNext = pPage->sHdr.iOfft;
-	SyBigEndianPack16(zRaw,pCell->iNext);
-	zRaw += 2;
-	/* 8 byte overflow page number */
-	SyBigEndianPack64(zRaw,pCell->iOvfl);
+	lhCellPackHeader(pPage->pHash,pCell,&pPage->pRaw->zData[pCell->iStart]);
 	/* Update the page header */
 	pPage->sHdr.iOfft = pCell->iStart;
 	/* pEngine->pIo->xWrite() has been successfully called on this page */
@@ -49990,7 +50876,7 @@ static int lhCellWriteLocalPayload(lhcell *pCell,
 	lhpage *pPage = pCell->pPage;
 	unsigned char *zRaw = pPage->pRaw->zData;
 	/* Seek to the desired location */
-	zRaw += pCell->iStart + L_HASH_CELL_SZ;
+	zRaw += pCell->iStart + L_HASH_CELL_HDR(pPage);
 	/* Write the key */
 	SyMemcpy(pKey,(void *)zRaw,nKeylen);
 	zRaw += nKeylen;
@@ -50027,7 +50913,7 @@ static int lhCellWriteOvflPayload(lhcell *pCell,const void *pKey,sxu32 nKeylen,.
 	/* Link */
 	pCell->iOvfl = pOvfl->pgno;
 	/* Update the cell header */
-	SyBigEndianPack64(&pPage->pRaw->zData[pCell->iStart + 4/*Hash*/ + 4/*Key*/ + 8/*Data*/ + 2 /*Next cell*/],pCell->iOvfl);
+	SyBigEndianPack64(&pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_DATA(pPage) + 8/*Data*/ + 2 /*Next cell*/],pCell->iOvfl);
 	/* Start the write process */
 	zPtr = (const unsigned char *)pKey;
 	zEnd = &zPtr[nKeylen];
@@ -50146,6 +51032,7 @@ static int lhRestorePage(lhash_kv_engine *pEngine,unqlite_page *pPage)
 	/* Link to the list of free page */
 	SyBigEndianPack64(pPage->zData,pEngine->nFreeList);
 	pEngine->nFreeList = pPage->pgno;
+	pEngine->nFreePage++;
 	SyBigEndianPack64(&pEngine->pHeader->zData[4/*Magic*/+4/*Hash*/],pEngine->nFreeList);
 	/* All done */
 	return UNQLITE_OK;
@@ -50181,7 +51068,7 @@ static int lhUnlinkCell(lhcell *pCell)
 {
 	lhash_kv_engine *pEngine = pCell->pPage->pHash;
 	lhpage *pPage = pCell->pPage;
-	sxu16 nByte = L_HASH_CELL_SZ;
+	sxu16 nByte = pEngine->nCellSz;
 	lhcell *pPrev;
 	int rc;
 	rc = pEngine->pIo->xWrite(pPage->pRaw);
@@ -50193,7 +51080,7 @@ static int lhUnlinkCell(lhcell *pCell)
 	if( pPrev ){
 		pPrev->iNext = pCell->iNext;
 		/* Fix offsets in the page header */
-		SyBigEndianPack16(&pPage->pRaw->zData[pPrev->iStart + 4/*Hash*/+4/*Key*/+8/*Data*/],pCell->iNext);
+		SyBigEndianPack16(&pPage->pRaw->zData[pPrev->iStart + L_HASH_CELL_DATA(pPage) + 8/*Data*/],pCell->iNext);
 	}else{
 		/* First entry on this page (either master or slave) */
 		pPage->sHdr.iOfft = pCell->iNext;
@@ -50273,13 +51160,13 @@ static int lhMoveLocalCell(
 	unqlite_int64 nData
 	)
 {
-	sxu16 iKeyOfft = pCell->iStart + L_HASH_CELL_SZ;
+	sxu16 iKeyOfft = pCell->iStart + L_HASH_CELL_HDR(pCell->pPage);
 	lhpage *pPage = pCell->pPage;
 	lhcell *pSibeling;
 	pSibeling = lhFindSibeling(pCell);
 	if( pSibeling ){
 		/* Fix link */
-		SyBigEndianPack16(&pPage->pRaw->zData[pSibeling->iStart + 4/*Hash*/+4/*Key*/+8/*Data*/],pCell->iNext);
+		SyBigEndianPack16(&pPage->pRaw->zData[pSibeling->iStart + L_HASH_CELL_DATA(pPage) + 8/*Data*/],pCell->iNext);
 		pSibeling->iNext = pCell->iNext;
 	}else{
 		/* First cell, update page header only */
@@ -50319,7 +51206,7 @@ static int lhRecordOverwrite(
 	}
 	if( pCell->iOvfl == 0 ){
 		/* Local payload, try to deal with the free space issues */
-		zPayload = &pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_SZ + pCell->nKey];
+		zPayload = &pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_HDR(pPage) + pCell->nKey];
 		if( pCell->nData == (sxu64)nByte ){
 			/* Best scenario, simply a memcpy operation */
 			SyMemcpy(pData,(void *)zPayload,(sxu32)nByte);
@@ -50327,25 +51214,25 @@ static int lhRecordOverwrite(
 			/* Shorter data, not so ugly */
 			SyMemcpy(pData,(void *)zPayload,(sxu32)nByte);
 			/* Update the cell header */
-			SyBigEndianPack64(&pPage->pRaw->zData[pCell->iStart + 4 /* Hash */ + 4 /* Key */],nByte);
+			SyBigEndianPack64(&pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_DATA(pPage)],nByte);
 			/* Restore freespace */
-			lhRestoreSpace(pPage,(sxu16)(pCell->iStart + L_HASH_CELL_SZ + pCell->nKey + nByte),(sxu16)(pCell->nData - nByte));
+			lhRestoreSpace(pPage,(sxu16)(pCell->iStart + L_HASH_CELL_HDR(pPage) + pCell->nKey + nByte),(sxu16)(pCell->nData - nByte));
 			/* New data size */
 			pCell->nData = (sxu64)nByte;
 		}else{
 			sxu16 iOfft = 0; /* cc warning */
 			/* Check if another chunk is available for this cell */
-			rc = lhAllocateSpace(pPage,L_HASH_CELL_SZ + pCell->nKey + nByte,&iOfft);
+			rc = lhAllocateSpace(pPage,L_HASH_CELL_HDR(pPage) + pCell->nKey + nByte,&iOfft);
 			if( rc != UNQLITE_OK ){
 				/* Transfer the payload to an overflow page */
-				rc = lhCellWriteOvflPayload(pCell,&pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_SZ],pCell->nKey,pData,nByte,(const void *)0);
+				rc = lhCellWriteOvflPayload(pCell,&pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_HDR(pPage)],pCell->nKey,pData,nByte,(const void *)0);
 				if( rc != UNQLITE_OK ){
 					return rc;
 				}
 				/* Update the cell header */
-				SyBigEndianPack64(&pPage->pRaw->zData[pCell->iStart + 4 /* Hash */ + 4 /* Key */],(sxu64)nByte);
+				SyBigEndianPack64(&pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_DATA(pPage)],(sxu64)nByte);
 				/* Restore freespace */
-				lhRestoreSpace(pPage,(sxu16)(pCell->iStart + L_HASH_CELL_SZ),(sxu16)(pCell->nKey + pCell->nData));
+				lhRestoreSpace(pPage,(sxu16)(pCell->iStart + L_HASH_CELL_HDR(pPage)),(sxu16)(pCell->nKey + pCell->nData));
 				/* New data size */
 				pCell->nData = (sxu64)nByte;
 			}else{
@@ -50354,7 +51241,7 @@ static int lhRecordOverwrite(
 				/* Space is available, transfer the cell */
 				lhMoveLocalCell(pCell,iOfft,pData,nByte);
 				/* Restore cell space */
-				lhRestoreSpace(pPage,iOldOfft,(sxu16)(L_HASH_CELL_SZ + pCell->nKey + iOld));
+				lhRestoreSpace(pPage,iOldOfft,(sxu16)(L_HASH_CELL_HDR(pPage) + pCell->nKey + iOld));
 			}
 		}
 		return UNQLITE_OK;
@@ -50436,7 +51323,7 @@ static int lhRecordOverwrite(
 	pEngine->pIo->xPageUnref(pOvfl);
 	/* Finally, update the cell header */
 	pCell->nData = (sxu64)nByte;
-	SyBigEndianPack64(&pPage->pRaw->zData[pCell->iStart + 4 /* Hash */ + 4 /* Key */],pCell->nData);
+	SyBigEndianPack64(&pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_DATA(pPage)],pCell->nData);
 	/* All done */
 	return UNQLITE_OK;
 }
@@ -50470,21 +51357,21 @@ static int lhRecordAppend(
 	if( pCell->iOvfl == 0 ){
 		sxu16 iOfft = 0; /* cc warning */
 		/* Local payload, check for a bigger place */
-		rc = lhAllocateSpace(pPage,L_HASH_CELL_SZ + pCell->nKey + pCell->nData + nByte,&iOfft);
+		rc = lhAllocateSpace(pPage,L_HASH_CELL_HDR(pPage) + pCell->nKey + pCell->nData + nByte,&iOfft);
 		if( rc != UNQLITE_OK ){
 			/* Transfer the payload to an overflow page */
 			rc = lhCellWriteOvflPayload(pCell,
-				&pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_SZ],pCell->nKey,
-				(const void *)&pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_SZ + pCell->nKey],pCell->nData,
+				&pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_HDR(pPage)],pCell->nKey,
+				(const void *)&pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_HDR(pPage) + pCell->nKey],pCell->nData,
 				pData,nByte,
 				(const void *)0);
 			if( rc != UNQLITE_OK ){
 				return rc;
 			}
 			/* Update the cell header */
-			SyBigEndianPack64(&pPage->pRaw->zData[pCell->iStart + 4 /* Hash */ + 4 /* Key */],pCell->nData + nByte);
+			SyBigEndianPack64(&pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_DATA(pPage)],pCell->nData + nByte);
 			/* Restore freespace */
-			lhRestoreSpace(pPage,(sxu16)(pCell->iStart + L_HASH_CELL_SZ),(sxu16)(pCell->nKey + pCell->nData));
+			lhRestoreSpace(pPage,(sxu16)(pCell->iStart + L_HASH_CELL_HDR(pPage)),(sxu16)(pCell->nKey + pCell->nData));
 			/* New data size */
 			pCell->nData += nByte;
 		}else{
@@ -50493,7 +51380,7 @@ static int lhRecordAppend(
 			SyBlob sWorker;
 			SyBlobInit(&sWorker,&pEngine->sAllocator);
 			/* Copy the old data */
-			rc = SyBlobAppend(&sWorker,(const void *)&pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_SZ + pCell->nKey],(sxu32)pCell->nData);
+			rc = SyBlobAppend(&sWorker,(const void *)&pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_HDR(pPage) + pCell->nKey],(sxu32)pCell->nData);
 			if( rc == SXRET_OK ){
 				/* Append the new data */
 				rc = SyBlobAppend(&sWorker,pData,(sxu32)nByte);
@@ -50505,7 +51392,7 @@ static int lhRecordAppend(
 			/* Space is available, transfer the cell */
 			lhMoveLocalCell(pCell,iOfft,SyBlobData(&sWorker),(unqlite_int64)SyBlobLength(&sWorker));
 			/* Restore cell space */
-			lhRestoreSpace(pPage,iOldOfft,(sxu16)(L_HASH_CELL_SZ + pCell->nKey + iOld));
+			lhRestoreSpace(pPage,iOldOfft,(sxu16)(L_HASH_CELL_HDR(pPage) + pCell->nKey + iOld));
 			/* All done */
 			SyBlobRelease(&sWorker);
 		}
@@ -50597,7 +51484,7 @@ static int lhRecordAppend(
 	pEngine->pIo->xPageUnref(pOvfl);
 	/* Finally, update the cell header */
 	pCell->nData += nByte;
-	SyBigEndianPack64(&pPage->pRaw->zData[pCell->iStart + 4 /* Hash */ + 4 /* Key */],pCell->nData);
+	SyBigEndianPack64(&pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_DATA(pPage)],pCell->nData);
 	/* All done */
 	return UNQLITE_OK;
 }
@@ -50665,10 +51552,10 @@ static int lhStoreCell(
 		return rc;
 	}
 	/* Check for a free block  */
-	rc = lhAllocateSpace(pPage,L_HASH_CELL_SZ+nKeyLen+nDataLen,&nOfft);
+	rc = lhAllocateSpace(pPage,L_HASH_CELL_HDR(pPage)+nKeyLen+nDataLen,&nOfft);
 	if( rc != UNQLITE_OK ){
 		/* Check for a free block to hold a single cell only (without payload) */
-		rc = lhAllocateSpace(pPage,L_HASH_CELL_SZ,&nOfft);
+		rc = lhAllocateSpace(pPage,L_HASH_CELL_HDR(pPage),&nOfft);
 		if( rc != UNQLITE_OK ){
 			if( !auto_append ){
 				/* A split must be done */
@@ -50732,10 +51619,10 @@ static int lhFindSlavePage(lhpage *pPage,sxu64 nAmount,sxu16 *pOfft,lhpage **ppS
 	/* Look for an already attached slave page */
 	for( i = 0 ; i < pMaster->iSlave ; ++i ){
 		/* Find a free chunk big enough */
-		rc = lhAllocateSpace(pSlave,L_HASH_CELL_SZ+nAmount,&iOfft);
+		rc = lhAllocateSpace(pSlave,L_HASH_CELL_HDR(pSlave)+nAmount,&iOfft);
 		if( rc != UNQLITE_OK ){
 			/* A space for cell header only */
-			rc = lhAllocateSpace(pSlave,L_HASH_CELL_SZ,&iOfft);
+			rc = lhAllocateSpace(pSlave,L_HASH_CELL_HDR(pSlave),&iOfft);
 		}
 		if( rc == UNQLITE_OK ){
 			/* All done */
@@ -50771,9 +51658,9 @@ static int lhFindSlavePage(lhpage *pPage,sxu64 nAmount,sxu16 *pOfft,lhpage **ppS
 	}
 	if( pOfft ){
 		/* Look for a free block */
-		if( UNQLITE_OK != lhAllocateSpace(pNew,L_HASH_CELL_SZ+nAmount,&iOfft) ){
+		if( UNQLITE_OK != lhAllocateSpace(pNew,L_HASH_CELL_HDR(pNew)+nAmount,&iOfft) ){
 			/* Cell header only */
-			lhAllocateSpace(pNew,L_HASH_CELL_SZ,&iOfft); /* Never fail */
+			lhAllocateSpace(pNew,L_HASH_CELL_HDR(pNew),&iOfft); /* Never fail */
 		}	
 		*pOfft = iOfft;
 	}
@@ -50823,10 +51710,10 @@ static int lhTransferCell(lhcell *pTarget,lhpage *pPage)
 	sxu16 nOfft;
 	int rc;
 	/* Check for a free block to hold a single cell only */
-	rc = lhAllocateSpace(pPage,L_HASH_CELL_SZ,&nOfft);
+	rc = lhAllocateSpace(pPage,L_HASH_CELL_HDR(pPage),&nOfft);
 	if( rc != UNQLITE_OK ){
 		/* Store in a slave page */
-		rc = lhFindSlavePage(pPage,L_HASH_CELL_SZ,&nOfft,&pPage);
+		rc = lhFindSlavePage(pPage,L_HASH_CELL_HDR(pPage),&nOfft,&pPage);
 		if( rc != UNQLITE_OK ){
 			return rc;
 		}
@@ -50935,7 +51822,10 @@ static int lhSplit(lhpage *pTarget,int *pRetry)
 	unqlite_page *pRaw;
 	int rc;
 	/* Get the real page number of the bucket to split */
-	pRec = lhMapFindBucket(pEngine,pEngine->split_bucket);
+	rc = lhMapLookup(pEngine,pEngine->split_bucket,&pRec);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
 	if( pRec == 0 ){
 		/* Can't happen */
 		return UNQLITE_CORRUPT;
@@ -51058,6 +51948,10 @@ static int lh_record_insert(
 	if( rc != UNQLITE_OK ){
 		return rc;
 	}
+	if( pEngine->nFixedKey && nKeyLen != pEngine->nFixedKey ){
+		pEngine->pIo->xErr(pEngine->pIo->pHandle,"Key length does not match the fixed key length of this database");
+		return UNQLITE_INVALID;
+	}
 	iCnt = 0;
 	/* Compute the hash of the key first */
 	nHash = pEngine->xHash(pKey,(sxu32)nKeyLen);
@@ -51069,7 +51963,10 @@ retry:
 		iBucket = nHash & (pEngine->max_split_bucket - 1);
 	}
 	/* Map the logical bucket number to real page number */
-	pRec = lhMapFindBucket(pEngine,iBucket);
+	rc = lhMapLookup(pEngine,iBucket,&pRec);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
 	if( pRec == 0 ){
 		/* Request a new page */
 		rc = lhAcquirePage(pEngine,&pRaw);
@@ -51162,6 +52059,7 @@ static int lhash_write_header(lhash_kv_engine *pEngine,unqlite_page *pHeader)
 
 	pEngine->pHeader = pHeader;
 	/* 4 byte magic number */
+	pEngine->nMagic = pEngine->nFixedKey ? (L_HASH_MAGIC_FIXED | pEngine->nFixedKey) : L_HASH_MAGIC;
 	SyBigEndianPack32(zRaw,pEngine->nMagic);
 	zRaw += 4;
 	/* 4 byte hash value to identify a valid hash function */
@@ -51190,6 +52088,20 @@ static int lhash_write_header(lhash_kv_engine *pEngine,unqlite_page *pHeader)
 	/* All done */
 	return UNQLITE_OK;
  }
+/*
+ * Select the cell layout: fixed length keys (nKey > 0) or variable length keys.
+ */
+static void lhSetFixedKey(lhash_kv_engine *pEngine,sxu32 nKey)
+{
+	pEngine->nFixedKey = nKey;
+	if( nKey ){
+		pEngine->nCellSz = L_HASH_CELL_SZ_FIXED;
+		pEngine->iCellData = 4/*Hash*/;
+	}else{
+		pEngine->nCellSz = L_HASH_CELL_SZ;
+		pEngine->iCellData = 4/*Hash*/+4/*Key*/;
+	}
+}
 /*
  * Exported: xOpen() method.
  */
@@ -51238,6 +52150,30 @@ static void lhash_page_release(void *pUserData)
 	lhcell *pNext,*pCell = pPage->pList;
 	unqlite_page *pRaw = pPage->pRaw;
 	sxu32 n;
+	if( pPage->pMaster != pPage ){
+		/* Slave page: detach from its master */
+		lhpage **ppSlave = &pPage->pMaster->pSlave;
+		while( *ppSlave ){
+			if( *ppSlave == pPage ){
+				*ppSlave = pPage->pNextSlave;
+				pPage->pMaster->iSlave--;
+				break;
+			}
+			ppSlave = &(*ppSlave)->pNextSlave;
+		}
+	}else{
+		/* Master page: the cells of the slave pages live in the master list
+		 * and are released below. Forget the slave pages too, so they get
+		 * parsed again when the master is reloaded (they stay referenced).
+		 */
+		lhpage *pSlave = pPage->pSlave;
+		while( pSlave ){
+			lhpage *pNextSlave = pSlave->pNextSlave;
+			pSlave->pRaw->pUserData = 0;
+			SyMemBackendPoolFree(&pEngine->sAllocator,pSlave);
+			pSlave = pNextSlave;
+		}
+	}
 	/* Drop in-memory cells */
 	for( n = 0 ; n < pPage->nCell ; ++n ){
 		pNext = pCell->pNext;
@@ -51275,6 +52211,79 @@ static sxu32 lhash_bin_hash(const void *pSrc,sxu32 nLen)
 	}	
 	return nH;
 }
+/*
+ * Word at a time hash function (in the style of wyhash).
+ *
+ * Eight bytes are consumed per step and mixed with a 64x64->128 bit multiply,
+ * which spreads uuid-like keys evenly over the low bits the linear hash uses
+ * to pick a split bucket. 16 byte keys (i.e. uuids) take a dedicated path.
+ * Words are read in little-endian order so that the result (which ends up
+ * on disk) does not depend on the host.
+ */
+#define FH_P0 0xa0761d6478bd642fULL
+#define FH_P1 0xe7037ed1a0b428dbULL
+#define FH_P2 0x8ebc6af09c88c6e3ULL
+static sxu64 fh_read64(const unsigned char *z)
+{
+	return (sxu64)z[0] | ((sxu64)z[1] << 8) | ((sxu64)z[2] << 16) | ((sxu64)z[3] << 24) |
+		((sxu64)z[4] << 32) | ((sxu64)z[5] << 40) | ((sxu64)z[6] << 48) | ((sxu64)z[7] << 56);
+}
+static sxu64 fh_read32(const unsigned char *z)
+{
+	return (sxu64)z[0] | ((sxu64)z[1] << 8) | ((sxu64)z[2] << 16) | ((sxu64)z[3] << 24);
+}
+/*
+ * Multiply two 64 bit words and fold the 128 bit product.
+ */
+static sxu64 fh_mix(sxu64 a,sxu64 b)
+{
+#if defined(__SIZEOF_INT128__)
+	unsigned __int128 r = (unsigned __int128)a * b;
+	return (sxu64)r ^ (sxu64)(r >> 64);
+#else
+	sxu64 ha = a >> 32, hb = b >> 32, la = (sxu32)a, lb = (sxu32)b;
+	sxu64 rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	sxu64 t = rl + (rm0 << 32), c = t < rl;
+	sxu64 lo = t + (rm1 << 32);
+	c += lo < t;
+	return lo ^ (rh + (rm0 >> 32) + (rm1 >> 32) + c);
+#endif
+}
+UNQLITE_PRIVATE sxu32 unqliteFastHash(const void *pSrc,sxu32 nLen)
+{
+	const unsigned char *zIn = (const unsigned char *)pSrc;
+	sxu64 nSeed = FH_P0 ^ nLen;
+	sxu64 a,b,h;
+	if( nLen == 16 ){
+		/* Fast path: uuid keys */
+		a = fh_read64(zIn);
+		b = fh_read64(&zIn[8]);
+	}else if( nLen < 16 ){
+		if( nLen >= 4 ){
+			/* Two (possibly overlapping) 32 bit words from each end */
+			sxu32 n = (nLen >> 3) << 2;
+			a = (fh_read32(zIn) << 32) | fh_read32(&zIn[n]);
+			b = (fh_read32(&zIn[nLen - 4]) << 32) | fh_read32(&zIn[nLen - 4 - n]);
+		}else if( nLen > 0 ){
+			a = ((sxu64)zIn[0] << 16) | ((sxu64)zIn[nLen >> 1] << 8) | zIn[nLen - 1];
+			b = 0;
+		}else{
+			a = b = 0;
+		}
+	}else{
+		const unsigned char *zEnd = &zIn[nLen];
+		while( zEnd - zIn > 16 ){
+			nSeed = fh_mix(fh_read64(zIn) ^ FH_P1,fh_read64(&zIn[8]) ^ nSeed);
+			zIn += 16;
+		}
+		/* Last 16 bytes (may overlap the previous block) */
+		a = fh_read64(zEnd - 16);
+		b = fh_read64(zEnd - 8);
+	}
+	h = fh_mix(a ^ FH_P1,b ^ nSeed);
+	h = fh_mix(h ^ FH_P2,nLen ^ FH_P1);
+	return (sxu32)(h ^ (h >> 32));
+}
 /*
  * Exported: xInit() method.
  * Initialize the Key value storage engine.
@@ -51309,6 +52318,7 @@ static int lhash_kv_init(unqlite_kv_engine *pEngine,int iPageSize)
 	pHash->max_split_bucket = 1;
 	pHash->nmax_split_nucket = 2;
 	pHash->nMagic = L_HASH_MAGIC;
+	lhSetFixedKey(pHash,0);
 	/* Install the cache unpin and reload callbacks */
 	pHash->pIo->xSetUnpin(pHash->pIo->pHandle,lhash_page_release);
 	pHash->pIo->xSetReload(pHash->pIo->pHandle,lhash_page_release);
@@ -51327,6 +52337,35 @@ static void lhash_kv_release(unqlite_kv_engine *pEngine)
 	/* Release the private memory backend */
 	SyMemBackendRelease(&pHash->sAllocator);
 }
+/*
+ * Count the pages of the free list by walking it, which reads every free page.
+ * Only done when the host application did not give the length of the list.
+ */
+static int lhCountFreePages(lhash_kv_engine *pEngine)
+{
+	unqlite_page *pPage;
+	sxi64 nPage = 0;
+	pgno iNext;
+	int rc;
+	/* Acquire the first page (hash Header) so that the free list head gets loaded */
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,1,0);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	iNext = pEngine->nFreeList;
+	while( iNext != 0 ){
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,iNext,&pPage);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		SyBigEndianUnpack64(pPage->zData,&iNext);
+		pEngine->pIo->xPageUnref(pPage);
+		nPage++;
+	}
+	pEngine->nFreePage = nPage;
+	pEngine->bFreeKnown = 1;
+	return UNQLITE_OK;
+}
 /*
  *  Exported: xConfig() method.
  *  Configure the linear hash KV store.
@@ -51357,6 +52396,43 @@ static int lhash_kv_config(unqlite_kv_engine *pEngine,int op,va_list ap)
 		}
 		break;
 									 }
+	case UNQLITE_KV_CONFIG_FIXED_KEY_SIZE: {
+		/* Length of every key (new databases only) */
+		unsigned int nKey = va_arg(ap,unsigned int);
+		if( pHash->nBuckRec > 0 ){
+			/* Locked operation */
+			rc = UNQLITE_LOCKED;
+		}else if( nKey > 0xFF ){
+			rc = UNQLITE_INVALID;
+		}else{
+			lhSetFixedKey(pHash,nKey);
+		}
+		break;
+									 }
+	case UNQLITE_KV_CONFIG_FREE_PAGES: {
+		/* Length of the free list, as recorded by the host application when it last closed the database */
+		sxi64 nPage = va_arg(ap,sxi64);
+		if( nPage < 0 ){
+			rc = UNQLITE_INVALID;
+		}else{
+			pHash->nFreePage = nPage;
+			pHash->bFreeKnown = 1;
+		}
+		break;
+									 }
+	case UNQLITE_KV_CONFIG_GET_FREE_PAGES: {
+		/* Length of the free list and page size */
+		sxi64 *pnPage = va_arg(ap,sxi64 *);
+		int *pPageSize = va_arg(ap,int *);
+		if( !pHash->bFreeKnown ){
+			rc = lhCountFreePages(pHash);
+		}
+		if( rc == UNQLITE_OK ){
+			*pnPage = pHash->nFreePage;
+			*pPageSize = pHash->iPageSize;
+		}
+		break;
+									 }
 	default:
 		/* Unknown OP */
 		rc = UNQLITE_UNKNOWN;
@@ -51418,6 +52494,13 @@ static int lhCursorNextPage(lhash_kv_cursor *pPtr)
 			pCur->pStore->pIo->xPageUnref(pPtr->pRaw);
 			pPtr->pRaw = 0;
 		}
+		if( pRec->pPrev == 0 ){
+			/* Reached the end of what is loaded of the bucket map */
+			rc = lhMapLoadAll((lhash_kv_engine *)pCur->pStore);
+			if( rc != UNQLITE_OK ){
+				return rc;
+			}
+		}
 		/* Advance the map cursor */
 		pCur->pRec = pRec->pPrev; /* Not a bug, reverse link */
 		/* Load the next page on the list */
@@ -51522,6 +52605,11 @@ static int lhCursorLast(unqlite_kv_cursor *pCursor)
 		}
 		pCur->is_first = 0;
 	}
+	/* The last map record may not be loaded yet */
+	rc = lhMapLoadAll(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
 	/* Point to the last map record */
 	pCur->pRec = pEngine->pList;
 	/* Load the cells */
@@ -51656,6 +52744,48 @@ static int lhCursorData(unqlite_kv_cursor *pCursor,int (*xConsumer)(const void *
 	rc = lhConsumeCellData(pCell,xConsumer,pUserData);
 	return rc;
 }
+/*
+ * Consume at most nLen bytes of the data starting at offset iOfft.
+ */
+static int lhCursorDataRange(unqlite_kv_cursor *pCursor,unqlite_int64 iOfft,unqlite_int64 nLen,
+	int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
+{
+	lhash_kv_cursor *pCur = (lhash_kv_cursor *)pCursor;
+	lhcell *pCell;
+	if( pCur->iState != L_HASH_CURSOR_STATE_CELL || pCur->pCell == 0 || iOfft < 0 || nLen < 0 ){
+		/* Invalid state */
+		return UNQLITE_INVALID;
+	}
+	/* Point to the target cell */
+	pCell = pCur->pCell;
+	if( (sxu64)iOfft >= pCell->nData ){
+		/* Nothing to consume */
+		return UNQLITE_OK;
+	}
+	if( (sxu64)nLen > pCell->nData - (sxu64)iOfft ){
+		nLen = (unqlite_int64)(pCell->nData - (sxu64)iOfft);
+	}
+	return lhCellDataRange(pCell,(sxu64)iOfft,(sxu64)nLen,0,xConsumer,pUserData);
+}
+/*
+ * Overwrite nLen bytes of the data starting at offset iOfft in place.
+ */
+static int lhCursorOverwrite(unqlite_kv_cursor *pCursor,unqlite_int64 iOfft,const void *pData,unqlite_int64 nLen)
+{
+	lhash_kv_cursor *pCur = (lhash_kv_cursor *)pCursor;
+	lhcell *pCell;
+	if( pCur->iState != L_HASH_CURSOR_STATE_CELL || pCur->pCell == 0 || iOfft < 0 || nLen < 0 ){
+		/* Invalid state */
+		return UNQLITE_INVALID;
+	}
+	/* Point to the target cell */
+	pCell = pCur->pCell;
+	if( (sxu64)iOfft > pCell->nData || (sxu64)nLen > pCell->nData - (sxu64)iOfft ){
+		/* Range out of the data */
+		return UNQLITE_INVALID;
+	}
+	return lhCellDataRange(pCell,(sxu64)iOfft,(sxu64)nLen,(const unsigned char *)pData,0,0);
+}
 /*
  * Find a partiuclar record.
  */
@@ -51703,7 +52833,7 @@ UNQLITE_PRIVATE const unqlite_kv_methods * unqliteExportDiskKvStorage(void)
 		"hash",                     /* zName */
 		sizeof(lhash_kv_engine),    /* szKv */
 		sizeof(lhash_kv_cursor),    /* szCursor */
-		1,                          /* iVersion */
+		2,                          /* iVersion */
 		lhash_kv_init,              /* xInit */
 		lhash_kv_release,           /* xRelease */
 		lhash_kv_config,            /* xConfig */
@@ -51723,7 +52853,9 @@ UNQLITE_PRIVATE const unqlite_kv_methods * unqliteExportDiskKvStorage(void)
 		lhCursorDataLength,         /* xDataLength */
 		lhCursorData,               /* xData */
 		lhCursorReset,              /* xReset */
-		0                           /* xRelease */                        
+		0,                          /* xRelease */
+		lhCursorDataRange,          /* xDataRange */
+		lhCursorOverwrite           /* xOverwrite */
 	};
 	return &sDiskStore;
 }
@@ -52128,6 +53260,47 @@ static int MemHashCursorData(unqlite_kv_cursor *pCursor,int (*xConsumer)(const v
 	/* Callback result */
 	return rc;
 }
+/*
+ * Consume at most nLen bytes of the data starting at offset iOfft.
+ */
+static int MemHashCursorDataRange(unqlite_kv_cursor *pCursor,unqlite_int64 iOfft,unqlite_int64 nLen,
+	int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
+{
+	mem_hash_cursor *pMem = (mem_hash_cursor *)pCursor;
+	mem_hash_record *pRec = pMem->pCur;
+	if( pRec == 0){
+		 return UNQLITE_EOF;
+	}
+	if( iOfft < 0 || nLen < 0 ){
+		return UNQLITE_INVALID;
+	}
+	if( iOfft >= (unqlite_int64)pRec->nDataLen ){
+		/* Nothing to consume */
+		return UNQLITE_OK;
+	}
+	if( nLen > (unqlite_int64)pRec->nDataLen - iOfft ){
+		nLen = (unqlite_int64)pRec->nDataLen - iOfft;
+	}
+	return xConsumer(&((const char *)pRec->pData)[iOfft],(unsigned int)nLen,pUserData);
+}
+/*
+ * Overwrite nLen bytes of the data starting at offset iOfft in place.
+ */
+static int MemHashCursorOverwrite(unqlite_kv_cursor *pCursor,unqlite_int64 iOfft,const void *pData,unqlite_int64 nLen)
+{
+	mem_hash_cursor *pMem = (mem_hash_cursor *)pCursor;
+	mem_hash_record *pRec = pMem->pCur;
+	if( pRec == 0){
+		 return UNQLITE_EOF;
+	}
+	if( iOfft < 0 || nLen < 0 || iOfft + nLen > (unqlite_int64)pRec->nDataLen ){
+		/* Range out of the data */
+		return UNQLITE_INVALID;
+	}
+	/* The record owns its data */
+	SyMemcpy(pData,&((char *)pRec->pData)[iOfft],(sxu32)nLen);
+	return UNQLITE_OK;
+}
 /*
  * Reset the cursor.
  */
@@ -52172,23 +53345,6 @@ static int MemHashCursorSeek(unqlite_kv_cursor *pCursor,const void *pKey,int nBy
 	}
 	return UNQLITE_OK;
 }
-/*
- * Builtin hash function.
- */
-static sxu32 MemHashFunc(const void *pSrc,sxu32 nLen)
-{
-	register unsigned char *zIn = (unsigned char *)pSrc;
-	unsigned char *zEnd;
-	sxu32 nH = 5381;
-	zEnd = &zIn[nLen];
-	for(;;){
-		if( zIn >= zEnd ){ break; } nH = nH * 33 + zIn[0] ; zIn++;
-		if( zIn >= zEnd ){ break; } nH = nH * 33 + zIn[0] ; zIn++;
-		if( zIn >= zEnd ){ break; } nH = nH * 33 + zIn[0] ; zIn++;
-		if( zIn >= zEnd ){ break; } nH = nH * 33 + zIn[0] ; zIn++;
-	}	
-	return nH;
-}
 /* Default bucket size */
 #define MEM_HASH_BUCKET_SIZE 64
 /* Default fill factor */
@@ -52206,8 +53362,10 @@ static int MemHashInit(unqlite_kv_engine *pKvEngine,int iPageSize)
 	/* Already protected by the upper layers */
 	SyMemBackendDisbaleMutexing(&pEngine->sAlloc);
 #endif
-	/* Default hash & comparison function */
-	pEngine->xHash = MemHashFunc;
+	/* Default hash & comparison function. Nothing is persisted by this
+	 * engine, so it can always use the word at a time hash.
+	 */
+	pEngine->xHash = unqliteFastHash;
 	pEngine->xCmp = SyMemcmp;
 	/* Allocate a new bucket */
 	pEngine->apBucket = (mem_hash_record **)SyMemBackendAlloc(&pEngine->sAlloc,MEM_HASH_BUCKET_SIZE * sizeof(mem_hash_record *));
@@ -52387,7 +53545,7 @@ UNQLITE_PRIVATE const unqlite_kv_methods * unqliteExportMemKvStorage(void)
 		"mem",                      /* zName */
 		sizeof(mem_hash_kv_engine), /* szKv */
 		sizeof(mem_hash_cursor),    /* szCursor */
-		1,                          /* iVersion */
+		2,                          /* iVersion */
 		MemHashInit,                /* xInit */
 		MemHashRelease,             /* xRelease */
 		MemHashConfigure,           /* xConfig */
@@ -52407,10 +53565,611 @@ UNQLITE_PRIVATE const unqlite_kv_methods * unqliteExportMemKvStorage(void)
 		MemHashCursorDataLength,    /* xDataLength */
 		MemHashCursorData,          /* xData */
 		MemHashCursorReset,         /* xReset */
-		0        /* xRelease */                        
+		0,                          /* xRelease */
+		MemHashCursorDataRange,     /* xDataRange */
+		MemHashCursorOverwrite      /* xOverwrite */
 	};
 	return &sMemStore;
 }
+/*
+ * ----------------------------------------------------------
+ * File: skiplist_kv.c
+ * ----------------------------------------------------------
+ */
+#ifndef UNQLITE_AMALGAMATION
+#include "unqliteInt.h"
+#endif
+/*
+ * This file implements an ordered in-memory key value storage engine for unQLite.
+ * Records are kept in a skiplist sorted by key, so cursors walk the records in key
+ * order and UNQLITE_CURSOR_MATCH_LE and UNQLITE_CURSOR_MATCH_GE seeks position a
+ * cursor on the nearest record. Like the "mem" engine, it does not support
+ * transactions and relies on the upper layers for locking.
+ * Select it by name with the UNQLITE_CONFIG_KV_ENGINE verb on an in-memory database.
+ */
+/* Maximum height of a record. With a 1/4 promotion probability, 4^24 records */
+#define SL_MAX_LEVEL 24
+/* Forward declaration */
+typedef struct sl_kv_engine sl_kv_engine;
+/*
+ * Each record is stored in an instance of the following structure.
+ * The key is stored right after the forward links.
+ */
+typedef struct sl_record sl_record;
+struct sl_record
+{
+	sl_kv_engine *pEngine;   /* Storage engine */
+	const void *pKey;        /* Key */
+	sxu32 nKeyLen;           /* Key size */
+	void *pData;             /* Data */
+	sxu32 nDataLen;          /* Data length (Max 4GB) */
+	sxu32 nLevel;            /* Number of forward links */
+	sl_record *pPrev;        /* Previous record in key order */
+	sl_record *apNext[1];    /* Forward links, one per level */
+};
+/*
+ * Each ordered in-memory KV engine is represented by an instance
+ * of the following structure.
+ */
+struct sl_kv_engine
+{
+	const unqlite_kv_io *pIo;         /* IO methods: MUST be first */
+	/* Private data */
+	SyMemBackend sAlloc;              /* Private memory allocator */
+	ProcCmp xCmp;                     /* Key comparison function */
+	sxu32 nRecord;                    /* Total number of records */
+	sxu32 nLevel;                     /* Current height of the list */
+	sxu32 iRand;                      /* PRNG state for record heights */
+	sl_record *apHead[SL_MAX_LEVEL];  /* Head links, one per level */
+	sl_record *pLast;                 /* Record with the largest key */
+};
+/*
+ * Compare the key of a record with a given key.
+ * Keys are ordered by content and then by length.
+ */
+static sxi32 SkipListCmp(sl_kv_engine *pEngine,sl_record *pRec,const void *pKey,sxu32 nKeyLen)
+{
+	sxu32 n = pRec->nKeyLen < nKeyLen ? pRec->nKeyLen : nKeyLen;
+	sxi32 rc = n > 0 ? pEngine->xCmp(pRec->pKey,pKey,n) : 0;
+	if( rc == 0 && pRec->nKeyLen != nKeyLen ){
+		rc = pRec->nKeyLen < nKeyLen ? -1 : 1;
+	}
+	return rc;
+}
+/*
+ * Return the first record whose key is greater than or equal to the given key.
+ * If apUpdate is not NULL, it receives the last record before that position
+ * at each level (NULL for the list head).
+ */
+static sl_record * SkipListFind(sl_kv_engine *pEngine,const void *pKey,sxu32 nKeyLen,sl_record **apUpdate)
+{
+	sl_record *pCur = 0;
+	sl_record *pNext;
+	sxi32 i;
+	for( i = (sxi32)pEngine->nLevel - 1 ; i >= 0 ; --i ){
+		pNext = pCur ? pCur->apNext[i] : pEngine->apHead[i];
+		while( pNext && SkipListCmp(pEngine,pNext,pKey,nKeyLen) < 0 ){
+			pCur = pNext;
+			pNext = pCur->apNext[i];
+		}
+		if( apUpdate ){
+			apUpdate[i] = pCur;
+		}
+	}
+	return pCur ? pCur->apNext[0] : pEngine->apHead[0];
+}
+/*
+ * Pick the height of a new record.
+ */
+static sxu32 SkipListRandomLevel(sl_kv_engine *pEngine)
+{
+	sxu32 nLevel = 1;
+	sxu32 x = pEngine->iRand;
+	/* xorshift32 */
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	pEngine->iRand = x;
+	while( (x & 3) == 0 && nLevel < SL_MAX_LEVEL ){
+		nLevel++;
+		x >>= 2;
+	}
+	return nLevel;
+}
+/*
+ * Allocate a new record and link it after the records in apUpdate.
+ */
+static sl_record * SkipListInsert(
+	sl_kv_engine *pEngine,
+	sl_record **apUpdate,
+	const void *pKey,sxu32 nKey,
+	const void *pData,sxu32 nData
+	)
+{
+	SyMemBackend *pAlloc = &pEngine->sAlloc;
+	sl_record *pRecord,*pNext;
+	sxu32 nLevel,nByte,i;
+	char *zPtr;
+	nLevel = SkipListRandomLevel(pEngine);
+	/* Total number of bytes to alloc */
+	nByte = sizeof(sl_record) + (nLevel - 1) * sizeof(sl_record *) + nKey;
+	pRecord = (sl_record *)SyMemBackendAlloc(pAlloc,nByte);
+	if( pRecord == 0 ){
+		return 0;
+	}
+	SyZero(pRecord,nByte - nKey);
+	pRecord->pData = SyMemBackendAlloc(pAlloc,nData);
+	if( pRecord->pData == 0 && nData > 0 ){
+		SyMemBackendFree(pAlloc,pRecord);
+		return 0;
+	}
+	/* Fill in the structure */
+	zPtr = (char *)&pRecord->apNext[nLevel];
+	SyMemcpy(pKey,zPtr,nKey);
+	SyMemcpy(pData,pRecord->pData,nData);
+	pRecord->pEngine = pEngine;
+	pRecord->pKey = (const void *)zPtr;
+	pRecord->nKeyLen = nKey;
+	pRecord->nDataLen = nData;
+	pRecord->nLevel = nLevel;
+	/* Levels above the current height start at the list head */
+	for( i = pEngine->nLevel ; i < nLevel ; ++i ){
+		apUpdate[i] = 0;
+	}
+	if( nLevel > pEngine->nLevel ){
+		pEngine->nLevel = nLevel;
+	}
+	/* Link the record */
+	for( i = 0 ; i < nLevel ; ++i ){
+		if( apUpdate[i] ){
+			pRecord->apNext[i] = apUpdate[i]->apNext[i];
+			apUpdate[i]->apNext[i] = pRecord;
+		}else{
+			pRecord->apNext[i] = pEngine->apHead[i];
+			pEngine->apHead[i] = pRecord;
+		}
+	}
+	pRecord->pPrev = apUpdate[0];
+	pNext = pRecord->apNext[0];
+	if( pNext ){
+		pNext->pPrev = pRecord;
+	}else{
+		pEngine->pLast = pRecord;
+	}
+	pEngine->nRecord++;
+	return pRecord;
+}
+/*
+ * Unlink a given record from the skiplist and release it.
+ */
+static void SkipListRemove(sl_kv_engine *pEngine,sl_record *pRecord)
+{
+	sl_record *apUpdate[SL_MAX_LEVEL];
+	sl_record *pNext = pRecord->apNext[0];
+	sxu32 i;
+	SkipListFind(pEngine,pRecord->pKey,pRecord->nKeyLen,apUpdate);
+	for( i = 0 ; i < pRecord->nLevel ; ++i ){
+		if( apUpdate[i] ){
+			apUpdate[i]->apNext[i] = pRecord->apNext[i];
+		}else{
+			pEngine->apHead[i] = pRecord->apNext[i];
+		}
+	}
+	if( pNext ){
+		pNext->pPrev = pRecord->pPrev;
+	}else{
+		pEngine->pLast = pRecord->pPrev;
+	}
+	while( pEngine->nLevel > 0 && pEngine->apHead[pEngine->nLevel - 1] == 0 ){
+		pEngine->nLevel--;
+	}
+	pEngine->nRecord--;
+	/* Release the entry */
+	SyMemBackendFree(&pEngine->sAlloc,pRecord->pData);
+	SyMemBackendFree(&pEngine->sAlloc,pRecord); /* Key is also stored here */
+}
+/*
+ * Exported Interfaces.
+ */
+/*
+ * Each public cursor is identified by an instance of this structure.
+ */
+typedef struct sl_cursor sl_cursor;
+struct sl_cursor
+{
+	unqlite_kv_engine *pStore; /* Must be first */
+	/* Private fields */
+	sl_record *pCur;           /* Current record */
+};
+/*
+ * Initialize the cursor.
+ */
+static void SkipListInitCursor(unqlite_kv_cursor *pCursor)
+{
+	 sl_kv_engine *pEngine = (sl_kv_engine *)pCursor->pStore;
+	 sl_cursor *pSl = (sl_cursor *)pCursor;
+	 /* Point to the smallest key */
+	 pSl->pCur = pEngine->apHead[0];
+}
+/*
+ * Point to the first entry.
+ */
+static int SkipListCursorFirst(unqlite_kv_cursor *pCursor)
+{
+	 sl_kv_engine *pEngine = (sl_kv_engine *)pCursor->pStore;
+	 sl_cursor *pSl = (sl_cursor *)pCursor;
+	 pSl->pCur = pEngine->apHead[0];
+	 return UNQLITE_OK;
+}
+/*
+ * Point to the last entry.
+ */
+static int SkipListCursorLast(unqlite_kv_cursor *pCursor)
+{
+	 sl_kv_engine *pEngine = (sl_kv_engine *)pCursor->pStore;
+	 sl_cursor *pSl = (sl_cursor *)pCursor;
+	 pSl->pCur = pEngine->pLast;
+	 return UNQLITE_OK;
+}
+/*
+ * is a Valid Cursor.
+ */
+static int SkipListCursorValid(unqlite_kv_cursor *pCursor)
+{
+	 sl_cursor *pSl = (sl_cursor *)pCursor;
+	 return pSl->pCur != 0 ? 1 : 0;
+}
+/*
+ * Point to the next entry.
+ */
+static int SkipListCursorNext(unqlite_kv_cursor *pCursor)
+{
+	 sl_cursor *pSl = (sl_cursor *)pCursor;
+	 if( pSl->pCur == 0){
+		 return UNQLITE_EOF;
+	 }
+	 pSl->pCur = pSl->pCur->apNext[0];
+	 return UNQLITE_OK;
+}
+/*
+ * Point to the previous entry.
+ */
+static int SkipListCursorPrev(unqlite_kv_cursor *pCursor)
+{
+	 sl_cursor *pSl = (sl_cursor *)pCursor;
+	 if( pSl->pCur == 0){
+		 return UNQLITE_EOF;
+	 }
+	 pSl->pCur = pSl->pCur->pPrev;
+	 return UNQLITE_OK;
+}
+/*
+ * Return key length.
+ */
+static int SkipListCursorKeyLength(unqlite_kv_cursor *pCursor,int *pLen)
+{
+	sl_cursor *pSl = (sl_cursor *)pCursor;
+	if( pSl->pCur == 0){
+		 return UNQLITE_EOF;
+	}
+	*pLen = (int)pSl->pCur->nKeyLen;
+	return UNQLITE_OK;
+}
+/*
+ * Return data length.
+ */
+static int SkipListCursorDataLength(unqlite_kv_cursor *pCursor,unqlite_int64 *pLen)
+{
+	sl_cursor *pSl = (sl_cursor *)pCursor;
+	if( pSl->pCur == 0 ){
+		 return UNQLITE_EOF;
+	}
+	*pLen = pSl->pCur->nDataLen;
+	return UNQLITE_OK;
+}
+/*
+ * Consume the key.
+ */
+static int SkipListCursorKey(unqlite_kv_cursor *pCursor,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
+{
+	sl_cursor *pSl = (sl_cursor *)pCursor;
+	if( pSl->pCur == 0){
+		 return UNQLITE_EOF;
+	}
+	/* Invoke the callback */
+	return xConsumer(pSl->pCur->pKey,pSl->pCur->nKeyLen,pUserData);
+}
+/*
+ * Consume the data.
+ */
+static int SkipListCursorData(unqlite_kv_cursor *pCursor,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
+{
+	sl_cursor *pSl = (sl_cursor *)pCursor;
+	if( pSl->pCur == 0){
+		 return UNQLITE_EOF;
+	}
+	/* Invoke the callback */
+	return xConsumer(pSl->pCur->pData,pSl->pCur->nDataLen,pUserData);
+}
+/*
+ * Consume at most nLen bytes of the data starting at offset iOfft.
+ */
+static int SkipListCursorDataRange(unqlite_kv_cursor *pCursor,unqlite_int64 iOfft,unqlite_int64 nLen,
+	int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
+{
+	sl_cursor *pSl = (sl_cursor *)pCursor;
+	sl_record *pRec = pSl->pCur;
+	if( pRec == 0){
+		 return UNQLITE_EOF;
+	}
+	if( iOfft < 0 || nLen < 0 ){
+		return UNQLITE_INVALID;
+	}
+	if( iOfft >= (unqlite_int64)pRec->nDataLen ){
+		/* Nothing to consume */
+		return UNQLITE_OK;
+	}
+	if( nLen > (unqlite_int64)pRec->nDataLen - iOfft ){
+		nLen = (unqlite_int64)pRec->nDataLen - iOfft;
+	}
+	return xConsumer(&((const char *)pRec->pData)[iOfft],(unsigned int)nLen,pUserData);
+}
+/*
+ * Overwrite nLen bytes of the data starting at offset iOfft in place.
+ */
+static int SkipListCursorOverwrite(unqlite_kv_cursor *pCursor,unqlite_int64 iOfft,const void *pData,unqlite_int64 nLen)
+{
+	sl_cursor *pSl = (sl_cursor *)pCursor;
+	sl_record *pRec = pSl->pCur;
+	if( pRec == 0){
+		 return UNQLITE_EOF;
+	}
+	if( iOfft < 0 || nLen < 0 || iOfft + nLen > (unqlite_int64)pRec->nDataLen ){
+		/* Range out of the data */
+		return UNQLITE_INVALID;
+	}
+	SyMemcpy(pData,&((char *)pRec->pData)[iOfft],(sxu32)nLen);
+	return UNQLITE_OK;
+}
+/*
+ * Reset the cursor.
+ */
+static void SkipListCursorReset(unqlite_kv_cursor *pCursor)
+{
+	sl_cursor *pSl = (sl_cursor *)pCursor;
+	pSl->pCur = ((sl_kv_engine *)pCursor->pStore)->apHead[0];
+}
+/*
+ * Remove a particular record.
+ */
+static int SkipListCursorDelete(unqlite_kv_cursor *pCursor)
+{
+	sl_cursor *pSl = (sl_cursor *)pCursor;
+	sl_record *pNext;
+	if( pSl->pCur == 0 ){
+		/* Cursor does not point to anything */
+		return UNQLITE_NOTFOUND;
+	}
+	pNext = pSl->pCur->apNext[0];
+	/* Perform the deletion */
+	SkipListRemove(pSl->pCur->pEngine,pSl->pCur);
+	/* Point to the next entry */
+	pSl->pCur = pNext;
+	return UNQLITE_OK;
+}
+/*
+ * Find a particular record.
+ * UNQLITE_CURSOR_MATCH_LE and UNQLITE_CURSOR_MATCH_GE fall back to the nearest
+ * smaller or larger key when there is no exact match.
+ */
+static int SkipListCursorSeek(unqlite_kv_cursor *pCursor,const void *pKey,int nByte,int iPos)
+{
+	sl_kv_engine *pEngine = (sl_kv_engine *)pCursor->pStore;
+	sl_cursor *pSl = (sl_cursor *)pCursor;
+	sl_record *pRec;
+	/* Perform the lookup */
+	pRec = SkipListFind(pEngine,pKey,(sxu32)nByte,0);
+	if( pRec == 0 || SkipListCmp(pEngine,pRec,pKey,(sxu32)nByte) != 0 ){
+		if( iPos == UNQLITE_CURSOR_MATCH_LE ){
+			/* Largest key smaller than the given one */
+			pRec = pRec ? pRec->pPrev : pEngine->pLast;
+		}else if( iPos != UNQLITE_CURSOR_MATCH_GE ){
+			pRec = 0;
+		}
+	}
+	pSl->pCur = pRec;
+	if( pRec == 0 ){
+		/* No such record */
+		return UNQLITE_NOTFOUND;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Initialize the ordered in-memory storage engine.
+ */
+static int SkipListInit(unqlite_kv_engine *pKvEngine,int iPageSize)
+{
+	sl_kv_engine *pEngine = (sl_kv_engine *)pKvEngine;
+	/* Note that this instance is already zeroed */	
+	/* Memory backend */
+	SyMemBackendInitFromParent(&pEngine->sAlloc,unqliteExportMemBackend());
+#if defined(UNQLITE_ENABLE_THREADS)
+	/* Already protected by the upper layers */
+	SyMemBackendDisbaleMutexing(&pEngine->sAlloc);
+#endif
+	/* Default comparison function */
+	pEngine->xCmp = SyMemcmp;
+	/* Any non zero seed will do */
+	pEngine->iRand = 0x9E3779B9;
+	SXUNUSED(iPageSize); /* cc warning */
+	return UNQLITE_OK;
+}
+/*
+ * Release the ordered in-memory storage engine.
+ */
+static void SkipListRelease(unqlite_kv_engine *pKvEngine)
+{
+	sl_kv_engine *pEngine = (sl_kv_engine *)pKvEngine;
+	/* Release the private memory backend */
+	SyMemBackendRelease(&pEngine->sAlloc);
+}
+/*
+ * Configure the ordered in-memory storage engine.
+ */
+static int SkipListConfigure(unqlite_kv_engine *pKvEngine,int iOp,va_list ap)
+{
+	sl_kv_engine *pEngine = (sl_kv_engine *)pKvEngine;
+	int rc = UNQLITE_OK;
+	switch(iOp){
+	case UNQLITE_KV_CONFIG_HASH_FUNC:
+		/* Keys are not hashed, nothing to do */
+		break;
+	case UNQLITE_KV_CONFIG_CMP_FUNC: {
+		/* The comparison function defines the key order */
+		if( pEngine->nRecord > 0 ){
+			rc = UNQLITE_LOCKED;
+		}else{
+			ProcCmp xCmp = va_arg(ap,ProcCmp);
+			if( xCmp ){
+				pEngine->xCmp = xCmp;
+			}
+		}
+		break;
+									 }
+	default:
+		/* Unknown configuration option */
+		rc = UNQLITE_UNKNOWN;
+	}
+	return rc;
+}
+/*
+ * Replace method.
+ */
+static int SkipListReplace(
+	  unqlite_kv_engine *pKv,
+	  const void *pKey,int nKeyLen,
+	  const void *pData,unqlite_int64 nDataLen
+	  )
+{
+	sl_kv_engine *pEngine = (sl_kv_engine *)pKv;
+	sl_record *apUpdate[SL_MAX_LEVEL];
+	sl_record *pRecord;
+	if( nDataLen > SXU32_HIGH ){
+		/* Database limit */
+		pEngine->pIo->xErr(pEngine->pIo->pHandle,"Record size limit reached");
+		return UNQLITE_LIMIT;
+	}
+	/* Fetch the record first */
+	pRecord = SkipListFind(pEngine,pKey,(sxu32)nKeyLen,apUpdate);
+	if( pRecord == 0 || SkipListCmp(pEngine,pRecord,pKey,(sxu32)nKeyLen) != 0 ){
+		/* Insert a new record */
+		pRecord = SkipListInsert(pEngine,apUpdate,pKey,(sxu32)nKeyLen,pData,(sxu32)nDataLen);
+		if( pRecord == 0 ){
+			return UNQLITE_NOMEM;
+		}
+	}else{
+		sxu32 nData = (sxu32)nDataLen;
+		void *pNew;
+		/* Replace an existing record */
+		if( nData == pRecord->nDataLen ){
+			/* No need to free the old chunk */
+			pNew = pRecord->pData;
+		}else{
+			pNew = SyMemBackendAlloc(&pEngine->sAlloc,nData);
+			if( pNew == 0 && nData > 0 ){
+				return UNQLITE_NOMEM;
+			}
+			/* Release the old data */
+			SyMemBackendFree(&pEngine->sAlloc,pRecord->pData);
+		}
+		/* Reflect the change */
+		pRecord->nDataLen = nData;
+		SyMemcpy(pData,pNew,nData);
+		pRecord->pData = pNew;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Append method.
+ */
+static int SkipListAppend(
+	  unqlite_kv_engine *pKv,
+	  const void *pKey,int nKeyLen,
+	  const void *pData,unqlite_int64 nDataLen
+	  )
+{
+	sl_kv_engine *pEngine = (sl_kv_engine *)pKv;
+	sl_record *apUpdate[SL_MAX_LEVEL];
+	sl_record *pRecord;
+	if( nDataLen > SXU32_HIGH ){
+		/* Database limit */
+		pEngine->pIo->xErr(pEngine->pIo->pHandle,"Record size limit reached");
+		return UNQLITE_LIMIT;
+	}
+	/* Fetch the record first */
+	pRecord = SkipListFind(pEngine,pKey,(sxu32)nKeyLen,apUpdate);
+	if( pRecord == 0 || SkipListCmp(pEngine,pRecord,pKey,(sxu32)nKeyLen) != 0 ){
+		/* Insert a new record */
+		pRecord = SkipListInsert(pEngine,apUpdate,pKey,(sxu32)nKeyLen,pData,(sxu32)nDataLen);
+		if( pRecord == 0 ){
+			return UNQLITE_NOMEM;
+		}
+	}else{
+		unqlite_int64 nNew = pRecord->nDataLen + nDataLen;
+		char *zNew;
+		/* Append data to the existing record */
+		if( nNew > SXU32_HIGH ){
+			/* Overflow */
+			pEngine->pIo->xErr(pEngine->pIo->pHandle,"Append operation will cause data overflow");	
+			return UNQLITE_LIMIT;
+		}
+		/* Allocate bigger chunk */
+		zNew = (char *)SyMemBackendRealloc(&pEngine->sAlloc,pRecord->pData,(sxu32)nNew);
+		if( zNew == 0 ){
+			return UNQLITE_NOMEM;
+		}
+		/* Reflect the change */
+		SyMemcpy(pData,&zNew[pRecord->nDataLen],(sxu32)nDataLen);
+		pRecord->pData = zNew;
+		pRecord->nDataLen = (sxu32)nNew;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Export the ordered in-memory storage engine.
+ */
+UNQLITE_PRIVATE const unqlite_kv_methods * unqliteExportSkipListKvStorage(void)
+{
+	static const unqlite_kv_methods sSkipListStore = {
+		"skiplist",                 /* zName */
+		sizeof(sl_kv_engine),       /* szKv */
+		sizeof(sl_cursor),          /* szCursor */
+		2,                          /* iVersion */
+		SkipListInit,               /* xInit */
+		SkipListRelease,            /* xRelease */
+		SkipListConfigure,          /* xConfig */
+		0,                          /* xOpen */
+		SkipListReplace,            /* xReplace */
+		SkipListAppend,             /* xAppend */
+		SkipListInitCursor,         /* xCursorInit */
+		SkipListCursorSeek,         /* xSeek */
+		SkipListCursorFirst,        /* xFirst */
+		SkipListCursorLast,         /* xLast */
+		SkipListCursorValid,        /* xValid */
+		SkipListCursorNext,         /* xNext */
+		SkipListCursorPrev,         /* xPrev */
+		SkipListCursorDelete,       /* xDelete */
+		SkipListCursorKeyLength,    /* xKeyLength */
+		SkipListCursorKey,          /* xKey */
+		SkipListCursorDataLength,   /* xDataLength */
+		SkipListCursorData,         /* xData */
+		SkipListCursorReset,        /* xReset */
+		0,                          /* xRelease */
+		SkipListCursorDataRange,    /* xDataRange */
+		SkipListCursorOverwrite     /* xOverwrite */
+	};
+	return &sSkipListStore;
+}
 /*
  * ----------------------------------------------------------
  * File: os.c
@@ -52448,6 +54207,22 @@ UNQLITE_PRIVATE int unqliteOsWrite(unqlite_file *id, const void *pBuf, unqlite_i
 {
   return id->pMethods->xWrite(id, pBuf, amt, offset);
 }
+UNQLITE_PRIVATE int unqliteOsWritev(unqlite_file *id, const void **apBuf, int nBuf, unqlite_int64 amt, unqlite_int64 offset)
+{
+  int rc = UNQLITE_OK;
+  int i;
+  if( id->pMethods->iVersion > 1 && id->pMethods->xWritev ){
+    return id->pMethods->xWritev(id, apBuf, nBuf, amt, offset);
+  }
+  /* Vectored I/O not supported by the underlying VFS, one write per buffer */
+  for( i = 0 ; i < nBuf ; i++ ){
+    rc = id->pMethods->xWrite(id, apBuf[i], amt, offset + i * amt);
+    if( rc != UNQLITE_OK ){
+      break;
+    }
+  }
+  return rc;
+}
 UNQLITE_PRIVATE int unqliteOsTruncate(unqlite_file *id, unqlite_int64 size)
 {
   return id->pMethods->xTruncate(id, size);
@@ -53634,6 +55409,50 @@ static int unixWrite(
   return UNQLITE_OK;
 }
 /*
+** Write nBuf buffers of amt bytes each to consecutive file locations starting
+** at offset. A run of contiguous pages is handed to the kernel in a single
+** pwritev() call where available. Short writes are completed by unixWrite().
+*/
+#ifndef UNQLITE_MAX_WRITEV
+# define UNQLITE_MAX_WRITEV 64
+#endif
+static int unixWritev(
+  unqlite_file *id,
+  const void **apBuf,
+  int nBuf,
+  unqlite_int64 amt,
+  unqlite_int64 offset
+){
+  unixFile *pFile = (unixFile*)id;
+  unqlite_int64 nDone = 0;
+  int i;
+#if defined(__linux__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+  struct iovec aIov[UNQLITE_MAX_WRITEV];
+  if( nBuf <= UNQLITE_MAX_WRITEV ){
+    ssize_t got;
+    for( i = 0 ; i < nBuf ; i++ ){
+      aIov[i].iov_base = (void *)apBuf[i];
+      aIov[i].iov_len = (size_t)amt;
+    }
+    got = pwritev(pFile->h, aIov, nBuf, (off_t)offset);
+    if( got<0 ){
+      pFile->lastErrno = errno;
+      return UNQLITE_IOERR;
+    }
+    nDone = (unqlite_int64)got;
+  }
+#endif
+  /* Finish whatever pwritev() did not write (if anything) */
+  for( i = (int)(nDone / amt) ; i < nBuf ; i++ ){
+    unqlite_int64 iSkip = nDone > i * amt ? nDone - i * amt : 0;
+    int rc = unixWrite(id, &((const char *)apBuf[i])[iSkip], amt - iSkip, offset + i * amt + iSkip);
+    if( rc != UNQLITE_OK ){
+      return rc;
+    }
+  }
+  return UNQLITE_OK;
+}
+/*
 ** We do not trust systems to provide a working fdatasync().  Some do.
 ** Others do no.  To be safe, we will stick with the (slower) fsync().
 ** If you know that your system does support fdatasync() correctly,
@@ -53728,6 +55547,7 @@ static int full_fsync(int fd, int fullSync, int dataOnly){
 ** the directory entry for the journal was never created) and the transaction
 ** will not roll back - possibly leading to database corruption.
 */
+static int unixSyncDirectory(unixFile *pFile, int isFullsync);
 static int unixSync(unqlite_file *id, int flags){
   int rc;
   unixFile *pFile = (unixFile*)id;
@@ -53741,6 +55561,15 @@ static int unixSync(unqlite_file *id, int flags){
     pFile->lastErrno = errno;
     return UNQLITE_IOERR;
   }
+  return unixSyncDirectory(pFile, isFullsync);
+}
+/*
+** Sync and close the directory file descriptor opened by unixOpen() for
+** newly created files. This is done once, the first time the file is synced.
+*/
+static int unixSyncDirectory(unixFile *pFile, int isFullsync){
+  int rc = UNQLITE_OK;
+  SXUNUSED(isFullsync);
   if( pFile->dirfd>=0 ){
     int err;
 #ifndef UNQLITE_DISABLE_DIRSYNC
@@ -53828,7 +55657,7 @@ static int unixSectorSize(unqlite_file *NotUsed){
 ** unqlite_file for Windows systems.
 */
 static const unqlite_io_methods unixIoMethod = {
-  1,                              /* iVersion */
+  2,                              /* iVersion */
   unixClose,                       /* xClose */
   unixRead,                        /* xRead */
   unixWrite,                       /* xWrite */
@@ -53839,6 +55668,7 @@ static const unqlite_io_methods unixIoMethod = {
   unixUnlock,                      /* xUnlock */
   unixCheckReservedLock,           /* xCheckReservedLock */
   unixSectorSize,                  /* xSectorSize */
+  unixWritev,                      /* xWritev */
 };
 /****************************************************************************
 **************************** unqlite_vfs methods ****************************
@@ -54307,6 +56137,488 @@ UNQLITE_PRIVATE const unqlite_vfs * unqliteExportBuiltinVfs(void)
 	};
 	return &sUnixvfs;
 }
+#if defined(UNQLITE_ENABLE_IO_URING) && defined(__linux__)
+/****************************************************************************
+**************************** io_uring I/O methods ***************************
+**
+** This division contains an alternative set of unqlite_io_methods that
+** queue writes in memory and hand them to the kernel in one io_uring
+** submission when the file is synced. The pager writes the journal and
+** then every dirty page one at a time, so a commit collapses into a single
+** io_uring_enter() per file instead of one pwrite() per page plus an fsync().
+**
+** The ring is driven through the raw system calls so that no external
+** library (liburing) is required. If the kernel refuses to set up a ring
+** or lacks IORING_OP_WRITE (older than 5.6, seccomp, etc.) the file keeps
+** the plain unixIoMethod.
+*/
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+/*
+** Maximum number of queued writes per file. When the queue is full, the
+** pending writes are submitted without waiting for a sync. One extra
+** submission slot is reserved for the trailing fsync.
+*/
+#ifndef UNQLITE_URING_QUEUE_DEPTH
+# define UNQLITE_URING_QUEUE_DEPTH 128
+#endif
+#define URING_FSYNC_TAG 0xFFFFFFFFFFFFFFFFULL /* user_data of the fsync request */
+/*
+** A write that was handed to xWrite but not yet submitted to the kernel.
+** The content is copied since the pager may release the page right after
+** xWrite returns.
+*/
+typedef struct uringPending uringPending;
+struct uringPending {
+  sxi64 iOfft;            /* File offset */
+  sxu32 nByte;            /* Content length */
+  unsigned char *zBuf;    /* Private copy of the content */
+};
+/*
+** The uringFile structure is a subclass of unixFile. The locking methods
+** and the methods that do not touch file content are inherited as is.
+*/
+typedef struct uringFile uringFile;
+struct uringFile {
+  unixFile base;                   /* Must be first: unixFile methods cast to it */
+  int ring_fd;                     /* io_uring file descriptor */
+  void *pSqRing;                   /* Submission ring mapping */
+  void *pCqRing;                   /* Completion ring mapping (may equal pSqRing) */
+  size_t nSqRing,nCqRing;          /* Mapping sizes */
+  struct io_uring_sqe *aSqe;       /* Submission queue entries */
+  size_t nSqe;                     /* Size of the aSqe[] mapping */
+  unsigned *sq_tail,*sq_mask,*sq_array;
+  unsigned *cq_head,*cq_tail,*cq_mask;
+  struct io_uring_cqe *aCqe;       /* Completion queue entries */
+  uringPending aPending[UNQLITE_URING_QUEUE_DEPTH - 1]; /* Queued writes */
+  sxu32 nPending;                  /* Total number of queued writes */
+  sxi64 iPendingEnd;               /* Offset one past the end of the furthest queued write */
+};
+/*
+** Release the ring mappings and the ring descriptor.
+*/
+static void uringRingRelease(uringFile *p){
+  if( p->aSqe ) munmap(p->aSqe,p->nSqe);
+  if( p->pCqRing && p->pCqRing!=p->pSqRing ) munmap(p->pCqRing,p->nCqRing);
+  if( p->pSqRing ) munmap(p->pSqRing,p->nSqRing);
+  if( p->ring_fd>=0 ) close(p->ring_fd);
+  p->aSqe = 0;
+  p->pSqRing = p->pCqRing = 0;
+  p->ring_fd = -1;
+}
+/*
+** Return TRUE if the ring supports IORING_OP_WRITE. io_uring_setup() works
+** from Linux 5.1 but the plain write request only came with 5.6, as did
+** IORING_REGISTER_PROBE: a kernel that cannot answer the probe would fail
+** every queued write with -EINVAL.
+*/
+static int uringHasWrite(int ring_fd){
+  struct io_uring_probe *pProbe;
+  sxu32 nByte = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+  int rc;
+  pProbe = (struct io_uring_probe *)unqlite_malloc(nByte);
+  if( pProbe == 0 ){
+    return 0;
+  }
+  SyZero(pProbe,nByte);
+  rc = (int)syscall(__NR_io_uring_register,ring_fd,IORING_REGISTER_PROBE,pProbe,256);
+  rc = rc >= 0 && pProbe->last_op >= IORING_OP_WRITE && (pProbe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+  unqlite_free(pProbe);
+  return rc;
+}
+/*
+** Set up a private submission/completion ring for the given file.
+** Return UNQLITE_OK on success, any other return value means that
+** io_uring is unusable and that the caller should stick with plain
+** unix I/O.
+*/
+static int uringRingInit(uringFile *p){
+  struct io_uring_params sParams;
+  unsigned char *zSq,*zCq;
+  SyZero(&sParams,sizeof(sParams));
+  p->ring_fd = (int)syscall(__NR_io_uring_setup,UNQLITE_URING_QUEUE_DEPTH,&sParams);
+  if( p->ring_fd<0 ){
+    return UNQLITE_NOTIMPLEMENTED;
+  }
+  if( !uringHasWrite(p->ring_fd) ){
+    uringRingRelease(p);
+    return UNQLITE_NOTIMPLEMENTED;
+  }
+  p->nSqRing = sParams.sq_off.array + sParams.sq_entries * sizeof(unsigned);
+  p->nCqRing = sParams.cq_off.cqes + sParams.cq_entries * sizeof(struct io_uring_cqe);
+  if( sParams.features & IORING_FEAT_SINGLE_MMAP ){
+    if( p->nCqRing>p->nSqRing ) p->nSqRing = p->nCqRing;
+    p->nCqRing = p->nSqRing;
+  }
+  zSq = (unsigned char *)mmap(0,p->nSqRing,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,p->ring_fd,IORING_OFF_SQ_RING);
+  if( zSq==MAP_FAILED ){
+    uringRingRelease(p);
+    return UNQLITE_IOERR;
+  }
+  p->pSqRing = zSq;
+  if( sParams.features & IORING_FEAT_SINGLE_MMAP ){
+    zCq = zSq;
+  }else{
+    zCq = (unsigned char *)mmap(0,p->nCqRing,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,p->ring_fd,IORING_OFF_CQ_RING);
+    if( zCq==MAP_FAILED ){
+      uringRingRelease(p);
+      return UNQLITE_IOERR;
+    }
+  }
+  p->pCqRing = zCq;
+  p->nSqe = sParams.sq_entries * sizeof(struct io_uring_sqe);
+  p->aSqe = (struct io_uring_sqe *)mmap(0,p->nSqe,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,p->ring_fd,IORING_OFF_SQES);
+  if( p->aSqe==MAP_FAILED ){
+    p->aSqe = 0;
+    uringRingRelease(p);
+    return UNQLITE_IOERR;
+  }
+  p->sq_tail  = (unsigned *)&zSq[sParams.sq_off.tail];
+  p->sq_mask  = (unsigned *)&zSq[sParams.sq_off.ring_mask];
+  p->sq_array = (unsigned *)&zSq[sParams.sq_off.array];
+  p->cq_head  = (unsigned *)&zCq[sParams.cq_off.head];
+  p->cq_tail  = (unsigned *)&zCq[sParams.cq_off.tail];
+  p->cq_mask  = (unsigned *)&zCq[sParams.cq_off.ring_mask];
+  p->aCqe     = (struct io_uring_cqe *)&zCq[sParams.cq_off.cqes];
+  return UNQLITE_OK;
+}
+/*
+** Grab the next free submission queue entry. The caller must make sure
+** that no more than UNQLITE_URING_QUEUE_DEPTH entries are queued at once.
+*/
+static struct io_uring_sqe * uringNextSqe(uringFile *p,unsigned *pTail){
+  unsigned iIdx = (*pTail) & (*p->sq_mask);
+  struct io_uring_sqe *pSqe = &p->aSqe[iIdx];
+  SyZero(pSqe,sizeof(struct io_uring_sqe));
+  p->sq_array[iIdx] = iIdx;
+  (*pTail)++;
+  return pSqe;
+}
+/*
+** Release the private copies of the queued writes.
+*/
+static void uringDiscardPending(uringFile *p){
+  sxu32 n;
+  for( n = 0 ; n < p->nPending ; n++ ){
+    unqlite_free(p->aPending[n].zBuf);
+  }
+  p->nPending = 0;
+  p->iPendingEnd = 0;
+}
+/*
+** Reap every completion posted so far. Short writes are completed
+** synchronously. *pRc is set to UNQLITE_IOERR if a request failed.
+** Return the number of completions reaped.
+*/
+static unsigned uringReap(uringFile *p,int *pRc){
+  unsigned iHead = *p->cq_head;
+  unsigned nReap = 0;
+  while( iHead != __atomic_load_n(p->cq_tail,__ATOMIC_ACQUIRE) ){
+    struct io_uring_cqe *pCqe = &p->aCqe[iHead & (*p->cq_mask)];
+    if( pCqe->user_data == URING_FSYNC_TAG ){
+      if( pCqe->res<0 ){
+        p->base.lastErrno = -pCqe->res;
+        *pRc = UNQLITE_IOERR;
+      }
+    }else{
+      uringPending *pW = &p->aPending[pCqe->user_data];
+      if( pCqe->res<0 ){
+        p->base.lastErrno = -pCqe->res;
+        *pRc = UNQLITE_IOERR;
+      }else if( (sxu32)pCqe->res < pW->nByte ){
+        /* Short write, finish it the old way */
+        int rcw = unixWrite((unqlite_file *)p,&pW->zBuf[pCqe->res],pW->nByte - pCqe->res,pW->iOfft + pCqe->res);
+        if( rcw != UNQLITE_OK ) *pRc = rcw;
+      }
+    }
+    iHead++;
+    nReap++;
+  }
+  __atomic_store_n(p->cq_head,iHead,__ATOMIC_RELEASE);
+  return nReap;
+}
+/*
+** Give up on the ring after io_uring_enter() failed: wait for the nFlight
+** requests the kernel already took, since it may still be writing from
+** their buffers, then tear the ring down and switch the file to plain unix
+** I/O. Requests left in the submission queue go with the ring and are never
+** started. Return UNQLITE_OK if every request in flight was reaped, in which
+** case the queued buffers may be released.
+*/
+static int uringRetire(uringFile *p,unsigned nFlight){
+  int rc = UNQLITE_OK;
+  while( nFlight > 0 ){
+    int got;
+    got = (int)syscall(__NR_io_uring_enter,p->ring_fd,0,nFlight,IORING_ENTER_GETEVENTS,0,0);
+    if( got<0 && errno!=EINTR ){
+      break;
+    }
+    nFlight -= uringReap(p,&rc);
+  }
+  uringRingRelease(p);
+  p->base.pMethod = &unixIoMethod;
+  return nFlight > 0 ? UNQLITE_IOERR : UNQLITE_OK;
+}
+/*
+** Submit every queued write to the kernel, optionally followed by an
+** fdatasync() that is drained behind them, and wait for all of them to
+** complete: one io_uring_enter() round-trip for the whole batch.
+**
+** Short writes are completed synchronously. Return UNQLITE_OK if every
+** request succeeded, UNQLITE_IOERR otherwise.
+*/
+static int uringSubmit(uringFile *p,int bSync){
+  struct io_uring_sqe *pSqe;
+  unsigned nSubmit,nSent,nDone;
+  unsigned iTail;
+  int rc = UNQLITE_OK;
+  sxu32 n;
+  if( p->nPending < 1 && !bSync ){
+    return UNQLITE_OK;
+  }
+  iTail = *p->sq_tail;
+  for( n = 0 ; n < p->nPending ; n++ ){
+    uringPending *pW = &p->aPending[n];
+    pSqe = uringNextSqe(p,&iTail);
+    pSqe->opcode = IORING_OP_WRITE;
+    pSqe->fd = p->base.h;
+    pSqe->off = (__u64)pW->iOfft;
+    pSqe->addr = (__u64)(unsigned long)pW->zBuf;
+    pSqe->len = pW->nByte;
+    pSqe->user_data = n;
+  }
+  if( bSync ){
+    pSqe = uringNextSqe(p,&iTail);
+    pSqe->opcode = IORING_OP_FSYNC;
+    pSqe->fd = p->base.h;
+    pSqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    /* Do not start the fsync before all the writes above have completed */
+    pSqe->flags = IOSQE_IO_DRAIN;
+    pSqe->user_data = URING_FSYNC_TAG;
+  }
+  nSubmit = p->nPending + (bSync ? 1 : 0);
+  __atomic_store_n(p->sq_tail,iTail,__ATOMIC_RELEASE);
+  nSent = nDone = 0;
+  while( nDone < nSubmit ){
+    int got;
+    got = (int)syscall(__NR_io_uring_enter,p->ring_fd,nSubmit - nSent,nSubmit - nDone,IORING_ENTER_GETEVENTS,0,0);
+    if( got<0 ){
+      if( errno==EINTR ) continue;
+      p->base.lastErrno = errno;
+      if( uringRetire(p,nSent - nDone) != UNQLITE_OK ){
+        /* The kernel may still read the buffers, leak them rather than free them under it */
+        p->nPending = 0;
+        p->iPendingEnd = 0;
+        return UNQLITE_IOERR;
+      }
+      rc = UNQLITE_IOERR;
+      break;
+    }
+    nSent += (unsigned)got;
+    nDone += uringReap(p,&rc);
+  }
+  uringDiscardPending(p);
+  return rc;
+}
+/*
+** Return the first queued write that overlaps the given region.
+** NULL otherwise.
+*/
+static uringPending * uringOverlap(uringFile *p,sxi64 iOfft,sxi64 nByte){
+  sxu32 n;
+  for( n = 0 ; n < p->nPending ; n++ ){
+    uringPending *pW = &p->aPending[n];
+    if( iOfft < pW->iOfft + (sxi64)pW->nByte && pW->iOfft < iOfft + nByte ){
+      return pW;
+    }
+  }
+  return 0;
+}
+/*
+** Queue a write. Writes that fall entirely inside a queued one (i.e. the
+** journal record count patched into the journal header) are merged into
+** it. Other overlapping writes are ordered by submitting the queue first
+** since the kernel is free to complete requests in any order.
+*/
+static int uringWrite(unqlite_file *id,const void *pBuf,unqlite_int64 amt,unqlite_int64 offset){
+  uringFile *p = (uringFile *)id;
+  uringPending *pW;
+  int rc;
+  pW = uringOverlap(p,offset,amt);
+  if( pW && offset >= pW->iOfft && offset + amt <= pW->iOfft + (sxi64)pW->nByte ){
+    /* Queued writes never overlap each other, so patching this one is safe */
+    SyMemcpy(pBuf,&pW->zBuf[offset - pW->iOfft],(sxu32)amt);
+    return UNQLITE_OK;
+  }
+  if( p->nPending >= SX_ARRAYSIZE(p->aPending) || pW ){
+    rc = uringSubmit(p,0);
+    if( rc != UNQLITE_OK ){
+      return rc;
+    }
+  }
+  pW = &p->aPending[p->nPending];
+  pW->zBuf = (unsigned char *)unqlite_malloc((sxu32)amt);
+  if( pW->zBuf == 0 ){
+    /* Write synchronously instead */
+    rc = uringSubmit(p,0);
+    if( rc != UNQLITE_OK ){
+      return rc;
+    }
+    return unixWrite(id,pBuf,amt,offset);
+  }
+  SyMemcpy(pBuf,pW->zBuf,(sxu32)amt);
+  pW->iOfft = offset;
+  pW->nByte = (sxu32)amt;
+  p->nPending++;
+  if( offset + amt > p->iPendingEnd ){
+    p->iPendingEnd = offset + amt;
+  }
+  return UNQLITE_OK;
+}
+/*
+** Read data from the file. Queued writes covering the requested region
+** are submitted first.
+*/
+static int uringRead(unqlite_file *id,void *pBuf,unqlite_int64 amt,unqlite_int64 offset){
+  uringFile *p = (uringFile *)id;
+  if( uringOverlap(p,offset,amt) ){
+    int rc = uringSubmit(p,0);
+    if( rc != UNQLITE_OK ){
+      return rc;
+    }
+  }
+  return unixRead(id,pBuf,amt,offset);
+}
+/*
+** Submit the queued writes together with the fsync in one batch.
+*/
+static int uringSync(unqlite_file *id,int flags){
+  uringFile *p = (uringFile *)id;
+  int rc;
+  rc = uringSubmit(p,1);
+  if( rc != UNQLITE_OK ){
+    return rc;
+  }
+  return unixSyncDirectory(&p->base,(flags&0x0F)==UNQLITE_SYNC_FULL);
+}
+/*
+** Truncate the file. Queued writes past the new end must land first,
+** otherwise they would extend the file again.
+*/
+static int uringTruncate(unqlite_file *id,sxi64 nByte){
+  uringFile *p = (uringFile *)id;
+  if( p->iPendingEnd > nByte ){
+    int rc = uringSubmit(p,0);
+    if( rc != UNQLITE_OK ){
+      return rc;
+    }
+  }
+  return unixTruncate(id,nByte);
+}
+/*
+** Report the size the file will have once the queued writes land.
+*/
+static int uringFileSize(unqlite_file *id,sxi64 *pSize){
+  uringFile *p = (uringFile *)id;
+  int rc;
+  rc = unixFileSize(id,pSize);
+  if( rc == UNQLITE_OK && p->iPendingEnd > *pSize ){
+    *pSize = p->iPendingEnd;
+  }
+  return rc;
+}
+/*
+** Queued writes must reach the file before a lock is released. If they
+** do not, the lock is kept and the error reported, as uringSync() does.
+*/
+static int uringUnlock(unqlite_file *id,int eFileLock){
+  int rc;
+  rc = uringSubmit((uringFile *)id,0);
+  if( rc != UNQLITE_OK ){
+    return rc;
+  }
+  return unixUnlock(id,eFileLock);
+}
+/*
+** Close the file: flush the queue, tear down the ring, then close
+** the underlying descriptor the usual way. A failed flush is returned.
+*/
+static int uringClose(unqlite_file *id){
+  uringFile *p = (uringFile *)id;
+  int rc = UNQLITE_OK;
+  int rcClose;
+  if( p ){
+    rc = uringSubmit(p,0);
+    uringRingRelease(p);
+  }
+  /* The descriptor is closed even if the flush failed, the failure is reported */
+  rcClose = unixClose(id);
+  return rc != UNQLITE_OK ? rc : rcClose;
+}
+static const unqlite_io_methods uringIoMethod = {
+  1,                              /* iVersion */
+  uringClose,                      /* xClose */
+  uringRead,                       /* xRead */
+  uringWrite,                      /* xWrite */
+  uringTruncate,                   /* xTruncate */
+  uringSync,                       /* xSync */
+  uringFileSize,                   /* xFileSize */
+  unixLock,                        /* xLock */
+  uringUnlock,                     /* xUnlock */
+  unixCheckReservedLock,           /* xCheckReservedLock */
+  unixSectorSize,                  /* xSectorSize */
+};
+/*
+** Open the file the usual way, then try to attach a ring to it.
+*/
+static int uringOpen(
+  unqlite_vfs *pVfs,
+  const char *zPath,
+  unqlite_file *pFile,
+  unsigned int flags
+){
+  uringFile *p = (uringFile *)pFile;
+  int rc;
+  SyZero(p,sizeof(uringFile));
+  p->ring_fd = -1;
+  rc = unixOpen(pVfs,zPath,pFile,flags);
+  if( rc != UNQLITE_OK ){
+    return rc;
+  }
+  if( uringRingInit(p) == UNQLITE_OK ){
+    p->base.pMethod = &uringIoMethod;
+  }
+  return UNQLITE_OK;
+}
+/*
+ * Export the io_uring Vfs.
+ */
+UNQLITE_PRIVATE const unqlite_vfs * unqliteExportUringVfs(void)
+{
+	static const unqlite_vfs sUringVfs = {
+		"UnixUring",         /* Vfs name */
+		1,                   /* Vfs structure version */
+		sizeof(uringFile),   /* szOsFile */
+		MAX_PATHNAME,        /* mxPathName */
+		uringOpen,           /* xOpen */
+		unixDelete,          /* xDelete */
+		unixAccess,          /* xAccess */
+		unixFullPathname,    /* xFullPathname */
+		0,                   /* xTmp */
+		unixSleep,           /* xSleep */
+		unixCurrentTime,     /* xCurrentTime */
+		0,                   /* xGetLastError */
+	};
+	return &sUringVfs;
+}
+#else
+UNQLITE_PRIVATE const unqlite_vfs * unqliteExportUringVfs(void)
+{
+	/* io_uring support omitted from the build */
+	return 0;
+}
+#endif /* UNQLITE_ENABLE_IO_URING && __linux__ */
 
 #endif /* __UNIXES__ */
 
@@ -55278,6 +57590,9 @@ UNQLITE_PRIVATE const unqlite_vfs * unqliteExportBuiltinVfs(void)
 #ifndef UNQLITE_AMALGAMATION
 #include "unqliteInt.h"
 #endif
+#if defined(__UNIXES__)
+#include <time.h>
+#endif
 /*
 ** This file implements the pager and the transaction manager for UnQLite (Mostly inspired from the SQLite3 Source tree).
 **
@@ -55498,6 +57813,7 @@ struct Pager
   sxu32 nSize;                   /* apHash[] size: Must be a power of two  */
   sxu32 nPage;                   /* Total number of page loaded in memory */
   sxu32 nCacheMax;               /* Maximum page to cache*/
+  unqlite_pager_stats sStats;    /* Page cache and commit counters */
 };
 /* Control flags */
 #define PAGER_CTRL_COMMIT_ERR   0x001 /* Commit error */
@@ -57000,33 +59316,76 @@ static int page_write(Pager *pPager,Page *pPage)
 ** is upgraded to an EXCLUSIVE lock. If the lock cannot be obtained,
 ** UNQLITE_BUSY is returned and no data is written to the database file.
 */
+/*
+ * Maximum number of contiguous pages written by a single vectored write.
+ */
+#define PAGER_MAX_RUN 64
+/*
+ * Collect the run of pages starting at pDirty whose page numbers are contiguous.
+ * The list must be sorted by page number (see pager_get_dirty_pages()) and is
+ * walked using the reverse link (pDirtyPrev for dirty pages, pPrevHot for hot
+ * pages). Pages marked PAGE_DONT_WRITE end up alone in their run.
+ * Return the number of collected pages, zero if the list is empty.
+ */
+static sxu32 pager_collect_run(Page *pDirty,int bHot,Page **apRun)
+{
+	sxu32 nRun = 0;
+	while( pDirty && nRun < PAGER_MAX_RUN ){
+		if( nRun > 0 && ( (pDirty->flags & PAGE_DONT_WRITE) || (apRun[0]->flags & PAGE_DONT_WRITE)
+			|| pDirty->pgno != apRun[nRun - 1]->pgno + 1 ) ){
+			break;
+		}
+		apRun[nRun++] = pDirty;
+		pDirty = bHot ? pDirty->pPrevHot : pDirty->pDirtyPrev; /* Not a bug: Reverse link */
+	}
+	return nRun;
+}
+/*
+ * Write a run of contiguous pages collected by pager_collect_run() using
+ * a single vectored write.
+ */
+static int pager_write_run(Pager *pPager,Page **apRun,sxu32 nRun)
+{
+	const void *apBuf[PAGER_MAX_RUN];
+	sxu32 n;
+	if( apRun[0]->flags & PAGE_DONT_WRITE ){
+		/* Nothing to write */
+		return UNQLITE_OK;
+	}
+	for( n = 0 ; n < nRun ; ++n ){
+		apBuf[n] = apRun[n]->zData;
+	}
+	return unqliteOsWritev(pPager->pfd,apBuf,(int)nRun,pPager->iPageSize,apRun[0]->pgno * pPager->iPageSize);
+}
 static int pager_write_dirty_pages(Pager *pPager,Page *pDirty)
 {
+	Page *apRun[PAGER_MAX_RUN];
 	int rc = UNQLITE_OK;
-	Page *pNext;
+	sxu32 nRun,n;
 	for(;;){
-		if( pDirty == 0 ){
+		/* Runs of contiguous pages are written using a single system call */
+		nRun = pager_collect_run(pDirty,0,apRun);
+		if( nRun < 1 ){
 			break;
 		}
-		/* Point to the next dirty page */
-		pNext = pDirty->pDirtyPrev; /* Not a bug: Reverse link */
-		if( (pDirty->flags & PAGE_DONT_WRITE) == 0 ){
-			rc = unqliteOsWrite(pPager->pfd,pDirty->zData,pPager->iPageSize,pDirty->pgno * pPager->iPageSize);
-			if( rc != UNQLITE_OK ){
-				/* A rollback should be done */
-				break;
-			}
+		/* Point to the next run */
+		pDirty = apRun[nRun - 1]->pDirtyPrev; /* Not a bug: Reverse link */
+		rc = pager_write_run(pPager,apRun,nRun);
+		if( rc != UNQLITE_OK ){
+			/* A rollback should be done */
+			break;
 		}
-		/* Remove stale flags */
-		pDirty->flags &= ~(PAGE_DIRTY|PAGE_DONT_WRITE|PAGE_NEED_SYNC|PAGE_IN_JOURNAL|PAGE_HOT_DIRTY);
-		if( pDirty->nRef < 1 ){
-			/* Unlink the page now it is unused */
-			pager_unlink_page(pPager,pDirty);
-			/* Release the page */
-			pager_release_page(pPager,pDirty);
+		for( n = 0 ; n < nRun ; ++n ){
+			Page *pPage = apRun[n];
+			/* Remove stale flags */
+			pPage->flags &= ~(PAGE_DIRTY|PAGE_DONT_WRITE|PAGE_NEED_SYNC|PAGE_IN_JOURNAL|PAGE_HOT_DIRTY);
+			if( pPage->nRef < 1 ){
+				/* Unlink the page now it is unused */
+				pager_unlink_page(pPager,pPage);
+				/* Release the page */
+				pager_release_page(pPager,pPage);
+			}
 		}
-		/* Point to the next page */
-		pDirty = pNext;
 	}
 	pPager->pDirty = pPager->pFirstDirty = 0;
 	pPager->pHotDirty = pPager->pFirstHot = 0;
@@ -57047,39 +59406,40 @@ static int pager_write_dirty_pages(Pager *pPager,Page *pDirty)
 */
 static int pager_write_hot_dirty_pages(Pager *pPager,Page *pDirty)
 {
+	Page *apRun[PAGER_MAX_RUN];
 	int rc = UNQLITE_OK;
-	Page *pNext;
+	sxu32 nRun,n;
 	for(;;){
-		if( pDirty == 0 ){
+		nRun = pager_collect_run(pDirty,1,apRun);
+		if( nRun < 1 ){
 			break;
 		}
-		/* Point to the next page */
-		pNext = pDirty->pPrevHot; /* Not a bug: Reverse link */
-		if( (pDirty->flags & PAGE_DONT_WRITE) == 0 ){
-			rc = unqliteOsWrite(pPager->pfd,pDirty->zData,pPager->iPageSize,pDirty->pgno * pPager->iPageSize);
-			if( rc != UNQLITE_OK ){
-				break;
-			}
-		}
-		/* Remove stale flags */
-		pDirty->flags &= ~(PAGE_DIRTY|PAGE_DONT_WRITE|PAGE_NEED_SYNC|PAGE_IN_JOURNAL|PAGE_HOT_DIRTY);
-		/* Unlink from the list of dirty pages */
-		if( pDirty->pDirtyPrev ){
-			pDirty->pDirtyPrev->pDirtyNext = pDirty->pDirtyNext;
-		}else{
-			pPager->pDirty = pDirty->pDirtyNext;
+		/* Point to the next run */
+		pDirty = apRun[nRun - 1]->pPrevHot; /* Not a bug: Reverse link */
+		rc = pager_write_run(pPager,apRun,nRun);
+		if( rc != UNQLITE_OK ){
+			break;
 		}
-		if( pDirty->pDirtyNext ){
-			pDirty->pDirtyNext->pDirtyPrev = pDirty->pDirtyPrev;
-		}else{
-			pPager->pFirstDirty = pDirty->pDirtyPrev;
+		for( n = 0 ; n < nRun ; ++n ){
+			Page *pPage = apRun[n];
+			/* Remove stale flags */
+			pPage->flags &= ~(PAGE_DIRTY|PAGE_DONT_WRITE|PAGE_NEED_SYNC|PAGE_IN_JOURNAL|PAGE_HOT_DIRTY);
+			/* Unlink from the list of dirty pages */
+			if( pPage->pDirtyPrev ){
+				pPage->pDirtyPrev->pDirtyNext = pPage->pDirtyNext;
+			}else{
+				pPager->pDirty = pPage->pDirtyNext;
+			}
+			if( pPage->pDirtyNext ){
+				pPage->pDirtyNext->pDirtyPrev = pPage->pDirtyPrev;
+			}else{
+				pPager->pFirstDirty = pPage->pDirtyPrev;
+			}
+			/* Discard */
+			pager_unlink_page(pPager,pPage);
+			/* Release the page */
+			pager_release_page(pPager,pPage);
 		}
-		/* Discard */
-		pager_unlink_page(pPager,pDirty);
-		/* Release the page */
-		pager_release_page(pPager,pDirty);
-		/* Next hot page */
-		pDirty = pNext;
 	}
 	return rc;
 }
@@ -57201,6 +59561,7 @@ static int pager_dirty_commit(Pager *pPager)
 	}
 	/* Tell that a dirty commit happen */
 	pPager->iFlags |= PAGER_CTRL_DIRTY_COMMIT;
+	pPager->sStats.nDirtyCommit++;
 	/* Write the hot pages now */
 	rc = pager_write_hot_dirty_pages(pPager,pHot);
 	if( rc != UNQLITE_OK ){
@@ -57226,9 +59587,29 @@ static int pager_dirty_commit(Pager *pPager)
 **   * the database file synced.
 **   * the journal file is deleted.
 */
+/*
+ * Monotonic clock in microseconds, used to time commits.
+ */
+static sxi64 pager_clock_usec(void)
+{
+#if defined(__UNIXES__)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (sxi64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+	return 0;
+#endif
+}
 UNQLITE_PRIVATE int unqlitePagerCommit(Pager *pPager)
 {
+	sxi64 iStart = 0;
+	int bWrite;
 	int rc;
+	/* Only transactions that changed something are counted */
+	bWrite = pPager->iState >= PAGER_WRITER_CACHEMOD;
+	if( bWrite ){
+		iStart = pager_clock_usec();
+	}
 	/* Commit: Phase One */
 	rc = pager_commit_phase1(pPager);
 	if( rc != UNQLITE_OK ){
@@ -57241,6 +59622,14 @@ UNQLITE_PRIVATE int unqlitePagerCommit(Pager *pPager)
 	}
 	/* Remove stale flags */
 	pPager->iFlags &= ~PAGER_CTRL_COMMIT_ERR;
+	if( bWrite ){
+		sxi64 iUsec = pager_clock_usec() - iStart;
+		pPager->sStats.nCommit++;
+		pPager->sStats.nCommitUsec += iUsec;
+		if( iUsec > pPager->sStats.nMaxCommitUsec ){
+			pPager->sStats.nMaxCommitUsec = iUsec;
+		}
+	}
 	/* All done */
 	return UNQLITE_OK;
 fail:
@@ -57248,6 +59637,14 @@ fail:
 	pPager->pDb->iFlags |= UNQLITE_FL_DISABLE_AUTO_COMMIT;
 	return rc;
 }
+/*
+ * Copy the page cache and commit counters.
+ */
+UNQLITE_PRIVATE void unqlitePagerGetStats(Pager *pPager,unqlite_pager_stats *pStats)
+{
+	SyMemcpy((const void *)&pPager->sStats,(void *)pStats,sizeof(unqlite_pager_stats));
+	pStats->nPage = (unqlite_int64)pPager->dbSize;
+}
 /*
  * Reset the pager to its initial state. This is caused by
  * a rollback operation.
@@ -57475,6 +59872,7 @@ static int unqlitePagerAcquire(
 		return pPage ? UNQLITE_OK : UNQLITE_NOTFOUND;
 	}
 	if( pPage == 0 ){
+		pPager->sStats.nMiss++;
 		/* Allocate a new page */
 		pPage = pager_alloc_page(pPager,pgno);
 		if( pPage == 0 ){
@@ -57490,6 +59888,7 @@ static int unqlitePagerAcquire(
 		/* Link the page */
 		pager_link_page(pPager,pPage);
 	}else{
+		pPager->sStats.nHit++;
 		if( ppPage ){
 			page_ref(pPage);
 		}
@@ -57657,6 +60056,24 @@ fail:
 	SyMemBackendFree(&pDb->sMem,pIo);
 	return rc;
 }
+/*
+ * Replace the KV storage engine of an in-memory database with the given one.
+ * Records stored so far are discarded. The engine of an on-disk database is
+ * recorded in the database header and cannot be switched.
+ */
+UNQLITE_PRIVATE int unqlitePagerSwitchKvEngine(Pager *pPager,unqlite_kv_methods *pMethods)
+{
+	int rc;
+	if( !pPager->is_mem ){
+		unqliteGenError(pPager->pDb,"Only the storage engine of an in-memory database can be switched");
+		return UNQLITE_LOCKED;
+	}
+	rc = unqlitePagerRegisterKvEngine(pPager,pMethods);
+	if( rc == UNQLITE_OK ){
+		SyStringInitFromBuf(&pPager->sKv,pMethods->zName,SyStrlen(pMethods->zName));
+	}
+	return rc;
+}
 /*
  * Return the underlying KV storage engine instance.
  */
@@ -154,6 +154,15 @@ typedef struct unqlite unqlite;
  * UNQLITE_ENABLE_JX9_HASH_IO
  * If this directive is enabled, built-in hash functions such as md5(), sha1(), md5_file(), crc32(), etc.
  * are included in the build.
+ *
+ * UNQLITE_ENABLE_IO_URING
+ *  If this directive is enabled (Linux only), an io_uring backed VFS is included in the build.
+ *  Writes are queued in memory and submitted to the kernel as a single batch when the file
+ *  is synced, the fsync being ordered after the queued writes so that a whole commit costs
+ *  one submission round-trip per file. The VFS is obtained via unqlite_lib_uring_vfs() and
+ *  installed using unqlite_lib_config() with a configuration verb set to UNQLITE_LIB_CONFIG_VFS.
+ *  Files for which the kernel refuses to set up a ring silently fall back to the built-in
+ *  UNIX I/O methods.
  */
 /* Symisc public definitions */
 #if !defined(SYMISC_STANDARD_DEFS)
@@ -389,6 +398,47 @@ typedef sxi64 unqlite_int64;
 #define UNQLITE_CONFIG_KV_ENGINE           4  /* ONE ARGUMENT: const char *zKvName */
 #define UNQLITE_CONFIG_DISABLE_AUTO_COMMIT 5  /* NO ARGUMENTS */
 #define UNQLITE_CONFIG_GET_KV_NAME         6  /* ONE ARGUMENT: const char **pzPtr */
+#define UNQLITE_CONFIG_MEM_STATS           7  /* TWO ARGUMENTS: unqlite_mem_stats *pDbStats, unqlite_mem_stats *pLibStats */
+#define UNQLITE_CONFIG_PAGER_STATS         8  /* ONE ARGUMENT: unqlite_pager_stats *pStats */
+/*
+ * Page cache and transaction counters, filled by
+ * unqlite_config(pDb,UNQLITE_CONFIG_PAGER_STATS,&sStats).
+ * Counters are cumulative since the database was opened. Commit times are in
+ * microseconds and stay 0 on platforms without a suitable clock.
+ */
+typedef struct unqlite_pager_stats unqlite_pager_stats;
+struct unqlite_pager_stats
+{
+	unqlite_int64 nHit;           /* Page requests served from the page cache */
+	unqlite_int64 nMiss;          /* Page requests that had to load the page */
+	unqlite_int64 nCommit;        /* Write transactions committed */
+	unqlite_int64 nCommitUsec;    /* Total time of the nCommit commits, syncs and journal deletes included */
+	unqlite_int64 nMaxCommitUsec; /* Longest of the nCommit commits */
+	unqlite_int64 nDirtyCommit;   /* Hot dirty pages flushed early because the page cache filled up */
+	unqlite_int64 nPage;          /* Pages in the database file, a gauge rather than a counter */
+};
+/*
+ * Memory allocator counters.
+ *
+ * unqlite_config(pDb,UNQLITE_CONFIG_MEM_STATS,&sDb,&sLib) fills sDb with the counters of
+ * the allocator private to the database handle (pager pages, cursors, VM) and sLib with
+ * those of the allocator shared by all handles. Either pointer may be NULL.
+ * Counters are cumulative. Pool requests served by a per-thread cache are added to the
+ * totals the next time that cache refills from or flushes to the shared pool.
+ */
+typedef struct unqlite_mem_stats unqlite_mem_stats;
+struct unqlite_mem_stats
+{
+	unqlite_int64 nHeapAlloc;  /* Blocks taken from the underlying allocator (malloc() by default) */
+	unqlite_int64 nHeapFree;   /* Blocks given back to the underlying allocator */
+	unqlite_int64 nPoolAlloc;  /* Small chunks handed out by the pool allocator */
+	unqlite_int64 nPoolFree;   /* Small chunks returned to the pool allocator */
+	unqlite_int64 nCacheHit;   /* Pool requests served by a per-thread cache without locking */
+	unqlite_int64 nCacheFill;  /* Batches moved from the shared pool to a per-thread cache */
+	unqlite_int64 nCacheFlush; /* Batches moved from a per-thread cache back to the shared pool */
+	unqlite_int64 nLock;       /* Times the allocator mutex was taken */
+	unqlite_int64 nLockWait;   /* Times the allocator mutex was already held by another thread */
+};
 /*
  * UnQLite/Jx9 Virtual Machine Configuration Commands.
  *
@@ -434,6 +484,9 @@ typedef sxi64 unqlite_int64;
  */
 #define UNQLITE_KV_CONFIG_HASH_FUNC  1 /* ONE ARGUMENT: unsigned int (*xHash)(const void *,unsigned int) */
 #define UNQLITE_KV_CONFIG_CMP_FUNC   2 /* ONE ARGUMENT: int (*xCmp)(const void *,const void *,unsigned int) */
+#define UNQLITE_KV_CONFIG_FIXED_KEY_SIZE 3 /* ONE ARGUMENT: unsigned int nKeyLen (1..255, 0 for variable length keys) */
+#define UNQLITE_KV_CONFIG_FREE_PAGES     4 /* ONE ARGUMENT: unqlite_int64 nPage, length of the free page list recorded by the caller */
+#define UNQLITE_KV_CONFIG_GET_FREE_PAGES 5 /* TWO ARGUMENTS: unqlite_int64 *pnPage, int *pPageSize */
 /*
  * Global Library Configuration Commands.
  *
@@ -559,9 +612,14 @@ struct unqlite_file {
  * the file. The sector size is the minimum write that can be performed without
  * disturbing other bytes in the file.
  *
+ * The xWritev() method is only available when iVersion is 2 or greater and may be NULL.
+ * It writes nBuf buffers of iAmt bytes each to consecutive locations of the file starting
+ * at offset iOfst (i.e. a run of contiguous database pages) using as few system calls as
+ * possible. When it is not available, UnQLite falls back to one xWrite() call per buffer.
+ *
  */
 struct unqlite_io_methods {
-  int iVersion;                 /* Structure version number (currently 1) */
+  int iVersion;                 /* Structure version number (currently 2) */
   int (*xClose)(unqlite_file*);
   int (*xRead)(unqlite_file*, void*, unqlite_int64 iAmt, unqlite_int64 iOfst);
   int (*xWrite)(unqlite_file*, const void*, unqlite_int64 iAmt, unqlite_int64 iOfst);
@@ -572,6 +630,8 @@ struct unqlite_io_methods {
   int (*xUnlock)(unqlite_file*, int);
   int (*xCheckReservedLock)(unqlite_file*, int *pResOut);
   int (*xSectorSize)(unqlite_file*);
+  /* Methods above are valid for version 1 */
+  int (*xWritev)(unqlite_file*, const void **apBuf, int nBuf, unqlite_int64 iAmt, unqlite_int64 iOfst);
 };
 /*
  * CAPIREF: OS Interface Object
@@ -739,13 +799,19 @@ struct unqlite_kv_engine
  * object.
  * Registration of a Key/Value storage engine at run-time is done via [unqlite_lib_config()]
  * with a configuration verb set to UNQLITE_LIB_CONFIG_STORAGE_ENGINE.
+ *
+ * The xDataRange() and xOverwrite() methods are only available when iVersion is 2 or greater
+ * and may be NULL. xDataRange() consumes at most nLen bytes of the cursor's data starting at
+ * offset iOfft. xOverwrite() replaces nLen bytes of the cursor's data starting at offset iOfft
+ * in place; the range must lie within the data. When they are not available, UnQLite falls
+ * back to xData() and to rewriting the whole record.
  */
 struct unqlite_kv_methods
 {
   const char *zName; /* Storage engine name [i.e. Hash, B+tree, LSM, R-tree, Mem, etc.]*/
   int szKv;          /* 'unqlite_kv_engine' subclass size */
   int szCursor;      /* 'unqlite_kv_cursor' subclass size */
-  int iVersion;      /* Structure version, currently 1 */
+  int iVersion;      /* Structure version, currently 2 */
   /* Storage engine methods */
   int (*xInit)(unqlite_kv_engine *,int iPageSize);
   void (*xRelease)(unqlite_kv_engine *);
@@ -775,6 +841,10 @@ struct unqlite_kv_methods
   int (*xData)(unqlite_kv_cursor *,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData);
   void (*xReset)(unqlite_kv_cursor *);
   void (*xCursorRelease)(unqlite_kv_cursor *);
+  /* Methods above are in version 1 of the structure. Methods below are added in version 2 */
+  int (*xDataRange)(unqlite_kv_cursor *,unqlite_int64 iOfft,unqlite_int64 nLen,
+	  int (*xConsumer)(const void *,unsigned int,void *),void *pUserData);
+  int (*xOverwrite)(unqlite_kv_cursor *,unqlite_int64 iOfft,const void *pData,unqlite_int64 nLen);
 };
 /*
  * UnQLite journal file suffix.
@@ -811,6 +881,10 @@ UNQLITE_APIEXPORT int unqlite_kv_append_fmt(unqlite *pDb,const void *pKey,int nK
 UNQLITE_APIEXPORT int unqlite_kv_fetch(unqlite *pDb,const void *pKey,int nKeyLen,void *pBuf,unqlite_int64 /* in|out */*pBufLen);
 UNQLITE_APIEXPORT int unqlite_kv_fetch_callback(unqlite *pDb,const void *pKey,
 	                    int nKeyLen,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData);
+UNQLITE_APIEXPORT int unqlite_kv_fetch_range(unqlite *pDb,const void *pKey,int nKeyLen,
+	                    unqlite_int64 iOfft,void *pBuf,unqlite_int64 /* in|out */*pBufLen);
+UNQLITE_APIEXPORT int unqlite_kv_overwrite(unqlite *pDb,const void *pKey,int nKeyLen,
+	                    unqlite_int64 iOfft,const void *pData,unqlite_int64 nDataLen);
 UNQLITE_APIEXPORT int unqlite_kv_delete(unqlite *pDb,const void *pKey,int nKeyLen);
 UNQLITE_APIEXPORT int unqlite_kv_config(unqlite *pDb,int iOp,...);
 
@@ -850,6 +924,7 @@ UNQLITE_APIEXPORT int unqlite_util_load_mmaped_file(const char *zFile,void **ppM
 UNQLITE_APIEXPORT int unqlite_util_release_mmaped_file(void *pMap,unqlite_int64 iFileSize);
 UNQLITE_APIEXPORT int unqlite_util_random_string(unqlite *pDb,char *zBuf,unsigned int buf_size);
 UNQLITE_APIEXPORT unsigned int unqlite_util_random_num(unqlite *pDb);
+UNQLITE_APIEXPORT unsigned int unqlite_util_fast_hash(const void *pKey,unsigned int nLen);
 
 /* In-process extending interfaces */
 UNQLITE_APIEXPORT int unqlite_create_function(unqlite_vm *pVm,const char *zName,int (*xFunc)(unqlite_context *,int,unqlite_value **),void *pUserData);
@@ -945,5 +1020,6 @@ UNQLITE_APIEXPORT const char * unqlite_lib_version(void);
 UNQLITE_APIEXPORT const char * unqlite_lib_signature(void);
 UNQLITE_APIEXPORT const char * unqlite_lib_ident(void);
 UNQLITE_APIEXPORT const char * unqlite_lib_copyright(void);
+UNQLITE_APIEXPORT const unqlite_vfs * unqlite_lib_uring_vfs(void);
 
 #endif /* _UNQLITE_H_ */
\ No newline at end of file